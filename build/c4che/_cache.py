@@ -0,0 +1,78 @@
+AR = ['/usr/bin/ar']
+ARFLAGS = ['rcs']
+BINDIR = '/usr/local/bin'
+BUILD_STATIC = False
+CC = ['/usr/bin/gcc']
+CCLNK_SRC_F = []
+CCLNK_TGT_F = ['-o']
+CC_NAME = 'gcc'
+CC_SRC_F = []
+CC_TGT_F = ['-c', '-o']
+CC_VERSION = ('12', '2', '0')
+CFLAGS = ['-Wextra', '-Wall', '-std=gnu99', '-pedantic', '-fPIC', '-DPIC', '-O2']
+CFLAGS_MACBUNDLE = ['-fPIC']
+CFLAGS_cshlib = ['-fPIC']
+COMPILER_CC = 'gcc'
+CPPPATH_ST = '-I%s'
+DATADIR = '/usr/local/share'
+DATAROOTDIR = '/usr/local/share'
+DEFINES = []
+DEFINES_ST = '-D%s'
+DEFINE_COMMENTS = {'IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED': '', 'IMXDMABUFFER_DMA_HEAP_DEVICE_NODE_PATH': '', 'IMXDMABUFFER_ION_ALLOCATOR_ENABLED': '', 'IMXDMABUFFER_DWL_ALLOCATOR_ENABLED': '', 'IMXDMABUFFER_DWL_USE_CLIENT_TYPE_HEVC': '', 'IMXDMABUFFER_IPU_ALLOCATOR_ENABLED': '', 'IMXDMABUFFER_G2D_ALLOCATOR_ENABLED': '', 'IMXDMABUFFER_PXP_ALLOCATOR_ENABLED': '', 'IMXDMABUFFER_VERSION': ''}
+DEST_BINFMT = 'elf'
+DEST_CPU = 'x86_64'
+DEST_OS = 'linux'
+DOCDIR = '/usr/local/share/doc/'
+DVIDIR = '/usr/local/share/doc/'
+EXEC_PREFIX = '/usr/local'
+EXTRA_HEADER_FILES = ['imxdmabuffer/imxdmabuffer_dma_heap_allocator.h', 'imxdmabuffer/imxdmabuffer_ion_allocator.h', 'imxdmabuffer/imxdmabuffer_dwl_allocator.h', 'imxdmabuffer/imxdmabuffer_ipu_allocator.h', 'imxdmabuffer/imxdmabuffer_g2d_allocator.h', 'imxdmabuffer/imxdmabuffer_pxp_allocator.h']
+EXTRA_SOURCE_FILES = ['imxdmabuffer/imxdmabuffer_dma_heap_allocator.c', 'imxdmabuffer/imxdmabuffer_soft_dirty_priv.c', 'imxdmabuffer/imxdmabuffer_ion_allocator.c', 'imxdmabuffer/imxdmabuffer_dwl_allocator.c', 'imxdmabuffer/imxdmabuffer_ipu_allocator.c', 'imxdmabuffer/imxdmabuffer_ipu_priv.c', 'imxdmabuffer/imxdmabuffer_g2d_allocator.c', 'imxdmabuffer/imxdmabuffer_pxp_allocator.c']
+EXTRA_USELIBS = ['PTHREAD', 'IMXHEADERS', 'IMXHEADERS', 'HANTRO', 'RT', 'IMXHEADERS', 'IMXG2D', 'IMXHEADERS']
+HTMLDIR = '/usr/local/share/doc/'
+IMXDMABUFFER_VERSION = '2.0.0'
+INCLUDEDIR = '/usr/local/include'
+INCLUDES_HANTRO = ['/tmp/imxstub/hantro']
+INCLUDES_IMXG2D = ['/tmp/imxstub/g2d']
+INCLUDES_IMXHEADERS = ['/tmp/imxstub/inc']
+INFODIR = '/usr/local/share/info'
+LDFLAGS = ['-L/tmp/imxstub/hantro', '-L/tmp/imxstub/g2d/lib', '-Wl,-rpath,/tmp/imxstub/hantro', '-Wl,-rpath,/tmp/imxstub/g2d/lib']
+LIBDIR = '/usr/local/lib64'
+LIBEXECDIR = '/usr/local/libexec'
+LIBPATH_IMXG2D = ['/tmp/imxstub/g2d/lib']
+LIBPATH_ST = '-L%s'
+LIB_HANTRO = ['hantro']
+LIB_IMXG2D = ['g2d']
+LIB_PTHREAD = ['pthread']
+LIB_RT = ['rt']
+LIB_ST = '-l%s'
+LINKFLAGS_MACBUNDLE = ['-bundle', '-undefined', 'dynamic_lookup']
+LINKFLAGS_cshlib = ['-shared']
+LINKFLAGS_cstlib = ['-Wl,-Bstatic']
+LINK_CC = ['/usr/bin/gcc']
+LOCALEDIR = '/usr/local/share/locale'
+LOCALSTATEDIR = '/usr/local/var'
+MANDIR = '/usr/local/share/man'
+OLDINCLUDEDIR = '/usr/include'
+PACKAGE = []
+PDFDIR = '/usr/local/share/doc/'
+PREFIX = '/usr/local'
+PSDIR = '/usr/local/share/doc/'
+RPATH_ST = '-Wl,-rpath,%s'
+SBINDIR = '/usr/local/sbin'
+SHAREDSTATEDIR = '/usr/local/com'
+SHLIB_MARKER = '-Wl,-Bdynamic'
+SONAME_ST = '-Wl,-h,%s'
+STLIBPATH_ST = '-L%s'
+STLIB_MARKER = '-Wl,-Bstatic'
+STLIB_ST = '-l%s'
+SYSCONFDIR = '/usr/local/etc'
+WITH_DMA_HEAP_ALLOCATOR = 1
+WITH_ION_ALLOCATOR = 1
+WITH_IPU_ALLOCATOR = 1
+WITH_PXP_ALLOCATOR = 1
+cfg_files = ['/root/repo/build/imxdmabuffer_config.h']
+cprogram_PATTERN = '%s'
+cshlib_PATTERN = 'lib%s.so'
+cstlib_PATTERN = 'lib%s.a'
+define_key = []
+macbundle_PATTERN = '%s.bundle'
@@ -0,0 +1,16 @@
+/* WARNING! All changes made to this file will be lost! */
+
+#ifndef W_IMXDMABUFFER_CONFIG_H_WAF
+#define W_IMXDMABUFFER_CONFIG_H_WAF
+
+#define IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED 1
+#define IMXDMABUFFER_DMA_HEAP_DEVICE_NODE_PATH "/dev/dma_heap/linux,cma"
+#define IMXDMABUFFER_ION_ALLOCATOR_ENABLED 1
+#define IMXDMABUFFER_DWL_ALLOCATOR_ENABLED 1
+#define IMXDMABUFFER_DWL_USE_CLIENT_TYPE_HEVC 1
+#define IMXDMABUFFER_IPU_ALLOCATOR_ENABLED 1
+#define IMXDMABUFFER_G2D_ALLOCATOR_ENABLED 1
+#define IMXDMABUFFER_PXP_ALLOCATOR_ENABLED 1
+#define IMXDMABUFFER_VERSION "2.0.0"
+
+#endif /* W_IMXDMABUFFER_CONFIG_H_WAF */
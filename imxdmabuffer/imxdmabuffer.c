@@ -1,6 +1,13 @@
 #include <assert.h>
+#include <errno.h>
+#include <search.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <imxdmabuffer_config.h>
+/* Produce the exported definitions of the inline getters. */
+#define IMX_DMA_BUFFER_GETTER_LINKAGE
 #include "imxdmabuffer.h"
 #include "imxdmabuffer_priv.h"
 
@@ -29,6 +36,68 @@
 #endif
 
 
+typedef struct _ImxDmaBufferRegistry ImxDmaBufferRegistry;
+
+struct _ImxDmaBufferRegistry
+{
+	/* Allocator whose live buffers are listed here. */
+	ImxDmaBufferAllocator *allocator;
+
+	pthread_mutex_t mutex;
+	/* Sentinel of the circular list of live buffers. */
+	ImxDmaBufferLink buffers;
+	size_t num_buffers;
+
+	/* Set by imx_dma_buffer_allocator_enable_address_lookup(). Protected
+	 * by the mutex. Newly registered buffers are indexed if this is set. */
+	int address_lookup_enabled;
+};
+
+#define IMX_DMA_BUFFER_FROM_REGISTRY_LINK(LINK) ((ImxDmaBuffer *)(((uint8_t *)(LINK)) - offsetof(ImxDmaBuffer, registry_link)))
+
+/* Process-wide index of the registries, ordered by allocator. The registries
+ * are kept here instead of in ImxDmaBufferAllocator, since that structure is
+ * filled by the allocators, and a pointer owned by libimxdmabuffer would be
+ * exposed to them. A registry is created by the first allocation, and removed
+ * when the allocator is destroyed. */
+static void *registry_index = NULL;
+static pthread_rwlock_t registry_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Process-wide indexes of the physical and mapped virtual address ranges
+ * of registered buffers of allocators with address lookup enabled. These are balanced binary trees (managed with
+ * tsearch() and friends) of ImxDmaBuffer pointers, ordered by the ranges.
+ * Since the ranges of different buffers do not overlap, a range that
+ * contains a given address compares equal to that address. */
+static void *physical_address_index = NULL;
+static void *virtual_address_index = NULL;
+static pthread_rwlock_t address_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Process-wide default allocator. Created by the first
+ * imx_dma_buffer_allocator_get_default() call, never destroyed. */
+static ImxDmaBufferAllocator *default_allocator = NULL;
+static pthread_mutex_t default_allocator_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void imx_dma_buffer_init_managed_fields(ImxDmaBuffer *buffer);
+static void imx_dma_buffer_remove_from_address_indexes(ImxDmaBuffer *buffer);
+static void imx_dma_buffer_remove_from_address_index(void **index, ImxDmaBuffer *buffer, int (*compare)(void const *, void const *));
+static int imx_dma_buffer_compare_physical_ranges(void const *first, void const *second);
+static int imx_dma_buffer_compare_virtual_ranges(void const *first, void const *second);
+static int imx_dma_buffer_compare_registries(void const *first, void const *second);
+
+static ImxDmaBufferRegistry* imx_dma_buffer_get_registry(ImxDmaBufferAllocator *allocator, int create);
+static void imx_dma_buffer_registry_unlink(ImxDmaBufferRegistry *registry, ImxDmaBuffer *buffer);
+static size_t imx_dma_buffer_registry_free_buffers(ImxDmaBufferAllocator *allocator, int all_groups, unsigned int group);
+
+
+void imx_dma_buffer_allocator_init(ImxDmaBufferAllocator *allocator)
+{
+	assert(allocator != NULL);
+
+	memset(allocator, 0, sizeof(ImxDmaBufferAllocator));
+	allocator->magic = IMX_DMA_BUFFER_ALLOCATOR_MAGIC;
+}
+
+
 ImxDmaBufferAllocator* imx_dma_buffer_allocator_new(int *error)
 {
 #ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
@@ -62,20 +131,115 @@ ImxDmaBufferAllocator* imx_dma_buffer_allocator_new(int *error)
 }
 
 
+ImxDmaBufferAllocator* imx_dma_buffer_allocator_get_default(int *error)
+{
+	ImxDmaBufferAllocator *allocator;
+
+	/* Fast path: the default allocator already exists. */
+	allocator = __atomic_load_n(&default_allocator, __ATOMIC_ACQUIRE);
+	if (allocator != NULL)
+		return allocator;
+
+	pthread_mutex_lock(&default_allocator_mutex);
+
+	/* Another thread may have created the default allocator
+	 * while this thread was waiting for the mutex. */
+	allocator = default_allocator;
+	if (allocator == NULL)
+	{
+		allocator = imx_dma_buffer_allocator_new(error);
+		if (allocator != NULL)
+			__atomic_store_n(&default_allocator, allocator, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&default_allocator_mutex);
+
+	return allocator;
+}
+
+
 void imx_dma_buffer_allocator_destroy(ImxDmaBufferAllocator *allocator)
 {
+	ImxDmaBufferRegistry *registry;
+
 	assert(allocator != NULL);
 	assert(allocator->destroy != NULL);
+	assert(allocator != __atomic_load_n(&default_allocator, __ATOMIC_RELAXED));
+
+	registry = imx_dma_buffer_get_registry(allocator, 0);
+	if (registry != NULL)
+	{
+		imx_dma_buffer_registry_free_buffers(allocator, 1, IMX_DMA_BUFFER_NO_GROUP);
+
+		pthread_rwlock_wrlock(&registry_index_lock);
+		tdelete(registry, &registry_index, imx_dma_buffer_compare_registries);
+		pthread_rwlock_unlock(&registry_index_lock);
+
+		pthread_mutex_destroy(&(registry->mutex));
+		free(registry);
+	}
+
 	allocator->destroy(allocator);
 }
 
 
 ImxDmaBuffer* imx_dma_buffer_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error)
 {
+	ImxDmaBuffer *buffer;
+	ImxDmaBufferRegistry *registry;
+
+	assert(allocator != NULL);
+	assert(allocator->allocate != NULL);
+	assert(size >= 1);
+
+	buffer = allocator->allocate(allocator, size, alignment, error);
+
+	/* Attachments and reference counts are managed here, not by the allocators. */
+	if ((buffer != NULL) && IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+	{
+		imx_dma_buffer_init_managed_fields(buffer);
+
+		/* If the registry cannot be created, the buffer is still usable;
+		 * it is just not tracked, and cannot be looked up by address. */
+		registry = (IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS(allocator) & IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNTRACKED_BUFFERS) ? NULL : imx_dma_buffer_get_registry(allocator, 1);
+		if (registry != NULL)
+		{
+			pthread_mutex_lock(&(registry->mutex));
+			buffer->registry_link.prev = registry->buffers.prev;
+			buffer->registry_link.next = &(registry->buffers);
+			registry->buffers.prev->next = &(buffer->registry_link);
+			registry->buffers.prev = &(buffer->registry_link);
+			registry->num_buffers++;
+			buffer->address_indexed = registry->address_lookup_enabled;
+			pthread_mutex_unlock(&(registry->mutex));
+
+			if (buffer->address_indexed)
+			{
+				/* If this fails, the buffer just cannot be looked up. */
+				pthread_rwlock_wrlock(&address_index_lock);
+				tsearch(buffer, &physical_address_index, imx_dma_buffer_compare_physical_ranges);
+				pthread_rwlock_unlock(&address_index_lock);
+			}
+		}
+	}
+
+	return buffer;
+}
+
+
+ImxDmaBuffer* imx_dma_buffer_allocate_untracked(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error)
+{
+	ImxDmaBuffer *buffer;
+
 	assert(allocator != NULL);
 	assert(allocator->allocate != NULL);
 	assert(size >= 1);
-	return allocator->allocate(allocator, size, alignment, error);
+
+	buffer = allocator->allocate(allocator, size, alignment, error);
+	if ((buffer != NULL) && IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+		imx_dma_buffer_init_managed_fields(buffer);
+
+	return buffer;
 }
 
 
@@ -84,16 +248,45 @@ void imx_dma_buffer_deallocate(ImxDmaBuffer *buffer)
 	assert(buffer != NULL);
 	assert(buffer->allocator != NULL);
 	assert(buffer->allocator->deallocate != NULL);
+
+	if (IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+	{
+		ImxDmaBufferAttachmentKey key;
+		ImxDmaBufferRegistry *registry = imx_dma_buffer_get_registry(buffer->allocator, 0);
+
+		if (registry != NULL)
+		{
+			pthread_mutex_lock(&(registry->mutex));
+			imx_dma_buffer_registry_unlink(registry, buffer);
+			pthread_mutex_unlock(&(registry->mutex));
+		}
+
+		if (buffer->address_indexed)
+			imx_dma_buffer_remove_from_address_indexes(buffer);
+
+		for (key = 0; key < IMX_DMA_BUFFER_MAX_ATTACHMENTS; ++key)
+			imx_dma_buffer_set_attachment(buffer, key, NULL);
+	}
+
 	buffer->allocator->deallocate(buffer->allocator, buffer);
 }
 
 
 uint8_t* imx_dma_buffer_map(ImxDmaBuffer *buffer, unsigned int flags, int *error)
 {
+	uint8_t *virtual_address;
+
 	assert(buffer != NULL);
 	assert(buffer->allocator != NULL);
 	assert(buffer->allocator->map != NULL);
-	return buffer->allocator->map(buffer->allocator, buffer, flags, error);
+
+	virtual_address = buffer->allocator->map(buffer->allocator, buffer, flags, error);
+
+	/* Only the first map call changes the mapped virtual address. */
+	if (IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer) && buffer->address_indexed && (buffer->indexed_virtual_address != buffer->mapped_virtual_address))
+		imx_dma_buffer_update_virtual_address_index(buffer);
+
+	return virtual_address;
 }
 
 
@@ -102,7 +295,12 @@ void imx_dma_buffer_unmap(ImxDmaBuffer *buffer)
 	assert(buffer != NULL);
 	assert(buffer->allocator != NULL);
 	assert(buffer->allocator->unmap != NULL);
+
 	buffer->allocator->unmap(buffer->allocator, buffer);
+
+	/* Only the last unmap call changes the mapped virtual address. */
+	if (IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer) && buffer->address_indexed && (buffer->indexed_virtual_address != buffer->mapped_virtual_address))
+		imx_dma_buffer_update_virtual_address_index(buffer);
 }
 
 
@@ -124,31 +322,587 @@ void imx_dma_buffer_stop_sync_session(ImxDmaBuffer *buffer)
 }
 
 
-imx_physical_address_t imx_dma_buffer_get_physical_address(ImxDmaBuffer *buffer)
+void imx_dma_buffer_sync_many(ImxDmaBuffer * const *buffers, ImxDmaBufferSyncDirection const *directions, size_t num_buffers)
+{
+	size_t i;
+
+	assert((num_buffers == 0) || (buffers != NULL));
+	assert((num_buffers == 0) || (directions != NULL));
+
+	for (i = 0; i < num_buffers; ++i)
+	{
+		assert(buffers[i] != NULL);
+		assert(buffers[i]->allocator != NULL);
+
+		/* Uncached memory never needs syncing. */
+		if (IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS(buffers[i]->allocator) & IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY)
+			continue;
+
+		if (directions[i] == IMX_DMA_BUFFER_SYNC_DIRECTION_START)
+			imx_dma_buffer_start_sync_session(buffers[i]);
+		else
+			imx_dma_buffer_stop_sync_session(buffers[i]);
+	}
+}
+
+
+uint8_t* imx_dma_buffer_map_range(ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error)
+{
+	uint8_t *virtual_address;
+
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+	assert(length > 0);
+	assert((offset + length) <= imx_dma_buffer_get_size(buffer));
+
+	if (IMX_DMA_BUFFER_ALLOCATOR_IS_INITIALIZED(buffer->allocator) && (buffer->allocator->map_range != NULL))
+		return buffer->allocator->map_range(buffer->allocator, buffer, offset, length, flags, error);
+
+	virtual_address = imx_dma_buffer_map(buffer, flags, error);
+	return (virtual_address != NULL) ? (virtual_address + offset) : NULL;
+}
+
+
+void imx_dma_buffer_unmap_range(ImxDmaBuffer *buffer, uint8_t *virtual_address)
+{
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+
+	if (IMX_DMA_BUFFER_ALLOCATOR_IS_INITIALIZED(buffer->allocator) && (buffer->allocator->unmap_range != NULL))
+		buffer->allocator->unmap_range(buffer->allocator, buffer, virtual_address);
+	else
+		imx_dma_buffer_unmap(buffer);
+}
+
+
+void imx_dma_buffer_start_range_sync_session(ImxDmaBuffer *buffer, uint8_t *virtual_address)
+{
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+
+	if (IMX_DMA_BUFFER_ALLOCATOR_IS_INITIALIZED(buffer->allocator) && (buffer->allocator->sync_range != NULL))
+		buffer->allocator->sync_range(buffer->allocator, buffer, virtual_address, 1);
+	else
+		imx_dma_buffer_start_sync_session(buffer);
+}
+
+
+void imx_dma_buffer_stop_range_sync_session(ImxDmaBuffer *buffer, uint8_t *virtual_address)
 {
 	assert(buffer != NULL);
 	assert(buffer->allocator != NULL);
-	assert(buffer->allocator->get_physical_address != NULL);
-	return buffer->allocator->get_physical_address(buffer->allocator, buffer);
+
+	if (IMX_DMA_BUFFER_ALLOCATOR_IS_INITIALIZED(buffer->allocator) && (buffer->allocator->sync_range != NULL))
+		buffer->allocator->sync_range(buffer->allocator, buffer, virtual_address, 0);
+	else
+		imx_dma_buffer_stop_sync_session(buffer);
+}
+
+
+
+
+
+typedef struct
+{
+	char const *name;
+	ImxDmaBufferAttachmentDestroyFunc destroy_func;
+}
+ImxDmaBufferAttachmentKeyInfo;
+
+static ImxDmaBufferAttachmentKeyInfo attachment_keys[IMX_DMA_BUFFER_MAX_ATTACHMENTS];
+static int num_attachment_keys = 0;
+static pthread_mutex_t attachment_keys_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+ImxDmaBufferAttachmentKey imx_dma_buffer_register_attachment_key(char const *name, ImxDmaBufferAttachmentDestroyFunc destroy_func, int *error)
+{
+	ImxDmaBufferAttachmentKey key = -1;
+
+	assert(name != NULL);
+
+	pthread_mutex_lock(&attachment_keys_mutex);
+
+	if (num_attachment_keys < IMX_DMA_BUFFER_MAX_ATTACHMENTS)
+	{
+		key = num_attachment_keys;
+		attachment_keys[key].name = name;
+		attachment_keys[key].destroy_func = destroy_func;
+		num_attachment_keys++;
+	}
+	else if (error != NULL)
+		*error = ENOSPC;
+
+	pthread_mutex_unlock(&attachment_keys_mutex);
+
+	return key;
 }
 
 
-int imx_dma_buffer_get_fd(ImxDmaBuffer *buffer)
+char const * imx_dma_buffer_get_attachment_key_name(ImxDmaBufferAttachmentKey key)
 {
+	/* No locking needed, since the key was already registered
+	 * before, and registered keys are never modified. */
+	assert((key >= 0) && (key < IMX_DMA_BUFFER_MAX_ATTACHMENTS));
+	return attachment_keys[key].name;
+}
+
+
+int imx_dma_buffer_set_attachment(ImxDmaBuffer *buffer, ImxDmaBufferAttachmentKey key, void *attachment)
+{
+	void *old_attachment;
+
 	assert(buffer != NULL);
 	assert(buffer->allocator != NULL);
-	return (buffer->allocator->get_fd != NULL) ? buffer->allocator->get_fd(buffer->allocator, buffer) : -1;
+	assert((key >= 0) && (key < IMX_DMA_BUFFER_MAX_ATTACHMENTS));
+
+	if (!IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+		return 0;
+
+	old_attachment = buffer->attachments[key];
+	buffer->attachments[key] = attachment;
+
+	if ((old_attachment != NULL) && (old_attachment != attachment) && (attachment_keys[key].destroy_func != NULL))
+		attachment_keys[key].destroy_func(buffer, old_attachment);
+
+	return 1;
 }
 
 
-size_t imx_dma_buffer_get_size(ImxDmaBuffer *buffer)
+int imx_dma_buffer_ref(ImxDmaBuffer *buffer)
 {
 	assert(buffer != NULL);
 	assert(buffer->allocator != NULL);
-	return buffer->allocator->get_size(buffer->allocator, buffer);
+
+	if (!IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+		return 0;
+
+	/* Taking a reference needs no ordering, since the caller
+	 * already has access to the buffer. */
+	__atomic_fetch_add(&(buffer->refcount), 1, __ATOMIC_RELAXED);
+	return 1;
 }
 
 
+void imx_dma_buffer_unref(ImxDmaBuffer *buffer)
+{
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+
+	if (IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+	{
+		/* Release ordering makes sure that all accesses to the buffer by
+		 * this thread happen before the buffer is released by another one.
+		 * Acquire ordering makes sure the releasing thread sees them. */
+		int old_refcount = __atomic_fetch_sub(&(buffer->refcount), 1, __ATOMIC_ACQ_REL);
+		assert(old_refcount > 0);
+		if (old_refcount != 1)
+			return;
+
+		if (buffer->release_func != NULL)
+		{
+			buffer->release_func(buffer, buffer->release_func_user_data);
+			return;
+		}
+	}
+
+	imx_dma_buffer_deallocate(buffer);
+}
+
+
+int imx_dma_buffer_set_release_func(ImxDmaBuffer *buffer, ImxDmaBufferReleaseFunc release_func, void *user_data)
+{
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+
+	if (!IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+		return 0;
+
+	buffer->release_func = release_func;
+	buffer->release_func_user_data = user_data;
+	return 1;
+}
+
+
+
+int imx_dma_buffer_set_group(ImxDmaBuffer *buffer, unsigned int group)
+{
+	ImxDmaBufferRegistry *registry;
+
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+
+	if (!IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+		return 0;
+
+	/* The lock is needed since imx_dma_buffer_allocator_free_group()
+	 * may be looking at the group from another thread. */
+	registry = imx_dma_buffer_get_registry(buffer->allocator, 0);
+	if (registry != NULL)
+		pthread_mutex_lock(&(registry->mutex));
+	buffer->group = group;
+	if (registry != NULL)
+		pthread_mutex_unlock(&(registry->mutex));
+
+	return 1;
+}
+
+
+unsigned int imx_dma_buffer_get_group(ImxDmaBuffer *buffer)
+{
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+	return IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer) ? buffer->group : IMX_DMA_BUFFER_NO_GROUP;
+}
+
+
+size_t imx_dma_buffer_allocator_free_group(ImxDmaBufferAllocator *allocator, unsigned int group)
+{
+	assert(allocator != NULL);
+	return imx_dma_buffer_registry_free_buffers(allocator, 0, group);
+}
+
+
+size_t imx_dma_buffer_allocator_get_num_live_buffers(ImxDmaBufferAllocator *allocator)
+{
+	size_t num_buffers;
+	ImxDmaBufferRegistry *registry;
+
+	assert(allocator != NULL);
+
+	registry = imx_dma_buffer_get_registry(allocator, 0);
+	if (registry == NULL)
+		return 0;
+
+	pthread_mutex_lock(&(registry->mutex));
+	num_buffers = registry->num_buffers;
+	pthread_mutex_unlock(&(registry->mutex));
+
+	return num_buffers;
+}
+
+
+size_t imx_dma_buffer_allocator_report_leaks(ImxDmaBufferAllocator *allocator, int fd)
+{
+	size_t num_buffers;
+	ImxDmaBufferLink *link;
+	ImxDmaBufferRegistry *registry;
+
+	assert(allocator != NULL);
+	assert(fd >= 0);
+
+	registry = imx_dma_buffer_get_registry(allocator, 0);
+	if (registry == NULL)
+		return 0;
+
+	pthread_mutex_lock(&(registry->mutex));
+
+	num_buffers = registry->num_buffers;
+	if (num_buffers > 0)
+		dprintf(fd, "libimxdmabuffer: allocator %p has %zu live buffer(s)\n", (void *)allocator, num_buffers);
+
+	for (link = registry->buffers.next; link != &(registry->buffers); link = link->next)
+	{
+		ImxDmaBuffer *buffer = IMX_DMA_BUFFER_FROM_REGISTRY_LINK(link);
+		dprintf(
+			fd,
+			"  buffer %p: size %zu physical address %" IMX_PHYSICAL_ADDRESS_FORMAT " fd %d group %u refcount %d\n",
+			(void *)buffer,
+			buffer->size,
+			buffer->physical_address,
+			buffer->fd,
+			buffer->group,
+			__atomic_load_n(&(buffer->refcount), __ATOMIC_RELAXED)
+		);
+	}
+
+	pthread_mutex_unlock(&(registry->mutex));
+
+	return num_buffers;
+}
+
+
+int imx_dma_buffer_allocator_enable_address_lookup(ImxDmaBufferAllocator *allocator, int *error)
+{
+	ImxDmaBufferRegistry *registry;
+
+	assert(allocator != NULL);
+
+	if (!(IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS(allocator) & IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER)
+	 || (IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS(allocator) & IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNTRACKED_BUFFERS))
+	{
+		if (error != NULL)
+			*error = ENOTSUP;
+		return 0;
+	}
+
+	registry = imx_dma_buffer_get_registry(allocator, 1);
+	if (registry == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return 0;
+	}
+
+	pthread_mutex_lock(&(registry->mutex));
+	registry->address_lookup_enabled = 1;
+	pthread_mutex_unlock(&(registry->mutex));
+
+	return 1;
+}
+
+
+ImxDmaBuffer* imx_dma_buffer_lookup_by_physical_address(imx_physical_address_t physical_address, size_t *offset)
+{
+	void *node;
+	ImxDmaBuffer key;
+	ImxDmaBuffer *buffer = NULL;
+
+	/* A range of one byte compares equal to the range that contains it. */
+	key.physical_address = physical_address;
+	key.size = 1;
+
+	pthread_rwlock_rdlock(&address_index_lock);
+	node = tfind(&key, &physical_address_index, imx_dma_buffer_compare_physical_ranges);
+	if (node != NULL)
+	{
+		buffer = *((ImxDmaBuffer **)node);
+		if (offset != NULL)
+			*offset = physical_address - buffer->physical_address;
+	}
+	pthread_rwlock_unlock(&address_index_lock);
+
+	return buffer;
+}
+
+
+ImxDmaBuffer* imx_dma_buffer_lookup_by_virtual_address(void const *virtual_address, size_t *offset)
+{
+	void *node;
+	ImxDmaBuffer key;
+	ImxDmaBuffer *buffer = NULL;
+
+	key.indexed_virtual_address = (uint8_t *)virtual_address;
+	key.size = 1;
+
+	pthread_rwlock_rdlock(&address_index_lock);
+	node = tfind(&key, &virtual_address_index, imx_dma_buffer_compare_virtual_ranges);
+	if (node != NULL)
+	{
+		buffer = *((ImxDmaBuffer **)node);
+		if (offset != NULL)
+			*offset = (uint8_t const *)virtual_address - buffer->indexed_virtual_address;
+	}
+	pthread_rwlock_unlock(&address_index_lock);
+
+	return buffer;
+}
+
+
+void imx_dma_buffer_update_virtual_address_index(ImxDmaBuffer *buffer)
+{
+	assert(buffer != NULL);
+
+	if (!(buffer->address_indexed))
+		return;
+
+	pthread_rwlock_wrlock(&address_index_lock);
+
+	if (buffer->indexed_virtual_address != NULL)
+		imx_dma_buffer_remove_from_address_index(&virtual_address_index, buffer, imx_dma_buffer_compare_virtual_ranges);
+
+	buffer->indexed_virtual_address = buffer->mapped_virtual_address;
+	if ((buffer->indexed_virtual_address != NULL) && (tsearch(buffer, &virtual_address_index, imx_dma_buffer_compare_virtual_ranges) == NULL))
+		buffer->indexed_virtual_address = NULL;
+
+	pthread_rwlock_unlock(&address_index_lock);
+}
+
+
+static void imx_dma_buffer_init_managed_fields(ImxDmaBuffer *buffer)
+{
+	memset(buffer->attachments, 0, sizeof(buffer->attachments));
+	buffer->refcount = 1;
+	buffer->release_func = NULL;
+	buffer->release_func_user_data = NULL;
+	buffer->registry_link.prev = buffer->registry_link.next = NULL;
+	buffer->group = IMX_DMA_BUFFER_NO_GROUP;
+	buffer->address_indexed = 0;
+	buffer->indexed_virtual_address = NULL;
+}
+
+
+static void imx_dma_buffer_remove_from_address_indexes(ImxDmaBuffer *buffer)
+{
+	pthread_rwlock_wrlock(&address_index_lock);
+
+	imx_dma_buffer_remove_from_address_index(&physical_address_index, buffer, imx_dma_buffer_compare_physical_ranges);
+	if (buffer->indexed_virtual_address != NULL)
+	{
+		imx_dma_buffer_remove_from_address_index(&virtual_address_index, buffer, imx_dma_buffer_compare_virtual_ranges);
+		buffer->indexed_virtual_address = NULL;
+	}
+
+	pthread_rwlock_unlock(&address_index_lock);
+}
+
+
+static void imx_dma_buffer_remove_from_address_index(void **index, ImxDmaBuffer *buffer, int (*compare)(void const *, void const *))
+{
+	/* The node that compares equal may belong to a different buffer if
+	 * this one could not be inserted, since the comparison functions only
+	 * check for overlaps. Make sure not to remove that other buffer. */
+	void *node = tfind(buffer, index, compare);
+	if ((node != NULL) && (*((ImxDmaBuffer **)node) == buffer))
+		tdelete(buffer, index, compare);
+}
+
+
+static int imx_dma_buffer_compare_physical_ranges(void const *first, void const *second)
+{
+	ImxDmaBuffer const *first_buffer = (ImxDmaBuffer const *)first;
+	ImxDmaBuffer const *second_buffer = (ImxDmaBuffer const *)second;
+
+	if ((first_buffer->physical_address + first_buffer->size) <= second_buffer->physical_address)
+		return -1;
+	else if ((second_buffer->physical_address + second_buffer->size) <= first_buffer->physical_address)
+		return 1;
+	else
+		return 0;
+}
+
+
+static int imx_dma_buffer_compare_virtual_ranges(void const *first, void const *second)
+{
+	ImxDmaBuffer const *first_buffer = (ImxDmaBuffer const *)first;
+	ImxDmaBuffer const *second_buffer = (ImxDmaBuffer const *)second;
+
+	if ((first_buffer->indexed_virtual_address + first_buffer->size) <= second_buffer->indexed_virtual_address)
+		return -1;
+	else if ((second_buffer->indexed_virtual_address + second_buffer->size) <= first_buffer->indexed_virtual_address)
+		return 1;
+	else
+		return 0;
+}
+
+
+static int imx_dma_buffer_compare_registries(void const *first, void const *second)
+{
+	uintptr_t first_allocator = (uintptr_t)(((ImxDmaBufferRegistry const *)first)->allocator);
+	uintptr_t second_allocator = (uintptr_t)(((ImxDmaBufferRegistry const *)second)->allocator);
+
+	if (first_allocator < second_allocator)
+		return -1;
+	else if (first_allocator > second_allocator)
+		return 1;
+	else
+		return 0;
+}
+
+
+static ImxDmaBufferRegistry* imx_dma_buffer_get_registry(ImxDmaBufferAllocator *allocator, int create)
+{
+	void *node;
+	ImxDmaBufferRegistry key;
+	ImxDmaBufferRegistry *registry = NULL, *new_registry;
+
+	key.allocator = allocator;
+
+	pthread_rwlock_rdlock(&registry_index_lock);
+	node = tfind(&key, &registry_index, imx_dma_buffer_compare_registries);
+	if (node != NULL)
+		registry = *((ImxDmaBufferRegistry **)node);
+	pthread_rwlock_unlock(&registry_index_lock);
+
+	if ((registry != NULL) || !create)
+		return registry;
+
+	new_registry = (ImxDmaBufferRegistry *)malloc(sizeof(ImxDmaBufferRegistry));
+	if (new_registry == NULL)
+		return NULL;
+
+	new_registry->allocator = allocator;
+	pthread_mutex_init(&(new_registry->mutex), NULL);
+	new_registry->buffers.prev = new_registry->buffers.next = &(new_registry->buffers);
+	new_registry->num_buffers = 0;
+	new_registry->address_lookup_enabled = 0;
+
+	/* Another thread may have created a registry in the meantime. In that
+	 * case, tsearch() returns that one, and this one is discarded. */
+	pthread_rwlock_wrlock(&registry_index_lock);
+	node = tsearch(new_registry, &registry_index, imx_dma_buffer_compare_registries);
+	if (node != NULL)
+		registry = *((ImxDmaBufferRegistry **)node);
+	pthread_rwlock_unlock(&registry_index_lock);
+
+	if (registry != new_registry)
+	{
+		pthread_mutex_destroy(&(new_registry->mutex));
+		free(new_registry);
+	}
+
+	return registry;
+}
+
+
+static void imx_dma_buffer_registry_unlink(ImxDmaBufferRegistry *registry, ImxDmaBuffer *buffer)
+{
+	/* Buffers that are not tracked, or were already
+	 * unlinked by a bulk free, have NULL links. */
+	if (buffer->registry_link.prev == NULL)
+		return;
+
+	buffer->registry_link.prev->next = buffer->registry_link.next;
+	buffer->registry_link.next->prev = buffer->registry_link.prev;
+	buffer->registry_link.prev = buffer->registry_link.next = NULL;
+	registry->num_buffers--;
+}
+
+
+static size_t imx_dma_buffer_registry_free_buffers(ImxDmaBufferAllocator *allocator, int all_groups, unsigned int group)
+{
+	size_t num_freed = 0;
+	ImxDmaBufferLink *link;
+	ImxDmaBuffer *freed_buffers = NULL;
+	ImxDmaBufferRegistry *registry;
+
+	registry = imx_dma_buffer_get_registry(allocator, 0);
+	if (registry == NULL)
+		return 0;
+
+	/* The buffers are collected first and deallocated after the mutex is
+	 * unlocked, since deallocating calls attachment destroy functions and
+	 * allocator vfuncs, which must not run with the mutex locked. The
+	 * unlinked buffers are chained through their next links. */
+	pthread_mutex_lock(&(registry->mutex));
+	link = registry->buffers.next;
+	while (link != &(registry->buffers))
+	{
+		ImxDmaBuffer *buffer = IMX_DMA_BUFFER_FROM_REGISTRY_LINK(link);
+		link = link->next;
+
+		if (!all_groups && (buffer->group != group))
+			continue;
+
+		imx_dma_buffer_registry_unlink(registry, buffer);
+		buffer->registry_link.next = (freed_buffers != NULL) ? &(freed_buffers->registry_link) : NULL;
+		freed_buffers = buffer;
+	}
+	pthread_mutex_unlock(&(registry->mutex));
+
+	while (freed_buffers != NULL)
+	{
+		ImxDmaBuffer *buffer = freed_buffers;
+		link = buffer->registry_link.next;
+		freed_buffers = (link != NULL) ? IMX_DMA_BUFFER_FROM_REGISTRY_LINK(link) : NULL;
+
+		buffer->registry_link.next = NULL;
+		imx_dma_buffer_deallocate(buffer);
+		num_freed++;
+	}
+
+	return num_freed;
+}
+
 
 
 
@@ -224,7 +978,10 @@ static ImxDmaBufferAllocator wrapped_dma_buffer_allocator =
 	wrapped_dma_buffer_allocator_get_physical_address,
 	wrapped_dma_buffer_allocator_get_fd,
 	wrapped_dma_buffer_allocator_get_size,
-	{ 0, }
+	IMX_DMA_BUFFER_ALLOCATOR_MAGIC,
+	0, /* wrapped buffers are filled from the outside, so the common buffer header is not used */
+	NULL, NULL, NULL, /* ranges are mapped by mapping the whole wrapped buffer */
+	{ NULL }
 };
 
 
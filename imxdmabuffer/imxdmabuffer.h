@@ -29,23 +29,101 @@ ImxDmaBufferMappingFlags;
 #define IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK (IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE)
 
 
+/* ImxDmaBufferAllocatorFlags: Flags for the flags field in ImxDmaBufferAllocator.
+ * These flags can be bitwise-OR combined. */
+typedef enum
+{
+	/* The allocator fills the common buffer header fields in ImxDmaBuffer
+	 * (physical_address, size, fd, mapped_virtual_address) and keeps them
+	 * up to date. The imx_dma_buffer_get_* functions then read these fields
+	 * directly instead of calling the allocator's getter vfuncs. */
+	IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER = (1UL << 0),
+
+	/* The allocator allocates uncached (typically write-combined) DMA memory.
+	 * CPU access to such memory is slow unless it is done sequentially with
+	 * wide loads and stores. Code that copies data with the CPU uses this
+	 * to pick a suitable copy method. Allocators that do not set this flag
+	 * are assumed to allocate cached memory. */
+	IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY = (1UL << 1)
+}
+ImxDmaBufferAllocatorFlags;
+
+
 typedef struct _ImxDmaBuffer ImxDmaBuffer;
 typedef struct _ImxDmaBufferAllocator ImxDmaBufferAllocator;
 typedef struct _ImxWrappedDmaBuffer ImxWrappedDmaBuffer;
+typedef struct _ImxDmaBufferLink ImxDmaBufferLink;
 
 
 #define IMX_DMA_BUFFER_PADDING 8
 
+/* Number of attachment slots in each ImxDmaBuffer. This is also
+ * the maximum number of attachment keys that can be registered. */
+#define IMX_DMA_BUFFER_MAX_ATTACHMENTS 4
+
+
+/* Link in a circular doubly linked list of buffers. */
+struct _ImxDmaBufferLink
+{
+	ImxDmaBufferLink *prev;
+	ImxDmaBufferLink *next;
+};
+
 
 /* ImxDmaBuffer:
  *
- * Opaque object containing a DMA buffer (a physically contiguous
- * memory block that can be used for transmissions through DMA channels).
- * Its structure is defined by the allocator which created the object.
+ * Object containing a DMA buffer (a physically contiguous memory block
+ * that can be used for transmissions through DMA channels). Allocators
+ * define their own buffer structures, with ImxDmaBuffer as their first
+ * member.
+ *
+ * The fields after the allocator pointer form a common header. It is only
+ * valid if the allocator has the IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER
+ * flag set. All built-in allocators do that. The fields are placed at the
+ * beginning so they share a cache line with the allocator pointer. Do not
+ * modify these fields from the outside; use the imx_dma_buffer_* functions
+ * to access them.
+ *
+ * In versions before 2.0.0, this structure only contained the allocator
+ * pointer. Allocators built against these versions have to be rebuilt.
  */
 struct _ImxDmaBuffer
 {
 	ImxDmaBufferAllocator *allocator;
+
+	/* Virtual address of the current mapping, or NULL if the buffer
+	 * is currently not mapped. */
+	uint8_t *mapped_virtual_address;
+	/* Physical address, already aligned as requested in the allocate call. */
+	imx_physical_address_t physical_address;
+	/* Size of the buffer in bytes, as requested in the allocate call. */
+	size_t size;
+	/* File descriptor associated with the buffer, or -1 if there is none. */
+	int fd;
+
+	/* Attachment slots, indexed by attachment key. These are managed by
+	 * libimxdmabuffer itself, not by the allocator. See
+	 * imx_dma_buffer_set_attachment() for details. */
+	void *attachments[IMX_DMA_BUFFER_MAX_ATTACHMENTS];
+
+	/* Reference count and release function. These are also managed by
+	 * libimxdmabuffer itself. See imx_dma_buffer_ref() for details. */
+	int refcount;
+	void (*release_func)(ImxDmaBuffer *buffer, void *user_data);
+	void *release_func_user_data;
+
+	/* Link in the allocator's list of live buffers, and the group tag. These
+	 * are managed by libimxdmabuffer itself as well. See
+	 * imx_dma_buffer_set_group() for details. */
+	ImxDmaBufferLink registry_link;
+	unsigned int group;
+
+	/* Whether the buffer is in the address indexes, and its mapped virtual
+	 * address as currently stored in the virtual address index. Managed by
+	 * libimxdmabuffer. See imx_dma_buffer_allocator_enable_address_lookup()
+	 * for details. */
+	int address_indexed;
+	uint8_t *indexed_virtual_address;
 };
 
 
@@ -58,6 +136,14 @@ struct _ImxDmaBuffer
  * The vfuncs typically are not called directly from the outside, but by using the corresponding
  * imx_dma_buffer_* functions() instead. See the documentation of these functions for more details
  * about what the vfuncs do. 
+ *
+ * Allocators must call imx_dma_buffer_allocator_init() on this structure before filling
+ * in the vfuncs. That function zeroes the structure and sets the magic field. The fields
+ * after the magic field were reserved slots in earlier versions, which did not require
+ * allocators to zero them. These fields are therefore only used if the magic field has
+ * the right value; otherwise, libimxdmabuffer treats them as if they were all zero.
+ * The _reserved slots at the end are kept for adding fields without changing the size
+ * of this structure.
  */
 struct _ImxDmaBufferAllocator
 {
@@ -77,10 +163,51 @@ struct _ImxDmaBufferAllocator
 
 	size_t (*get_size)(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 
-	void* _reserved[IMX_DMA_BUFFER_PADDING - 2];
+	/* Set to IMX_DMA_BUFFER_ALLOCATOR_MAGIC by imx_dma_buffer_allocator_init().
+	 * This takes up one of the formerly reserved slots. */
+	uintptr_t magic;
+
+	/* Bitwise OR combination of ImxDmaBufferAllocatorFlags. This takes up
+	 * one of the formerly reserved slots. Custom allocators must leave this
+	 * at 0 unless they explicitly support one of these flags. */
+	uintptr_t flags;
+
+	/* Optional vfuncs for mapping and syncing parts of a buffer. These take up
+	 * formerly reserved slots. If they are NULL, the imx_dma_buffer_*_range()
+	 * functions fall back to mapping and syncing the whole buffer. Custom
+	 * allocators must leave them at NULL unless they implement them. */
+	uint8_t* (*map_range)(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error);
+	void (*unmap_range)(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address);
+	void (*sync_range)(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address, int start);
+
+	void* _reserved[IMX_DMA_BUFFER_PADDING - 7];
 };
 
 
+/* Value of the magic field of allocators that were initialized
+ * with imx_dma_buffer_allocator_init(). */
+#define IMX_DMA_BUFFER_ALLOCATOR_MAGIC ((uintptr_t)0x49444232UL)
+
+/* Checks whether the fields after the magic field of the allocator can be used. */
+#define IMX_DMA_BUFFER_ALLOCATOR_IS_INITIALIZED(ALLOCATOR) ((ALLOCATOR)->magic == IMX_DMA_BUFFER_ALLOCATOR_MAGIC)
+
+/* Gets the ImxDmaBufferAllocatorFlags of the allocator. Allocators that were
+ * not initialized with imx_dma_buffer_allocator_init() have no flags set. */
+#define IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS(ALLOCATOR) (IMX_DMA_BUFFER_ALLOCATOR_IS_INITIALIZED(ALLOCATOR) ? (ALLOCATOR)->flags : 0)
+
+
+/* Initializes an ImxDmaBufferAllocator structure.
+ *
+ * Allocators call this before filling in the vfuncs, typically right after
+ * allocating their own allocator structure. This sets all fields to zero,
+ * and sets the magic field to IMX_DMA_BUFFER_ALLOCATOR_MAGIC. Only then are
+ * the flags and the optional vfuncs used.
+ *
+ * @param allocator Allocator structure to initialize. Must not be NULL.
+ */
+void imx_dma_buffer_allocator_init(ImxDmaBufferAllocator *allocator);
+
+
 /* Creates a new DMA buffer allocator.
  *
  * This uses one of the several available i.MX DMA allocators internally. Which
@@ -93,11 +220,31 @@ struct _ImxDmaBufferAllocator
  */
 ImxDmaBufferAllocator* imx_dma_buffer_allocator_new(int *error);
 
+/* Returns the process-wide default DMA buffer allocator.
+ *
+ * The first call creates the allocator with imx_dma_buffer_allocator_new().
+ * Subsequent calls return the same allocator. This function is thread safe.
+ * The default allocator is never destroyed, and must not be passed to
+ * imx_dma_buffer_allocator_destroy(). Libraries that need an allocator but
+ * do not get one from their caller should use this instead of creating their
+ * own, so that all of them share one allocator and one set of device handles.
+ *
+ * @param error If this pointer is non-NULL, and if an error occurs, then the integer
+ *        the pointer refers to is set to an error code from errno.h. If getting
+ *        the allocator succeeds, the integer is not modified.
+ * @return Pointer to the default DMA allocator, or NULL in case of an error.
+ *         If creating it fails, the next call tries again.
+ */
+ImxDmaBufferAllocator* imx_dma_buffer_allocator_get_default(int *error);
+
 /* Destroys a previously created DMA buffer allocator.
  *
  * After this call, the allocator is fully destroyed, and must not be used anymore.
  * Also, any existing DMA buffers that have been allocated by this allocator will be
- * deallocated.
+ * deallocated, regardless of their reference counts. This requires the
+ * IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER flag; see the buffer
+ * registry section below. Use imx_dma_buffer_allocator_report_leaks() before
+ * this call to find out which buffers were still alive.
  */
 void imx_dma_buffer_allocator_destroy(ImxDmaBufferAllocator *allocator);
 
@@ -126,6 +273,9 @@ void imx_dma_buffer_allocator_destroy(ImxDmaBufferAllocator *allocator);
 ImxDmaBuffer* imx_dma_buffer_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error);
 
 /* Deallocates a DMA buffer.
+ *
+ * Before the buffer is deallocated, the destroy functions of its attachments
+ * are called. See imx_dma_buffer_set_attachment() for details.
  *
  * After this call, the buffer is fully deallocated, and must not be accessed anymore.
  */
@@ -145,6 +295,12 @@ void imx_dma_buffer_deallocate(ImxDmaBuffer *buffer);
  * was already mapped, but with the read flag only, and another, redundant mapping attempt is
  * made with only the write flag, then this is invalid.
  *
+ * The dma-heap, ION, IPU, and PxP allocators lift this restriction: If a redundant mapping
+ * attempt requests read/write flags that the existing mapping does not have, the mapping is
+ * upgraded in place (with mprotect()), and the same virtual address is returned. The mapping
+ * then keeps the widened access until it is actually unmapped. If a sync session is currently
+ * running, it is adjusted to cover the new access type as well.
+ *
  * IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC however is not subject to this restriction.
  * This flag is only applied to the first map / last unmap. In redundant (un)mapping calls,
  * it is ignored.
@@ -222,6 +378,106 @@ void imx_dma_buffer_start_sync_session(ImxDmaBuffer *buffer);
  */
 void imx_dma_buffer_stop_sync_session(ImxDmaBuffer *buffer);
 
+/* ImxDmaBufferSyncDirection: Per-buffer operations of imx_dma_buffer_sync_many(). */
+typedef enum
+{
+	/* Start a sync session, like imx_dma_buffer_start_sync_session(). */
+	IMX_DMA_BUFFER_SYNC_DIRECTION_START = 0,
+	/* Stop a sync session, like imx_dma_buffer_stop_sync_session(). */
+	IMX_DMA_BUFFER_SYNC_DIRECTION_STOP
+}
+ImxDmaBufferSyncDirection;
+
+/* Starts and/or stops synchronized map access sessions of several buffers.
+ *
+ * This is a convenience function for frame boundaries, where the sessions of
+ * all planes and metadata buffers of a frame are started or stopped together.
+ * It calls imx_dma_buffer_start_sync_session() or
+ * imx_dma_buffer_stop_sync_session() for each buffer, in array order. Buffers
+ * of allocators that allocate uncached memory are skipped. Since the kernel
+ * cannot sync several DMA-BUFs with one call, this does not save any syscalls
+ * or cache maintenance compared to syncing the buffers one by one.
+ *
+ * @param buffers Array of num_buffers buffers to sync.
+ * @param directions Array of num_buffers directions. directions[i] specifies
+ *        whether the session of buffers[i] is started or stopped.
+ * @param num_buffers Number of entries in both arrays. Can be 0.
+ */
+void imx_dma_buffer_sync_many(ImxDmaBuffer * const *buffers, ImxDmaBufferSyncDirection const *directions, size_t num_buffers);
+
+/* Maps a part of a DMA buffer to the local address space.
+ *
+ * Only the pages that contain the bytes offset to (offset + length - 1) are
+ * mapped. This is useful for accessing a small part of a large buffer, like a
+ * single plane of a video frame or the header of a bitstream buffer, since it
+ * uses less virtual address space and fewer page table entries, and since the
+ * automatic sync only covers the mapped window instead of the whole buffer.
+ *
+ * Each window has its own mapping reference counter. Mapping the same pages again
+ * returns the same window, and the window is unmapped once imx_dma_buffer_unmap_range()
+ * was called as many times as the window was mapped. Redundant mapping attempts with
+ * read/write flags that the window does not have yet upgrade the window in place.
+ * Windows are independent of the mapping made by imx_dma_buffer_map(); the same
+ * memory may be mapped both ways at the same time.
+ *
+ * The flags behave like those of imx_dma_buffer_map(). If
+ * IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC is set, use
+ * imx_dma_buffer_start_range_sync_session() and
+ * imx_dma_buffer_stop_range_sync_session() for syncing the window.
+ *
+ * The dma-heap, ION, IPU, and PxP allocators support this natively. With other
+ * allocators, this maps the whole buffer with imx_dma_buffer_map() and returns
+ * a pointer into that mapping.
+ *
+ * @param offset Offset of the first byte to map, in bytes.
+ * @param length Number of bytes to map. Must be at least 1, and offset + length
+ *        must not exceed the size of the buffer.
+ * @param flags See imx_dma_buffer_map().
+ * @param error If this pointer is non-NULL, and an error occurs, then the integer
+ *        the pointer refers to is set to an error code from errno.h. If mapping
+ *        succeeds, the integer is not modified.
+ * @return Pointer to the byte at the given offset in the mapped window, or NULL in
+ *         case of an error.
+ */
+uint8_t* imx_dma_buffer_map_range(ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error);
+
+/* Unmaps a window that was mapped with imx_dma_buffer_map_range().
+ *
+ * virtual_address must be a pointer that was returned by imx_dma_buffer_map_range().
+ * The window is not actually unmapped until its reference counter reaches zero.
+ */
+void imx_dma_buffer_unmap_range(ImxDmaBuffer *buffer, uint8_t *virtual_address);
+
+/* Starts a synchronized map access session for a window.
+ *
+ * This is the counterpart of imx_dma_buffer_start_sync_session() for windows
+ * that were mapped with imx_dma_buffer_map_range() and the
+ * IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC flag. virtual_address must be a pointer
+ * that was returned by imx_dma_buffer_map_range(). Where the architecture allows
+ * for it, only the cache lines of the window are synced; otherwise, the whole
+ * buffer is synced.
+ */
+void imx_dma_buffer_start_range_sync_session(ImxDmaBuffer *buffer, uint8_t *virtual_address);
+
+/* Stops a synchronized map access session for a window.
+ *
+ * See imx_dma_buffer_start_range_sync_session() for details.
+ */
+void imx_dma_buffer_stop_range_sync_session(ImxDmaBuffer *buffer, uint8_t *virtual_address);
+
+
+/* The getters below are inline functions. If the buffer's allocator fills the
+ * common buffer header, they are plain loads. Otherwise, they call the allocator's
+ * getter vfuncs. They are still exported from the library as regular functions;
+ * imxdmabuffer.c defines IMX_DMA_BUFFER_GETTER_LINKAGE as empty to produce the
+ * exported definitions. To keep them as cheap as plain loads, they do not check
+ * their arguments; buffer must not be NULL. */
+#ifndef IMX_DMA_BUFFER_GETTER_LINKAGE
+#define IMX_DMA_BUFFER_GETTER_LINKAGE static inline
+#endif
+
+#define IMX_DMA_BUFFER_HAS_COMMON_HEADER(BUFFER) ((IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS((BUFFER)->allocator) & IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER) != 0)
+
 /* Gets the physical address associated with the DMA buffer.
  *
  * This address points to the start of the buffer in the physical address space. The
@@ -230,7 +486,12 @@ void imx_dma_buffer_stop_sync_session(ImxDmaBuffer *buffer);
  *
  * This function can also be called while the DMA buffer is memory-mapped.
  */
-imx_physical_address_t imx_dma_buffer_get_physical_address(ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_GETTER_LINKAGE imx_physical_address_t imx_dma_buffer_get_physical_address(ImxDmaBuffer *buffer)
+{
+	if (IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+		return buffer->physical_address;
+	return buffer->allocator->get_physical_address(buffer->allocator, buffer);
+}
 
 /* Returns a file descriptor associated with the DMA buffer (if one exists).
  *
@@ -240,13 +501,293 @@ imx_physical_address_t imx_dma_buffer_get_physical_address(ImxDmaBuffer *buffer)
  *
  * This function can also be called while the DMA buffer is memory-mapped.
  */
-int imx_dma_buffer_get_fd(ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_GETTER_LINKAGE int imx_dma_buffer_get_fd(ImxDmaBuffer *buffer)
+{
+	if (IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+		return buffer->fd;
+	return (buffer->allocator->get_fd != NULL) ? buffer->allocator->get_fd(buffer->allocator, buffer) : -1;
+}
 
 /* Returns the size of the buffer, in bytes.
  *
  * This function can also be called while the DMA buffer is memory-mapped.
  */
-size_t imx_dma_buffer_get_size(ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_GETTER_LINKAGE size_t imx_dma_buffer_get_size(ImxDmaBuffer *buffer)
+{
+	if (IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer))
+		return buffer->size;
+	return buffer->allocator->get_size(buffer->allocator, buffer);
+}
+
+
+
+/* Attachments:
+ *
+ * Attachments are pointers to objects that are derived from a DMA buffer, such
+ * as device specific registrations of that buffer (G2D surfaces, V4L2 buffer
+ * queue indices, DRM framebuffers etc). Storing them in the buffer itself allows
+ * for looking them up in O(1) instead of having to maintain external lookup
+ * tables that map DMA buffers to such objects.
+ *
+ * Each ImxDmaBuffer has IMX_DMA_BUFFER_MAX_ATTACHMENTS attachment slots. A slot
+ * is identified by an attachment key. Keys are registered once per process with
+ * imx_dma_buffer_register_attachment_key(), typically by the subsystem that
+ * produces the derived objects. The key's destroy function is called for any
+ * attachment that is still set when the buffer is deallocated.
+ *
+ * Attachments are only supported by buffers whose allocator has the
+ * IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER flag set.
+ */
+
+
+/* Attachment key. Valid keys are in the 0 .. (IMX_DMA_BUFFER_MAX_ATTACHMENTS-1) range. */
+typedef int ImxDmaBufferAttachmentKey;
+
+/* Function for destroying an attachment. This is called when a buffer that
+ * still has an attachment is deallocated, and when an attachment is replaced
+ * by imx_dma_buffer_set_attachment(). The attachment is never NULL. */
+typedef void (*ImxDmaBufferAttachmentDestroyFunc)(ImxDmaBuffer *buffer, void *attachment);
+
+/* Registers a new attachment key.
+ *
+ * This is meant to be called once per process for each type of attachment.
+ * Registered keys cannot be unregistered. This function is thread safe.
+ *
+ * @param name Name for the key, used for diagnostics. The string must
+ *        stay valid for the lifetime of the process. Must not be NULL.
+ * @param destroy_func Function to call for destroying attachments with this key.
+ *        Can be NULL if the attachments do not need to be destroyed.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the integer
+ *        the pointer refers to is set to an error code from errno.h. If registering
+ *        the key succeeds, the integer is not modified.
+ * @return The new key, or a negative value if all IMX_DMA_BUFFER_MAX_ATTACHMENTS
+ *         keys are already registered (the error is then set to ENOSPC).
+ */
+ImxDmaBufferAttachmentKey imx_dma_buffer_register_attachment_key(char const *name, ImxDmaBufferAttachmentDestroyFunc destroy_func, int *error);
+
+/* Returns the name the attachment key was registered with. */
+char const * imx_dma_buffer_get_attachment_key_name(ImxDmaBufferAttachmentKey key);
+
+/* Sets the buffer's attachment for the given key.
+ *
+ * If the buffer already has a different attachment for this key, that one is
+ * destroyed first by calling the key's destroy function. Setting NULL removes
+ * (and destroys) the current attachment.
+ *
+ * This function is not thread safe. Attachments of one buffer must not be set
+ * concurrently from multiple threads.
+ *
+ * @param buffer DMA buffer to set the attachment for.
+ * @param key Key of the attachment slot to use.
+ * @param attachment The new attachment, or NULL to remove the current one.
+ * @return Nonzero if the attachment was set, 0 if the buffer's allocator does not
+ *         support attachments (see IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER).
+ */
+int imx_dma_buffer_set_attachment(ImxDmaBuffer *buffer, ImxDmaBufferAttachmentKey key, void *attachment);
+
+/* Returns the buffer's attachment for the given key, or NULL if there is none
+ * (or if the buffer's allocator does not support attachments). Like the getters
+ * above, this does not check its arguments. key must be a registered key. */
+static inline void* imx_dma_buffer_get_attachment(ImxDmaBuffer *buffer, ImxDmaBufferAttachmentKey key)
+{
+	return IMX_DMA_BUFFER_HAS_COMMON_HEADER(buffer) ? buffer->attachments[key] : NULL;
+}
+
+
+
+/* Reference counting:
+ *
+ * Buffers can be shared between multiple users (for example a display stage
+ * and an encoder stage that both consume the same decoded frame) by using
+ * reference counting. A newly allocated buffer has a reference count of 1.
+ * imx_dma_buffer_ref() increments it, imx_dma_buffer_unref() decrements it.
+ * Both are atomic, so different threads can hold references to the same
+ * buffer. Once the last reference is dropped, the buffer is released: if a
+ * release function is set, it is called, otherwise, the buffer is deallocated
+ * with imx_dma_buffer_deallocate().
+ *
+ * The release function takes over the buffer. It can deallocate it, or keep
+ * it for reuse (for example by putting it back into an application specific
+ * pool, or by notifying the producer that the buffer is free again). Before
+ * a kept buffer is handed out again, imx_dma_buffer_ref() must be called on
+ * it to bring the reference count from 0 back to 1.
+ *
+ * Reference counting is only supported by buffers whose allocator has the
+ * IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER flag set. With other
+ * buffers, imx_dma_buffer_ref() does nothing, and imx_dma_buffer_unref()
+ * always releases the buffer.
+ */
+
+
+/* Function for releasing a buffer once its last reference was dropped. */
+typedef void (*ImxDmaBufferReleaseFunc)(ImxDmaBuffer *buffer, void *user_data);
+
+/* Increments the buffer's reference count. This function is thread safe.
+ *
+ * @return Nonzero if the reference count was incremented, 0 if the buffer
+ *         does not support reference counting.
+ */
+int imx_dma_buffer_ref(ImxDmaBuffer *buffer);
+
+/* Decrements the buffer's reference count, and releases the buffer if this
+ * dropped the last reference. This function is thread safe. After this call,
+ * the caller must not access the buffer anymore. */
+void imx_dma_buffer_unref(ImxDmaBuffer *buffer);
+
+/* Sets the function that is called when the last reference is dropped.
+ *
+ * This replaces the previously set function. Setting NULL restores the default
+ * behavior, which is to deallocate the buffer. This function is not thread safe;
+ * it must not be called while other threads may drop references to the buffer.
+ *
+ * @return Nonzero if the function was set, 0 if the buffer
+ *         does not support reference counting.
+ */
+int imx_dma_buffer_set_release_func(ImxDmaBuffer *buffer, ImxDmaBufferReleaseFunc release_func, void *user_data);
+
+
+
+/* Buffer registry:
+ *
+ * Each allocator keeps a list of its live buffers, that is, of all buffers
+ * that were allocated with imx_dma_buffer_allocate() and not deallocated yet.
+ * The list is intrusive (the links are part of the ImxDmaBuffer common header),
+ * so registering and unregistering a buffer takes constant time and does not
+ * allocate memory. This list is what allows imx_dma_buffer_allocator_destroy()
+ * to deallocate the remaining buffers.
+ *
+ * Buffers can additionally be tagged with a group, for example a stream ID.
+ * All buffers of a group can then be deallocated with one
+ * imx_dma_buffer_allocator_free_group() call when the stream is torn down,
+ * instead of keeping track of these buffers in the application.
+ *
+ * Buffers that were kept by a release function (see imx_dma_buffer_unref())
+ * are still live, since they were not deallocated.
+ *
+ * The registry is only supported by allocators that have the
+ * IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER flag set. Buffers of other
+ * allocators are not tracked. The functions below are thread safe, except
+ * that a buffer must not be deallocated by one thread while another thread
+ * frees its group or destroys its allocator.
+ */
+
+
+/* Group of buffers that were not assigned to a group. */
+#define IMX_DMA_BUFFER_NO_GROUP 0
+
+/* Assigns the buffer to a group.
+ *
+ * Groups are arbitrary nonzero numbers chosen by the caller. Newly
+ * allocated buffers are in the IMX_DMA_BUFFER_NO_GROUP group.
+ *
+ * @return Nonzero if the group was set, 0 if the buffer's allocator does
+ *         not support the registry.
+ */
+int imx_dma_buffer_set_group(ImxDmaBuffer *buffer, unsigned int group);
+
+/* Returns the group of the buffer, or IMX_DMA_BUFFER_NO_GROUP if it has none
+ * (or if the buffer's allocator does not support the registry). */
+unsigned int imx_dma_buffer_get_group(ImxDmaBuffer *buffer);
+
+/* Deallocates all live buffers of the allocator that are in the given group.
+ *
+ * The buffers are deallocated with imx_dma_buffer_deallocate(), regardless of
+ * their reference counts, and they must not be accessed afterwards. Passing
+ * IMX_DMA_BUFFER_NO_GROUP deallocates all buffers that are not in a group.
+ *
+ * @return Number of deallocated buffers.
+ */
+size_t imx_dma_buffer_allocator_free_group(ImxDmaBufferAllocator *allocator, unsigned int group);
+
+/* Returns the number of live buffers of the allocator. */
+size_t imx_dma_buffer_allocator_get_num_live_buffers(ImxDmaBufferAllocator *allocator);
+
+/* Prints a report about the allocator's live buffers.
+ *
+ * This is meant to be called before destroying an allocator, or at the end
+ * of a stream after its buffers should have been deallocated. Each live buffer
+ * is listed with its size, physical address, file descriptor, group, and
+ * reference count. If there are no live buffers, nothing is printed.
+ *
+ * @param allocator Allocator whose buffers to report.
+ * @param fd File descriptor to print the report to, for example STDERR_FILENO.
+ * @return Number of live buffers.
+ */
+size_t imx_dma_buffer_allocator_report_leaks(ImxDmaBufferAllocator *allocator, int fd);
+
+
+
+/* Address lookup:
+ *
+ * Devices like the Hantro VPU, the IPU, and the PxP report buffers by their
+ * physical address. Also, some APIs only pass around pointers into mapped
+ * buffers. The functions below find the ImxDmaBuffer that contains such an
+ * address, without having to scan buffer lists.
+ *
+ * libimxdmabuffer keeps two process-wide indexes for this purpose: one with
+ * the physical address ranges of live buffers, and one with the virtual
+ * address ranges of buffers that are currently mapped with imx_dma_buffer_map().
+ * Both are balanced binary trees, so lookups take O(log n) time. Buffers are
+ * added to and removed from the indexes when they are allocated, deallocated,
+ * mapped, and unmapped.
+ *
+ * Keeping the indexes up to date takes a process-wide lock and allocates a
+ * tree node on each of these operations. This is why the indexes are opt-in:
+ * only buffers of allocators that have address lookup enabled with
+ * imx_dma_buffer_allocator_enable_address_lookup() are indexed. Buffers of
+ * other allocators are allocated, mapped, and unmapped without touching the
+ * indexes at all.
+ *
+ * Lookups are thread safe, and can be done while other threads allocate,
+ * deallocate, map, and unmap buffers. However, the returned buffer is only
+ * guaranteed to stay valid as long as the caller makes sure it is not
+ * deallocated, for example by holding a reference to it.
+ *
+ * Only buffers that are tracked by the buffer registry (see above) are
+ * indexed. Windows mapped with imx_dma_buffer_map_range() are not part of the
+ * virtual address index, unless the allocator implements them by mapping the
+ * whole buffer.
+ */
+
+
+/* Enables address lookup for buffers of the given allocator.
+ *
+ * Buffers that the allocator allocates after this call are added to the
+ * address indexes, so imx_dma_buffer_lookup_by_physical_address() and
+ * imx_dma_buffer_lookup_by_virtual_address() can find them. Buffers that
+ * were allocated before are not indexed. Address lookup cannot be disabled
+ * again. This function is thread safe.
+ *
+ * @param allocator Allocator to enable address lookup for.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the integer
+ *        the pointer refers to is set to an error code from errno.h. ENOTSUP means
+ *        that the allocator's buffers are not tracked by the buffer registry.
+ * @return Nonzero if address lookup was enabled, 0 in case of an error.
+ */
+int imx_dma_buffer_allocator_enable_address_lookup(ImxDmaBufferAllocator *allocator, int *error);
+
+
+/* Finds the live buffer whose physical address range contains the given address.
+ *
+ * @param physical_address Physical address to look up. This does not have to be
+ *        the start of the buffer.
+ * @param offset If non-NULL, and a buffer was found, the offset of the address
+ *        relative to the buffer's physical address is written here.
+ * @return The buffer, or NULL if no indexed buffer contains the address.
+ *         Buffers of allocators without address lookup enabled are never found.
+ */
+ImxDmaBuffer* imx_dma_buffer_lookup_by_physical_address(imx_physical_address_t physical_address, size_t *offset);
+
+/* Finds the mapped buffer whose virtual address range contains the given pointer.
+ *
+ * @param virtual_address Pointer to look up. This does not have to be the
+ *        start of the mapping.
+ * @param offset If non-NULL, and a buffer was found, the offset of the pointer
+ *        relative to the buffer's mapped virtual address is written here.
+ * @return The buffer, or NULL if no indexed mapping contains the pointer.
+ *         Buffers of allocators without address lookup enabled are never found.
+ */
+ImxDmaBuffer* imx_dma_buffer_lookup_by_virtual_address(void const *virtual_address, size_t *offset);
 
 
 /* ImxWrappedDmaBuffer:
@@ -0,0 +1,331 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_arena_allocator.h"
+
+
+typedef struct
+{
+	/* The physical address and size are stored in the common buffer header.
+	 * mapped_virtual_address is set while the buffer is mapped. */
+	ImxDmaBuffer parent;
+
+	/* Offset of the buffer in the arena buffer. */
+	size_t offset;
+
+	int mapping_refcount;
+}
+ImxDmaBufferArenaBuffer;
+
+
+typedef struct
+{
+	ImxDmaBufferAllocator parent;
+
+	ImxDmaBufferAllocator *underlying_allocator;
+	ImxDmaBuffer *arena_buffer;
+	imx_physical_address_t arena_physical_address;
+	size_t arena_size;
+
+	/* Offset of the first unused byte in the arena buffer. */
+	size_t used_size;
+
+	/* Preallocated buffer structures. The first num_buffers are in use. */
+	ImxDmaBufferArenaBuffer *buffers;
+	size_t max_num_buffers;
+	size_t num_buffers;
+}
+ImxDmaBufferArenaAllocator;
+
+
+static void imx_dma_buffer_arena_allocator_destroy(ImxDmaBufferAllocator *allocator);
+static ImxDmaBuffer* imx_dma_buffer_arena_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error);
+static void imx_dma_buffer_arena_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static uint8_t* imx_dma_buffer_arena_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
+static void imx_dma_buffer_arena_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static void imx_dma_buffer_arena_allocator_start_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static void imx_dma_buffer_arena_allocator_stop_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static uint8_t* imx_dma_buffer_arena_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error);
+static void imx_dma_buffer_arena_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address);
+static void imx_dma_buffer_arena_allocator_sync_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address, int start);
+static imx_physical_address_t imx_dma_buffer_arena_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static int imx_dma_buffer_arena_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static size_t imx_dma_buffer_arena_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+
+
+static void imx_dma_buffer_arena_allocator_destroy(ImxDmaBufferAllocator *allocator)
+{
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+	ImxDmaBufferAllocator *underlying_allocator;
+
+	assert(imx_arena_allocator != NULL);
+
+	underlying_allocator = imx_arena_allocator->underlying_allocator;
+	if (imx_arena_allocator->arena_buffer != NULL)
+	{
+		size_t i;
+
+		/* Arena buffers are not registered, so imx_dma_buffer_allocator_destroy()
+		 * does not deallocate the ones that are still live. Make sure their
+		 * windows are unmapped before the arena buffer is deallocated. */
+		for (i = 0; i < imx_arena_allocator->num_buffers; ++i)
+			imx_dma_buffer_arena_allocator_deallocate(allocator, (ImxDmaBuffer *)&(imx_arena_allocator->buffers[i]));
+
+		underlying_allocator->deallocate(underlying_allocator, imx_arena_allocator->arena_buffer);
+	}
+
+	free(imx_arena_allocator->buffers);
+	free(imx_arena_allocator);
+}
+
+
+static ImxDmaBuffer* imx_dma_buffer_arena_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error)
+{
+	size_t offset;
+	imx_physical_address_t physical_address;
+	ImxDmaBufferArenaBuffer *imx_arena_buffer;
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+
+	assert(imx_arena_allocator != NULL);
+
+	if (alignment == 0)
+		alignment = 1;
+
+	/* The alignment applies to the physical address, so
+	 * align that instead of the offset in the arena. */
+	physical_address = imx_arena_allocator->arena_physical_address + imx_arena_allocator->used_size;
+	physical_address = (physical_address + alignment - 1) / alignment * alignment;
+	offset = physical_address - imx_arena_allocator->arena_physical_address;
+
+	if ((imx_arena_allocator->num_buffers >= imx_arena_allocator->max_num_buffers)
+	 || (offset > imx_arena_allocator->arena_size)
+	 || (size > (imx_arena_allocator->arena_size - offset)))
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	imx_arena_buffer = &(imx_arena_allocator->buffers[imx_arena_allocator->num_buffers]);
+	imx_arena_allocator->num_buffers++;
+	imx_arena_allocator->used_size = offset + size;
+
+	imx_arena_buffer->parent.allocator = allocator;
+	imx_arena_buffer->parent.mapped_virtual_address = NULL;
+	imx_arena_buffer->parent.physical_address = physical_address;
+	imx_arena_buffer->parent.size = size;
+	imx_arena_buffer->parent.fd = -1;
+	imx_arena_buffer->offset = offset;
+	imx_arena_buffer->mapping_refcount = 0;
+
+	return (ImxDmaBuffer *)imx_arena_buffer;
+}
+
+
+static void imx_dma_buffer_arena_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	ImxDmaBufferArenaBuffer *imx_arena_buffer = (ImxDmaBufferArenaBuffer *)buffer;
+
+	assert(imx_arena_buffer != NULL);
+
+	/* The space is reclaimed by imx_dma_buffer_arena_allocator_reset(). */
+	while (imx_arena_buffer->mapping_refcount > 0)
+		imx_dma_buffer_arena_allocator_unmap(allocator, buffer);
+}
+
+
+static uint8_t* imx_dma_buffer_arena_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
+{
+	uint8_t *virtual_address;
+	ImxDmaBufferArenaBuffer *imx_arena_buffer = (ImxDmaBufferArenaBuffer *)buffer;
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+
+	assert(imx_arena_buffer != NULL);
+
+	/* Windows are refcounted by the arena buffer, so mapping the same
+	 * range again returns the same address as the first time. */
+	virtual_address = imx_dma_buffer_map_range(imx_arena_allocator->arena_buffer, imx_arena_buffer->offset, imx_arena_buffer->parent.size, flags, error);
+	if (virtual_address != NULL)
+	{
+		imx_arena_buffer->parent.mapped_virtual_address = virtual_address;
+		imx_arena_buffer->mapping_refcount++;
+	}
+
+	return virtual_address;
+}
+
+
+static void imx_dma_buffer_arena_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	ImxDmaBufferArenaBuffer *imx_arena_buffer = (ImxDmaBufferArenaBuffer *)buffer;
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+
+	assert(imx_arena_buffer != NULL);
+
+	if (imx_arena_buffer->mapping_refcount == 0)
+		return;
+
+	imx_dma_buffer_unmap_range(imx_arena_allocator->arena_buffer, imx_arena_buffer->parent.mapped_virtual_address);
+
+	imx_arena_buffer->mapping_refcount--;
+	if (imx_arena_buffer->mapping_refcount == 0)
+		imx_arena_buffer->parent.mapped_virtual_address = NULL;
+}
+
+
+static void imx_dma_buffer_arena_allocator_start_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+	if (buffer->mapped_virtual_address != NULL)
+		imx_dma_buffer_start_range_sync_session(imx_arena_allocator->arena_buffer, buffer->mapped_virtual_address);
+}
+
+
+static void imx_dma_buffer_arena_allocator_stop_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+	if (buffer->mapped_virtual_address != NULL)
+		imx_dma_buffer_stop_range_sync_session(imx_arena_allocator->arena_buffer, buffer->mapped_virtual_address);
+}
+
+
+static uint8_t* imx_dma_buffer_arena_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error)
+{
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+	return imx_dma_buffer_map_range(imx_arena_allocator->arena_buffer, ((ImxDmaBufferArenaBuffer *)buffer)->offset + offset, length, flags, error);
+}
+
+
+static void imx_dma_buffer_arena_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address)
+{
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+	IMX_DMA_BUFFER_UNUSED_PARAM(buffer);
+	imx_dma_buffer_unmap_range(imx_arena_allocator->arena_buffer, virtual_address);
+}
+
+
+static void imx_dma_buffer_arena_allocator_sync_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address, int start)
+{
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(buffer);
+
+	if (start)
+		imx_dma_buffer_start_range_sync_session(imx_arena_allocator->arena_buffer, virtual_address);
+	else
+		imx_dma_buffer_stop_range_sync_session(imx_arena_allocator->arena_buffer, virtual_address);
+}
+
+
+static imx_physical_address_t imx_dma_buffer_arena_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return buffer->physical_address;
+}
+
+
+static int imx_dma_buffer_arena_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return buffer->fd;
+}
+
+
+static size_t imx_dma_buffer_arena_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return buffer->size;
+}
+
+
+ImxDmaBufferAllocator* imx_dma_buffer_arena_allocator_new(
+	ImxDmaBufferAllocator *underlying_allocator,
+	size_t arena_size,
+	size_t max_num_buffers,
+	int *error
+)
+{
+	ImxDmaBufferArenaAllocator *imx_arena_allocator;
+
+	assert(underlying_allocator != NULL);
+	assert(arena_size >= 1);
+	assert(max_num_buffers >= 1);
+
+	imx_arena_allocator = (ImxDmaBufferArenaAllocator *)malloc(sizeof(ImxDmaBufferArenaAllocator));
+	if (imx_arena_allocator == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	memset(imx_arena_allocator, 0, sizeof(ImxDmaBufferArenaAllocator));
+	imx_dma_buffer_allocator_init(&(imx_arena_allocator->parent));
+	imx_arena_allocator->parent.destroy = imx_dma_buffer_arena_allocator_destroy;
+	imx_arena_allocator->parent.allocate = imx_dma_buffer_arena_allocator_allocate;
+	imx_arena_allocator->parent.deallocate = imx_dma_buffer_arena_allocator_deallocate;
+	imx_arena_allocator->parent.map = imx_dma_buffer_arena_allocator_map;
+	imx_arena_allocator->parent.unmap = imx_dma_buffer_arena_allocator_unmap;
+	imx_arena_allocator->parent.start_sync_session = imx_dma_buffer_arena_allocator_start_sync_session;
+	imx_arena_allocator->parent.stop_sync_session = imx_dma_buffer_arena_allocator_stop_sync_session;
+	imx_arena_allocator->parent.get_physical_address = imx_dma_buffer_arena_allocator_get_physical_address;
+	imx_arena_allocator->parent.get_fd = imx_dma_buffer_arena_allocator_get_fd;
+	imx_arena_allocator->parent.get_size = imx_dma_buffer_arena_allocator_get_size;
+	/* Arena buffers are parts of a buffer of the underlying allocator, so they have its cache mode. */
+	imx_arena_allocator->parent.flags = IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER | (IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS(underlying_allocator) & IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY);
+	/* Arena buffers are not registered, so resetting the arena does not
+	 * have to unregister them one by one. */
+	imx_arena_allocator->parent.flags |= IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNTRACKED_BUFFERS;
+	imx_arena_allocator->parent.map_range = imx_dma_buffer_arena_allocator_map_range;
+	imx_arena_allocator->parent.unmap_range = imx_dma_buffer_arena_allocator_unmap_range;
+	imx_arena_allocator->parent.sync_range = imx_dma_buffer_arena_allocator_sync_range;
+	imx_arena_allocator->underlying_allocator = underlying_allocator;
+	imx_arena_allocator->arena_size = arena_size;
+	imx_arena_allocator->max_num_buffers = max_num_buffers;
+
+	imx_arena_allocator->buffers = (ImxDmaBufferArenaBuffer *)malloc(sizeof(ImxDmaBufferArenaBuffer) * max_num_buffers);
+	if (imx_arena_allocator->buffers == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		goto error;
+	}
+
+	/* Page alignment means that allocations with alignments up to the page
+	 * size are aligned in mapped windows of the arena buffer as well. */
+	imx_arena_allocator->arena_buffer = imx_dma_buffer_allocate_untracked(underlying_allocator, arena_size, sysconf(_SC_PAGESIZE), error);
+	if (imx_arena_allocator->arena_buffer == NULL)
+		goto error;
+	imx_arena_allocator->arena_physical_address = imx_dma_buffer_get_physical_address(imx_arena_allocator->arena_buffer);
+
+	return (ImxDmaBufferAllocator *)imx_arena_allocator;
+
+error:
+	imx_dma_buffer_arena_allocator_destroy((ImxDmaBufferAllocator *)imx_arena_allocator);
+	return NULL;
+}
+
+
+void imx_dma_buffer_arena_allocator_reset(ImxDmaBufferAllocator *allocator)
+{
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+
+	assert(imx_arena_allocator != NULL);
+
+	imx_arena_allocator->used_size = 0;
+	imx_arena_allocator->num_buffers = 0;
+}
+
+
+size_t imx_dma_buffer_arena_allocator_get_used_size(ImxDmaBufferAllocator *allocator)
+{
+	ImxDmaBufferArenaAllocator *imx_arena_allocator = (ImxDmaBufferArenaAllocator *)allocator;
+	assert(imx_arena_allocator != NULL);
+	return imx_arena_allocator->used_size;
+}
@@ -0,0 +1,86 @@
+#ifndef IMXDMABUFFER_ARENA_ALLOCATOR_H
+#define IMXDMABUFFER_ARENA_ALLOCATOR_H
+
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Creates a new DMA buffer allocator that hands out parts of one large buffer.
+ *
+ * The arena allocator allocates one buffer of arena_size bytes from the
+ * underlying allocator when it is created. Allocations from the arena are
+ * placed one after the other in that buffer. Allocating only increments an
+ * offset (after aligning it), and the physical address of an allocated buffer
+ * is the physical address of the arena buffer plus that offset. Deallocating
+ * a buffer does not make its space available again. Instead, all space is
+ * reclaimed at once with imx_dma_buffer_arena_allocator_reset(), which takes
+ * constant time, regardless of how many buffers were allocated.
+ *
+ * For the same reason, arena buffers are not tracked by the buffer registry.
+ * They are not counted by imx_dma_buffer_allocator_get_num_live_buffers(),
+ * not listed by imx_dma_buffer_allocator_report_leaks(), and cannot be
+ * looked up by address. Also, imx_dma_buffer_allocator_free_group() does not
+ * deallocate them.
+ *
+ * This is intended for scratch data that is needed for one frame only, like
+ * motion vectors, metadata blocks, and small intermediate surfaces. These are
+ * allocated during the frame, and the arena is reset at the end of the frame.
+ *
+ * Mapping a buffer of the arena maps only the part of the arena buffer that
+ * the buffer occupies, with imx_dma_buffer_map_range(). Sync sessions of a
+ * buffer only sync that part, if the underlying allocator supports this.
+ * Buffers of the arena have no file descriptor, since it would refer to the
+ * whole arena.
+ *
+ * The arena allocator does not take ownership of the underlying allocator.
+ * Destroying the arena allocator deallocates the arena buffer, and unmaps arena
+ * buffers that are still mapped. The underlying allocator must be destroyed
+ * after the arena allocator.
+ *
+ * The arena allocator is not thread safe. Typically, each thread that
+ * processes frames uses its own arena.
+ *
+ * @param underlying_allocator Allocator to allocate the arena buffer with.
+ *        Must not be NULL.
+ * @param arena_size Size of the arena buffer, in bytes. Must be at least 1.
+ * @param max_num_buffers Maximum number of buffers that can be allocated from
+ *        the arena between two resets. The ImxDmaBuffer structures are
+ *        preallocated, so allocating does not call malloc(). Must be at least 1.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If creating the allocator succeeds, the integer is not modified.
+ * @return Pointer to the newly created arena allocator, or NULL in case of an error.
+ */
+ImxDmaBufferAllocator* imx_dma_buffer_arena_allocator_new(
+	ImxDmaBufferAllocator *underlying_allocator,
+	size_t arena_size,
+	size_t max_num_buffers,
+	int *error
+);
+
+/* Reclaims the space of all buffers that were allocated from the arena.
+ *
+ * Buffers allocated before the reset must not be used afterwards. They do not
+ * have to be deallocated; deallocating them only matters if they are still
+ * mapped or have attachments, since mappings are then unmapped, and the
+ * attachment destroy functions are called. Buffers that are not deallocated
+ * must therefore be unmapped and must not have attachments at this point.
+ * This takes constant time, since arena buffers are not registered.
+ */
+void imx_dma_buffer_arena_allocator_reset(ImxDmaBufferAllocator *allocator);
+
+/* Returns the number of bytes of the arena that are used by allocations,
+ * including the padding that was inserted for aligning buffers. */
+size_t imx_dma_buffer_arena_allocator_get_used_size(ImxDmaBufferAllocator *allocator);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_ARENA_ALLOCATOR_H */
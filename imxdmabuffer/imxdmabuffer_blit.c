@@ -0,0 +1,317 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_blit.h"
+#include "imxdmabuffer_worker_pool_priv.h"
+
+
+/* Copies smaller than this are not split into bands, since waking up
+ * worker threads would take longer than the copy itself. This is also
+ * the minimum size of a band. */
+#define IMX_DMA_BUFFER_BLIT_MIN_BAND_SIZE (64 * 1024)
+
+#define IMX_DMA_BUFFER_BLIT_MAX_NUM_BANDS 16
+
+
+typedef void (*ImxDmaBufferBlitCopyRowFunc)(uint8_t *dest, uint8_t const *src, size_t size);
+
+
+typedef struct
+{
+	uint8_t const *src;
+	size_t src_stride;
+	uint8_t *dest;
+	size_t dest_stride;
+	size_t row_size;
+	unsigned int num_rows;
+	ImxDmaBufferBlitCopyRowFunc copy_row;
+}
+ImxDmaBufferBlitBand;
+
+
+static void imx_dma_buffer_blit_copy_row_memcpy(uint8_t *dest, uint8_t const *src, size_t size)
+{
+	memcpy(dest, src, size);
+}
+
+
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+/* Copies 64 bytes per iteration, with all loads issued before the stores.
+ * Used if one of the buffers is uncached, since accessing uncached memory
+ * in wide, sequential bursts is much faster than with the smaller and
+ * interleaved accesses that memcpy() may do. */
+static void imx_dma_buffer_blit_copy_row_wide(uint8_t *dest, uint8_t const *src, size_t size)
+{
+	for (; size >= 64; dest += 64, src += 64, size -= 64)
+	{
+#if defined(__SSE2__)
+		__m128i a = _mm_loadu_si128((__m128i const *)(src +  0));
+		__m128i b = _mm_loadu_si128((__m128i const *)(src + 16));
+		__m128i c = _mm_loadu_si128((__m128i const *)(src + 32));
+		__m128i d = _mm_loadu_si128((__m128i const *)(src + 48));
+		_mm_storeu_si128((__m128i *)(dest +  0), a);
+		_mm_storeu_si128((__m128i *)(dest + 16), b);
+		_mm_storeu_si128((__m128i *)(dest + 32), c);
+		_mm_storeu_si128((__m128i *)(dest + 48), d);
+#else
+		uint8x16_t a = vld1q_u8(src +  0);
+		uint8x16_t b = vld1q_u8(src + 16);
+		uint8x16_t c = vld1q_u8(src + 32);
+		uint8x16_t d = vld1q_u8(src + 48);
+		vst1q_u8(dest +  0, a);
+		vst1q_u8(dest + 16, b);
+		vst1q_u8(dest + 32, c);
+		vst1q_u8(dest + 48, d);
+#endif
+	}
+
+	memcpy(dest, src, size);
+}
+
+#endif
+
+
+#if defined(__SSE2__)
+
+/* Like the wide copy, but with non-temporal stores, which go through the
+ * write combining buffers instead of the cache. Used for uncached
+ * destinations. Stream stores require 16-byte aligned addresses. */
+static void imx_dma_buffer_blit_copy_row_stream(uint8_t *dest, uint8_t const *src, size_t size)
+{
+	size_t head = (16 - ((uintptr_t)dest & 15)) & 15;
+
+	if (head > size)
+		head = size;
+	memcpy(dest, src, head);
+	dest += head;
+	src += head;
+	size -= head;
+
+	for (; size >= 64; dest += 64, src += 64, size -= 64)
+	{
+		__m128i a = _mm_loadu_si128((__m128i const *)(src +  0));
+		__m128i b = _mm_loadu_si128((__m128i const *)(src + 16));
+		__m128i c = _mm_loadu_si128((__m128i const *)(src + 32));
+		__m128i d = _mm_loadu_si128((__m128i const *)(src + 48));
+		_mm_stream_si128((__m128i *)(dest +  0), a);
+		_mm_stream_si128((__m128i *)(dest + 16), b);
+		_mm_stream_si128((__m128i *)(dest + 32), c);
+		_mm_stream_si128((__m128i *)(dest + 48), d);
+	}
+
+	memcpy(dest, src, size);
+}
+
+#endif
+
+
+static void imx_dma_buffer_blit_band(void *task)
+{
+	ImxDmaBufferBlitBand *band = (ImxDmaBufferBlitBand *)task;
+	unsigned int row;
+
+	/* If there are no gaps between the rows, copy the band in one go. */
+	if ((band->src_stride == band->row_size) && (band->dest_stride == band->row_size))
+	{
+		band->copy_row(band->dest, band->src, band->row_size * band->num_rows);
+	}
+	else
+	{
+		for (row = 0; row < band->num_rows; ++row)
+			band->copy_row(band->dest + band->dest_stride * row, band->src + band->src_stride * row, band->row_size);
+	}
+
+#if defined(__SSE2__)
+	/* Non-temporal stores are weakly ordered; make them visible
+	 * before the band is reported as finished. */
+	if (band->copy_row == imx_dma_buffer_blit_copy_row_stream)
+		_mm_sfence();
+#endif
+}
+
+
+/* Checks that a rectangle of width x height pixels at (x, y) lies within a
+ * plane with the given stride that starts at offset in a buffer of buffer_size
+ * bytes. The plane only has to extend to the bottom right corner of the
+ * rectangle; later rows may well lie outside of the buffer. width and height
+ * must be nonzero. The coordinates come from the caller, so all sums are
+ * computed with size_t, and sums that overflow are rejected. */
+static int imx_dma_buffer_blit_rect_fits(size_t buffer_size, size_t offset, size_t stride, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int bytes_per_pixel)
+{
+	size_t right = (size_t)x + width;
+	size_t bottom = (size_t)y + height;
+	size_t row_end;
+
+	if ((right < x) || (bottom < y))
+		return 0;
+	if (right > (SIZE_MAX / bytes_per_pixel))
+		return 0;
+	row_end = right * bytes_per_pixel;
+
+	if (stride < row_end)
+		return 0;
+	if ((offset > buffer_size) || (row_end > (buffer_size - offset)))
+		return 0;
+	return ((bottom - 1) <= ((buffer_size - offset - row_end) / stride));
+}
+
+
+/* The rectangles must have passed imx_dma_buffer_blit_rect_fits(). */
+static int imx_dma_buffer_blit_rects_overlap(size_t x1, size_t y1, size_t x2, size_t y2, size_t width, size_t height)
+{
+	return (x1 < (x2 + width)) && (x2 < (x1 + width)) && (y1 < (y2 + height)) && (y2 < (y1 + height));
+}
+
+
+int imx_dma_buffer_blit_2d(
+	ImxDmaBuffer *source_buffer,
+	size_t source_offset,
+	size_t source_stride,
+	ImxDmaBufferRect const *source_rect,
+	ImxDmaBuffer *dest_buffer,
+	size_t dest_offset,
+	size_t dest_stride,
+	unsigned int dest_x,
+	unsigned int dest_y,
+	unsigned int bytes_per_pixel,
+	int *error
+)
+{
+	int same_buffer = (source_buffer == dest_buffer);
+	int source_is_uncached, dest_is_uncached;
+	size_t row_size, source_start, dest_start;
+	size_t num_bands;
+	uint8_t *source_virtual_address;
+	uint8_t *dest_virtual_address;
+	ImxDmaBufferBlitCopyRowFunc copy_row;
+	ImxDmaBufferBlitBand bands[IMX_DMA_BUFFER_BLIT_MAX_NUM_BANDS];
+	unsigned int i;
+
+	assert(source_buffer != NULL);
+	assert(source_rect != NULL);
+	assert(dest_buffer != NULL);
+
+	if (bytes_per_pixel == 0)
+		goto invalid;
+
+	if ((source_rect->width == 0) || (source_rect->height == 0))
+		return 1;
+
+	if (!imx_dma_buffer_blit_rect_fits(imx_dma_buffer_get_size(source_buffer), source_offset, source_stride, source_rect->x, source_rect->y, source_rect->width, source_rect->height, bytes_per_pixel)
+	 || !imx_dma_buffer_blit_rect_fits(imx_dma_buffer_get_size(dest_buffer), dest_offset, dest_stride, dest_x, dest_y, source_rect->width, source_rect->height, bytes_per_pixel))
+		goto invalid;
+
+	/* These cannot overflow, since the rectangles fit in the buffers. */
+	row_size = (size_t)(source_rect->width) * bytes_per_pixel;
+	source_start = source_offset + source_stride * source_rect->y + (size_t)(source_rect->x) * bytes_per_pixel;
+	dest_start = dest_offset + dest_stride * dest_y + (size_t)dest_x * bytes_per_pixel;
+
+	if (same_buffer)
+	{
+		if ((source_offset == dest_offset) && (source_stride == dest_stride))
+		{
+			if (imx_dma_buffer_blit_rects_overlap(source_rect->x, source_rect->y, dest_x, dest_y, source_rect->width, source_rect->height))
+				goto invalid;
+		}
+		else
+		{
+			/* The planes are laid out differently, so just check
+			 * that the byte ranges spanned by the rectangles are
+			 * disjoint. This may reject some valid copies. */
+			size_t source_end = source_start + source_stride * (source_rect->height - 1) + row_size;
+			size_t dest_end = dest_start + dest_stride * (source_rect->height - 1) + row_size;
+			if ((source_start < dest_end) && (dest_start < source_end))
+				goto invalid;
+		}
+	}
+
+	/* The mappings start and stop the sync sessions: Mapping for reading
+	 * makes the source data visible to the CPU, and unmapping after
+	 * writing makes the copied data visible to devices. */
+	if (same_buffer)
+	{
+		source_virtual_address = imx_dma_buffer_map(source_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, error);
+		if (source_virtual_address == NULL)
+			return 0;
+		dest_virtual_address = source_virtual_address;
+	}
+	else
+	{
+		source_virtual_address = imx_dma_buffer_map(source_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ, error);
+		if (source_virtual_address == NULL)
+			return 0;
+
+		dest_virtual_address = imx_dma_buffer_map(dest_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, error);
+		if (dest_virtual_address == NULL)
+		{
+			imx_dma_buffer_unmap(source_buffer);
+			return 0;
+		}
+	}
+
+	/* Pick the copy method based on the cache modes of the buffers. */
+	source_is_uncached = (IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS(source_buffer->allocator) & IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY) != 0;
+	dest_is_uncached = (IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS(dest_buffer->allocator) & IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY) != 0;
+	copy_row = imx_dma_buffer_blit_copy_row_memcpy;
+#if defined(__SSE2__)
+	if (dest_is_uncached)
+		copy_row = imx_dma_buffer_blit_copy_row_stream;
+	else if (source_is_uncached)
+		copy_row = imx_dma_buffer_blit_copy_row_wide;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	if (source_is_uncached || dest_is_uncached)
+		copy_row = imx_dma_buffer_blit_copy_row_wide;
+#else
+	IMX_DMA_BUFFER_UNUSED_PARAM(source_is_uncached);
+	IMX_DMA_BUFFER_UNUSED_PARAM(dest_is_uncached);
+#endif
+
+	num_bands = (row_size * source_rect->height) / IMX_DMA_BUFFER_BLIT_MIN_BAND_SIZE;
+	if (num_bands > imx_dma_buffer_worker_pool_get_num_threads())
+		num_bands = imx_dma_buffer_worker_pool_get_num_threads();
+	if (num_bands > IMX_DMA_BUFFER_BLIT_MAX_NUM_BANDS)
+		num_bands = IMX_DMA_BUFFER_BLIT_MAX_NUM_BANDS;
+	if (num_bands > source_rect->height)
+		num_bands = source_rect->height;
+	if (num_bands == 0)
+		num_bands = 1;
+
+	for (i = 0; i < num_bands; ++i)
+	{
+		unsigned int first_row = (unsigned int)(((uint64_t)(source_rect->height) * i) / num_bands);
+		unsigned int end_row = (unsigned int)(((uint64_t)(source_rect->height) * (i + 1)) / num_bands);
+
+		bands[i].src = source_virtual_address + source_start + source_stride * first_row;
+		bands[i].src_stride = source_stride;
+		bands[i].dest = dest_virtual_address + dest_start + dest_stride * first_row;
+		bands[i].dest_stride = dest_stride;
+		bands[i].row_size = row_size;
+		bands[i].num_rows = end_row - first_row;
+		bands[i].copy_row = copy_row;
+	}
+
+	imx_dma_buffer_worker_pool_run(imx_dma_buffer_blit_band, bands, sizeof(ImxDmaBufferBlitBand), num_bands);
+
+	if (!same_buffer)
+		imx_dma_buffer_unmap(dest_buffer);
+	imx_dma_buffer_unmap(source_buffer);
+
+	return 1;
+
+invalid:
+	if (error != NULL)
+		*error = EINVAL;
+	return 0;
+}
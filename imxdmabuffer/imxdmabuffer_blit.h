@@ -0,0 +1,84 @@
+#ifndef IMXDMABUFFER_BLIT_H
+#define IMXDMABUFFER_BLIT_H
+
+#include <stddef.h>
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Rectangle in a 2D plane. Coordinates and sizes are given in pixels. */
+typedef struct
+{
+	unsigned int x, y;
+	unsigned int width, height;
+}
+ImxDmaBufferRect;
+
+
+/* Copies a rectangle of a 2D plane in one DMA buffer to a 2D plane in another.
+ *
+ * This covers cropping (copying a part of a plane), padding (copying a plane
+ * into a part of a bigger one), and converting between different strides,
+ * like when passing planes between devices with different stride alignment
+ * requirements. Multi-plane frames are copied by calling this once per plane.
+ *
+ * Large copies are split into horizontal bands that are copied in parallel
+ * by a small process-wide pool of worker threads. The calling thread copies
+ * one of the bands. Rows are copied with memcpy() if both buffers are cached.
+ * If one of them is uncached (see IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY),
+ * SSE2 or NEON code is used instead, if available, which accesses uncached
+ * memory with wide, sequential loads and stores. On x86, non-temporal stores
+ * are used for uncached destinations.
+ *
+ * Both buffers are mapped during the copy, the source buffer with
+ * IMX_DMA_BUFFER_MAPPING_FLAG_READ and the destination buffer with
+ * IMX_DMA_BUFFER_MAPPING_FLAG_WRITE. The automatic sync sessions make sure
+ * the source data is up to date for the CPU, and the copied data is visible
+ * to devices once this function returns. The buffers must therefore not be
+ * mapped with the IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC flag when this is
+ * called. Source and destination may be the same buffer, as long as the
+ * source and destination rectangles do not overlap.
+ *
+ * @param source_buffer DMA buffer to copy from.
+ * @param source_offset Offset of the source plane in the source buffer, in bytes.
+ * @param source_stride Number of bytes per row of the source plane.
+ * @param source_rect Rectangle to copy. It must lie within the source plane.
+ *        If its width or height is 0, nothing is copied.
+ * @param dest_buffer DMA buffer to copy to.
+ * @param dest_offset Offset of the destination plane in the destination buffer, in bytes.
+ * @param dest_stride Number of bytes per row of the destination plane.
+ * @param dest_x X coordinate of the top left corner of the destination rectangle.
+ * @param dest_y Y coordinate of the top left corner of the destination rectangle.
+ * @param bytes_per_pixel Number of bytes per pixel in both planes. Must be at least 1.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If a rectangle does not fit in its plane or buffer, or if the source
+ *        and destination rectangles overlap, the error code is EINVAL.
+ *        If the copy succeeds, the integer is not modified.
+ * @return Nonzero if the copy succeeds, 0 in case of an error.
+ */
+int imx_dma_buffer_blit_2d(
+	ImxDmaBuffer *source_buffer,
+	size_t source_offset,
+	size_t source_stride,
+	ImxDmaBufferRect const *source_rect,
+	ImxDmaBuffer *dest_buffer,
+	size_t dest_offset,
+	size_t dest_stride,
+	unsigned int dest_x,
+	unsigned int dest_y,
+	unsigned int bytes_per_pixel,
+	int *error
+);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_BLIT_H */
@@ -0,0 +1,412 @@
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_copy_queue.h"
+
+
+struct _ImxDmaBufferCopyToken
+{
+	/* Next token in the queue's list of pending or running jobs. */
+	ImxDmaBufferCopyToken *next;
+
+	ImxDmaBufferCopyJob job;
+
+	/* Written to once the job is complete. It is never read,
+	 * so it stays readable from then on. */
+	int event_fd;
+
+	/* Set to 1 once the job is complete. error is only valid then. */
+	int complete;
+	int error;
+
+	/* One reference is held by the caller, one by the queue
+	 * until the job is complete. */
+	int refcount;
+};
+
+
+struct _ImxDmaBufferCopyQueue
+{
+	ImxDmaBufferCopyEngine engine;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	ImxDmaBufferCopyToken *pending_head;
+	ImxDmaBufferCopyToken *pending_tail;
+	/* Jobs that are currently being executed by the threads. */
+	ImxDmaBufferCopyToken *running;
+	int shutting_down;
+
+	pthread_t *threads;
+	unsigned int num_threads;
+};
+
+
+static int imx_dma_buffer_copy_queue_cpu_copy(void *engine_data, ImxDmaBufferCopyJob const *job, int *error)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(engine_data);
+
+	return imx_dma_buffer_blit_2d(
+		job->source_buffer, job->source_offset, job->source_stride, &(job->source_rect),
+		job->dest_buffer, job->dest_offset, job->dest_stride, job->dest_x, job->dest_y,
+		job->bytes_per_pixel,
+		error
+	);
+}
+
+
+static void imx_dma_buffer_copy_token_unref(ImxDmaBufferCopyToken *token)
+{
+	if (__atomic_sub_fetch(&(token->refcount), 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		close(token->event_fd);
+		free(token);
+	}
+}
+
+
+static int imx_dma_buffer_copy_jobs_share_buffers(ImxDmaBufferCopyJob const *job1, ImxDmaBufferCopyJob const *job2)
+{
+	return (job1->source_buffer == job2->source_buffer) || (job1->source_buffer == job2->dest_buffer)
+	    || (job1->dest_buffer == job2->source_buffer) || (job1->dest_buffer == job2->dest_buffer);
+}
+
+
+/* Removes the oldest pending job that does not share a buffer with any of
+ * the running jobs or with any of the older pending jobs from the pending
+ * list, and returns it. Mapping and unmapping the same buffer from several
+ * threads at the same time is not safe, so such jobs have to wait until the
+ * running ones are finished. And a job must not overtake an older one that
+ * uses the same buffer, since it may depend on the result of the older job,
+ * or the older job may depend on the buffer's current contents. Returns NULL
+ * if there is no such job. Must be called with the mutex locked. */
+static ImxDmaBufferCopyToken* imx_dma_buffer_copy_queue_take_job(ImxDmaBufferCopyQueue *queue)
+{
+	ImxDmaBufferCopyToken **link;
+	ImxDmaBufferCopyToken *previous = NULL;
+
+	for (link = &(queue->pending_head); (*link) != NULL; previous = *link, link = &((*link)->next))
+	{
+		ImxDmaBufferCopyToken *token = *link;
+		ImxDmaBufferCopyToken *running, *older;
+
+		for (running = queue->running; running != NULL; running = running->next)
+		{
+			if (imx_dma_buffer_copy_jobs_share_buffers(&(token->job), &(running->job)))
+				break;
+		}
+		if (running != NULL)
+			continue;
+
+		for (older = queue->pending_head; older != token; older = older->next)
+		{
+			if (imx_dma_buffer_copy_jobs_share_buffers(&(token->job), &(older->job)))
+				break;
+		}
+		if (older != token)
+			continue;
+
+		*link = token->next;
+		if (queue->pending_tail == token)
+			queue->pending_tail = previous;
+
+		token->next = queue->running;
+		queue->running = token;
+
+		return token;
+	}
+
+	return NULL;
+}
+
+
+static void* imx_dma_buffer_copy_queue_thread(void *arg)
+{
+	ImxDmaBufferCopyQueue *queue = (ImxDmaBufferCopyQueue *)arg;
+
+	pthread_mutex_lock(&(queue->mutex));
+
+	while (1)
+	{
+		ImxDmaBufferCopyToken *token;
+		ImxDmaBufferCopyToken **link;
+		int error = 0;
+		uint64_t one = 1;
+		ssize_t ret;
+
+		/* Pending jobs are executed even when shutting down. */
+		while (((token = imx_dma_buffer_copy_queue_take_job(queue)) == NULL) && !((queue->shutting_down) && (queue->pending_head == NULL)))
+			pthread_cond_wait(&(queue->cond), &(queue->mutex));
+
+		if (token == NULL)
+			break;
+
+		pthread_mutex_unlock(&(queue->mutex));
+
+		if (!queue->engine.copy(queue->engine.engine_data, &(token->job), &error))
+		{
+			/* Make sure a failed copy never looks like a successful one. */
+			token->error = (error != 0) ? error : EIO;
+		}
+
+		__atomic_store_n(&(token->complete), 1, __ATOMIC_RELEASE);
+		/* This can only fail if the counter would overflow, which cannot
+		 * happen since it is written to only once. Waiters check the
+		 * complete flag as well, so they would not miss it anyway. */
+		ret = write(token->event_fd, &one, sizeof(one));
+		(void)ret;
+
+		pthread_mutex_lock(&(queue->mutex));
+
+		for (link = &(queue->running); (*link) != token; link = &((*link)->next))
+			assert((*link) != NULL);
+		*link = token->next;
+		token->next = NULL;
+
+		/* Pending jobs that share buffers with this one may run now. */
+		if (queue->pending_head != NULL)
+			pthread_cond_broadcast(&(queue->cond));
+
+		imx_dma_buffer_copy_token_unref(token);
+	}
+
+	pthread_mutex_unlock(&(queue->mutex));
+
+	return NULL;
+}
+
+
+ImxDmaBufferCopyQueue* imx_dma_buffer_copy_queue_new(ImxDmaBufferCopyEngine const *engine, unsigned int num_threads, int *error)
+{
+	ImxDmaBufferCopyQueue *queue;
+	int ret;
+
+	assert((engine == NULL) || (engine->copy != NULL));
+
+	if (num_threads == 0)
+		num_threads = 1;
+
+	queue = (ImxDmaBufferCopyQueue *)malloc(sizeof(ImxDmaBufferCopyQueue));
+	if (queue == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	memset(queue, 0, sizeof(ImxDmaBufferCopyQueue));
+
+	if (engine != NULL)
+	{
+		queue->engine = *engine;
+	}
+	else
+	{
+		queue->engine.copy = imx_dma_buffer_copy_queue_cpu_copy;
+		queue->engine.destroy = NULL;
+		queue->engine.engine_data = NULL;
+	}
+
+	queue->threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+	if (queue->threads == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		free(queue);
+		return NULL;
+	}
+
+	pthread_mutex_init(&(queue->mutex), NULL);
+	pthread_cond_init(&(queue->cond), NULL);
+
+	for (queue->num_threads = 0; queue->num_threads < num_threads; ++(queue->num_threads))
+	{
+		ret = pthread_create(&(queue->threads[queue->num_threads]), NULL, imx_dma_buffer_copy_queue_thread, queue);
+		if (ret != 0)
+		{
+			if (error != NULL)
+				*error = ret;
+			/* The engine is owned by the caller until the queue is created. */
+			queue->engine.destroy = NULL;
+			imx_dma_buffer_copy_queue_free(queue);
+			return NULL;
+		}
+	}
+
+	return queue;
+}
+
+
+void imx_dma_buffer_copy_queue_free(ImxDmaBufferCopyQueue *queue)
+{
+	unsigned int i;
+
+	if (queue == NULL)
+		return;
+
+	pthread_mutex_lock(&(queue->mutex));
+	queue->shutting_down = 1;
+	pthread_cond_broadcast(&(queue->cond));
+	pthread_mutex_unlock(&(queue->mutex));
+
+	for (i = 0; i < queue->num_threads; ++i)
+		pthread_join(queue->threads[i], NULL);
+
+	if (queue->engine.destroy != NULL)
+		queue->engine.destroy(queue->engine.engine_data);
+
+	pthread_cond_destroy(&(queue->cond));
+	pthread_mutex_destroy(&(queue->mutex));
+
+	free(queue->threads);
+	free(queue);
+}
+
+
+ImxDmaBufferCopyToken* imx_dma_buffer_copy_queue_submit(ImxDmaBufferCopyQueue *queue, ImxDmaBufferCopyJob const *job, int *error)
+{
+	ImxDmaBufferCopyToken *token;
+
+	assert(queue != NULL);
+	assert(job != NULL);
+	assert(job->source_buffer != NULL);
+	assert(job->dest_buffer != NULL);
+
+	token = (ImxDmaBufferCopyToken *)malloc(sizeof(ImxDmaBufferCopyToken));
+	if (token == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	token->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (token->event_fd < 0)
+	{
+		if (error != NULL)
+			*error = errno;
+		free(token);
+		return NULL;
+	}
+
+	token->next = NULL;
+	token->job = *job;
+	token->complete = 0;
+	token->error = 0;
+	token->refcount = 2;
+
+	pthread_mutex_lock(&(queue->mutex));
+
+	assert(!(queue->shutting_down));
+
+	if (queue->pending_tail != NULL)
+		queue->pending_tail->next = token;
+	else
+		queue->pending_head = token;
+	queue->pending_tail = token;
+	pthread_cond_signal(&(queue->cond));
+
+	pthread_mutex_unlock(&(queue->mutex));
+
+	return token;
+}
+
+
+void imx_dma_buffer_copy_token_free(ImxDmaBufferCopyToken *token)
+{
+	if (token != NULL)
+		imx_dma_buffer_copy_token_unref(token);
+}
+
+
+int imx_dma_buffer_copy_token_get_fd(ImxDmaBufferCopyToken *token)
+{
+	assert(token != NULL);
+	return token->event_fd;
+}
+
+
+int imx_dma_buffer_copy_token_is_complete(ImxDmaBufferCopyToken *token)
+{
+	assert(token != NULL);
+	return __atomic_load_n(&(token->complete), __ATOMIC_ACQUIRE);
+}
+
+
+int imx_dma_buffer_copy_token_wait(ImxDmaBufferCopyToken *token, int timeout_ms, int *error)
+{
+	struct timespec deadline;
+
+	assert(token != NULL);
+
+	memset(&deadline, 0, sizeof(deadline));
+	if (timeout_ms > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	while (!imx_dma_buffer_copy_token_is_complete(token))
+	{
+		struct pollfd pfd;
+		int remaining_ms = timeout_ms;
+		int ret;
+
+		/* poll() can be interrupted by signals, so the
+		 * remaining time has to be computed for each attempt. */
+		if (timeout_ms > 0)
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining_ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000L;
+			if (remaining_ms < 0)
+				remaining_ms = 0;
+		}
+
+		pfd.fd = token->event_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		ret = poll(&pfd, 1, remaining_ms);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (error != NULL)
+				*error = errno;
+			return 0;
+		}
+		else if ((ret == 0) && !imx_dma_buffer_copy_token_is_complete(token))
+		{
+			if (error != NULL)
+				*error = ETIMEDOUT;
+			return 0;
+		}
+	}
+
+	if (token->error != 0)
+	{
+		if (error != NULL)
+			*error = token->error;
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,153 @@
+#ifndef IMXDMABUFFER_COPY_QUEUE_H
+#define IMXDMABUFFER_COPY_QUEUE_H
+
+#include <stddef.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_blit.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Description of a copy between two DMA buffers. The fields have the same
+ * meaning as the arguments of imx_dma_buffer_blit_2d(). A linear copy of
+ * N bytes is a copy of a rectangle that is N pixels wide and 1 pixel high,
+ * with 1 byte per pixel. */
+typedef struct
+{
+	ImxDmaBuffer *source_buffer;
+	size_t source_offset;
+	size_t source_stride;
+	ImxDmaBufferRect source_rect;
+
+	ImxDmaBuffer *dest_buffer;
+	size_t dest_offset;
+	size_t dest_stride;
+	unsigned int dest_x, dest_y;
+
+	unsigned int bytes_per_pixel;
+}
+ImxDmaBufferCopyJob;
+
+
+/* ImxDmaBufferCopyEngine:
+ *
+ * Performs the copies of a copy queue. The default engine copies with the
+ * CPU, using imx_dma_buffer_blit_2d(). Other engines can be plugged in, for
+ * example one that uses a 2D blitter like the PxP or G2D.
+ */
+typedef struct
+{
+	/* Performs the copy described by job, and returns once it is finished.
+	 * This is called by the threads of the queue; if the queue has more than
+	 * one thread, calls can happen concurrently. Returns nonzero if the copy
+	 * succeeded. Otherwise, it returns 0, and sets *error to an error code
+	 * from errno.h. error is never NULL. */
+	int (*copy)(void *engine_data, ImxDmaBufferCopyJob const *job, int *error);
+
+	/* Called when the queue is freed, after the last copy. Can be NULL. */
+	void (*destroy)(void *engine_data);
+
+	void *engine_data;
+}
+ImxDmaBufferCopyEngine;
+
+
+/* ImxDmaBufferCopyQueue:
+ *
+ * Performs copies between DMA buffers asynchronously. Copy jobs are submitted
+ * to the queue, which returns a completion token for each job. The jobs are
+ * executed in submission order by the queue's threads, so the submitting
+ * pipeline stage can continue with other work in the meantime. With several
+ * threads, a job may start before older jobs, but only if it does not share
+ * any buffer with them. Once a job is
+ * finished, its token is marked as complete, and the token's eventfd becomes
+ * readable, so completion can be waited for with poll() / epoll_wait(),
+ * together with other file descriptors.
+ *
+ * The buffers of a job must not be deallocated, and must not be mapped with
+ * the IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC flag, until the job is complete.
+ *
+ * All functions of the queue and the tokens are thread safe.
+ */
+typedef struct _ImxDmaBufferCopyQueue ImxDmaBufferCopyQueue;
+
+/* ImxDmaBufferCopyToken:
+ *
+ * Completion token of a copy job.
+ */
+typedef struct _ImxDmaBufferCopyToken ImxDmaBufferCopyToken;
+
+
+/* Creates a new copy queue and starts its threads.
+ *
+ * @param engine Engine to perform the copies with. The structure is copied,
+ *        so it does not have to stay valid. If this is NULL, the copies are
+ *        done by the CPU with imx_dma_buffer_blit_2d().
+ * @param num_threads Number of threads executing jobs. With more than one
+ *        thread, several jobs can be executed at the same time, so jobs may
+ *        finish in a different order than they were submitted. Jobs that
+ *        share a buffer are still executed in submission order, one after
+ *        the other, so a job can use the result of an earlier job. 0 means 1.
+ *        imx_dma_buffer_blit_2d() already splits large copies into bands
+ *        that are copied in parallel, so with the CPU engine, one thread
+ *        is usually enough.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If creating the queue succeeds, the integer is not modified.
+ * @return Pointer to the newly created queue, or NULL in case of an error.
+ */
+ImxDmaBufferCopyQueue* imx_dma_buffer_copy_queue_new(ImxDmaBufferCopyEngine const *engine, unsigned int num_threads, int *error);
+
+/* Frees a copy queue. Jobs that are still pending are executed first. Then
+ * the threads are stopped, and the engine's destroy function is called.
+ * Tokens of the jobs stay valid, and still have to be freed. */
+void imx_dma_buffer_copy_queue_free(ImxDmaBufferCopyQueue *queue);
+
+/* Submits a copy job.
+ *
+ * @param queue Queue to submit the job to.
+ * @param job Job to submit. The structure is copied, so it does not have
+ *        to stay valid.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        Errors of the copy itself are not reported here, but by the token.
+ *        If submitting succeeds, the integer is not modified.
+ * @return Completion token of the job, or NULL in case of an error. The
+ *         token has to be freed with imx_dma_buffer_copy_token_free().
+ */
+ImxDmaBufferCopyToken* imx_dma_buffer_copy_queue_submit(ImxDmaBufferCopyQueue *queue, ImxDmaBufferCopyJob const *job, int *error);
+
+/* Frees a token. If its job is not complete yet, the job is still executed,
+ * and the token is freed once it is complete. */
+void imx_dma_buffer_copy_token_free(ImxDmaBufferCopyToken *token);
+
+/* Returns the token's eventfd, for use with poll(), select(), and epoll. It
+ * becomes readable once the job is complete. The file descriptor is owned
+ * by the token, and must not be closed or read. */
+int imx_dma_buffer_copy_token_get_fd(ImxDmaBufferCopyToken *token);
+
+/* Returns nonzero if the token's job is complete. This never blocks. */
+int imx_dma_buffer_copy_token_is_complete(ImxDmaBufferCopyToken *token);
+
+/* Waits until the token's job is complete.
+ *
+ * @param token Token to wait for.
+ * @param timeout_ms Maximum time to wait, in milliseconds. -1 waits indefinitely.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If the timeout expires, the integer is set to ETIMEDOUT. If the copy
+ *        failed, the integer is set to the error code of the copy.
+ * @return Nonzero if the job is complete and the copy succeeded, 0 otherwise.
+ */
+int imx_dma_buffer_copy_token_wait(ImxDmaBufferCopyToken *token, int timeout_ms, int *error);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_COPY_QUEUE_H */
@@ -0,0 +1,389 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define IMX_DMA_BUFFER_DETILE_HAVE_SIMD
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IMX_DMA_BUFFER_DETILE_HAVE_SIMD
+#endif
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_detile.h"
+#include "imxdmabuffer_worker_pool_priv.h"
+
+
+/* All supported tile layouts have tiles that are 4 rows high. */
+#define IMX_DMA_BUFFER_DETILE_TILE_HEIGHT 4
+
+#define IMX_DMA_BUFFER_DETILE_MAX_NUM_THREADS 16
+
+
+typedef struct
+{
+	uint8_t const *tiled_plane;
+	unsigned int tile_width;
+	size_t tiled_stride;
+
+	/* Size of the plane. The width is given in bytes. */
+	size_t width;
+	unsigned int height;
+
+	uint8_t *dest;
+	size_t dest_stride;
+
+	/* If this is non-NULL, the plane contains interleaved U and V bytes,
+	 * which are split: U bytes go to dest, V bytes go to dest_v. */
+	uint8_t *dest_v;
+	size_t dest_v_stride;
+}
+ImxDmaBufferDetilePlane;
+
+
+typedef struct
+{
+	ImxDmaBufferDetilePlane const *planes;
+	/* Tile rows this band converts, for the luma and chroma planes. */
+	unsigned int first_tile_rows[2];
+	unsigned int end_tile_rows[2];
+}
+ImxDmaBufferDetileBand;
+
+
+#ifdef IMX_DMA_BUFFER_DETILE_HAVE_SIMD
+
+/* Converts the complete tile row src to linear rows, in groups of
+ * 16 bytes per row. Both layouts store 4 rows of 16 bytes in 64
+ * consecutive bytes (four 4x4 tiles or two 8x4 tiles). Returns the
+ * number of bytes per row that were converted. */
+static size_t imx_dma_buffer_detile_tile_row_simd(ImxDmaBufferDetilePlane const *plane, uint8_t const *src, unsigned int first_row)
+{
+	size_t x;
+	unsigned int r;
+	size_t simd_width = plane->width & ~((size_t)15);
+	uint8_t *dest = plane->dest + (size_t)first_row * plane->dest_stride;
+	uint8_t *dest_v = (plane->dest_v != NULL) ? (plane->dest_v + (size_t)first_row * plane->dest_v_stride) : NULL;
+
+#if defined(__SSE2__)
+	__m128i uv_mask = _mm_set1_epi16(0x00FF);
+	__m128i zero = _mm_setzero_si128();
+#endif
+
+	for (x = 0; x < simd_width; x += 16, src += 64)
+	{
+#if defined(__SSE2__)
+		__m128i rows[4];
+		__m128i a = _mm_loadu_si128((__m128i const *)(src +  0));
+		__m128i b = _mm_loadu_si128((__m128i const *)(src + 16));
+		__m128i c = _mm_loadu_si128((__m128i const *)(src + 32));
+		__m128i d = _mm_loadu_si128((__m128i const *)(src + 48));
+
+		if (plane->tile_width == 4)
+		{
+			/* a..d are four tiles; each 32-bit lane is one tile row.
+			 * Transpose the 4x4 matrix of lanes. */
+			__m128i t0 = _mm_unpacklo_epi32(a, b);
+			__m128i t1 = _mm_unpacklo_epi32(c, d);
+			__m128i t2 = _mm_unpackhi_epi32(a, b);
+			__m128i t3 = _mm_unpackhi_epi32(c, d);
+			rows[0] = _mm_unpacklo_epi64(t0, t1);
+			rows[1] = _mm_unpackhi_epi64(t0, t1);
+			rows[2] = _mm_unpacklo_epi64(t2, t3);
+			rows[3] = _mm_unpackhi_epi64(t2, t3);
+		}
+		else
+		{
+			/* a,b are the first tile, c,d the second one;
+			 * each 64-bit lane is one tile row. */
+			rows[0] = _mm_unpacklo_epi64(a, c);
+			rows[1] = _mm_unpackhi_epi64(a, c);
+			rows[2] = _mm_unpacklo_epi64(b, d);
+			rows[3] = _mm_unpackhi_epi64(b, d);
+		}
+
+		for (r = 0; r < IMX_DMA_BUFFER_DETILE_TILE_HEIGHT; ++r)
+		{
+			if (dest_v == NULL)
+			{
+				_mm_storeu_si128((__m128i *)(dest + r * plane->dest_stride + x), rows[r]);
+			}
+			else
+			{
+				__m128i u = _mm_packus_epi16(_mm_and_si128(rows[r], uv_mask), zero);
+				__m128i v = _mm_packus_epi16(_mm_srli_epi16(rows[r], 8), zero);
+				_mm_storel_epi64((__m128i *)(dest + r * plane->dest_stride + x / 2), u);
+				_mm_storel_epi64((__m128i *)(dest_v + r * plane->dest_v_stride + x / 2), v);
+			}
+		}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		uint8x16_t rows[4];
+		uint8x16_t a = vld1q_u8(src +  0);
+		uint8x16_t b = vld1q_u8(src + 16);
+		uint8x16_t c = vld1q_u8(src + 32);
+		uint8x16_t d = vld1q_u8(src + 48);
+
+		if (plane->tile_width == 4)
+		{
+			/* a..d are four tiles; each 32-bit lane is one tile row.
+			 * Transpose the 4x4 matrix of lanes. */
+			uint32x4x2_t ab = vtrnq_u32(vreinterpretq_u32_u8(a), vreinterpretq_u32_u8(b));
+			uint32x4x2_t cd = vtrnq_u32(vreinterpretq_u32_u8(c), vreinterpretq_u32_u8(d));
+			rows[0] = vreinterpretq_u8_u32(vcombine_u32(vget_low_u32(ab.val[0]), vget_low_u32(cd.val[0])));
+			rows[1] = vreinterpretq_u8_u32(vcombine_u32(vget_low_u32(ab.val[1]), vget_low_u32(cd.val[1])));
+			rows[2] = vreinterpretq_u8_u32(vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0])));
+			rows[3] = vreinterpretq_u8_u32(vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1])));
+		}
+		else
+		{
+			/* a,b are the first tile, c,d the second one;
+			 * each 64-bit lane is one tile row. */
+			rows[0] = vcombine_u8(vget_low_u8(a), vget_low_u8(c));
+			rows[1] = vcombine_u8(vget_high_u8(a), vget_high_u8(c));
+			rows[2] = vcombine_u8(vget_low_u8(b), vget_low_u8(d));
+			rows[3] = vcombine_u8(vget_high_u8(b), vget_high_u8(d));
+		}
+
+		for (r = 0; r < IMX_DMA_BUFFER_DETILE_TILE_HEIGHT; ++r)
+		{
+			if (dest_v == NULL)
+			{
+				vst1q_u8(dest + r * plane->dest_stride + x, rows[r]);
+			}
+			else
+			{
+				uint8x8x2_t uv = vuzp_u8(vget_low_u8(rows[r]), vget_high_u8(rows[r]));
+				vst1_u8(dest + r * plane->dest_stride + x / 2, uv.val[0]);
+				vst1_u8(dest_v + r * plane->dest_v_stride + x / 2, uv.val[1]);
+			}
+		}
+#endif
+	}
+
+	return simd_width;
+}
+
+#endif
+
+
+static void imx_dma_buffer_detile_tile_row(ImxDmaBufferDetilePlane const *plane, unsigned int tile_row)
+{
+	uint8_t const *src = plane->tiled_plane + (size_t)tile_row * plane->tiled_stride * IMX_DMA_BUFFER_DETILE_TILE_HEIGHT;
+	unsigned int first_row = tile_row * IMX_DMA_BUFFER_DETILE_TILE_HEIGHT;
+	unsigned int num_rows = plane->height - first_row;
+	size_t tile_size = plane->tile_width * IMX_DMA_BUFFER_DETILE_TILE_HEIGHT;
+	size_t x = 0;
+	unsigned int r;
+
+	if (num_rows > IMX_DMA_BUFFER_DETILE_TILE_HEIGHT)
+		num_rows = IMX_DMA_BUFFER_DETILE_TILE_HEIGHT;
+
+#ifdef IMX_DMA_BUFFER_DETILE_HAVE_SIMD
+	/* The SIMD version always writes all rows of the tile row, so it
+	 * cannot be used for the last tile row if that one is incomplete. */
+	if (num_rows == IMX_DMA_BUFFER_DETILE_TILE_HEIGHT)
+		x = imx_dma_buffer_detile_tile_row_simd(plane, src, first_row);
+#endif
+
+	/* Convert what is left (or everything if SIMD is not available)
+	 * tile by tile. x is always at the start of a tile here. */
+	for (; x < plane->width; x += plane->tile_width)
+	{
+		uint8_t const *tile = src + (x / plane->tile_width) * tile_size;
+		size_t num_bytes = plane->width - x;
+		if (num_bytes > plane->tile_width)
+			num_bytes = plane->tile_width;
+
+		for (r = 0; r < num_rows; ++r)
+		{
+			uint8_t const *tile_line = tile + r * plane->tile_width;
+
+			if (plane->dest_v == NULL)
+			{
+				memcpy(plane->dest + (size_t)(first_row + r) * plane->dest_stride + x, tile_line, num_bytes);
+			}
+			else
+			{
+				size_t i;
+				uint8_t *u = plane->dest + (size_t)(first_row + r) * plane->dest_stride + x / 2;
+				uint8_t *v = plane->dest_v + (size_t)(first_row + r) * plane->dest_v_stride + x / 2;
+
+				for (i = 0; i < num_bytes; i += 2)
+				{
+					u[i / 2] = tile_line[i + 0];
+					v[i / 2] = tile_line[i + 1];
+				}
+			}
+		}
+	}
+}
+
+
+static void imx_dma_buffer_detile_band(void *task)
+{
+	ImxDmaBufferDetileBand *band = (ImxDmaBufferDetileBand *)task;
+	unsigned int plane_index, tile_row;
+
+	for (plane_index = 0; plane_index < 2; ++plane_index)
+	{
+		for (tile_row = band->first_tile_rows[plane_index]; tile_row < band->end_tile_rows[plane_index]; ++tile_row)
+			imx_dma_buffer_detile_tile_row(&(band->planes[plane_index]), tile_row);
+	}
+}
+
+
+/* Checks that num_rows rows of row_size bytes, with the given stride,
+ * fit in a buffer of buffer_size bytes when starting at offset. */
+static int imx_dma_buffer_detile_plane_fits(size_t buffer_size, size_t offset, size_t stride, size_t row_size, unsigned int num_rows)
+{
+	if (stride < row_size)
+		return 0;
+	if ((offset > buffer_size) || (row_size > (buffer_size - offset)))
+		return 0;
+	return ((num_rows - 1) <= ((buffer_size - offset - row_size) / stride));
+}
+
+
+static unsigned int imx_dma_buffer_detile_num_tile_rows(unsigned int height)
+{
+	return (height + IMX_DMA_BUFFER_DETILE_TILE_HEIGHT - 1) / IMX_DMA_BUFFER_DETILE_TILE_HEIGHT;
+}
+
+
+int imx_dma_buffer_detile(
+	ImxDmaBuffer *tiled_buffer,
+	ImxDmaBufferTiledFrame const *tiled_frame,
+	ImxDmaBuffer *linear_buffer,
+	ImxDmaBufferLinearFrame const *linear_frame,
+	unsigned int num_threads,
+	int *error
+)
+{
+	unsigned int tile_width;
+	unsigned int width, height, chroma_height;
+	unsigned int num_tile_rows[2];
+	size_t tiled_size, linear_size;
+	int is_i420;
+	uint8_t *tiled_virtual_address;
+	uint8_t *linear_virtual_address;
+	ImxDmaBufferDetilePlane planes[2];
+	ImxDmaBufferDetileBand bands[IMX_DMA_BUFFER_DETILE_MAX_NUM_THREADS];
+	unsigned int i, plane_index;
+
+	assert(tiled_buffer != NULL);
+	assert(tiled_frame != NULL);
+	assert(linear_buffer != NULL);
+	assert(linear_frame != NULL);
+
+	switch (tiled_frame->tile_layout)
+	{
+		case IMX_DMA_BUFFER_TILE_LAYOUT_4X4: tile_width = 4; break;
+		case IMX_DMA_BUFFER_TILE_LAYOUT_8X4: tile_width = 8; break;
+		default: goto invalid;
+	}
+
+	switch (linear_frame->format)
+	{
+		case IMX_DMA_BUFFER_LINEAR_FORMAT_NV12: is_i420 = 0; break;
+		case IMX_DMA_BUFFER_LINEAR_FORMAT_I420: is_i420 = 1; break;
+		default: goto invalid;
+	}
+
+	width = tiled_frame->width;
+	height = tiled_frame->height;
+	chroma_height = height / 2;
+
+	if ((tiled_buffer == linear_buffer) || (width == 0) || (height == 0) || ((width & 1) != 0) || ((height & 1) != 0))
+		goto invalid;
+	if (((tiled_frame->stride % tile_width) != 0) || (tiled_frame->stride < width))
+		goto invalid;
+
+	num_tile_rows[0] = imx_dma_buffer_detile_num_tile_rows(height);
+	num_tile_rows[1] = imx_dma_buffer_detile_num_tile_rows(chroma_height);
+
+	/* Tile rows are always complete in the tiled buffer, even if the
+	 * frame height is not a multiple of the tile height. */
+	tiled_size = imx_dma_buffer_get_size(tiled_buffer);
+	if (!imx_dma_buffer_detile_plane_fits(tiled_size, tiled_frame->luma_offset, tiled_frame->stride, tiled_frame->stride, num_tile_rows[0] * IMX_DMA_BUFFER_DETILE_TILE_HEIGHT)
+	 || !imx_dma_buffer_detile_plane_fits(tiled_size, tiled_frame->chroma_offset, tiled_frame->stride, tiled_frame->stride, num_tile_rows[1] * IMX_DMA_BUFFER_DETILE_TILE_HEIGHT))
+		goto invalid;
+
+	linear_size = imx_dma_buffer_get_size(linear_buffer);
+	if (!imx_dma_buffer_detile_plane_fits(linear_size, linear_frame->offsets[0], linear_frame->strides[0], width, height))
+		goto invalid;
+	if (is_i420)
+	{
+		if (!imx_dma_buffer_detile_plane_fits(linear_size, linear_frame->offsets[1], linear_frame->strides[1], width / 2, chroma_height)
+		 || !imx_dma_buffer_detile_plane_fits(linear_size, linear_frame->offsets[2], linear_frame->strides[2], width / 2, chroma_height))
+			goto invalid;
+	}
+	else
+	{
+		if (!imx_dma_buffer_detile_plane_fits(linear_size, linear_frame->offsets[1], linear_frame->strides[1], width, chroma_height))
+			goto invalid;
+	}
+
+	/* The mappings start and stop the sync sessions: Mapping for reading
+	 * makes the decoder output visible to the CPU, and unmapping after
+	 * writing makes the linear frame visible to devices. */
+	tiled_virtual_address = imx_dma_buffer_map(tiled_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ, error);
+	if (tiled_virtual_address == NULL)
+		return 0;
+
+	linear_virtual_address = imx_dma_buffer_map(linear_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, error);
+	if (linear_virtual_address == NULL)
+	{
+		imx_dma_buffer_unmap(tiled_buffer);
+		return 0;
+	}
+
+	for (plane_index = 0; plane_index < 2; ++plane_index)
+	{
+		ImxDmaBufferDetilePlane *plane = &(planes[plane_index]);
+
+		plane->tiled_plane = tiled_virtual_address + ((plane_index == 0) ? tiled_frame->luma_offset : tiled_frame->chroma_offset);
+		plane->tile_width = tile_width;
+		plane->tiled_stride = tiled_frame->stride;
+		plane->width = width;
+		plane->height = (plane_index == 0) ? height : chroma_height;
+		plane->dest = linear_virtual_address + linear_frame->offsets[plane_index];
+		plane->dest_stride = linear_frame->strides[plane_index];
+		plane->dest_v = (is_i420 && (plane_index == 1)) ? (linear_virtual_address + linear_frame->offsets[2]) : NULL;
+		plane->dest_v_stride = linear_frame->strides[2];
+	}
+
+	if ((num_threads == 0) || (num_threads > imx_dma_buffer_worker_pool_get_num_threads()))
+		num_threads = imx_dma_buffer_worker_pool_get_num_threads();
+	if (num_threads > IMX_DMA_BUFFER_DETILE_MAX_NUM_THREADS)
+		num_threads = IMX_DMA_BUFFER_DETILE_MAX_NUM_THREADS;
+	/* There is no point in having bands without a single luma tile row. */
+	if (num_threads > num_tile_rows[0])
+		num_threads = num_tile_rows[0];
+
+	/* Split both planes into num_threads bands of (nearly) equal height. */
+	for (i = 0; i < num_threads; ++i)
+	{
+		bands[i].planes = planes;
+		for (plane_index = 0; plane_index < 2; ++plane_index)
+		{
+			bands[i].first_tile_rows[plane_index] = (unsigned int)(((uint64_t)num_tile_rows[plane_index] * i) / num_threads);
+			bands[i].end_tile_rows[plane_index] = (unsigned int)(((uint64_t)num_tile_rows[plane_index] * (i + 1)) / num_threads);
+		}
+	}
+
+	imx_dma_buffer_worker_pool_run(imx_dma_buffer_detile_band, bands, sizeof(ImxDmaBufferDetileBand), num_threads);
+
+	imx_dma_buffer_unmap(linear_buffer);
+	imx_dma_buffer_unmap(tiled_buffer);
+
+	return 1;
+
+invalid:
+	if (error != NULL)
+		*error = EINVAL;
+	return 0;
+}
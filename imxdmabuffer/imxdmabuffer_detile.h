@@ -0,0 +1,128 @@
+#ifndef IMXDMABUFFER_DETILE_H
+#define IMXDMABUFFER_DETILE_H
+
+#include <stddef.h>
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Tile layouts of tiled frames.
+ *
+ * In all layouts, a plane is divided into rows of tiles. The bytes of each
+ * tile are stored contiguously, row by row, and the tiles of a tile row are
+ * stored one after the other. Both layouts have tiles that are 4 rows high.
+ * The chroma plane is tiled the same way as the luma plane, with the
+ * interleaved U and V bytes treated like luma bytes. */
+typedef enum
+{
+	/* Tiles of 4x4 bytes. This is the tiled output format of the Hantro
+	 * G1 and G2 decoders, known as NV12_4L4 in V4L2. */
+	IMX_DMA_BUFFER_TILE_LAYOUT_4X4 = 0,
+	/* Tiles of 8x4 bytes. */
+	IMX_DMA_BUFFER_TILE_LAYOUT_8X4
+}
+ImxDmaBufferTileLayout;
+
+
+/* Description of a tiled NV12 frame in a DMA buffer. */
+typedef struct
+{
+	ImxDmaBufferTileLayout tile_layout;
+
+	/* Size of the frame in pixels. Both must be nonzero multiples of 2.
+	 * The height does not have to be a multiple of the tile height. */
+	unsigned int width, height;
+
+	/* Number of bytes per row, as if the plane were linear. A tile row
+	 * thus occupies stride * 4 bytes. Must be a multiple of the tile
+	 * width, and at least the frame width. Used for both planes. */
+	size_t stride;
+
+	/* Offsets of the planes from the beginning of the buffer, in bytes. */
+	size_t luma_offset;
+	size_t chroma_offset;
+}
+ImxDmaBufferTiledFrame;
+
+
+/* Formats of linear frames produced by imx_dma_buffer_detile(). */
+typedef enum
+{
+	/* Y plane, followed by a plane with interleaved U and V bytes. */
+	IMX_DMA_BUFFER_LINEAR_FORMAT_NV12 = 0,
+	/* Y plane, followed by separate U and V planes. */
+	IMX_DMA_BUFFER_LINEAR_FORMAT_I420
+}
+ImxDmaBufferLinearFormat;
+
+
+/* Description of a linear frame in a DMA buffer. The frame has the
+ * same size in pixels as the tiled frame it is detiled from. */
+typedef struct
+{
+	ImxDmaBufferLinearFormat format;
+
+	/* Strides and offsets of the planes, in bytes. NV12 uses the first
+	 * two entries, I420 all three. */
+	size_t strides[3];
+	size_t offsets[3];
+}
+ImxDmaBufferLinearFrame;
+
+
+/* Converts a tiled NV12 frame into a linear NV12 or I420 frame.
+ *
+ * This is intended for the tiled output of the Hantro decoders, which is
+ * typically in DWL buffers, and has to be linear for display or encoding.
+ * The conversion is done by the CPU. SSE2 and NEON are used if the library
+ * is built for a CPU that has them; there is also a portable scalar version.
+ * The SIMD versions read 64 bytes of tiles at once, which also makes reading
+ * from uncached memory faster.
+ *
+ * The frame is split into horizontal bands which are converted in parallel
+ * by a small process-wide pool of worker threads. The calling thread
+ * converts bands as well.
+ *
+ * Both buffers are mapped during the conversion, the tiled buffer with
+ * IMX_DMA_BUFFER_MAPPING_FLAG_READ and the linear buffer with
+ * IMX_DMA_BUFFER_MAPPING_FLAG_WRITE. The automatic sync sessions make sure
+ * the tiled frame written by the decoder is visible to the CPU, and the
+ * linear frame is visible to devices once this function returns. The buffers
+ * must therefore not be mapped with the IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC
+ * flag when this is called.
+ *
+ * @param tiled_buffer DMA buffer containing the tiled frame.
+ * @param tiled_frame Layout of the tiled frame.
+ * @param linear_buffer DMA buffer to write the linear frame to. Must not be
+ *        the same buffer as tiled_buffer.
+ * @param linear_frame Layout of the linear frame.
+ * @param num_threads Maximum number of threads to use, including the calling
+ *        thread. 0 uses all threads of the worker pool, which has about
+ *        one thread per online CPU core.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If the frame descriptions are invalid, or if the frames do not fit
+ *        in the buffers, the error code is EINVAL. If the conversion
+ *        succeeds, the integer is not modified.
+ * @return Nonzero if the conversion succeeds, 0 in case of an error.
+ */
+int imx_dma_buffer_detile(
+	ImxDmaBuffer *tiled_buffer,
+	ImxDmaBufferTiledFrame const *tiled_frame,
+	ImxDmaBuffer *linear_buffer,
+	ImxDmaBufferLinearFrame const *linear_frame,
+	unsigned int num_threads,
+	int *error
+);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_DETILE_H */
@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "imxdmabuffer_device_cache_priv.h"
+
+
+typedef struct _ImxDmaBufferDeviceCacheEntry ImxDmaBufferDeviceCacheEntry;
+
+struct _ImxDmaBufferDeviceCacheEntry
+{
+	ImxDmaBufferDeviceCacheEntry *next;
+	char const *device_node_path;
+	int open_flags;
+	int fd;
+	int refcount;
+};
+
+
+/* There are only a few device nodes per process, so a list is enough. */
+static ImxDmaBufferDeviceCacheEntry *device_cache_entries = NULL;
+static pthread_mutex_t device_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+int imx_dma_buffer_device_cache_acquire_fd(char const *device_node_path, int open_flags, int *error)
+{
+	int fd = -1;
+	ImxDmaBufferDeviceCacheEntry *entry;
+
+	assert(device_node_path != NULL);
+
+	pthread_mutex_lock(&device_cache_mutex);
+
+	for (entry = device_cache_entries; entry != NULL; entry = entry->next)
+	{
+		if ((entry->open_flags == open_flags) && (strcmp(entry->device_node_path, device_node_path) == 0))
+			break;
+	}
+
+	if (entry == NULL)
+	{
+		entry = (ImxDmaBufferDeviceCacheEntry *)malloc(sizeof(ImxDmaBufferDeviceCacheEntry));
+		if (entry == NULL)
+		{
+			if (error != NULL)
+				*error = ENOMEM;
+			goto finish;
+		}
+
+		/* The FD is shared, so it must not be inherited by child
+		 * processes that only one of the users might spawn. */
+		entry->fd = open(device_node_path, open_flags | O_CLOEXEC);
+		if (entry->fd < 0)
+		{
+			if (error != NULL)
+				*error = errno;
+			free(entry);
+			goto finish;
+		}
+
+		entry->device_node_path = device_node_path;
+		entry->open_flags = open_flags;
+		entry->refcount = 0;
+		entry->next = device_cache_entries;
+		device_cache_entries = entry;
+	}
+
+	entry->refcount++;
+	fd = entry->fd;
+
+finish:
+	pthread_mutex_unlock(&device_cache_mutex);
+	return fd;
+}
+
+
+void imx_dma_buffer_device_cache_release_fd(int fd)
+{
+	ImxDmaBufferDeviceCacheEntry **entry_ptr;
+
+	assert(fd >= 0);
+
+	pthread_mutex_lock(&device_cache_mutex);
+
+	for (entry_ptr = &device_cache_entries; *entry_ptr != NULL; entry_ptr = &((*entry_ptr)->next))
+	{
+		ImxDmaBufferDeviceCacheEntry *entry = *entry_ptr;
+
+		if (entry->fd != fd)
+			continue;
+
+		assert(entry->refcount > 0);
+		entry->refcount--;
+		if (entry->refcount == 0)
+		{
+			*entry_ptr = entry->next;
+			close(entry->fd);
+			free(entry);
+		}
+
+		break;
+	}
+
+	pthread_mutex_unlock(&device_cache_mutex);
+}
+
+
+int imx_dma_buffer_device_cache_get_fd(int *fd_slot, char const *device_node_path, int open_flags, int *error)
+{
+	int fd, expected_fd = -1;
+
+	assert(fd_slot != NULL);
+
+	/* Fast path: the FD was already acquired. */
+	fd = __atomic_load_n(fd_slot, __ATOMIC_ACQUIRE);
+	if (fd >= 0)
+		return fd;
+
+	fd = imx_dma_buffer_device_cache_acquire_fd(device_node_path, open_flags, error);
+	if (fd < 0)
+		return -1;
+
+	/* Another thread may have stored an FD in the meantime. Since both
+	 * refer to the same shared FD, just drop the extra reference. */
+	if (!__atomic_compare_exchange_n(fd_slot, &expected_fd, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		imx_dma_buffer_device_cache_release_fd(fd);
+		fd = expected_fd;
+	}
+
+	return fd;
+}
@@ -0,0 +1,47 @@
+#ifndef IMXDMABUFFER_DEVICE_CACHE_PRIV_H
+#define IMXDMABUFFER_DEVICE_CACHE_PRIV_H
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Process-wide cache of device node FDs, used by the allocators that talk
+ * to a kernel driver through a device node (dma-heap, ION, IPU, PxP).
+ *
+ * All allocator instances that use the same device node share one FD. The
+ * FDs are reference counted; the FD is closed once the last allocator that
+ * uses it is destroyed. Allocators do not acquire the FD when they are
+ * created, but on first use, with imx_dma_buffer_device_cache_get_fd().
+ * Creating an allocator is thus cheap, and allocators that are never used
+ * do not open anything.
+ *
+ * All of these functions are thread safe.
+ */
+
+
+/* Acquires a reference to the shared FD of the given device node, and
+ * opens the device node if no FD for it is open yet. device_node_path
+ * must stay valid until the FD is released. Returns the FD, or -1 in
+ * case of an error. */
+int imx_dma_buffer_device_cache_acquire_fd(char const *device_node_path, int open_flags, int *error);
+
+/* Releases a reference that was acquired with imx_dma_buffer_device_cache_acquire_fd(). */
+void imx_dma_buffer_device_cache_release_fd(int fd);
+
+/* Returns the FD stored in fd_slot. If fd_slot is negative, a reference
+ * to the shared FD of the device node is acquired and stored in fd_slot
+ * first. Concurrent calls with the same fd_slot acquire only one reference.
+ * The caller has to release it with imx_dma_buffer_device_cache_release_fd()
+ * if fd_slot is not negative anymore when the caller is destroyed.
+ * Returns the FD, or -1 in case of an error. */
+int imx_dma_buffer_device_cache_get_fd(int *fd_slot, char const *device_node_path, int open_flags, int *error);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_DEVICE_CACHE_PRIV_H */
@@ -13,7 +13,11 @@
 #include <imxdmabuffer_config.h>
 #include "imxdmabuffer.h"
 #include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_slab_priv.h"
 #include "imxdmabuffer_dma_heap_allocator.h"
+#include "imxdmabuffer_soft_dirty_priv.h"
+#include "imxdmabuffer_window_priv.h"
+#include "imxdmabuffer_device_cache_priv.h"
 
 
 /* XXX: Currently (2022-04-28), DMA-BUF heaps do not synchrnize properly in
@@ -32,16 +36,24 @@
 
 typedef struct
 {
+	/* The DMA-BUF FD, physical address, size, and mapped
+	 * virtual address are stored in the common buffer header. */
 	ImxDmaBuffer parent;
 
-	int dmabuf_fd;
-	imx_physical_address_t physical_address;
-	size_t size;
-	uint8_t* mapped_virtual_address;
 	unsigned int map_flags;
 
 	int mapping_refcount;
 	int sync_started;
+
+	/* Nonzero if a soft-dirty tracking session was begun
+	 * when the current sync session was started. */
+	int dirty_tracking_active;
+	/* Pagemap entries of the buffer's pages. Allocated when
+	 * dirty page tracking is used for the first time. */
+	uint64_t *pagemap_entries;
+
+	/* Windows mapped with imx_dma_buffer_map_range(). */
+	ImxDmaBufferWindow *windows;
 }
 ImxDmaBufferDmaHeapBuffer;
 
@@ -49,11 +61,18 @@ ImxDmaBufferDmaHeapBuffer;
 typedef struct
 {
 	ImxDmaBufferAllocator parent;
+	/* If dma_heap_fd_is_internal is nonzero, this is the shared FD from
+	 * the device cache. It is -1 until the first allocation. */
 	int dma_heap_fd;
 	int dma_heap_fd_is_internal;
 	unsigned int heap_flags;
 	unsigned int fd_flags;
 	int is_cached;
+
+	int dirty_page_tracking;
+
+	/* The ImxDmaBufferDmaHeapBuffer structures are allocated from this slab. */
+	ImxDmaBufferSlab buffer_slab;
 }
 ImxDmaBufferDmaHeapAllocator;
 
@@ -61,15 +80,21 @@ ImxDmaBufferDmaHeapAllocator;
 static void imx_dma_buffer_dma_heap_allocator_destroy(ImxDmaBufferAllocator *allocator);
 static ImxDmaBuffer* imx_dma_buffer_dma_heap_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error);
 static void imx_dma_buffer_dma_heap_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
-static uint8_t* imx_dma_buffer_dma_heap_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
-static void imx_dma_buffer_dma_heap_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
-static void imx_dma_buffer_dma_heap_allocator_start_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_dma_heap_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_dma_heap_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_dma_heap_allocator_start_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static void imx_dma_buffer_dma_heap_allocator_start_sync_session_impl(ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer);
-static void imx_dma_buffer_dma_heap_allocator_stop_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_dma_heap_allocator_stop_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static void imx_dma_buffer_dma_heap_allocator_stop_sync_session_impl(ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer);
+static int imx_dma_buffer_dma_heap_allocator_has_dirty_pages(ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer);
+static uint8_t* imx_dma_buffer_dma_heap_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error);
+static void imx_dma_buffer_dma_heap_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address);
+static void imx_dma_buffer_dma_heap_allocator_sync_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address, int start);
+static void imx_dma_buffer_dma_heap_allocator_sync_window(ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer, ImxDmaBufferWindow *window, int start);
 static imx_physical_address_t imx_dma_buffer_dma_heap_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static int imx_dma_buffer_dma_heap_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static size_t imx_dma_buffer_dma_heap_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static int imx_dma_buffer_dma_heap_allocator_get_dma_heap_fd_impl(ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator, int *error);
 
 
 static void imx_dma_buffer_dma_heap_allocator_destroy(ImxDmaBufferAllocator *allocator)
@@ -78,12 +103,13 @@ static void imx_dma_buffer_dma_heap_allocator_destroy(ImxDmaBufferAllocator *all
 
 	assert(imx_dma_heap_allocator != NULL);
 
-	if ((imx_dma_heap_allocator->dma_heap_fd > 0) && imx_dma_heap_allocator->dma_heap_fd_is_internal)
+	if ((imx_dma_heap_allocator->dma_heap_fd >= 0) && imx_dma_heap_allocator->dma_heap_fd_is_internal)
 	{
-		close(imx_dma_heap_allocator->dma_heap_fd);
+		imx_dma_buffer_device_cache_release_fd(imx_dma_heap_allocator->dma_heap_fd);
 		imx_dma_heap_allocator->dma_heap_fd = -1;
 	}
 
+	imx_dma_buffer_slab_cleanup(&(imx_dma_heap_allocator->buffer_slab));
 	free(imx_dma_heap_allocator);
 }
 
@@ -91,6 +117,7 @@ static void imx_dma_buffer_dma_heap_allocator_destroy(ImxDmaBufferAllocator *all
 static ImxDmaBuffer* imx_dma_buffer_dma_heap_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error)
 {
 	int dmabuf_fd = -1;
+	int dma_heap_fd;
 	imx_physical_address_t physical_address;
 	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer;
 	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)allocator;
@@ -98,11 +125,14 @@ static ImxDmaBuffer* imx_dma_buffer_dma_heap_allocator_allocate(ImxDmaBufferAllo
 	IMX_DMA_BUFFER_UNUSED_PARAM(alignment);
 
 	assert(imx_dma_heap_allocator != NULL);
-	assert(imx_dma_heap_allocator->dma_heap_fd > 0);
+
+	dma_heap_fd = imx_dma_buffer_dma_heap_allocator_get_dma_heap_fd_impl(imx_dma_heap_allocator, error);
+	if (dma_heap_fd < 0)
+		return NULL;
 
 	/* Perform the actual allocation. */
 	dmabuf_fd = imx_dma_buffer_dma_heap_allocate_dmabuf(
-		imx_dma_heap_allocator->dma_heap_fd,
+		dma_heap_fd,
 		size,
 		imx_dma_heap_allocator->heap_flags,
 		imx_dma_heap_allocator->fd_flags,
@@ -119,15 +149,25 @@ static ImxDmaBuffer* imx_dma_buffer_dma_heap_allocator_allocate(ImxDmaBufferAllo
 		return NULL;
 	}
 
-	/* Allocate system memory for the DMA buffer structure, and initialize its fields. */
-	imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)malloc(sizeof(ImxDmaBufferDmaHeapBuffer));
+	/* Get the DMA buffer structure from the slab, and initialize its fields. */
+	imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)imx_dma_buffer_slab_alloc(&(imx_dma_heap_allocator->buffer_slab));
+	if (imx_dma_heap_buffer == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		close(dmabuf_fd);
+		return NULL;
+	}
 	imx_dma_heap_buffer->parent.allocator = allocator;
-	imx_dma_heap_buffer->dmabuf_fd = dmabuf_fd;
-	imx_dma_heap_buffer->physical_address = physical_address;
-	imx_dma_heap_buffer->size = size;
-	imx_dma_heap_buffer->mapped_virtual_address = NULL;
+	imx_dma_heap_buffer->parent.fd = dmabuf_fd;
+	imx_dma_heap_buffer->parent.physical_address = physical_address;
+	imx_dma_heap_buffer->parent.size = size;
+	imx_dma_heap_buffer->parent.mapped_virtual_address = NULL;
 	imx_dma_heap_buffer->mapping_refcount = 0;
 	imx_dma_heap_buffer->sync_started = 0;
+	imx_dma_heap_buffer->dirty_tracking_active = 0;
+	imx_dma_heap_buffer->pagemap_entries = NULL;
+	imx_dma_heap_buffer->windows = NULL;
 
 	return (ImxDmaBuffer *)imx_dma_heap_buffer;
 }
@@ -136,11 +176,12 @@ static ImxDmaBuffer* imx_dma_buffer_dma_heap_allocator_allocate(ImxDmaBufferAllo
 static void imx_dma_buffer_dma_heap_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
 {
 	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
+	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)allocator;
 
 	assert(imx_dma_heap_buffer != NULL);
-	assert(imx_dma_heap_buffer->dmabuf_fd > 0);
+	assert(imx_dma_heap_buffer->parent.fd > 0);
 
-	if (imx_dma_heap_buffer->mapped_virtual_address != NULL)
+	if (imx_dma_heap_buffer->parent.mapped_virtual_address != NULL)
 	{
 		imx_dma_buffer_dma_heap_allocator_stop_sync_session(allocator, buffer);
 
@@ -150,12 +191,15 @@ static void imx_dma_buffer_dma_heap_allocator_deallocate(ImxDmaBufferAllocator *
 		imx_dma_buffer_dma_heap_allocator_unmap(allocator, buffer);
 	}
 
-	close(imx_dma_heap_buffer->dmabuf_fd);
-	free(imx_dma_heap_buffer);
+	imx_dma_buffer_window_unmap_all(&(imx_dma_heap_buffer->windows));
+
+	close(imx_dma_heap_buffer->parent.fd);
+	free(imx_dma_heap_buffer->pagemap_entries);
+	imx_dma_buffer_slab_free(&(imx_dma_heap_allocator->buffer_slab), imx_dma_heap_buffer);
 }
 
 
-static uint8_t* imx_dma_buffer_dma_heap_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_dma_heap_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
 {
 	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
 	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)allocator;
@@ -163,14 +207,45 @@ static uint8_t* imx_dma_buffer_dma_heap_allocator_map(ImxDmaBufferAllocator *all
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 
 	assert(imx_dma_heap_buffer != NULL);
-	assert(imx_dma_heap_buffer->dmabuf_fd > 0);
+	assert(imx_dma_heap_buffer->parent.fd > 0);
 
 	if ((flags & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK) == 0)
 		flags |= IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE;
 
-	if (imx_dma_heap_buffer->mapped_virtual_address != NULL)
+	if (imx_dma_heap_buffer->parent.mapped_virtual_address != NULL)
 	{
-		assert((imx_dma_heap_buffer->map_flags & flags & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK) == (flags & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK));
+		unsigned int missing_flags = flags & ~(imx_dma_heap_buffer->map_flags) & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK;
+
+		if (missing_flags != 0)
+		{
+			/* Buffer is already mapped, but without some of the requested
+			 * access flags. Upgrade the mapping in place instead of
+			 * remapping, so the virtual address stays the same and the
+			 * already populated pages do not have to be faulted in again. */
+			if (!imx_dma_buffer_protect_mapping(imx_dma_heap_buffer->parent.mapped_virtual_address, imx_dma_heap_buffer->parent.size, imx_dma_heap_buffer->map_flags | missing_flags, error))
+				return NULL;
+
+			imx_dma_heap_buffer->map_flags |= missing_flags;
+
+			/* If a sync session is running, start it again with the new
+			 * flags, so the caches are prepared for the new access type,
+			 * and so stopping the session syncs the new access type. */
+			if (imx_dma_heap_allocator->is_cached && imx_dma_heap_buffer->sync_started)
+				imx_dma_buffer_dma_heap_allocator_start_sync_session_impl(imx_dma_heap_buffer);
+		}
+
+		if (flags & IMX_DMA_BUFFER_MAPPING_FLAG_NO_DIRTY_TRACKING)
+		{
+			imx_dma_heap_buffer->map_flags |= IMX_DMA_BUFFER_MAPPING_FLAG_NO_DIRTY_TRACKING;
+
+			/* Writes through the other mappings are not tracked, so a
+			 * running session has to flush the whole buffer when it stops. */
+			if (imx_dma_heap_buffer->dirty_tracking_active)
+			{
+				imx_dma_buffer_soft_dirty_end_session();
+				imx_dma_heap_buffer->dirty_tracking_active = 0;
+			}
+		}
 
 		/* Buffer is already mapped. Just increment the
 		 * refcount and otherwise do nothing. */
@@ -190,7 +265,7 @@ static uint8_t* imx_dma_buffer_dma_heap_allocator_map(ImxDmaBufferAllocator *all
 
 		imx_dma_heap_buffer->map_flags = flags;
 
-		virtual_address = mmap(0, imx_dma_heap_buffer->size, mmap_prot, mmap_flags, imx_dma_heap_buffer->dmabuf_fd, 0);
+		virtual_address = mmap(0, imx_dma_heap_buffer->parent.size, mmap_prot, mmap_flags, imx_dma_heap_buffer->parent.fd, 0);
 		if (virtual_address == MAP_FAILED)
 		{
 			if (error != NULL)
@@ -199,18 +274,18 @@ static uint8_t* imx_dma_buffer_dma_heap_allocator_map(ImxDmaBufferAllocator *all
 		else
 		{
 			imx_dma_heap_buffer->mapping_refcount = 1;
-			imx_dma_heap_buffer->mapped_virtual_address = virtual_address;
+			imx_dma_heap_buffer->parent.mapped_virtual_address = virtual_address;
 		}
 
 		if (imx_dma_heap_allocator->is_cached && !(flags & IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC))
 			imx_dma_buffer_dma_heap_allocator_start_sync_session_impl(imx_dma_heap_buffer);
 	}
 
-	return imx_dma_heap_buffer->mapped_virtual_address;
+	return imx_dma_heap_buffer->parent.mapped_virtual_address;
 }
 
 
-static void imx_dma_buffer_dma_heap_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_dma_heap_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
 {
 	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
 	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)allocator;
@@ -218,9 +293,9 @@ static void imx_dma_buffer_dma_heap_allocator_unmap(ImxDmaBufferAllocator *alloc
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 
 	assert(imx_dma_heap_buffer != NULL);
-	assert(imx_dma_heap_buffer->dmabuf_fd > 0);
+	assert(imx_dma_heap_buffer->parent.fd > 0);
 
-	if (imx_dma_heap_buffer->mapped_virtual_address == NULL)
+	if (imx_dma_heap_buffer->parent.mapped_virtual_address == NULL)
 		return;
 
 	imx_dma_heap_buffer->mapping_refcount--;
@@ -230,62 +305,124 @@ static void imx_dma_buffer_dma_heap_allocator_unmap(ImxDmaBufferAllocator *alloc
 	if (imx_dma_heap_allocator->is_cached && !(imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC))
 		imx_dma_buffer_dma_heap_allocator_stop_sync_session_impl(imx_dma_heap_buffer);
 
-	munmap((void *)(imx_dma_heap_buffer->mapped_virtual_address), imx_dma_heap_buffer->size);
-	imx_dma_heap_buffer->mapped_virtual_address = NULL;
+	/* In case a manual sync session was not stopped before unmapping. */
+	if (imx_dma_heap_buffer->dirty_tracking_active)
+	{
+		imx_dma_buffer_soft_dirty_end_session();
+		imx_dma_heap_buffer->dirty_tracking_active = 0;
+	}
+
+	munmap((void *)(imx_dma_heap_buffer->parent.mapped_virtual_address), imx_dma_heap_buffer->parent.size);
+	imx_dma_heap_buffer->parent.mapped_virtual_address = NULL;
 }
 
 
-static void imx_dma_buffer_dma_heap_allocator_start_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+/* These two functions perform the cache maintenance for the whole buffer
+ * at the beginning and at the end of CPU access with the given flags. */
+static void imx_dma_buffer_dma_heap_begin_cpu_access(int dmabuf_fd, unsigned int map_flags)
 {
-	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
-
-	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+#ifdef USE_DMA_BUF_SYNC_IOCTL
+	{
+		struct dma_buf_sync dmabuf_sync;
+		memset(&dmabuf_sync, 0, sizeof(dmabuf_sync));
+		dmabuf_sync.flags = DMA_BUF_SYNC_START;
+		dmabuf_sync.flags |= (map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_READ) ? DMA_BUF_SYNC_READ : 0;
+		dmabuf_sync.flags |= (map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE) ? DMA_BUF_SYNC_WRITE : 0;
 
-	if (imx_dma_heap_buffer->sync_started)
-		return;
-	if (!(imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC))
-		return;
+		ioctl(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &dmabuf_sync);
+	}
+#endif
 
-	imx_dma_buffer_dma_heap_allocator_start_sync_session_impl(imx_dma_heap_buffer);
+#ifdef USE_DMA_BUF_PHYS_SYNC_WORKAROUND
+	/* Use the DMA_BUF_IOCTL_PHYS here to force the CPU cache to
+	 * be repopulated with the contents of the actual memory block.
+	 * Otherwise, CPU read operations might use stale cached data. */
+	if (map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_READ)
+	{
+		struct dma_buf_phys dma_phys;
+		ioctl(dmabuf_fd, DMA_BUF_IOCTL_PHYS, &dma_phys);
+	}
+#endif
 }
 
 
-static void imx_dma_buffer_dma_heap_allocator_start_sync_session_impl(ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer)
+static void imx_dma_buffer_dma_heap_end_cpu_access(int dmabuf_fd, unsigned int map_flags)
 {
 #ifdef USE_DMA_BUF_SYNC_IOCTL
 	{
 		struct dma_buf_sync dmabuf_sync;
 		memset(&dmabuf_sync, 0, sizeof(dmabuf_sync));
-		dmabuf_sync.flags = DMA_BUF_SYNC_START;
-		dmabuf_sync.flags |= (imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_READ) ? DMA_BUF_SYNC_READ : 0;
-		dmabuf_sync.flags |= (imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE) ? DMA_BUF_SYNC_WRITE : 0;
+		dmabuf_sync.flags = DMA_BUF_SYNC_END;
+		dmabuf_sync.flags |= (map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_READ) ? DMA_BUF_SYNC_READ : 0;
+		dmabuf_sync.flags |= (map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE) ? DMA_BUF_SYNC_WRITE : 0;
 
-		ioctl(imx_dma_heap_buffer->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &dmabuf_sync);
+		ioctl(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &dmabuf_sync);
 	}
 #endif
 
 #ifdef USE_DMA_BUF_PHYS_SYNC_WORKAROUND
-	/* Use the DMA_BUF_IOCTL_PHYS here to force the CPU cache to
-	 * be repopulated with the contents of the actual memory block.
-	 * Otherwise, CPU read operations might use stale cached data. */
-	if (imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_READ)
+	/* Use the DMA_BUF_IOCTL_PHYS here to force the CPU cache to be
+	 * written to the actual memory block. Otherwise, device DMA
+	 * access to memory may not use the data the CPU just wrote. */
+	if (map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE)
 	{
 		struct dma_buf_phys dma_phys;
-		ioctl(imx_dma_heap_buffer->dmabuf_fd, DMA_BUF_IOCTL_PHYS, &dma_phys);
+		ioctl(dmabuf_fd, DMA_BUF_IOCTL_PHYS, &dma_phys);
 	}
 #endif
+}
+
+
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_dma_heap_allocator_start_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	if (imx_dma_heap_buffer->sync_started)
+		return;
+	if (!(imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC))
+		return;
+
+	imx_dma_buffer_dma_heap_allocator_start_sync_session_impl(imx_dma_heap_buffer);
+}
+
+
+static void imx_dma_buffer_dma_heap_allocator_start_sync_session_impl(ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer)
+{
+	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)(imx_dma_heap_buffer->parent.allocator);
+
+	/* Begin tracking which pages the CPU writes to, so stopping
+	 * the session can skip the flush if none were written to. */
+	if (imx_dma_heap_allocator->dirty_page_tracking
+	 && (imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE)
+	 && !(imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_NO_DIRTY_TRACKING)
+	 && !(imx_dma_heap_buffer->dirty_tracking_active))
+	{
+		if (imx_dma_heap_buffer->pagemap_entries == NULL)
+		{
+			size_t page_size = sysconf(_SC_PAGESIZE);
+			size_t num_pages = (imx_dma_heap_buffer->parent.size + page_size - 1) / page_size;
+			imx_dma_heap_buffer->pagemap_entries = (uint64_t *)malloc(sizeof(uint64_t) * num_pages);
+		}
+
+		if (imx_dma_heap_buffer->pagemap_entries != NULL)
+			imx_dma_heap_buffer->dirty_tracking_active = imx_dma_buffer_soft_dirty_begin_session();
+	}
+
+	imx_dma_buffer_dma_heap_begin_cpu_access(imx_dma_heap_buffer->parent.fd, imx_dma_heap_buffer->map_flags);
 
 	imx_dma_heap_buffer->sync_started = 1;
 }
 
 
-static void imx_dma_buffer_dma_heap_allocator_stop_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_dma_heap_allocator_stop_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
 {
 	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
 
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 
-	assert(imx_dma_heap_buffer->mapped_virtual_address != 0);
+	assert(imx_dma_heap_buffer->parent.mapped_virtual_address != 0);
 
 	if (!imx_dma_heap_buffer->sync_started)
 		return;
@@ -298,30 +435,116 @@ static void imx_dma_buffer_dma_heap_allocator_stop_sync_session(ImxDmaBufferAllo
 
 static void imx_dma_buffer_dma_heap_allocator_stop_sync_session_impl(ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer)
 {
-#ifdef USE_DMA_BUF_SYNC_IOCTL
+	if (imx_dma_heap_buffer->dirty_tracking_active)
 	{
-		struct dma_buf_sync dmabuf_sync;
-		memset(&dmabuf_sync, 0, sizeof(dmabuf_sync));
-		dmabuf_sync.flags = DMA_BUF_SYNC_END;
-		dmabuf_sync.flags |= (imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_READ) ? DMA_BUF_SYNC_READ : 0;
-		dmabuf_sync.flags |= (imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE) ? DMA_BUF_SYNC_WRITE : 0;
+		int has_dirty_pages = imx_dma_buffer_dma_heap_allocator_has_dirty_pages(imx_dma_heap_buffer);
+
+		imx_dma_buffer_soft_dirty_end_session();
+		imx_dma_heap_buffer->dirty_tracking_active = 0;
 
-		ioctl(imx_dma_heap_buffer->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &dmabuf_sync);
+		/* The CPU did not write anything, so there is nothing to flush. */
+		if (!has_dirty_pages)
+		{
+			imx_dma_heap_buffer->sync_started = 0;
+			return;
+		}
 	}
-#endif
 
-#ifdef USE_DMA_BUF_PHYS_SYNC_WORKAROUND
-	/* Use the DMA_BUF_IOCTL_PHYS here to force the CPU cache to be
-	 * written to the actual memory block. Otherwise, device DMA
-	 * access to memory may not use the data the CPU just wrote. */
-	if (imx_dma_heap_buffer->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE)
+	imx_dma_buffer_dma_heap_end_cpu_access(imx_dma_heap_buffer->parent.fd, imx_dma_heap_buffer->map_flags);
+
+	imx_dma_heap_buffer->sync_started = 0;
+}
+
+
+/* Checks if the CPU wrote to any page of the buffer since the sync session
+ * started. Returns 0 only if it is certain that no page was written to. This
+ * can be relied on, since dirty page tracking is only enabled after
+ * imx_dma_buffer_dma_heap_allocator_check_soft_dirty() verified that
+ * writes to dma-heap mappings set the soft-dirty bits. */
+static int imx_dma_buffer_dma_heap_allocator_has_dirty_pages(ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer)
+{
+	size_t i;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t num_pages = (imx_dma_heap_buffer->parent.size + page_size - 1) / page_size;
+	uint64_t *entries = imx_dma_heap_buffer->pagemap_entries;
+
+	if (!imx_dma_buffer_soft_dirty_read_pagemap(imx_dma_heap_buffer->parent.mapped_virtual_address, num_pages, entries))
+		return 1;
+
+	for (i = 0; i < num_pages; ++i)
 	{
-		struct dma_buf_phys dma_phys;
-		ioctl(imx_dma_heap_buffer->dmabuf_fd, DMA_BUF_IOCTL_PHYS, &dma_phys);
+		if (entries[i] & IMX_DMA_BUFFER_PAGEMAP_SOFT_DIRTY_BIT)
+			return 1;
 	}
-#endif
 
-	imx_dma_heap_buffer->sync_started = 0;
+	return 0;
+}
+
+
+static uint8_t* imx_dma_buffer_dma_heap_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error)
+{
+	int needs_sync_start;
+	ImxDmaBufferWindow *window;
+	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
+	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)allocator;
+
+	assert(imx_dma_heap_buffer != NULL);
+	assert(imx_dma_heap_buffer->parent.fd > 0);
+
+	window = imx_dma_buffer_window_map(&(imx_dma_heap_buffer->windows), imx_dma_heap_buffer->parent.fd, 0, imx_dma_heap_buffer->parent.size, offset, length, flags, &needs_sync_start, error);
+	if (window == NULL)
+		return NULL;
+
+	if (needs_sync_start && imx_dma_heap_allocator->is_cached && !(window->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC))
+		imx_dma_buffer_dma_heap_allocator_sync_window(imx_dma_heap_buffer, window, 1);
+
+	return window->virtual_address + (offset - window->offset);
+}
+
+
+static void imx_dma_buffer_dma_heap_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address)
+{
+	ImxDmaBufferWindow *window;
+	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
+	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)allocator;
+
+	assert(imx_dma_heap_buffer != NULL);
+
+	window = imx_dma_buffer_window_find_by_address(imx_dma_heap_buffer->windows, virtual_address);
+	assert(window != NULL);
+
+	if ((window->refcount == 1) && imx_dma_heap_allocator->is_cached && !(window->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC))
+		imx_dma_buffer_dma_heap_allocator_sync_window(imx_dma_heap_buffer, window, 0);
+
+	imx_dma_buffer_window_unmap(&(imx_dma_heap_buffer->windows), window);
+}
+
+
+static void imx_dma_buffer_dma_heap_allocator_sync_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address, int start)
+{
+	ImxDmaBufferWindow *window;
+	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	window = imx_dma_buffer_window_find_by_address(imx_dma_heap_buffer->windows, virtual_address);
+	assert(window != NULL);
+
+	if (!(window->map_flags & IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC))
+		return;
+
+	imx_dma_buffer_dma_heap_allocator_sync_window(imx_dma_heap_buffer, window, start);
+}
+
+
+static void imx_dma_buffer_dma_heap_allocator_sync_window(ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer, ImxDmaBufferWindow *window, int start)
+{
+	/* The DMA-BUF sync ioctls cannot be limited to parts
+	 * of a buffer, so sync the whole buffer instead. */
+	if (start)
+		imx_dma_buffer_dma_heap_begin_cpu_access(imx_dma_heap_buffer->parent.fd, window->map_flags);
+	else
+		imx_dma_buffer_dma_heap_end_cpu_access(imx_dma_heap_buffer->parent.fd, window->map_flags);
 }
 
 
@@ -330,7 +553,7 @@ static imx_physical_address_t imx_dma_buffer_dma_heap_allocator_get_physical_add
 	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_dma_heap_buffer != NULL);
-	return imx_dma_heap_buffer->physical_address;
+	return imx_dma_heap_buffer->parent.physical_address;
 }
 
 
@@ -339,7 +562,7 @@ static int imx_dma_buffer_dma_heap_allocator_get_fd(ImxDmaBufferAllocator *alloc
 	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_dma_heap_buffer != NULL);
-	return imx_dma_heap_buffer->dmabuf_fd;
+	return imx_dma_heap_buffer->parent.fd;
 }
 
 
@@ -348,7 +571,7 @@ static size_t imx_dma_buffer_dma_heap_allocator_get_size(ImxDmaBufferAllocator *
 	ImxDmaBufferDmaHeapBuffer *imx_dma_heap_buffer = (ImxDmaBufferDmaHeapBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_dma_heap_buffer != NULL);
-	return imx_dma_heap_buffer->size;
+	return imx_dma_heap_buffer->parent.size;
 }
 
 
@@ -367,6 +590,7 @@ ImxDmaBufferAllocator* imx_dma_buffer_dma_heap_allocator_new(
 	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator;
 
 	imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)malloc(sizeof(ImxDmaBufferDmaHeapAllocator));
+	imx_dma_buffer_allocator_init(&(imx_dma_heap_allocator->parent));
 	imx_dma_heap_allocator->parent.destroy = imx_dma_buffer_dma_heap_allocator_destroy;
 	imx_dma_heap_allocator->parent.allocate = imx_dma_buffer_dma_heap_allocator_allocate;
 	imx_dma_heap_allocator->parent.deallocate = imx_dma_buffer_dma_heap_allocator_deallocate;
@@ -375,32 +599,33 @@ ImxDmaBufferAllocator* imx_dma_buffer_dma_heap_allocator_new(
 	imx_dma_heap_allocator->parent.get_physical_address = imx_dma_buffer_dma_heap_allocator_get_physical_address;
 	imx_dma_heap_allocator->parent.get_fd = imx_dma_buffer_dma_heap_allocator_get_fd;
 	imx_dma_heap_allocator->parent.get_size = imx_dma_buffer_dma_heap_allocator_get_size;
+	imx_dma_heap_allocator->parent.flags = IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER;
+	imx_dma_buffer_slab_init(&(imx_dma_heap_allocator->buffer_slab), sizeof(ImxDmaBufferDmaHeapBuffer));
+	imx_dma_heap_allocator->parent.map_range = imx_dma_buffer_dma_heap_allocator_map_range;
+	imx_dma_heap_allocator->parent.unmap_range = imx_dma_buffer_dma_heap_allocator_unmap_range;
 	imx_dma_heap_allocator->dma_heap_fd = dma_heap_fd;
 	imx_dma_heap_allocator->dma_heap_fd_is_internal = (dma_heap_fd < 0);
 	imx_dma_heap_allocator->heap_flags = heap_flags;
 	imx_dma_heap_allocator->fd_flags = fd_flags;
+	imx_dma_heap_allocator->dirty_page_tracking = 0;
 
 #ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATES_UNCACHED_MEMORY
 	imx_dma_heap_allocator->parent.start_sync_session = imx_dma_buffer_noop_start_sync_session_func;
 	imx_dma_heap_allocator->parent.stop_sync_session = imx_dma_buffer_noop_stop_sync_session_func;
+	imx_dma_heap_allocator->parent.sync_range = NULL;
+	imx_dma_heap_allocator->parent.flags |= IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY;
 	imx_dma_heap_allocator->is_cached = 0;
 #else
 	imx_dma_heap_allocator->parent.start_sync_session = imx_dma_buffer_dma_heap_allocator_start_sync_session;
 	imx_dma_heap_allocator->parent.stop_sync_session = imx_dma_buffer_dma_heap_allocator_stop_sync_session;
+	imx_dma_heap_allocator->parent.sync_range = imx_dma_buffer_dma_heap_allocator_sync_range;
 	imx_dma_heap_allocator->is_cached = 1;
 #endif
 
+	/* The internal dma-heap FD is acquired on first use. */
+	IMX_DMA_BUFFER_UNUSED_PARAM(error);
 	if (dma_heap_fd < 0)
-	{
-		imx_dma_heap_allocator->dma_heap_fd = open(IMXDMABUFFER_DMA_HEAP_DEVICE_NODE_PATH, O_RDWR);
-		if (imx_dma_heap_allocator->dma_heap_fd < 0)
-		{
-			if (error != NULL)
-				*error = errno;
-			free(imx_dma_heap_allocator);
-			return NULL;
-		}
-	}
+		imx_dma_heap_allocator->dma_heap_fd = -1;
 
 	return (ImxDmaBufferAllocator*)imx_dma_heap_allocator;
 }
@@ -418,6 +643,7 @@ ImxDmaBufferAllocator* imx_dma_buffer_dma_heap_allocator_new_from_fd(
 	assert(dma_heap_fd > 0);
 
 	imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)malloc(sizeof(ImxDmaBufferDmaHeapAllocator));
+	imx_dma_buffer_allocator_init(&(imx_dma_heap_allocator->parent));
 	imx_dma_heap_allocator->parent.destroy = imx_dma_buffer_dma_heap_allocator_destroy;
 	imx_dma_heap_allocator->parent.allocate = imx_dma_buffer_dma_heap_allocator_allocate;
 	imx_dma_heap_allocator->parent.deallocate = imx_dma_buffer_dma_heap_allocator_deallocate;
@@ -426,21 +652,29 @@ ImxDmaBufferAllocator* imx_dma_buffer_dma_heap_allocator_new_from_fd(
 	imx_dma_heap_allocator->parent.get_physical_address = imx_dma_buffer_dma_heap_allocator_get_physical_address;
 	imx_dma_heap_allocator->parent.get_fd = imx_dma_buffer_dma_heap_allocator_get_fd;
 	imx_dma_heap_allocator->parent.get_size = imx_dma_buffer_dma_heap_allocator_get_size;
+	imx_dma_heap_allocator->parent.flags = IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER;
+	imx_dma_buffer_slab_init(&(imx_dma_heap_allocator->buffer_slab), sizeof(ImxDmaBufferDmaHeapBuffer));
+	imx_dma_heap_allocator->parent.map_range = imx_dma_buffer_dma_heap_allocator_map_range;
+	imx_dma_heap_allocator->parent.unmap_range = imx_dma_buffer_dma_heap_allocator_unmap_range;
 	imx_dma_heap_allocator->dma_heap_fd = dma_heap_fd;
 	imx_dma_heap_allocator->dma_heap_fd_is_internal = 0;
 	imx_dma_heap_allocator->heap_flags = heap_flags;
 	imx_dma_heap_allocator->fd_flags = fd_flags;
 	imx_dma_heap_allocator->is_cached = !!is_cached_memory_heap;
+	imx_dma_heap_allocator->dirty_page_tracking = 0;
 
 	if (is_cached_memory_heap)
 	{
 		imx_dma_heap_allocator->parent.start_sync_session = imx_dma_buffer_dma_heap_allocator_start_sync_session;
 		imx_dma_heap_allocator->parent.stop_sync_session = imx_dma_buffer_dma_heap_allocator_stop_sync_session;
+		imx_dma_heap_allocator->parent.sync_range = imx_dma_buffer_dma_heap_allocator_sync_range;
 	}
 	else
 	{
 		imx_dma_heap_allocator->parent.start_sync_session = imx_dma_buffer_noop_start_sync_session_func;
 		imx_dma_heap_allocator->parent.stop_sync_session = imx_dma_buffer_noop_stop_sync_session_func;
+		imx_dma_heap_allocator->parent.sync_range = NULL;
+		imx_dma_heap_allocator->parent.flags |= IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY;
 	}
 
 	return (ImxDmaBufferAllocator*)imx_dma_heap_allocator;
@@ -450,7 +684,100 @@ ImxDmaBufferAllocator* imx_dma_buffer_dma_heap_allocator_new_from_fd(
 int imx_dma_buffer_dma_heap_allocator_get_dma_heap_fd(ImxDmaBufferAllocator *allocator)
 {
 	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)allocator;
-	return imx_dma_heap_allocator->dma_heap_fd;
+	assert(imx_dma_heap_allocator != NULL);
+	return imx_dma_buffer_dma_heap_allocator_get_dma_heap_fd_impl(imx_dma_heap_allocator, NULL);
+}
+
+
+static int imx_dma_buffer_dma_heap_allocator_get_dma_heap_fd_impl(ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator, int *error)
+{
+	if (!imx_dma_heap_allocator->dma_heap_fd_is_internal)
+		return imx_dma_heap_allocator->dma_heap_fd;
+
+	return imx_dma_buffer_device_cache_get_fd(&(imx_dma_heap_allocator->dma_heap_fd), IMXDMABUFFER_DMA_HEAP_DEVICE_NODE_PATH, O_RDWR, error);
+}
+
+
+/* Nonzero once soft-dirty tracking was found to work for mappings of DMA-BUFs
+ * from a dma-heap. This is cached because the check clears the soft-dirty bits
+ * of the whole process, which is not possible while sessions are running. */
+static int dma_buf_soft_dirty_works = 0;
+
+
+/* Checks that soft-dirty tracking works for mappings of DMA-BUFs from the
+ * allocator's dma-heap, by mapping a one-page DMA-BUF and testing it. Testing
+ * anonymous memory is not enough. dma-heap mappings may be set up in a way
+ * that the kernel does not track (VM_PFNMAP), and then CPU writes would not
+ * set any soft-dirty bits, causing flushes to be skipped. */
+static int imx_dma_buffer_dma_heap_allocator_check_soft_dirty(ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator, int *error)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	int dma_heap_fd, dmabuf_fd;
+	uint8_t *page;
+	int works;
+
+	if (__atomic_load_n(&dma_buf_soft_dirty_works, __ATOMIC_ACQUIRE))
+		return 1;
+
+	if (!imx_dma_buffer_soft_dirty_is_available())
+	{
+		if (error != NULL)
+			*error = ENOTSUP;
+		return 0;
+	}
+
+	dma_heap_fd = imx_dma_buffer_dma_heap_allocator_get_dma_heap_fd_impl(imx_dma_heap_allocator, error);
+	if (dma_heap_fd < 0)
+		return 0;
+
+	dmabuf_fd = imx_dma_buffer_dma_heap_allocate_dmabuf(dma_heap_fd, page_size, imx_dma_heap_allocator->heap_flags, imx_dma_heap_allocator->fd_flags, error);
+	if (dmabuf_fd < 0)
+		return 0;
+
+	page = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, dmabuf_fd, 0);
+	if (page == MAP_FAILED)
+	{
+		if (error != NULL)
+			*error = errno;
+		close(dmabuf_fd);
+		return 0;
+	}
+
+	works = imx_dma_buffer_soft_dirty_check_mapping(page);
+
+	munmap(page, page_size);
+	close(dmabuf_fd);
+
+	if (!works)
+	{
+		if (error != NULL)
+			*error = ENOTSUP;
+		return 0;
+	}
+
+	__atomic_store_n(&dma_buf_soft_dirty_works, 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+
+int imx_dma_buffer_dma_heap_allocator_enable_dirty_page_tracking(ImxDmaBufferAllocator *allocator, int *error)
+{
+	ImxDmaBufferDmaHeapAllocator *imx_dma_heap_allocator = (ImxDmaBufferDmaHeapAllocator *)allocator;
+
+	assert(imx_dma_heap_allocator != NULL);
+
+	if (!imx_dma_heap_allocator->is_cached)
+	{
+		if (error != NULL)
+			*error = EINVAL;
+		return 0;
+	}
+
+	if (!imx_dma_buffer_dma_heap_allocator_check_soft_dirty(imx_dma_heap_allocator, error))
+		return 0;
+
+	imx_dma_heap_allocator->dirty_page_tracking = 1;
+	return 1;
 }
 
 
@@ -25,7 +25,10 @@ extern unsigned int const IMX_DMA_BUFFER_DMA_HEAP_ALLOCATOR_DEFAULT_FD_FLAGS;
  * DMA-BUF FDs) is used. The device node path to use is configured at the time
  * when libimxdmabuffer is built. Typically, the default device node path
  * is set to "/dev/dma_heap/linux,cma". Whether that dma-heap allocates
- * cached or uncached memory is also defined at build time.
+ * cached or uncached memory is also defined at build time. The internal FD
+ * is shared by all allocators in the process, and is only opened when the
+ * first buffer is allocated. Errors from opening the device node are thus
+ * reported by imx_dma_buffer_allocate(), not by this function.
  *
  * NOTE: Using this with dma_heap_fd set to a valid FD is deprecated, because
  * this function does not allow for specifying whether this dma-heap allocates
@@ -78,9 +81,46 @@ ImxDmaBufferAllocator* imx_dma_buffer_dma_heap_allocator_new_from_fd(
     int is_cached_memory_heap
 );
 
-/* Returns the file descriptor of the opened dma-heap device node this allocator uses. */
+/* Returns the file descriptor of the opened dma-heap device node this allocator uses.
+ * If the allocator uses the internal FD and it is not open yet, it is opened now.
+ * Returns -1 if that fails. */
 int imx_dma_buffer_dma_heap_allocator_get_dma_heap_fd(ImxDmaBufferAllocator *allocator);
 
+/* Enables dirty page tracking for sync sessions of buffers from this allocator.
+ *
+ * Normally, stopping a sync session of a buffer that was mapped with the write
+ * flag flushes the CPU cache for the whole buffer, even if the CPU wrote to only
+ * a few pages or none at all. With dirty page tracking, the kernel's soft-dirty
+ * page bits (see /proc/self/pagemap) are used for finding out which pages were
+ * written to during the session. If none were written to, the flush is skipped.
+ * Otherwise, the whole buffer is flushed as usual.
+ *
+ * This is opt-in because clearing the soft-dirty bits at the beginning of a
+ * session is a process-wide operation that write-protects all pages of the
+ * process. The first write to each page afterwards causes a minor page fault.
+ * Whether that cost is outweighed by the saved flushes depends on the process.
+ *
+ * This requires a kernel with soft-dirty support (CONFIG_MEM_SOFT_DIRTY). ARM
+ * kernels, and therefore i.MX kernels, do not support it at all, so there, this
+ * function always fails with ENOTSUP. Also, the kernel does not track all kinds
+ * of mappings; dma-heap mappings set up with VM_PFNMAP for example are never
+ * marked as dirty. For this reason, this function maps a small DMA-BUF from
+ * the dma-heap, and checks that writing to it sets its soft-dirty bit. If not,
+ * dirty page tracking is not enabled, since skipped flushes would corrupt data.
+ *
+ * Only sync sessions that are started after this call are affected.
+ *
+ * @param allocator dma-heap allocator to enable dirty page tracking for.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        EINVAL means that the dma-heap does not allocate cached memory (so
+ *        nothing is ever flushed), ENOTSUP means that the kernel does not
+ *        support soft-dirty page tracking for mappings of the dma-heap's
+ *        DMA-BUFs.
+ * @return Nonzero if dirty page tracking was enabled, 0 otherwise.
+ */
+int imx_dma_buffer_dma_heap_allocator_enable_dirty_page_tracking(ImxDmaBufferAllocator *allocator, int *error);
+
 
 /* Allocates a DMA buffer with dma-heap and returns the file descriptor representing the buffer.
  *
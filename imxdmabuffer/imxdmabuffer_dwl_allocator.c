@@ -2,25 +2,28 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "dwl.h"
 
 #include <imxdmabuffer_config.h>
 #include "imxdmabuffer.h"
 #include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_slab_priv.h"
 #include "imxdmabuffer_dwl_allocator.h"
 
 
 typedef struct
 {
+	/* The aligned physical address and the size are stored in the
+	 * common buffer header. Its mapped_virtual_address is set to
+	 * aligned_virtual_address while the buffer is "mapped". */
 	ImxDmaBuffer parent;
 
 	struct DWLLinearMem dwl_linear_mem;
 
 	size_t actual_size;
-	size_t size;
 	uint8_t* aligned_virtual_address;
-	imx_physical_address_t aligned_physical_address;
 
 	/* These are kept around to catch invalid redundant mapping attempts.
 	 * It is good practice to check for those even if the underlying
@@ -35,20 +38,32 @@ ImxDmaBufferDwlBuffer;
 typedef struct
 {
 	ImxDmaBufferAllocator parent;
-	struct DWLInitParam dwl_init_param;
+	/* Set to the shared DWL instance when the first buffer is allocated. */
 	void const *dwl_instance;
+
+	/* The ImxDmaBufferDwlBuffer structures are allocated from this slab. */
+	ImxDmaBufferSlab buffer_slab;
 }
 ImxDmaBufferDwlAllocator;
 
 
+/* The DWL instance is shared by all DWL allocators in the process, since
+ * DWLInit() opens the Hantro device nodes, and only needs to be done once.
+ * It is released once the last allocator that uses it is destroyed. */
+static pthread_mutex_t shared_dwl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void const *shared_dwl_instance = NULL;
+static unsigned int shared_dwl_refcount = 0;
+
+
 static void imx_dma_buffer_dwl_allocator_destroy(ImxDmaBufferAllocator *allocator);
 static ImxDmaBuffer* imx_dma_buffer_dwl_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error);
 static void imx_dma_buffer_dwl_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
-static uint8_t* imx_dma_buffer_dwl_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
-static void imx_dma_buffer_dwl_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_dwl_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_dwl_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static imx_physical_address_t imx_dma_buffer_dwl_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static int imx_dma_buffer_dwl_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static size_t imx_dma_buffer_dwl_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static void const * imx_dma_buffer_dwl_allocator_get_dwl_instance(ImxDmaBufferDwlAllocator *imx_dwl_allocator, int *error);
 
 
 static void imx_dma_buffer_dwl_allocator_destroy(ImxDmaBufferAllocator *allocator)
@@ -56,10 +71,21 @@ static void imx_dma_buffer_dwl_allocator_destroy(ImxDmaBufferAllocator *allocato
 	ImxDmaBufferDwlAllocator *imx_dwl_allocator = (ImxDmaBufferDwlAllocator *)allocator;
 
 	assert(imx_dwl_allocator != NULL);
-	assert(imx_dwl_allocator->dwl_instance != NULL);
 
-	DWLRelease(imx_dwl_allocator->dwl_instance);
+	if (imx_dwl_allocator->dwl_instance != NULL)
+	{
+		pthread_mutex_lock(&shared_dwl_mutex);
+		assert(shared_dwl_refcount > 0);
+		shared_dwl_refcount--;
+		if (shared_dwl_refcount == 0)
+		{
+			DWLRelease(shared_dwl_instance);
+			shared_dwl_instance = NULL;
+		}
+		pthread_mutex_unlock(&shared_dwl_mutex);
+	}
 
+	imx_dma_buffer_slab_cleanup(&(imx_dwl_allocator->buffer_slab));
 	free(imx_dwl_allocator);
 }
 
@@ -67,16 +93,20 @@ static void imx_dma_buffer_dwl_allocator_destroy(ImxDmaBufferAllocator *allocato
 static ImxDmaBuffer* imx_dma_buffer_dwl_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error)
 {
 	size_t actual_size;
+	void const *dwl_instance;
 	ImxDmaBufferDwlBuffer *imx_dwl_buffer;
 	ImxDmaBufferDwlAllocator *imx_dwl_allocator = (ImxDmaBufferDwlAllocator *)allocator;
 
 	assert(imx_dwl_allocator != NULL);
-	assert(imx_dwl_allocator->dwl_instance != NULL);
+
+	dwl_instance = imx_dma_buffer_dwl_allocator_get_dwl_instance(imx_dwl_allocator, error);
+	if (dwl_instance == NULL)
+		return NULL;
 
 	/* The DWL allocator does not have a parameter for alignment, so we resort to a trick.
 	 * We allocate some extra bytes. Then, once allocated, we take the returned physical
 	 * address, and add an offset to it to make sure the address is aligned as requested.
-	 * This modified physical address is stored in aligned_physical_address . The maximum
+	 * This modified physical address is stored in the common buffer header. The maximum
 	 * offset equals the alignment size, which is why we increase the allocation size by
 	 * the alignment amount. Alignment of 0 or 1 however means "no alignment", so we don't
 	 * actually do this trick in that case. */
@@ -86,11 +116,19 @@ static ImxDmaBuffer* imx_dma_buffer_dwl_allocator_allocate(ImxDmaBufferAllocator
 	if (alignment > 1)
 		actual_size += alignment;
 
-	/* Allocate system memory for the DMA buffer structure, and initialize its fields. */
-	imx_dwl_buffer = (ImxDmaBufferDwlBuffer *)malloc(sizeof(ImxDmaBufferDwlBuffer));
+	/* Get the DMA buffer structure from the slab, and initialize its fields. */
+	imx_dwl_buffer = (ImxDmaBufferDwlBuffer *)imx_dma_buffer_slab_alloc(&(imx_dwl_allocator->buffer_slab));
+	if (imx_dwl_buffer == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
 	imx_dwl_buffer->parent.allocator = allocator;
 	imx_dwl_buffer->actual_size = actual_size;
-	imx_dwl_buffer->size = size;
+	imx_dwl_buffer->parent.size = size;
+	imx_dwl_buffer->parent.mapped_virtual_address = NULL;
+	imx_dwl_buffer->parent.fd = -1;
 	imx_dwl_buffer->mapping_refcount = 0;
 
 	/* Initialize the DWL linear memory structure for allocation. DWL_MEM_TYPE_CPU is
@@ -101,7 +139,7 @@ static ImxDmaBuffer* imx_dma_buffer_dwl_allocator_allocate(ImxDmaBufferAllocator
 	imx_dwl_buffer->dwl_linear_mem.mem_type = DWL_MEM_TYPE_CPU;
 
 	/* Perform the actual allocation. */
-	if (DWLMallocLinear(imx_dwl_allocator->dwl_instance, actual_size, &(imx_dwl_buffer->dwl_linear_mem)) < 0)
+	if (DWLMallocLinear(dwl_instance, actual_size, &(imx_dwl_buffer->dwl_linear_mem)) < 0)
 	{
 		if (error != NULL)
 			*error = ENOMEM;
@@ -112,13 +150,13 @@ static ImxDmaBuffer* imx_dma_buffer_dwl_allocator_allocate(ImxDmaBufferAllocator
 	 * strictly necessary (alignment is only required for the physical address), but
 	 * we do it regardless for sake of consistency. */
 	imx_dwl_buffer->aligned_virtual_address = (uint8_t *)IMX_DMA_BUFFER_ALIGN_VAL_TO((uint8_t *)(imx_dwl_buffer->dwl_linear_mem.virtual_address), alignment);
-	imx_dwl_buffer->aligned_physical_address = (imx_physical_address_t)IMX_DMA_BUFFER_ALIGN_VAL_TO((imx_physical_address_t)(imx_dwl_buffer->dwl_linear_mem.bus_address), alignment);
+	imx_dwl_buffer->parent.physical_address = (imx_physical_address_t)IMX_DMA_BUFFER_ALIGN_VAL_TO((imx_physical_address_t)(imx_dwl_buffer->dwl_linear_mem.bus_address), alignment);
 
 finish:
 	return (ImxDmaBuffer *)imx_dwl_buffer;
 
 cleanup:
-	free(imx_dwl_buffer);
+	imx_dma_buffer_slab_free(&(imx_dwl_allocator->buffer_slab), imx_dwl_buffer);
 	imx_dwl_buffer = NULL;
 	goto finish;
 }
@@ -134,10 +172,10 @@ static void imx_dma_buffer_dwl_allocator_deallocate(ImxDmaBufferAllocator *alloc
 
 	DWLFreeLinear(imx_dwl_allocator->dwl_instance, &(imx_dwl_buffer->dwl_linear_mem));
 
-	free(imx_dwl_buffer);
+	imx_dma_buffer_slab_free(&(imx_dwl_allocator->buffer_slab), imx_dwl_buffer);
 }
 
-static uint8_t* imx_dma_buffer_dwl_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_dwl_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
 {
 	ImxDmaBufferDwlBuffer *imx_dwl_buffer = (ImxDmaBufferDwlBuffer *)buffer;
 
@@ -161,6 +199,7 @@ static uint8_t* imx_dma_buffer_dwl_allocator_map(ImxDmaBufferAllocator *allocato
 	{
 		imx_dwl_buffer->map_flags = flags;
 		imx_dwl_buffer->mapping_refcount = 1;
+		imx_dwl_buffer->parent.mapped_virtual_address = imx_dwl_buffer->aligned_virtual_address;
 	}
 
 	/* DWL allocated memory is always mapped, so we just returned the aligned virtual
@@ -169,14 +208,18 @@ static uint8_t* imx_dma_buffer_dwl_allocator_map(ImxDmaBufferAllocator *allocato
 	return imx_dwl_buffer->aligned_virtual_address;
 }
 
-static void imx_dma_buffer_dwl_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_dwl_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
 {
 	ImxDmaBufferDwlBuffer *imx_dwl_buffer = (ImxDmaBufferDwlBuffer *)buffer;
 
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 
 	if (imx_dwl_buffer->mapping_refcount > 0)
+	{
 		imx_dwl_buffer->mapping_refcount--;
+		if (imx_dwl_buffer->mapping_refcount == 0)
+			imx_dwl_buffer->parent.mapped_virtual_address = NULL;
+	}
 
 	/* DWL allocated memory is always mapped, so we don't do anything here. */
 }
@@ -186,7 +229,7 @@ static imx_physical_address_t imx_dma_buffer_dwl_allocator_get_physical_address(
 	ImxDmaBufferDwlBuffer *imx_dwl_buffer = (ImxDmaBufferDwlBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_dwl_buffer != NULL);
-	return imx_dwl_buffer->aligned_physical_address;
+	return imx_dwl_buffer->parent.physical_address;
 }
 
 static int imx_dma_buffer_dwl_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
@@ -201,7 +244,7 @@ static size_t imx_dma_buffer_dwl_allocator_get_size(ImxDmaBufferAllocator *alloc
 	ImxDmaBufferDwlBuffer *imx_dwl_buffer = (ImxDmaBufferDwlBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_dwl_buffer != NULL);
-	return imx_dwl_buffer->size;
+	return imx_dwl_buffer->parent.size;
 }
 
 
@@ -209,6 +252,10 @@ ImxDmaBufferAllocator* imx_dma_buffer_dwl_allocator_new(int *error)
 {
 	ImxDmaBufferDwlAllocator *imx_dwl_allocator = (ImxDmaBufferDwlAllocator *)malloc(sizeof(ImxDmaBufferDwlAllocator));
 
+	/* The shared DWL instance is acquired on first use. */
+	IMX_DMA_BUFFER_UNUSED_PARAM(error);
+
+	imx_dma_buffer_allocator_init(&(imx_dwl_allocator->parent));
 	imx_dwl_allocator->parent.destroy = imx_dma_buffer_dwl_allocator_destroy;
 	imx_dwl_allocator->parent.allocate = imx_dma_buffer_dwl_allocator_allocate;
 	imx_dwl_allocator->parent.deallocate = imx_dma_buffer_dwl_allocator_deallocate;
@@ -219,33 +266,66 @@ ImxDmaBufferAllocator* imx_dma_buffer_dwl_allocator_new(int *error)
 	imx_dwl_allocator->parent.get_physical_address = imx_dma_buffer_dwl_allocator_get_physical_address;
 	imx_dwl_allocator->parent.get_fd = imx_dma_buffer_dwl_allocator_get_fd;
 	imx_dwl_allocator->parent.get_size = imx_dma_buffer_dwl_allocator_get_size;
+	imx_dwl_allocator->parent.flags = IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER | IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY;
+	imx_dma_buffer_slab_init(&(imx_dwl_allocator->buffer_slab), sizeof(ImxDmaBufferDwlBuffer));
+	/* DWL buffers can only be mapped as a whole. */
+	imx_dwl_allocator->parent.map_range = NULL;
+	imx_dwl_allocator->parent.unmap_range = NULL;
+	imx_dwl_allocator->parent.sync_range = NULL;
+	imx_dwl_allocator->dwl_instance = NULL;
+
+	return (ImxDmaBufferAllocator *)imx_dwl_allocator;
+}
 
-	memset(&(imx_dwl_allocator->dwl_init_param), 0, sizeof(imx_dwl_allocator->dwl_init_param));
 
-	/* Example code from the imx-vpu-hantro and imx-vpuwrap packages indicate that
-	 * for a Hantro G2 decoder, the HEVC client type should be used here, and for
-	 * a G1 decoder, we should use the H264 client type. The decoder version is
-	 * currently selected in the libimxdmabuffer build configuration. */
+static void const * imx_dma_buffer_dwl_allocator_get_dwl_instance(ImxDmaBufferDwlAllocator *imx_dwl_allocator, int *error)
+{
+	void const *dwl_instance;
+
+	/* Fast path: this allocator already holds a reference. */
+	dwl_instance = __atomic_load_n(&(imx_dwl_allocator->dwl_instance), __ATOMIC_ACQUIRE);
+	if (dwl_instance != NULL)
+		return dwl_instance;
+
+	pthread_mutex_lock(&shared_dwl_mutex);
+
+	/* Another thread may have acquired the instance for this
+	 * allocator while this thread was waiting for the mutex. */
+	dwl_instance = imx_dwl_allocator->dwl_instance;
+	if (dwl_instance != NULL)
+		goto finish;
+
+	if (shared_dwl_instance == NULL)
+	{
+		struct DWLInitParam dwl_init_param;
+
+		memset(&dwl_init_param, 0, sizeof(dwl_init_param));
+
+		/* Example code from the imx-vpu-hantro and imx-vpuwrap packages indicate that
+		 * for a Hantro G2 decoder, the HEVC client type should be used here, and for
+		 * a G1 decoder, we should use the H264 client type. The decoder version is
+		 * currently selected in the libimxdmabuffer build configuration. */
 #if defined(IMXDMABUFFER_DWL_USE_CLIENT_TYPE_HEVC)
-	imx_dwl_allocator->dwl_init_param.client_type = DWL_CLIENT_TYPE_HEVC_DEC;
+		dwl_init_param.client_type = DWL_CLIENT_TYPE_HEVC_DEC;
 #elif defined(IMXDMABUFFER_DWL_USE_CLIENT_TYPE_H264)
-	imx_dwl_allocator->dwl_init_param.client_type = DWL_CLIENT_TYPE_H264_DEC;
+		dwl_init_param.client_type = DWL_CLIENT_TYPE_H264_DEC;
 #else
 #error Unknown client type
 #endif
-	imx_dwl_allocator->dwl_instance = DWLInit(&(imx_dwl_allocator->dwl_init_param));
-	if (imx_dwl_allocator->dwl_instance == NULL)
-	{
-		if (error != NULL)
-			*error = ENOMEM;
-		goto cleanup;
+		shared_dwl_instance = DWLInit(&dwl_init_param);
+		if (shared_dwl_instance == NULL)
+		{
+			if (error != NULL)
+				*error = ENOMEM;
+			goto finish;
+		}
 	}
 
-finish:
-	return (ImxDmaBufferAllocator *)imx_dwl_allocator;
+	shared_dwl_refcount++;
+	dwl_instance = shared_dwl_instance;
+	__atomic_store_n(&(imx_dwl_allocator->dwl_instance), dwl_instance, __ATOMIC_RELEASE);
 
-cleanup:
-	free(imx_dwl_allocator);
-	imx_dwl_allocator = NULL;
-	goto finish;
+finish:
+	pthread_mutex_unlock(&shared_dwl_mutex);
+	return dwl_instance;
 }
@@ -16,6 +16,10 @@ extern "C" {
  *
  * This allocator supports file descriptors.
  *
+ * The DWL instance is shared by all DWL allocators in the process, and is only
+ * initialized when the first buffer is allocated. Errors from initializing it
+ * are thus reported by imx_dma_buffer_allocate(), not by this function.
+ *
  * @param error If this pointer is non-NULL, and if an error occurs, then the integer
  *        the pointer refers to is set to an error code from errno.h. If creating
  *        the allocator succeeds, the integer is not modified.
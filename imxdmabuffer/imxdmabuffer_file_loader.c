@@ -0,0 +1,388 @@
+/* Needed for O_DIRECT. */
+#define _GNU_SOURCE
+/* Files may be larger than 2 GB even on 32-bit platforms. */
+#define _FILE_OFFSET_BITS 64
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_file_loader.h"
+
+
+typedef struct
+{
+	/* FD for regular reads. */
+	int fd;
+	/* FD opened with O_DIRECT, or -1 if O_DIRECT is not available. */
+	int direct_fd;
+}
+ImxDmaBufferFile;
+
+
+typedef enum
+{
+	CHUNK_STATE_EMPTY,
+	CHUNK_STATE_FILLED,
+	CHUNK_STATE_HANDED_OUT
+}
+ChunkState;
+
+
+struct _ImxDmaBufferFileLoader
+{
+	ImxDmaBufferFile file;
+	uint64_t next_read_offset;
+	size_t chunk_size;
+
+	ImxDmaBuffer *chunk_buffers[2];
+	size_t chunk_lengths[2];
+	ChunkState chunk_states[2];
+
+	/* Index of the chunk buffer the reading thread fills next. */
+	int read_index;
+	/* Index of the chunk buffer that is handed out next. */
+	int consume_index;
+	/* Index of the chunk buffer the caller currently holds, or -1. */
+	int handed_out_index;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t reading_thread;
+	int reading_thread_started;
+	int end_of_file;
+	int read_error;
+	int shutting_down;
+};
+
+
+static int imx_dma_buffer_file_open(ImxDmaBufferFile *file, char const *filename, int *error);
+static void imx_dma_buffer_file_close(ImxDmaBufferFile *file);
+static ssize_t imx_dma_buffer_file_read(ImxDmaBufferFile *file, uint8_t *dest, uint64_t offset, size_t length, int *error);
+static ssize_t imx_dma_buffer_file_read_into_buffer(ImxDmaBufferFile *file, ImxDmaBuffer *buffer, uint64_t offset, size_t length, int *error);
+static void* imx_dma_buffer_file_loader_reading_thread(void *arg);
+
+
+static int imx_dma_buffer_file_open(ImxDmaBufferFile *file, char const *filename, int *error)
+{
+	file->fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (file->fd < 0)
+	{
+		if (error != NULL)
+			*error = errno;
+		return 0;
+	}
+
+	/* Some file systems (tmpfs for example) do not support O_DIRECT. */
+	file->direct_fd = open(filename, O_RDONLY | O_CLOEXEC | O_DIRECT);
+
+	return 1;
+}
+
+
+static void imx_dma_buffer_file_close(ImxDmaBufferFile *file)
+{
+	if (file->direct_fd >= 0)
+		close(file->direct_fd);
+	close(file->fd);
+}
+
+
+static ssize_t imx_dma_buffer_file_read(ImxDmaBufferFile *file, uint8_t *dest, uint64_t offset, size_t length, int *error)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t num_read_bytes = 0;
+
+	/* O_DIRECT requires the destination address, the file offset, and the
+	 * length to be aligned. Page alignment satisfies all file systems. Read
+	 * the aligned part with O_DIRECT, and the rest with regular reads. */
+	if ((file->direct_fd >= 0) && ((((uintptr_t)dest) % page_size) == 0) && ((offset % page_size) == 0))
+	{
+		size_t direct_length = (length / page_size) * page_size;
+
+		while (num_read_bytes < direct_length)
+		{
+			ssize_t ret = pread(file->direct_fd, dest + num_read_bytes, direct_length - num_read_bytes, offset + num_read_bytes);
+
+			if (ret < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				if ((errno == EINVAL) || (errno == EFAULT))
+				{
+					/* The file system rejected the alignment, or the mapping
+					 * cannot be used for direct I/O (this is the case with
+					 * mappings of memory that is not managed by the kernel's
+					 * page allocator). Use regular reads from now on. */
+					close(file->direct_fd);
+					file->direct_fd = -1;
+					break;
+				}
+
+				if (error != NULL)
+					*error = errno;
+				return -1;
+			}
+
+			num_read_bytes += ret;
+
+			/* A short read means that the end of the file was reached, or
+			 * that the remaining part is no longer aligned. In both cases,
+			 * continue with regular reads. */
+			if ((ret == 0) || ((ret % page_size) != 0))
+				break;
+		}
+	}
+
+	while (num_read_bytes < length)
+	{
+		ssize_t ret = pread(file->fd, dest + num_read_bytes, length - num_read_bytes, offset + num_read_bytes);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (error != NULL)
+				*error = errno;
+			return -1;
+		}
+
+		if (ret == 0)
+			break;
+
+		num_read_bytes += ret;
+	}
+
+	return num_read_bytes;
+}
+
+
+static ssize_t imx_dma_buffer_file_read_into_buffer(ImxDmaBufferFile *file, ImxDmaBuffer *buffer, uint64_t offset, size_t length, int *error)
+{
+	uint8_t *virtual_address;
+	ssize_t num_read_bytes;
+
+	/* Map for writing only, without manual sync. The automatic sync session
+	 * then makes sure at unmap time that the data is in memory, regardless
+	 * of whether the CPU (regular reads) or the storage device (O_DIRECT)
+	 * wrote it. */
+	virtual_address = imx_dma_buffer_map(buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, error);
+	if (virtual_address == NULL)
+		return -1;
+
+	num_read_bytes = imx_dma_buffer_file_read(file, virtual_address, offset, length, error);
+
+	imx_dma_buffer_unmap(buffer);
+
+	return num_read_bytes;
+}
+
+
+ssize_t imx_dma_buffer_read_file(ImxDmaBuffer *buffer, char const *filename, uint64_t file_offset, int *error)
+{
+	ImxDmaBufferFile file;
+	ssize_t num_read_bytes;
+
+	assert(buffer != NULL);
+	assert(filename != NULL);
+
+	if (!imx_dma_buffer_file_open(&file, filename, error))
+		return -1;
+
+	num_read_bytes = imx_dma_buffer_file_read_into_buffer(&file, buffer, file_offset, imx_dma_buffer_get_size(buffer), error);
+
+	imx_dma_buffer_file_close(&file);
+
+	return num_read_bytes;
+}
+
+
+ImxDmaBufferFileLoader* imx_dma_buffer_file_loader_new(ImxDmaBufferAllocator *allocator, char const *filename, size_t chunk_size, int *error)
+{
+	int i, ret;
+	ImxDmaBufferFileLoader *loader;
+
+	assert(allocator != NULL);
+	assert(filename != NULL);
+	assert(chunk_size >= 1);
+
+	loader = (ImxDmaBufferFileLoader *)malloc(sizeof(ImxDmaBufferFileLoader));
+	if (loader == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	memset(loader, 0, sizeof(ImxDmaBufferFileLoader));
+	loader->chunk_size = chunk_size;
+	loader->handed_out_index = -1;
+
+	pthread_mutex_init(&(loader->mutex), NULL);
+	pthread_cond_init(&(loader->cond), NULL);
+
+	if (!imx_dma_buffer_file_open(&(loader->file), filename, error))
+	{
+		loader->file.fd = -1;
+		goto error;
+	}
+
+	for (i = 0; i < 2; ++i)
+	{
+		loader->chunk_buffers[i] = imx_dma_buffer_allocate(allocator, chunk_size, 1, error);
+		if (loader->chunk_buffers[i] == NULL)
+			goto error;
+		loader->chunk_states[i] = CHUNK_STATE_EMPTY;
+	}
+
+	if ((ret = pthread_create(&(loader->reading_thread), NULL, imx_dma_buffer_file_loader_reading_thread, loader)) != 0)
+	{
+		if (error != NULL)
+			*error = ret;
+		goto error;
+	}
+	loader->reading_thread_started = 1;
+
+	return loader;
+
+error:
+	imx_dma_buffer_file_loader_free(loader);
+	return NULL;
+}
+
+
+void imx_dma_buffer_file_loader_free(ImxDmaBufferFileLoader *loader)
+{
+	int i;
+
+	assert(loader != NULL);
+
+	if (loader->reading_thread_started)
+	{
+		pthread_mutex_lock(&(loader->mutex));
+		loader->shutting_down = 1;
+		pthread_cond_broadcast(&(loader->cond));
+		pthread_mutex_unlock(&(loader->mutex));
+
+		pthread_join(loader->reading_thread, NULL);
+	}
+
+	for (i = 0; i < 2; ++i)
+	{
+		if (loader->chunk_buffers[i] != NULL)
+			imx_dma_buffer_deallocate(loader->chunk_buffers[i]);
+	}
+
+	if (loader->file.fd >= 0)
+		imx_dma_buffer_file_close(&(loader->file));
+
+	pthread_cond_destroy(&(loader->cond));
+	pthread_mutex_destroy(&(loader->mutex));
+
+	free(loader);
+}
+
+
+int imx_dma_buffer_file_loader_next_chunk(ImxDmaBufferFileLoader *loader, ImxDmaBuffer **chunk, size_t *chunk_length, int *error)
+{
+	int retval;
+	int index;
+
+	assert(loader != NULL);
+	assert(chunk != NULL);
+	assert(chunk_length != NULL);
+
+	pthread_mutex_lock(&(loader->mutex));
+
+	/* Hand the previous chunk buffer back to the reading thread. */
+	if (loader->handed_out_index >= 0)
+	{
+		loader->chunk_states[loader->handed_out_index] = CHUNK_STATE_EMPTY;
+		loader->handed_out_index = -1;
+		pthread_cond_broadcast(&(loader->cond));
+	}
+
+	index = loader->consume_index;
+	while ((loader->chunk_states[index] != CHUNK_STATE_FILLED) && !(loader->end_of_file) && (loader->read_error == 0))
+		pthread_cond_wait(&(loader->cond), &(loader->mutex));
+
+	if (loader->chunk_states[index] == CHUNK_STATE_FILLED)
+	{
+		loader->chunk_states[index] = CHUNK_STATE_HANDED_OUT;
+		loader->handed_out_index = index;
+		loader->consume_index = 1 - index;
+
+		*chunk = loader->chunk_buffers[index];
+		*chunk_length = loader->chunk_lengths[index];
+		retval = 1;
+	}
+	else if (loader->read_error != 0)
+	{
+		if (error != NULL)
+			*error = loader->read_error;
+		retval = -1;
+	}
+	else
+		retval = 0;
+
+	pthread_mutex_unlock(&(loader->mutex));
+
+	return retval;
+}
+
+
+static void* imx_dma_buffer_file_loader_reading_thread(void *arg)
+{
+	ImxDmaBufferFileLoader *loader = (ImxDmaBufferFileLoader *)arg;
+
+	pthread_mutex_lock(&(loader->mutex));
+
+	while (1)
+	{
+		int index = loader->read_index;
+		int err = 0;
+		ssize_t num_read_bytes;
+
+		while (!(loader->shutting_down) && (loader->chunk_states[index] != CHUNK_STATE_EMPTY))
+			pthread_cond_wait(&(loader->cond), &(loader->mutex));
+
+		if (loader->shutting_down)
+			break;
+
+		/* The chunk buffer is not accessed by the caller while it is empty,
+		 * so it can be filled without holding the lock. */
+		pthread_mutex_unlock(&(loader->mutex));
+		num_read_bytes = imx_dma_buffer_file_read_into_buffer(&(loader->file), loader->chunk_buffers[index], loader->next_read_offset, loader->chunk_size, &err);
+		pthread_mutex_lock(&(loader->mutex));
+
+		if (num_read_bytes < 0)
+			loader->read_error = err;
+		else if (num_read_bytes > 0)
+		{
+			loader->chunk_lengths[index] = num_read_bytes;
+			loader->chunk_states[index] = CHUNK_STATE_FILLED;
+			loader->read_index = 1 - index;
+			loader->next_read_offset += num_read_bytes;
+		}
+
+		if ((num_read_bytes < 0) || (((size_t)num_read_bytes) < loader->chunk_size))
+			loader->end_of_file = 1;
+
+		pthread_cond_broadcast(&(loader->cond));
+
+		if (loader->end_of_file)
+			break;
+	}
+
+	pthread_mutex_unlock(&(loader->mutex));
+
+	return NULL;
+}
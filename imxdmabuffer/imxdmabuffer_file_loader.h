@@ -0,0 +1,105 @@
+#ifndef IMXDMABUFFER_FILE_LOADER_H
+#define IMXDMABUFFER_FILE_LOADER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Reads data from a file directly into a DMA buffer.
+ *
+ * The data is read into the buffer's mapping, so no intermediate heap buffer
+ * and no memcpy() is needed. If the mapping and the file offset are page
+ * aligned, the file is opened with O_DIRECT, and the page aligned part of the
+ * data is transferred by the storage device straight into the DMA memory,
+ * bypassing the page cache. If O_DIRECT is not supported by the file system,
+ * or cannot be used with the buffer's mapping, regular reads are used instead.
+ *
+ * The buffer is mapped with IMX_DMA_BUFFER_MAPPING_FLAG_WRITE during the read,
+ * so the automatic sync session makes sure the data is visible to devices
+ * once this function returns. The buffer must not be mapped with the
+ * IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC flag when this is called.
+ *
+ * At most imx_dma_buffer_get_size(buffer) bytes are read. Less data is read
+ * if the end of the file is reached before the buffer is full.
+ *
+ * @param buffer DMA buffer to read the data into. The data is placed at the
+ *        beginning of the buffer.
+ * @param filename Name of the file to read.
+ * @param file_offset Offset in the file to start reading at, in bytes.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If reading succeeds, the integer is not modified.
+ * @return Number of bytes read, or -1 in case of an error.
+ */
+ssize_t imx_dma_buffer_read_file(ImxDmaBuffer *buffer, char const *filename, uint64_t file_offset, int *error);
+
+
+/* ImxDmaBufferFileLoader:
+ *
+ * Streams a file into DMA buffers in fixed size chunks. This is intended for
+ * files that are too large to be read into one DMA buffer, like encoded video
+ * clips that are fed to a decoder chunk by chunk.
+ *
+ * The loader is double buffered: It owns two DMA buffers, and a background
+ * thread reads the next chunk into one of them while the caller processes the
+ * chunk in the other one. The reads are done the same way as in
+ * imx_dma_buffer_read_file(), including the sync.
+ *
+ * A loader is not thread safe; only one thread may call its functions.
+ */
+typedef struct _ImxDmaBufferFileLoader ImxDmaBufferFileLoader;
+
+
+/* Creates a new file loader and starts reading the first chunk.
+ *
+ * @param allocator Allocator to allocate the two chunk buffers with. The
+ *        loader does not take ownership of the allocator. It must be
+ *        destroyed after the loader.
+ * @param filename Name of the file to read.
+ * @param chunk_size Size of the chunk buffers, in bytes. All chunks except
+ *        the last one have this size. Must be at least 1. Using a multiple
+ *        of the page size allows for O_DIRECT reads.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If creating the loader succeeds, the integer is not modified.
+ * @return Pointer to the newly created loader, or NULL in case of an error.
+ */
+ImxDmaBufferFileLoader* imx_dma_buffer_file_loader_new(ImxDmaBufferAllocator *allocator, char const *filename, size_t chunk_size, int *error);
+
+/* Stops the loader's background thread, deallocates its chunk buffers, and frees the loader. */
+void imx_dma_buffer_file_loader_free(ImxDmaBufferFileLoader *loader);
+
+/* Retrieves the next chunk of the file.
+ *
+ * This blocks until the chunk was read. The chunk buffer stays valid until
+ * the next call to this function or until the loader is freed, whichever
+ * comes first. The buffer belongs to the loader; do not deallocate it.
+ * Retrieving a chunk hands the previously retrieved chunk buffer back to
+ * the loader, which then starts reading the chunk after the next one into it.
+ *
+ * @param loader Loader to retrieve the chunk from.
+ * @param chunk Pointer to an ImxDmaBuffer pointer that is set to the chunk buffer.
+ *        Must not be NULL.
+ * @param chunk_length Pointer to an integer that is set to the number of valid
+ *        bytes in the chunk buffer. Must not be NULL.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        Otherwise, the integer is not modified.
+ * @return 1 if a chunk was retrieved, 0 if the end of the file was reached,
+ *         or -1 in case of an error.
+ */
+int imx_dma_buffer_file_loader_next_chunk(ImxDmaBufferFileLoader *loader, ImxDmaBuffer **chunk, size_t *chunk_length, int *error);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_FILE_LOADER_H */
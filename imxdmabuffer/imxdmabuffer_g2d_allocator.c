@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include <g2d.h>
@@ -7,17 +8,19 @@
 #include <imxdmabuffer_config.h>
 #include "imxdmabuffer.h"
 #include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_slab_priv.h"
 #include "imxdmabuffer_g2d_allocator.h"
 
 
 typedef struct
 {
+	/* The aligned physical address and the size are stored in the
+	 * common buffer header. Its mapped_virtual_address is set to
+	 * aligned_virtual_address while the buffer is "mapped". */
 	ImxDmaBuffer parent;
 
 	size_t actual_size;
-	size_t size;
 	uint8_t* aligned_virtual_address;
-	imx_physical_address_t aligned_physical_address;
 
 	/* These are kept around to catch invalid redundant mapping attempts.
 	 * It is good practice to check for those even if the underlying
@@ -34,6 +37,9 @@ ImxDmaBufferG2dBuffer;
 typedef struct
 {
 	ImxDmaBufferAllocator parent;
+
+	/* The ImxDmaBufferG2dBuffer structures are allocated from this slab. */
+	ImxDmaBufferSlab buffer_slab;
 }
 ImxDmaBufferG2dAllocator;
 
@@ -41,8 +47,8 @@ ImxDmaBufferG2dAllocator;
 static void imx_dma_buffer_g2d_allocator_destroy(ImxDmaBufferAllocator *allocator);
 static ImxDmaBuffer* imx_dma_buffer_g2d_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error);
 static void imx_dma_buffer_g2d_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
-static uint8_t* imx_dma_buffer_g2d_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
-static void imx_dma_buffer_g2d_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_g2d_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_g2d_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static imx_physical_address_t imx_dma_buffer_g2d_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static int imx_dma_buffer_g2d_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static size_t imx_dma_buffer_g2d_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
@@ -51,6 +57,7 @@ static size_t imx_dma_buffer_g2d_allocator_get_size(ImxDmaBufferAllocator *alloc
 static void imx_dma_buffer_g2d_allocator_destroy(ImxDmaBufferAllocator *allocator)
 {
 	ImxDmaBufferG2dAllocator *imx_g2d_allocator = (ImxDmaBufferG2dAllocator *)allocator;
+	imx_dma_buffer_slab_cleanup(&(imx_g2d_allocator->buffer_slab));
 	free(imx_g2d_allocator);
 }
 
@@ -66,7 +73,7 @@ static ImxDmaBuffer* imx_dma_buffer_g2d_allocator_allocate(ImxDmaBufferAllocator
 	/* The G2D allocator does not have a parameter for alignment, so we resort to a trick.
 	 * We allocate some extra bytes. Then, once allocated, we take the returned physical
 	 * address, and add an offset to it to make sure the address is aligned as requested.
-	 * This modified physical address is stored in aligned_physical_address . The maximum
+	 * This modified physical address is stored in the common buffer header. The maximum
 	 * offset equals the alignment size, which is why we increase the allocation size by
 	 * the alignment amount. Alignment of 0 or 1 however means "no alignment", so we don't
 	 * actually do this trick in that case. */
@@ -76,11 +83,19 @@ static ImxDmaBuffer* imx_dma_buffer_g2d_allocator_allocate(ImxDmaBufferAllocator
 	if (alignment > 1)
 		actual_size += alignment;
 
-	/* Allocate system memory for the DMA buffer structure, and initialize its fields. */
-	imx_g2d_buffer = (ImxDmaBufferG2dBuffer *)malloc(sizeof(ImxDmaBufferG2dBuffer));
+	/* Get the DMA buffer structure from the slab, and initialize its fields. */
+	imx_g2d_buffer = (ImxDmaBufferG2dBuffer *)imx_dma_buffer_slab_alloc(&(imx_g2d_allocator->buffer_slab));
+	if (imx_g2d_buffer == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
 	imx_g2d_buffer->parent.allocator = allocator;
 	imx_g2d_buffer->actual_size = actual_size;
-	imx_g2d_buffer->size = size;
+	imx_g2d_buffer->parent.size = size;
+	imx_g2d_buffer->parent.mapped_virtual_address = NULL;
+	imx_g2d_buffer->parent.fd = -1;
 	imx_g2d_buffer->mapping_refcount = 0;
 
 	/* Perform the actual allocation. */
@@ -95,13 +110,13 @@ static ImxDmaBuffer* imx_dma_buffer_g2d_allocator_allocate(ImxDmaBufferAllocator
 	 * strictly necessary (alignment is only required for the physical address), but
 	 * we do it regardless for sake of consistency. */
 	imx_g2d_buffer->aligned_virtual_address = (uint8_t *)IMX_DMA_BUFFER_ALIGN_VAL_TO((uint8_t *)(imx_g2d_buffer->buf->buf_vaddr), alignment);
-	imx_g2d_buffer->aligned_physical_address = (imx_physical_address_t)IMX_DMA_BUFFER_ALIGN_VAL_TO((imx_physical_address_t)(imx_g2d_buffer->buf->buf_paddr), alignment);
+	imx_g2d_buffer->parent.physical_address = (imx_physical_address_t)IMX_DMA_BUFFER_ALIGN_VAL_TO((imx_physical_address_t)(imx_g2d_buffer->buf->buf_paddr), alignment);
 
 finish:
 	return (ImxDmaBuffer *)imx_g2d_buffer;
 
 cleanup:
-	free(imx_g2d_buffer);
+	imx_dma_buffer_slab_free(&(imx_g2d_allocator->buffer_slab), imx_g2d_buffer);
 	imx_g2d_buffer = NULL;
 	goto finish;
 }
@@ -118,11 +133,11 @@ static void imx_dma_buffer_g2d_allocator_deallocate(ImxDmaBufferAllocator *alloc
 
 	g2d_free(imx_g2d_buffer->buf);
 
-	free(imx_g2d_buffer);
+	imx_dma_buffer_slab_free(&(imx_g2d_allocator->buffer_slab), imx_g2d_buffer);
 }
 
 
-static uint8_t* imx_dma_buffer_g2d_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_g2d_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
 {
 	ImxDmaBufferG2dBuffer *imx_g2d_buffer = (ImxDmaBufferG2dBuffer *)buffer;
 
@@ -146,6 +161,7 @@ static uint8_t* imx_dma_buffer_g2d_allocator_map(ImxDmaBufferAllocator *allocato
 	{
 		imx_g2d_buffer->map_flags = flags;
 		imx_g2d_buffer->mapping_refcount = 1;
+		imx_g2d_buffer->parent.mapped_virtual_address = imx_g2d_buffer->aligned_virtual_address;
 	}
 
 	/* G2D allocated memory is always mapped, so we just returned the aligned virtual
@@ -155,14 +171,18 @@ static uint8_t* imx_dma_buffer_g2d_allocator_map(ImxDmaBufferAllocator *allocato
 }
 
 
-static void imx_dma_buffer_g2d_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_g2d_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
 {
 	ImxDmaBufferG2dBuffer *imx_g2d_buffer = (ImxDmaBufferG2dBuffer *)buffer;
 
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 
 	if (imx_g2d_buffer->mapping_refcount > 0)
+	{
 		imx_g2d_buffer->mapping_refcount--;
+		if (imx_g2d_buffer->mapping_refcount == 0)
+			imx_g2d_buffer->parent.mapped_virtual_address = NULL;
+	}
 
 	/* G2D allocated memory is always mapped, so we don't do anything here. */
 }
@@ -173,7 +193,7 @@ static imx_physical_address_t imx_dma_buffer_g2d_allocator_get_physical_address(
 	ImxDmaBufferG2dBuffer *imx_g2d_buffer = (ImxDmaBufferG2dBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_g2d_buffer != NULL);
-	return imx_g2d_buffer->aligned_physical_address;
+	return imx_g2d_buffer->parent.physical_address;
 }
 
 
@@ -190,13 +210,14 @@ static size_t imx_dma_buffer_g2d_allocator_get_size(ImxDmaBufferAllocator *alloc
 	ImxDmaBufferG2dBuffer *imx_g2d_buffer = (ImxDmaBufferG2dBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_g2d_buffer != NULL);
-	return imx_g2d_buffer->size;
+	return imx_g2d_buffer->parent.size;
 }
 
 
 ImxDmaBufferAllocator* imx_dma_buffer_g2d_allocator_new(void)
 {
 	ImxDmaBufferG2dAllocator *imx_g2d_allocator = (ImxDmaBufferG2dAllocator *)malloc(sizeof(ImxDmaBufferG2dAllocator));
+	imx_dma_buffer_allocator_init(&(imx_g2d_allocator->parent));
 	imx_g2d_allocator->parent.destroy = imx_dma_buffer_g2d_allocator_destroy;
 	imx_g2d_allocator->parent.allocate = imx_dma_buffer_g2d_allocator_allocate;
 	imx_g2d_allocator->parent.deallocate = imx_dma_buffer_g2d_allocator_deallocate;
@@ -207,6 +228,12 @@ ImxDmaBufferAllocator* imx_dma_buffer_g2d_allocator_new(void)
 	imx_g2d_allocator->parent.get_physical_address = imx_dma_buffer_g2d_allocator_get_physical_address;
 	imx_g2d_allocator->parent.get_fd = imx_dma_buffer_g2d_allocator_get_fd;
 	imx_g2d_allocator->parent.get_size = imx_dma_buffer_g2d_allocator_get_size;
+	imx_g2d_allocator->parent.flags = IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER | IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY;
+	imx_dma_buffer_slab_init(&(imx_g2d_allocator->buffer_slab), sizeof(ImxDmaBufferG2dBuffer));
+	/* G2D buffers can only be mapped as a whole. */
+	imx_g2d_allocator->parent.map_range = NULL;
+	imx_g2d_allocator->parent.unmap_range = NULL;
+	imx_g2d_allocator->parent.sync_range = NULL;
 
 	return (ImxDmaBufferAllocator*)imx_g2d_allocator;
 }
@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -10,22 +11,27 @@
 #include <linux/dma-buf.h>
 #include <linux/version.h>
 
+#include <imxdmabuffer_config.h>
 #include "imxdmabuffer.h"
 #include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_slab_priv.h"
+#include "imxdmabuffer_window_priv.h"
 #include "imxdmabuffer_ion_allocator.h"
+#include "imxdmabuffer_device_cache_priv.h"
 
 
 typedef struct
 {
+	/* The DMA-BUF FD, physical address, size, and mapped
+	 * virtual address are stored in the common buffer header. */
 	ImxDmaBuffer parent;
 
-	int dmabuf_fd;
-	imx_physical_address_t physical_address;
-	size_t size;
-	uint8_t* mapped_virtual_address;
 	unsigned int map_flags;
 
 	int mapping_refcount;
+
+	/* Windows mapped with imx_dma_buffer_map_range(). */
+	ImxDmaBufferWindow *windows;
 }
 ImxDmaBufferIonBuffer;
 
@@ -37,6 +43,9 @@ typedef struct
 	int ion_fd_is_internal;
 	unsigned int ion_heap_id_mask;
 	unsigned int ion_heap_flags;
+
+	/* The ImxDmaBufferIonBuffer structures are allocated from this slab. */
+	ImxDmaBufferSlab buffer_slab;
 }
 ImxDmaBufferIonAllocator;
 
@@ -44,8 +53,10 @@ ImxDmaBufferIonAllocator;
 static void imx_dma_buffer_ion_allocator_destroy(ImxDmaBufferAllocator *allocator);
 static ImxDmaBuffer* imx_dma_buffer_ion_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error);
 static void imx_dma_buffer_ion_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
-static uint8_t* imx_dma_buffer_ion_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
-static void imx_dma_buffer_ion_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_ion_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_ion_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static uint8_t* imx_dma_buffer_ion_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error);
+static void imx_dma_buffer_ion_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address);
 static imx_physical_address_t imx_dma_buffer_ion_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static int imx_dma_buffer_ion_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static size_t imx_dma_buffer_ion_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
@@ -59,10 +70,11 @@ static void imx_dma_buffer_ion_allocator_destroy(ImxDmaBufferAllocator *allocato
 
 	if ((imx_ion_allocator->ion_fd >= 0) && imx_ion_allocator->ion_fd_is_internal)
 	{
-		close(imx_ion_allocator->ion_fd);
+		imx_dma_buffer_device_cache_release_fd(imx_ion_allocator->ion_fd);
 		imx_ion_allocator->ion_fd = -1;
 	}
 
+	imx_dma_buffer_slab_cleanup(&(imx_ion_allocator->buffer_slab));
 	free(imx_ion_allocator);
 }
 
@@ -75,7 +87,10 @@ static ImxDmaBuffer* imx_dma_buffer_ion_allocator_allocate(ImxDmaBufferAllocator
 	ImxDmaBufferIonAllocator *imx_ion_allocator = (ImxDmaBufferIonAllocator *)allocator;
 
 	assert(imx_ion_allocator != NULL);
-	assert(imx_ion_allocator->ion_fd >= 0);
+
+	/* The internal ION FD is acquired on first use. */
+	if (imx_ion_allocator->ion_fd_is_internal && (imx_dma_buffer_device_cache_get_fd(&(imx_ion_allocator->ion_fd), "/dev/ion", O_RDONLY, error) < 0))
+		return NULL;
 
 	/* Perform the actual allocation. */
 	dmabuf_fd = imx_dma_buffer_ion_allocate_dmabuf(imx_ion_allocator->ion_fd, size, alignment, imx_ion_allocator->ion_heap_id_mask, imx_ion_allocator->ion_heap_flags, error);
@@ -90,14 +105,22 @@ static ImxDmaBuffer* imx_dma_buffer_ion_allocator_allocate(ImxDmaBufferAllocator
 		return NULL;
 	}
 
-	/* Allocate system memory for the DMA buffer structure, and initialize its fields. */
-	imx_ion_buffer = (ImxDmaBufferIonBuffer *)malloc(sizeof(ImxDmaBufferIonBuffer));
+	/* Get the DMA buffer structure from the slab, and initialize its fields. */
+	imx_ion_buffer = (ImxDmaBufferIonBuffer *)imx_dma_buffer_slab_alloc(&(imx_ion_allocator->buffer_slab));
+	if (imx_ion_buffer == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		close(dmabuf_fd);
+		return NULL;
+	}
 	imx_ion_buffer->parent.allocator = allocator;
-	imx_ion_buffer->dmabuf_fd = dmabuf_fd;
-	imx_ion_buffer->physical_address = physical_address;
-	imx_ion_buffer->size = size;
-	imx_ion_buffer->mapped_virtual_address = NULL;
+	imx_ion_buffer->parent.fd = dmabuf_fd;
+	imx_ion_buffer->parent.physical_address = physical_address;
+	imx_ion_buffer->parent.size = size;
+	imx_ion_buffer->parent.mapped_virtual_address = NULL;
 	imx_ion_buffer->mapping_refcount = 0;
+	imx_ion_buffer->windows = NULL;
 
 	return (ImxDmaBuffer *)imx_ion_buffer;
 }
@@ -106,11 +129,12 @@ static ImxDmaBuffer* imx_dma_buffer_ion_allocator_allocate(ImxDmaBufferAllocator
 static void imx_dma_buffer_ion_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
 {
 	ImxDmaBufferIonBuffer *imx_ion_buffer = (ImxDmaBufferIonBuffer *)buffer;
+	ImxDmaBufferIonAllocator *imx_ion_allocator = (ImxDmaBufferIonAllocator *)allocator;
 
 	assert(imx_ion_buffer != NULL);
-	assert(imx_ion_buffer->dmabuf_fd >= 0);
+	assert(imx_ion_buffer->parent.fd >= 0);
 
-	if (imx_ion_buffer->mapped_virtual_address != NULL)
+	if (imx_ion_buffer->parent.mapped_virtual_address != NULL)
 	{
 		/* Set mapping_refcount to 1 to force an
 		* imx_dma_buffer_ion_allocator_unmap() to actually unmap the buffer. */
@@ -118,26 +142,40 @@ static void imx_dma_buffer_ion_allocator_deallocate(ImxDmaBufferAllocator *alloc
 		imx_dma_buffer_ion_allocator_unmap(allocator, buffer);
 	}
 
-	close(imx_ion_buffer->dmabuf_fd);
-	free(imx_ion_buffer);
+	imx_dma_buffer_window_unmap_all(&(imx_ion_buffer->windows));
+
+	close(imx_ion_buffer->parent.fd);
+	imx_dma_buffer_slab_free(&(imx_ion_allocator->buffer_slab), imx_ion_buffer);
 }
 
 
-static uint8_t* imx_dma_buffer_ion_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_ion_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
 {
 	ImxDmaBufferIonBuffer *imx_ion_buffer = (ImxDmaBufferIonBuffer *)buffer;
 
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 
 	assert(imx_ion_buffer != NULL);
-	assert(imx_ion_buffer->dmabuf_fd >= 0);
+	assert(imx_ion_buffer->parent.fd >= 0);
 
 	if (flags == 0)
 		flags = IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE;
 
-	if (imx_ion_buffer->mapped_virtual_address != NULL)
+	if (imx_ion_buffer->parent.mapped_virtual_address != NULL)
 	{
-		assert((imx_ion_buffer->map_flags & flags & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK) == (flags & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK));
+		unsigned int missing_flags = flags & ~(imx_ion_buffer->map_flags) & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK;
+
+		if (missing_flags != 0)
+		{
+			/* Buffer is already mapped, but without some of the requested
+			 * access flags. Upgrade the mapping in place instead of
+			 * remapping, so the virtual address stays the same and the
+			 * already populated pages do not have to be faulted in again. */
+			if (!imx_dma_buffer_protect_mapping(imx_ion_buffer->parent.mapped_virtual_address, imx_ion_buffer->parent.size, imx_ion_buffer->map_flags | missing_flags, error))
+				return NULL;
+
+			imx_ion_buffer->map_flags |= missing_flags;
+		}
 
 		/* Buffer is already mapped. Just increment the
 		 * refcount and otherwise do nothing. */
@@ -157,7 +195,7 @@ static uint8_t* imx_dma_buffer_ion_allocator_map(ImxDmaBufferAllocator *allocato
 
 		imx_ion_buffer->map_flags = flags;
 
-		virtual_address = mmap(0, imx_ion_buffer->size, mmap_prot, mmap_flags, imx_ion_buffer->dmabuf_fd, 0);
+		virtual_address = mmap(0, imx_ion_buffer->parent.size, mmap_prot, mmap_flags, imx_ion_buffer->parent.fd, 0);
 		if (virtual_address == MAP_FAILED)
 		{
 			if (error != NULL)
@@ -166,32 +204,68 @@ static uint8_t* imx_dma_buffer_ion_allocator_map(ImxDmaBufferAllocator *allocato
 		else
 		{
 			imx_ion_buffer->mapping_refcount = 1;
-			imx_ion_buffer->mapped_virtual_address = virtual_address;
+			imx_ion_buffer->parent.mapped_virtual_address = virtual_address;
 		}
 	}
 
-	return imx_ion_buffer->mapped_virtual_address;
+	return imx_ion_buffer->parent.mapped_virtual_address;
 }
 
 
-static void imx_dma_buffer_ion_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_ion_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
 {
 	ImxDmaBufferIonBuffer *imx_ion_buffer = (ImxDmaBufferIonBuffer *)buffer;
 
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 
 	assert(imx_ion_buffer != NULL);
-	assert(imx_ion_buffer->dmabuf_fd >= 0);
+	assert(imx_ion_buffer->parent.fd >= 0);
 
-	if (imx_ion_buffer->mapped_virtual_address == NULL)
+	if (imx_ion_buffer->parent.mapped_virtual_address == NULL)
 		return;
 
 	imx_ion_buffer->mapping_refcount--;
 	if (imx_ion_buffer->mapping_refcount != 0)
 		return;
 
-	munmap((void *)(imx_ion_buffer->mapped_virtual_address), imx_ion_buffer->size);
-	imx_ion_buffer->mapped_virtual_address = NULL;
+	munmap((void *)(imx_ion_buffer->parent.mapped_virtual_address), imx_ion_buffer->parent.size);
+	imx_ion_buffer->parent.mapped_virtual_address = NULL;
+}
+
+
+static uint8_t* imx_dma_buffer_ion_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error)
+{
+	int needs_sync_start;
+	ImxDmaBufferWindow *window;
+	ImxDmaBufferIonBuffer *imx_ion_buffer = (ImxDmaBufferIonBuffer *)buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	assert(imx_ion_buffer != NULL);
+	assert(imx_ion_buffer->parent.fd >= 0);
+
+	/* Sync sessions are no-ops with this allocator, so needs_sync_start is ignored. */
+	window = imx_dma_buffer_window_map(&(imx_ion_buffer->windows), imx_ion_buffer->parent.fd, 0, imx_ion_buffer->parent.size, offset, length, flags, &needs_sync_start, error);
+	if (window == NULL)
+		return NULL;
+
+	return window->virtual_address + (offset - window->offset);
+}
+
+
+static void imx_dma_buffer_ion_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address)
+{
+	ImxDmaBufferWindow *window;
+	ImxDmaBufferIonBuffer *imx_ion_buffer = (ImxDmaBufferIonBuffer *)buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	assert(imx_ion_buffer != NULL);
+
+	window = imx_dma_buffer_window_find_by_address(imx_ion_buffer->windows, virtual_address);
+	assert(window != NULL);
+
+	imx_dma_buffer_window_unmap(&(imx_ion_buffer->windows), window);
 }
 
 
@@ -200,7 +274,7 @@ static imx_physical_address_t imx_dma_buffer_ion_allocator_get_physical_address(
 	ImxDmaBufferIonBuffer *imx_ion_buffer = (ImxDmaBufferIonBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_ion_buffer != NULL);
-	return imx_ion_buffer->physical_address;
+	return imx_ion_buffer->parent.physical_address;
 }
 
 
@@ -209,7 +283,7 @@ static int imx_dma_buffer_ion_allocator_get_fd(ImxDmaBufferAllocator *allocator,
 	ImxDmaBufferIonBuffer *imx_ion_buffer = (ImxDmaBufferIonBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_ion_buffer != NULL);
-	return imx_ion_buffer->dmabuf_fd;
+	return imx_ion_buffer->parent.fd;
 }
 
 
@@ -218,13 +292,14 @@ static size_t imx_dma_buffer_ion_allocator_get_size(ImxDmaBufferAllocator *alloc
 	ImxDmaBufferIonBuffer *imx_ion_buffer = (ImxDmaBufferIonBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_ion_buffer != NULL);
-	return imx_ion_buffer->size;
+	return imx_ion_buffer->parent.size;
 }
 
 
 ImxDmaBufferAllocator* imx_dma_buffer_ion_allocator_new(int ion_fd, unsigned int ion_heap_id_mask, unsigned int ion_heap_flags, int *error)
 {
 	ImxDmaBufferIonAllocator *imx_ion_allocator = (ImxDmaBufferIonAllocator *)malloc(sizeof(ImxDmaBufferIonAllocator));
+	imx_dma_buffer_allocator_init(&(imx_ion_allocator->parent));
 	imx_ion_allocator->parent.destroy = imx_dma_buffer_ion_allocator_destroy;
 	imx_ion_allocator->parent.allocate = imx_dma_buffer_ion_allocator_allocate;
 	imx_ion_allocator->parent.deallocate = imx_dma_buffer_ion_allocator_deallocate;
@@ -235,22 +310,20 @@ ImxDmaBufferAllocator* imx_dma_buffer_ion_allocator_new(int ion_fd, unsigned int
 	imx_ion_allocator->parent.get_physical_address = imx_dma_buffer_ion_allocator_get_physical_address;
 	imx_ion_allocator->parent.get_fd = imx_dma_buffer_ion_allocator_get_fd;
 	imx_ion_allocator->parent.get_size = imx_dma_buffer_ion_allocator_get_size;
+	imx_ion_allocator->parent.flags = IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER | IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY;
+	imx_dma_buffer_slab_init(&(imx_ion_allocator->buffer_slab), sizeof(ImxDmaBufferIonBuffer));
+	imx_ion_allocator->parent.map_range = imx_dma_buffer_ion_allocator_map_range;
+	imx_ion_allocator->parent.unmap_range = imx_dma_buffer_ion_allocator_unmap_range;
+	imx_ion_allocator->parent.sync_range = NULL;
 	imx_ion_allocator->ion_fd = ion_fd;
 	imx_ion_allocator->ion_fd_is_internal = (ion_fd < 0);
 	imx_ion_allocator->ion_heap_id_mask = ion_heap_id_mask;
 	imx_ion_allocator->ion_heap_flags = ion_heap_flags;
 
+	/* The internal ION FD is acquired on first use. */
+	IMX_DMA_BUFFER_UNUSED_PARAM(error);
 	if (ion_fd < 0)
-	{
-		imx_ion_allocator->ion_fd = open("/dev/ion", O_RDONLY);
-		if (imx_ion_allocator->ion_fd < 0)
-		{
-			if (error != NULL)
-				*error = errno;
-			free(imx_ion_allocator);
-			return NULL;
-		}
-	}
+		imx_ion_allocator->ion_fd = -1;
 
 	return (ImxDmaBufferAllocator*)imx_ion_allocator;
 }
@@ -259,7 +332,11 @@ ImxDmaBufferAllocator* imx_dma_buffer_ion_allocator_new(int ion_fd, unsigned int
 int imx_dma_buffer_ion_allocator_get_ion_fd(ImxDmaBufferAllocator *allocator)
 {
 	ImxDmaBufferIonAllocator *imx_ion_allocator = (ImxDmaBufferIonAllocator *)allocator;
-	return imx_ion_allocator->ion_fd;
+
+	if (!imx_ion_allocator->ion_fd_is_internal)
+		return imx_ion_allocator->ion_fd;
+
+	return imx_dma_buffer_device_cache_get_fd(&(imx_ion_allocator->ion_fd), "/dev/ion", O_RDONLY, NULL);
 }
 
 
@@ -269,7 +346,12 @@ int imx_dma_buffer_ion_allocator_get_ion_fd(ImxDmaBufferAllocator *allocator)
 
 static unsigned int get_heap_id_mask(int ion_fd, int *error)
 {
+	/* Shared by all ION allocators in the process, like the internal
+	 * /dev/ion FD. Written with an atomic store once it is complete, so
+	 * concurrent first allocations never see a partially built mask. */
 	static unsigned int heap_id_mask = 0;
+	unsigned int detected_heap_id_mask = 0;
+	unsigned int cached_heap_id_mask;
 
 	/* Starting with kernel 4.14.34, we can iterate over the
 	 * ION heaps and find those with type ION_HEAP_TYPE_DMA. */
@@ -279,8 +361,9 @@ static unsigned int get_heap_id_mask(int ion_fd, int *error)
 	struct ion_heap_query query = { 0 };
 	struct ion_heap_data *heap_data = NULL;
 
-	if (heap_id_mask != 0)
-		return heap_id_mask;
+	cached_heap_id_mask = __atomic_load_n(&heap_id_mask, __ATOMIC_ACQUIRE);
+	if (cached_heap_id_mask != 0)
+		return cached_heap_id_mask;
 
 	if ((ioctl(ion_fd, ION_IOC_HEAP_QUERY, &query) < 0) || (query.cnt == 0))
 	{
@@ -306,12 +389,14 @@ static unsigned int get_heap_id_mask(int ion_fd, int *error)
 	{
 		int is_dma_heap = (heap_data[i].type == ION_HEAP_TYPE_DMA);
 		if (is_dma_heap)
-			heap_id_mask |= 1u << heap_data[i].heap_id;
+			detected_heap_id_mask |= 1u << heap_data[i].heap_id;
 	}
 
 	free(heap_data);
 
-	return heap_id_mask;
+	__atomic_store_n(&heap_id_mask, detected_heap_id_mask, __ATOMIC_RELEASE);
+
+	return detected_heap_id_mask;
 }
 
 #endif
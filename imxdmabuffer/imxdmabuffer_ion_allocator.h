@@ -29,8 +29,12 @@ extern "C" {
  * this is not permitted.
  *
  * The solution to this is the ion_fd argument. If set to a negative value, then
- * the allocator will open its own internal file descriptor to /dev/ion (and close
- * it when it gets destroyed). If however ion_fd is set to a valid file descriptor,
+ * the allocator uses an internal file descriptor to /dev/ion. That file descriptor
+ * is shared by all ION allocators in the process that use it, and is closed when
+ * the last of them is destroyed. It is only opened when the first buffer is
+ * allocated, so errors from opening /dev/ion are reported by
+ * imx_dma_buffer_allocate(), not by this function. If however ion_fd is set to a
+ * valid file descriptor,
  * then the allocator uses it instead and does not try to create its own /dev/ion
  * file descriptor (and this external /dev/ion file descriptor is not closed when
  * the allocator is destroyed).
@@ -55,7 +59,9 @@ extern "C" {
  */
 ImxDmaBufferAllocator* imx_dma_buffer_ion_allocator_new(int ion_fd, unsigned int ion_heap_id_mask, unsigned int ion_heap_flags, int *error);
 
-/* Returns the file descriptor of the opened ION device node this allocator uses. */
+/* Returns the file descriptor of the opened ION device node this allocator uses.
+ * If the allocator uses the internal FD and it is not open yet, it is opened now.
+ * Returns -1 if that fails. */
 int imx_dma_buffer_ion_allocator_get_ion_fd(ImxDmaBufferAllocator *allocator);
 
 
@@ -20,6 +20,9 @@ extern "C" {
  * @param ipu_fd /dev/mxc_ipu file descriptor to use, or a negative value if the allocator
  *        shall open and use its own file descriptor. The preprocessor macro
  *        IMX_DMA_BUFFER_IPU_ALLOCATOR_DEFAULT_IPU_FD can be used for the latter case.
+ *        The internal file descriptor is shared by all IPU allocators in
+ *        the process, and is only opened when the first buffer is allocated.
+ *        Errors from opening /dev/mxc_ipu are thus reported by imx_dma_buffer_allocate().
  * @param error If this pointer is non-NULL, and if an error occurs, then the integer
  *        the pointer refers to is set to an error code from errno.h. If creating
  *        the allocator succeeds, the integer is not modified.
@@ -0,0 +1,981 @@
+/* Needed for SCHED_IDLE. */
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_pool_allocator.h"
+
+
+/* First line of allocation profile files. The number is the format version. */
+#define IMX_DMA_BUFFER_POOL_PROFILE_HEADER "imxdmabuffer-pool-profile 1"
+
+
+typedef struct _ImxDmaBufferPoolSizeClass ImxDmaBufferPoolSizeClass;
+
+/* Allocation demand of one combination of size and alignment.
+ * This is what allocation profiles record. */
+struct _ImxDmaBufferPoolSizeClass
+{
+	ImxDmaBufferPoolSizeClass *next;
+	size_t size;
+	size_t alignment;
+	/* Number of buffers of this class that are currently in use. */
+	size_t num_in_use;
+	/* Highest num_in_use so far, including peaks from loaded profiles. */
+	size_t peak_num_in_use;
+};
+
+
+typedef struct _ImxDmaBufferPoolBuffer ImxDmaBufferPoolBuffer;
+
+struct _ImxDmaBufferPoolBuffer
+{
+	/* The physical address, size, and FD of the underlying buffer
+	 * are copied into the common buffer header. */
+	ImxDmaBuffer parent;
+
+	ImxDmaBuffer *underlying_buffer;
+	size_t alignment;
+	/* Set when the buffer is created. NULL if no memory was
+	 * available for a new size class, in which case the
+	 * buffer just does not show up in profiles. */
+	ImxDmaBufferPoolSizeClass *size_class;
+
+	int mapping_refcount;
+
+	/* Link in the allocator's clean or dirty list. Only used while
+	 * the buffer is idle. */
+	ImxDmaBufferPoolBuffer *next;
+};
+
+
+typedef struct
+{
+	ImxDmaBufferAllocator parent;
+
+	ImxDmaBufferAllocator *underlying_allocator;
+	size_t max_num_idle_buffers;
+	unsigned int flags;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/* Idle buffers that can be handed out right away. If zero filling is
+	 * enabled, these have already been zeroed. */
+	ImxDmaBufferPoolBuffer *clean_buffers;
+	/* Idle buffers that still need to be zeroed. Only used if zero
+	 * filling is enabled. */
+	ImxDmaBufferPoolBuffer *dirty_buffers;
+	/* Number of buffers in both lists plus the one that is currently
+	 * being zeroed by the zeroing thread. */
+	size_t num_idle_buffers;
+
+	/* Demand of all sizes allocated so far. Never shrinks until
+	 * the allocator is destroyed. Protected by the mutex. */
+	ImxDmaBufferPoolSizeClass *size_classes;
+
+	pthread_t zeroing_thread;
+	int zeroing_thread_started;
+	int shutting_down;
+}
+ImxDmaBufferPoolAllocator;
+
+
+/* State shared by the threads of one preallocation pass. */
+typedef struct
+{
+	ImxDmaBufferPoolAllocator *imx_pool_allocator;
+	/* One entry per buffer to allocate. */
+	ImxDmaBufferPoolSizeClass **jobs;
+	size_t num_jobs;
+	/* Index of the next job. Incremented atomically by the threads. */
+	size_t next_job;
+	size_t num_created_buffers;
+	/* errno value of the first failed allocation, or 0. */
+	int error;
+}
+ImxDmaBufferPoolPreallocation;
+
+
+static void imx_dma_buffer_pool_allocator_destroy(ImxDmaBufferAllocator *allocator);
+static ImxDmaBuffer* imx_dma_buffer_pool_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error);
+static void imx_dma_buffer_pool_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static uint8_t* imx_dma_buffer_pool_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
+static void imx_dma_buffer_pool_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static void imx_dma_buffer_pool_allocator_start_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static void imx_dma_buffer_pool_allocator_stop_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static uint8_t* imx_dma_buffer_pool_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error);
+static void imx_dma_buffer_pool_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address);
+static void imx_dma_buffer_pool_allocator_sync_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address, int start);
+static imx_physical_address_t imx_dma_buffer_pool_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static int imx_dma_buffer_pool_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static size_t imx_dma_buffer_pool_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+
+static ImxDmaBufferPoolBuffer* imx_dma_buffer_pool_allocator_create_buffer(ImxDmaBufferPoolAllocator *imx_pool_allocator, size_t size, size_t alignment, int *error);
+static void imx_dma_buffer_pool_allocator_free_buffer(ImxDmaBufferPoolAllocator *imx_pool_allocator, ImxDmaBufferPoolBuffer *imx_pool_buffer);
+static void imx_dma_buffer_pool_allocator_add_idle_buffer(ImxDmaBufferPoolAllocator *imx_pool_allocator, ImxDmaBufferPoolBuffer *imx_pool_buffer);
+static void imx_dma_buffer_pool_allocator_mark_in_use(ImxDmaBufferPoolBuffer *imx_pool_buffer);
+static ImxDmaBufferPoolSizeClass* imx_dma_buffer_pool_allocator_get_size_class(ImxDmaBufferPoolAllocator *imx_pool_allocator, size_t size, size_t alignment);
+static size_t imx_dma_buffer_pool_allocator_count_idle_buffers(ImxDmaBufferPoolBuffer *imx_pool_buffer, ImxDmaBufferPoolSizeClass *size_class);
+static void imx_dma_buffer_pool_allocator_free_buffer_list(ImxDmaBufferPoolAllocator *imx_pool_allocator, ImxDmaBufferPoolBuffer *imx_pool_buffer);
+/* The functions below must be called with the mutex locked. */
+
+static void imx_dma_buffer_pool_allocator_add_idle_buffer(ImxDmaBufferPoolAllocator *imx_pool_allocator, ImxDmaBufferPoolBuffer *imx_pool_buffer)
+{
+	if (imx_pool_allocator->flags & IMX_DMA_BUFFER_POOL_ALLOCATOR_FLAG_ZERO_FILL)
+	{
+		imx_pool_buffer->next = imx_pool_allocator->dirty_buffers;
+		imx_pool_allocator->dirty_buffers = imx_pool_buffer;
+		pthread_cond_signal(&(imx_pool_allocator->cond));
+	}
+	else
+	{
+		imx_pool_buffer->next = imx_pool_allocator->clean_buffers;
+		imx_pool_allocator->clean_buffers = imx_pool_buffer;
+	}
+}
+
+
+static void imx_dma_buffer_pool_allocator_mark_in_use(ImxDmaBufferPoolBuffer *imx_pool_buffer)
+{
+	ImxDmaBufferPoolSizeClass *size_class = imx_pool_buffer->size_class;
+
+	if (size_class == NULL)
+		return;
+
+	size_class->num_in_use++;
+	if (size_class->num_in_use > size_class->peak_num_in_use)
+		size_class->peak_num_in_use = size_class->num_in_use;
+}
+
+
+static ImxDmaBufferPoolSizeClass* imx_dma_buffer_pool_allocator_get_size_class(ImxDmaBufferPoolAllocator *imx_pool_allocator, size_t size, size_t alignment)
+{
+	ImxDmaBufferPoolSizeClass *size_class;
+
+	/* Pipelines use only a handful of different sizes,
+	 * so a linear search is sufficient. */
+	for (size_class = imx_pool_allocator->size_classes; size_class != NULL; size_class = size_class->next)
+	{
+		if ((size_class->size == size) && (size_class->alignment == alignment))
+			return size_class;
+	}
+
+	size_class = (ImxDmaBufferPoolSizeClass *)malloc(sizeof(ImxDmaBufferPoolSizeClass));
+	if (size_class == NULL)
+		return NULL;
+
+	size_class->size = size;
+	size_class->alignment = alignment;
+	size_class->num_in_use = 0;
+	size_class->peak_num_in_use = 0;
+	size_class->next = imx_pool_allocator->size_classes;
+	imx_pool_allocator->size_classes = size_class;
+
+	return size_class;
+}
+
+
+static size_t imx_dma_buffer_pool_allocator_count_idle_buffers(ImxDmaBufferPoolBuffer *imx_pool_buffer, ImxDmaBufferPoolSizeClass *size_class)
+{
+	size_t num_buffers = 0;
+
+	for (; imx_pool_buffer != NULL; imx_pool_buffer = imx_pool_buffer->next)
+	{
+		if (imx_pool_buffer->size_class == size_class)
+			num_buffers++;
+	}
+
+	return num_buffers;
+}
+
+
+static ImxDmaBufferPoolBuffer* imx_dma_buffer_pool_allocator_take_from_list(ImxDmaBufferPoolBuffer **list, size_t size, size_t alignment);
+static int imx_dma_buffer_pool_allocator_zero_buffer(ImxDmaBufferPoolBuffer *imx_pool_buffer, int *error);
+static void imx_dma_buffer_pool_allocator_fill_with_zeros(uint8_t *dest, size_t size);
+static void* imx_dma_buffer_pool_allocator_zeroing_thread(void *arg);
+static void* imx_dma_buffer_pool_allocator_preallocation_thread(void *arg);
+
+
+static void imx_dma_buffer_pool_allocator_destroy(ImxDmaBufferAllocator *allocator)
+{
+	ImxDmaBufferPoolAllocator *imx_pool_allocator = (ImxDmaBufferPoolAllocator *)allocator;
+
+	assert(imx_pool_allocator != NULL);
+
+	if (imx_pool_allocator->zeroing_thread_started)
+	{
+		pthread_mutex_lock(&(imx_pool_allocator->mutex));
+		imx_pool_allocator->shutting_down = 1;
+		pthread_cond_broadcast(&(imx_pool_allocator->cond));
+		pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+		pthread_join(imx_pool_allocator->zeroing_thread, NULL);
+	}
+
+	imx_dma_buffer_pool_allocator_free_buffer_list(imx_pool_allocator, imx_pool_allocator->clean_buffers);
+	imx_dma_buffer_pool_allocator_free_buffer_list(imx_pool_allocator, imx_pool_allocator->dirty_buffers);
+
+	while (imx_pool_allocator->size_classes != NULL)
+	{
+		ImxDmaBufferPoolSizeClass *next = imx_pool_allocator->size_classes->next;
+		free(imx_pool_allocator->size_classes);
+		imx_pool_allocator->size_classes = next;
+	}
+
+	pthread_cond_destroy(&(imx_pool_allocator->cond));
+	pthread_mutex_destroy(&(imx_pool_allocator->mutex));
+
+	free(imx_pool_allocator);
+}
+
+
+static ImxDmaBuffer* imx_dma_buffer_pool_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error)
+{
+	int needs_zeroing = 0;
+	ImxDmaBufferPoolBuffer *imx_pool_buffer;
+	ImxDmaBufferPoolAllocator *imx_pool_allocator = (ImxDmaBufferPoolAllocator *)allocator;
+	int zero_fill = (imx_pool_allocator->flags & IMX_DMA_BUFFER_POOL_ALLOCATOR_FLAG_ZERO_FILL);
+
+	assert(imx_pool_allocator != NULL);
+
+	/* Try to reuse an idle buffer first. If zero filling is enabled, then
+	 * a buffer that was not zeroed yet is still preferable over allocating
+	 * a new one, since the latter would have to be zeroed as well. */
+	pthread_mutex_lock(&(imx_pool_allocator->mutex));
+	imx_pool_buffer = imx_dma_buffer_pool_allocator_take_from_list(&(imx_pool_allocator->clean_buffers), size, alignment);
+	if ((imx_pool_buffer == NULL) && zero_fill)
+	{
+		imx_pool_buffer = imx_dma_buffer_pool_allocator_take_from_list(&(imx_pool_allocator->dirty_buffers), size, alignment);
+		needs_zeroing = (imx_pool_buffer != NULL);
+	}
+	if (imx_pool_buffer != NULL)
+	{
+		imx_pool_allocator->num_idle_buffers--;
+		imx_dma_buffer_pool_allocator_mark_in_use(imx_pool_buffer);
+	}
+	pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+	if (imx_pool_buffer == NULL)
+	{
+		imx_pool_buffer = imx_dma_buffer_pool_allocator_create_buffer(imx_pool_allocator, size, alignment, error);
+		if (imx_pool_buffer == NULL)
+			return NULL;
+
+		pthread_mutex_lock(&(imx_pool_allocator->mutex));
+		imx_dma_buffer_pool_allocator_mark_in_use(imx_pool_buffer);
+		pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+		needs_zeroing = zero_fill;
+	}
+
+	imx_pool_buffer->parent.mapped_virtual_address = NULL;
+	imx_pool_buffer->mapping_refcount = 0;
+	imx_pool_buffer->next = NULL;
+
+	if (needs_zeroing && !imx_dma_buffer_pool_allocator_zero_buffer(imx_pool_buffer, error))
+	{
+		pthread_mutex_lock(&(imx_pool_allocator->mutex));
+		if (imx_pool_buffer->size_class != NULL)
+			imx_pool_buffer->size_class->num_in_use--;
+		pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+		imx_dma_buffer_pool_allocator_free_buffer(imx_pool_allocator, imx_pool_buffer);
+		return NULL;
+	}
+
+	return (ImxDmaBuffer *)imx_pool_buffer;
+}
+
+
+static void imx_dma_buffer_pool_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	int keep_buffer = 0;
+	ImxDmaBufferPoolBuffer *imx_pool_buffer = (ImxDmaBufferPoolBuffer *)buffer;
+	ImxDmaBufferPoolAllocator *imx_pool_allocator = (ImxDmaBufferPoolAllocator *)allocator;
+
+	assert(imx_pool_allocator != NULL);
+	assert(imx_pool_buffer != NULL);
+
+	/* Idle buffers must not stay mapped, otherwise the next
+	 * user's mapping flags would not be applied. */
+	while (imx_pool_buffer->mapping_refcount > 0)
+		imx_dma_buffer_pool_allocator_unmap(allocator, buffer);
+
+	pthread_mutex_lock(&(imx_pool_allocator->mutex));
+	if (imx_pool_buffer->size_class != NULL)
+		imx_pool_buffer->size_class->num_in_use--;
+	if (imx_pool_allocator->num_idle_buffers < imx_pool_allocator->max_num_idle_buffers)
+	{
+		imx_dma_buffer_pool_allocator_add_idle_buffer(imx_pool_allocator, imx_pool_buffer);
+		imx_pool_allocator->num_idle_buffers++;
+		keep_buffer = 1;
+	}
+	pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+	if (!keep_buffer)
+		imx_dma_buffer_pool_allocator_free_buffer(imx_pool_allocator, imx_pool_buffer);
+}
+
+
+static uint8_t* imx_dma_buffer_pool_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
+{
+	uint8_t *virtual_address;
+	ImxDmaBufferPoolBuffer *imx_pool_buffer = (ImxDmaBufferPoolBuffer *)buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	assert(imx_pool_buffer != NULL);
+
+	virtual_address = imx_dma_buffer_map(imx_pool_buffer->underlying_buffer, flags, error);
+	if (virtual_address != NULL)
+	{
+		imx_pool_buffer->parent.mapped_virtual_address = virtual_address;
+		imx_pool_buffer->mapping_refcount++;
+	}
+
+	return virtual_address;
+}
+
+
+static void imx_dma_buffer_pool_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	ImxDmaBufferPoolBuffer *imx_pool_buffer = (ImxDmaBufferPoolBuffer *)buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	assert(imx_pool_buffer != NULL);
+
+	if (imx_pool_buffer->mapping_refcount == 0)
+		return;
+
+	imx_dma_buffer_unmap(imx_pool_buffer->underlying_buffer);
+
+	imx_pool_buffer->mapping_refcount--;
+	if (imx_pool_buffer->mapping_refcount == 0)
+		imx_pool_buffer->parent.mapped_virtual_address = NULL;
+}
+
+
+static void imx_dma_buffer_pool_allocator_start_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	imx_dma_buffer_start_sync_session(((ImxDmaBufferPoolBuffer *)buffer)->underlying_buffer);
+}
+
+
+static void imx_dma_buffer_pool_allocator_stop_sync_session(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	imx_dma_buffer_stop_sync_session(((ImxDmaBufferPoolBuffer *)buffer)->underlying_buffer);
+}
+
+
+/* Windows are tracked by the underlying buffer. They do not
+ * affect the mapping_refcount of the pool buffer. */
+
+static uint8_t* imx_dma_buffer_pool_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return imx_dma_buffer_map_range(((ImxDmaBufferPoolBuffer *)buffer)->underlying_buffer, offset, length, flags, error);
+}
+
+
+static void imx_dma_buffer_pool_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	imx_dma_buffer_unmap_range(((ImxDmaBufferPoolBuffer *)buffer)->underlying_buffer, virtual_address);
+}
+
+
+static void imx_dma_buffer_pool_allocator_sync_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address, int start)
+{
+	ImxDmaBuffer *underlying_buffer = ((ImxDmaBufferPoolBuffer *)buffer)->underlying_buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	if (start)
+		imx_dma_buffer_start_range_sync_session(underlying_buffer, virtual_address);
+	else
+		imx_dma_buffer_stop_range_sync_session(underlying_buffer, virtual_address);
+}
+
+
+static imx_physical_address_t imx_dma_buffer_pool_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return buffer->physical_address;
+}
+
+
+static int imx_dma_buffer_pool_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return buffer->fd;
+}
+
+
+static size_t imx_dma_buffer_pool_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return buffer->size;
+}
+
+
+static ImxDmaBufferPoolBuffer* imx_dma_buffer_pool_allocator_create_buffer(ImxDmaBufferPoolAllocator *imx_pool_allocator, size_t size, size_t alignment, int *error)
+{
+	ImxDmaBuffer *underlying_buffer;
+	ImxDmaBufferPoolBuffer *imx_pool_buffer;
+
+	/* Not using imx_dma_buffer_allocate() here, since the underlying
+	 * buffer is never exposed to the outside, so it must not be
+	 * registered as a live buffer of the underlying allocator. */
+	underlying_buffer = imx_dma_buffer_allocate_untracked(imx_pool_allocator->underlying_allocator, size, alignment, error);
+	if (underlying_buffer == NULL)
+		return NULL;
+
+	imx_pool_buffer = (ImxDmaBufferPoolBuffer *)malloc(sizeof(ImxDmaBufferPoolBuffer));
+	if (imx_pool_buffer == NULL)
+	{
+		imx_pool_allocator->underlying_allocator->deallocate(imx_pool_allocator->underlying_allocator, underlying_buffer);
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	imx_pool_buffer->parent.allocator = (ImxDmaBufferAllocator *)imx_pool_allocator;
+	imx_pool_buffer->parent.physical_address = imx_dma_buffer_get_physical_address(underlying_buffer);
+	imx_pool_buffer->parent.mapped_virtual_address = NULL;
+	imx_pool_buffer->parent.size = size;
+	imx_pool_buffer->parent.fd = imx_dma_buffer_get_fd(underlying_buffer);
+	imx_pool_buffer->underlying_buffer = underlying_buffer;
+	imx_pool_buffer->alignment = alignment;
+	imx_pool_buffer->mapping_refcount = 0;
+	imx_pool_buffer->next = NULL;
+
+	pthread_mutex_lock(&(imx_pool_allocator->mutex));
+	imx_pool_buffer->size_class = imx_dma_buffer_pool_allocator_get_size_class(imx_pool_allocator, size, alignment);
+	pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+	return imx_pool_buffer;
+}
+
+
+static void imx_dma_buffer_pool_allocator_free_buffer(ImxDmaBufferPoolAllocator *imx_pool_allocator, ImxDmaBufferPoolBuffer *imx_pool_buffer)
+{
+	ImxDmaBufferAllocator *underlying_allocator = imx_pool_allocator->underlying_allocator;
+	underlying_allocator->deallocate(underlying_allocator, imx_pool_buffer->underlying_buffer);
+	free(imx_pool_buffer);
+}
+
+
+static void imx_dma_buffer_pool_allocator_free_buffer_list(ImxDmaBufferPoolAllocator *imx_pool_allocator, ImxDmaBufferPoolBuffer *imx_pool_buffer)
+{
+	while (imx_pool_buffer != NULL)
+	{
+		ImxDmaBufferPoolBuffer *next = imx_pool_buffer->next;
+		imx_dma_buffer_pool_allocator_free_buffer(imx_pool_allocator, imx_pool_buffer);
+		imx_pool_buffer = next;
+	}
+}
+
+
+static ImxDmaBufferPoolBuffer* imx_dma_buffer_pool_allocator_take_from_list(ImxDmaBufferPoolBuffer **list, size_t size, size_t alignment)
+{
+	ImxDmaBufferPoolBuffer **link;
+
+	/* The lists are short (at most max_num_idle_buffers entries),
+	 * so a linear search is sufficient. */
+	for (link = list; (*link) != NULL; link = &((*link)->next))
+	{
+		ImxDmaBufferPoolBuffer *imx_pool_buffer = *link;
+
+		if ((imx_pool_buffer->parent.size == size) && (imx_pool_buffer->alignment == alignment))
+		{
+			*link = imx_pool_buffer->next;
+			imx_pool_buffer->next = NULL;
+			return imx_pool_buffer;
+		}
+	}
+
+	return NULL;
+}
+
+
+static int imx_dma_buffer_pool_allocator_zero_buffer(ImxDmaBufferPoolBuffer *imx_pool_buffer, int *error)
+{
+	uint8_t *virtual_address;
+	ImxDmaBuffer *underlying_buffer = imx_pool_buffer->underlying_buffer;
+
+	/* Write the zeros inside a sync session. With allocators that allocate
+	 * cached memory, ending the session writes the zeros back to memory, so
+	 * hardware that accesses the buffer later sees them. With other allocators,
+	 * the sync session functions do nothing. */
+	virtual_address = imx_dma_buffer_map(underlying_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE | IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC, error);
+	if (virtual_address == NULL)
+		return 0;
+
+	imx_dma_buffer_start_sync_session(underlying_buffer);
+	imx_dma_buffer_pool_allocator_fill_with_zeros(virtual_address, imx_pool_buffer->parent.size);
+	imx_dma_buffer_stop_sync_session(underlying_buffer);
+
+	imx_dma_buffer_unmap(underlying_buffer);
+
+	return 1;
+}
+
+
+static void imx_dma_buffer_pool_allocator_fill_with_zeros(uint8_t *dest, size_t size)
+{
+#if defined(__SSE2__)
+	/* Use non-temporal stores. The zeroed memory is typically not read by the
+	 * CPU afterwards, so there is no point in evicting other data from the
+	 * cache. Stream stores require 16-byte aligned addresses. */
+	__m128i zero = _mm_setzero_si128();
+	size_t head = (16 - ((uintptr_t)dest & 15)) & 15;
+
+	if (head > size)
+		head = size;
+	memset(dest, 0, head);
+	dest += head;
+	size -= head;
+
+	for (; size >= 64; dest += 64, size -= 64)
+	{
+		_mm_stream_si128((__m128i *)(dest +  0), zero);
+		_mm_stream_si128((__m128i *)(dest + 16), zero);
+		_mm_stream_si128((__m128i *)(dest + 32), zero);
+		_mm_stream_si128((__m128i *)(dest + 48), zero);
+	}
+
+	_mm_sfence();
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint8x16_t zero = vdupq_n_u8(0);
+
+	for (; size >= 64; dest += 64, size -= 64)
+	{
+		vst1q_u8(dest +  0, zero);
+		vst1q_u8(dest + 16, zero);
+		vst1q_u8(dest + 32, zero);
+		vst1q_u8(dest + 48, zero);
+	}
+#endif
+
+	/* Zero the remaining bytes (or everything if no SIMD is available). */
+	memset(dest, 0, size);
+}
+
+
+static void* imx_dma_buffer_pool_allocator_zeroing_thread(void *arg)
+{
+	ImxDmaBufferPoolAllocator *imx_pool_allocator = (ImxDmaBufferPoolAllocator *)arg;
+
+#ifdef SCHED_IDLE
+	{
+		/* Only zero buffers when nothing else wants to run. If
+		 * this fails, just continue with the default priority. */
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+	}
+#endif
+
+	pthread_mutex_lock(&(imx_pool_allocator->mutex));
+
+	while (1)
+	{
+		int zeroing_ok;
+		ImxDmaBufferPoolBuffer *imx_pool_buffer;
+
+		while (!(imx_pool_allocator->shutting_down) && (imx_pool_allocator->dirty_buffers == NULL))
+			pthread_cond_wait(&(imx_pool_allocator->cond), &(imx_pool_allocator->mutex));
+
+		if (imx_pool_allocator->shutting_down)
+			break;
+
+		imx_pool_buffer = imx_pool_allocator->dirty_buffers;
+		imx_pool_allocator->dirty_buffers = imx_pool_buffer->next;
+		imx_pool_buffer->next = NULL;
+
+		/* Zero the buffer without holding the lock, so allocations
+		 * and deallocations are not blocked in the meantime. */
+		pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+		zeroing_ok = imx_dma_buffer_pool_allocator_zero_buffer(imx_pool_buffer, NULL);
+		if (!zeroing_ok)
+			imx_dma_buffer_pool_allocator_free_buffer(imx_pool_allocator, imx_pool_buffer);
+		pthread_mutex_lock(&(imx_pool_allocator->mutex));
+
+		if (zeroing_ok)
+		{
+			imx_pool_buffer->next = imx_pool_allocator->clean_buffers;
+			imx_pool_allocator->clean_buffers = imx_pool_buffer;
+		}
+		else
+			imx_pool_allocator->num_idle_buffers--;
+	}
+
+	pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+	return NULL;
+}
+
+
+static void* imx_dma_buffer_pool_allocator_preallocation_thread(void *arg)
+{
+	ImxDmaBufferPoolPreallocation *preallocation = (ImxDmaBufferPoolPreallocation *)arg;
+	ImxDmaBufferPoolAllocator *imx_pool_allocator = preallocation->imx_pool_allocator;
+
+	while (__atomic_load_n(&(preallocation->error), __ATOMIC_RELAXED) == 0)
+	{
+		int error = 0;
+		ImxDmaBufferPoolBuffer *imx_pool_buffer;
+		ImxDmaBufferPoolSizeClass *size_class;
+		size_t job = __atomic_fetch_add(&(preallocation->next_job), 1, __ATOMIC_RELAXED);
+
+		if (job >= preallocation->num_jobs)
+			break;
+
+		size_class = preallocation->jobs[job];
+
+		imx_pool_buffer = imx_dma_buffer_pool_allocator_create_buffer(imx_pool_allocator, size_class->size, size_class->alignment, &error);
+		if (imx_pool_buffer == NULL)
+		{
+			int expected_error = 0;
+			/* Once one allocation failed, the others are likely to fail as
+			 * well (typically because the memory is exhausted), so stop. */
+			__atomic_compare_exchange_n(&(preallocation->error), &expected_error, (error != 0) ? error : ENOMEM, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			break;
+		}
+
+		/* The idle buffer count was already increased
+		 * for all jobs before the threads were started. */
+		pthread_mutex_lock(&(imx_pool_allocator->mutex));
+		imx_dma_buffer_pool_allocator_add_idle_buffer(imx_pool_allocator, imx_pool_buffer);
+		pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+		__atomic_fetch_add(&(preallocation->num_created_buffers), 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+
+ImxDmaBufferAllocator* imx_dma_buffer_pool_allocator_new(
+	ImxDmaBufferAllocator *underlying_allocator,
+	size_t max_num_idle_buffers,
+	unsigned int flags,
+	int *error
+)
+{
+	int ret;
+	ImxDmaBufferPoolAllocator *imx_pool_allocator;
+
+	assert(underlying_allocator != NULL);
+	assert(max_num_idle_buffers >= 1);
+
+	imx_pool_allocator = (ImxDmaBufferPoolAllocator *)malloc(sizeof(ImxDmaBufferPoolAllocator));
+	if (imx_pool_allocator == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	memset(imx_pool_allocator, 0, sizeof(ImxDmaBufferPoolAllocator));
+	imx_dma_buffer_allocator_init(&(imx_pool_allocator->parent));
+	imx_pool_allocator->parent.destroy = imx_dma_buffer_pool_allocator_destroy;
+	imx_pool_allocator->parent.allocate = imx_dma_buffer_pool_allocator_allocate;
+	imx_pool_allocator->parent.deallocate = imx_dma_buffer_pool_allocator_deallocate;
+	imx_pool_allocator->parent.map = imx_dma_buffer_pool_allocator_map;
+	imx_pool_allocator->parent.unmap = imx_dma_buffer_pool_allocator_unmap;
+	imx_pool_allocator->parent.start_sync_session = imx_dma_buffer_pool_allocator_start_sync_session;
+	imx_pool_allocator->parent.stop_sync_session = imx_dma_buffer_pool_allocator_stop_sync_session;
+	imx_pool_allocator->parent.get_physical_address = imx_dma_buffer_pool_allocator_get_physical_address;
+	imx_pool_allocator->parent.get_fd = imx_dma_buffer_pool_allocator_get_fd;
+	imx_pool_allocator->parent.get_size = imx_dma_buffer_pool_allocator_get_size;
+	/* Pool buffers are buffers of the underlying allocator, so they have its cache mode. */
+	imx_pool_allocator->parent.flags = IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER | (IMX_DMA_BUFFER_ALLOCATOR_GET_FLAGS(underlying_allocator) & IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY);
+	imx_pool_allocator->parent.map_range = imx_dma_buffer_pool_allocator_map_range;
+	imx_pool_allocator->parent.unmap_range = imx_dma_buffer_pool_allocator_unmap_range;
+	imx_pool_allocator->parent.sync_range = imx_dma_buffer_pool_allocator_sync_range;
+	imx_pool_allocator->underlying_allocator = underlying_allocator;
+	imx_pool_allocator->max_num_idle_buffers = max_num_idle_buffers;
+	imx_pool_allocator->flags = flags;
+
+	pthread_mutex_init(&(imx_pool_allocator->mutex), NULL);
+	pthread_cond_init(&(imx_pool_allocator->cond), NULL);
+
+	if (flags & IMX_DMA_BUFFER_POOL_ALLOCATOR_FLAG_ZERO_FILL)
+	{
+		ret = pthread_create(&(imx_pool_allocator->zeroing_thread), NULL, imx_dma_buffer_pool_allocator_zeroing_thread, imx_pool_allocator);
+		if (ret != 0)
+		{
+			if (error != NULL)
+				*error = ret;
+			imx_dma_buffer_pool_allocator_destroy((ImxDmaBufferAllocator *)imx_pool_allocator);
+			return NULL;
+		}
+
+		imx_pool_allocator->zeroing_thread_started = 1;
+	}
+
+	return (ImxDmaBufferAllocator *)imx_pool_allocator;
+}
+
+
+void imx_dma_buffer_pool_allocator_trim(ImxDmaBufferAllocator *allocator)
+{
+	size_t num_buffers = 0;
+	ImxDmaBufferPoolBuffer *imx_pool_buffer;
+	ImxDmaBufferPoolBuffer *clean_buffers, *dirty_buffers;
+	ImxDmaBufferPoolAllocator *imx_pool_allocator = (ImxDmaBufferPoolAllocator *)allocator;
+
+	assert(imx_pool_allocator != NULL);
+
+	pthread_mutex_lock(&(imx_pool_allocator->mutex));
+
+	clean_buffers = imx_pool_allocator->clean_buffers;
+	dirty_buffers = imx_pool_allocator->dirty_buffers;
+	imx_pool_allocator->clean_buffers = NULL;
+	imx_pool_allocator->dirty_buffers = NULL;
+
+	for (imx_pool_buffer = clean_buffers; imx_pool_buffer != NULL; imx_pool_buffer = imx_pool_buffer->next)
+		num_buffers++;
+	for (imx_pool_buffer = dirty_buffers; imx_pool_buffer != NULL; imx_pool_buffer = imx_pool_buffer->next)
+		num_buffers++;
+	imx_pool_allocator->num_idle_buffers -= num_buffers;
+
+	pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+	imx_dma_buffer_pool_allocator_free_buffer_list(imx_pool_allocator, clean_buffers);
+	imx_dma_buffer_pool_allocator_free_buffer_list(imx_pool_allocator, dirty_buffers);
+}
+
+
+size_t imx_dma_buffer_pool_allocator_get_num_idle_buffers(ImxDmaBufferAllocator *allocator)
+{
+	size_t num_idle_buffers;
+	ImxDmaBufferPoolAllocator *imx_pool_allocator = (ImxDmaBufferPoolAllocator *)allocator;
+
+	assert(imx_pool_allocator != NULL);
+
+	pthread_mutex_lock(&(imx_pool_allocator->mutex));
+	num_idle_buffers = imx_pool_allocator->num_idle_buffers;
+	pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+	return num_idle_buffers;
+}
+
+
+int imx_dma_buffer_pool_allocator_save_profile(ImxDmaBufferAllocator *allocator, char const *filename, int *error)
+{
+	int retval = 0;
+	FILE *file;
+	char *temp_filename;
+	ImxDmaBufferPoolSizeClass *size_class;
+	ImxDmaBufferPoolAllocator *imx_pool_allocator = (ImxDmaBufferPoolAllocator *)allocator;
+
+	assert(imx_pool_allocator != NULL);
+	assert(filename != NULL);
+
+	/* Write to a temporary file first, and rename it afterwards. That way,
+	 * a crash or power loss while writing (for example, during shutdown)
+	 * never leaves a truncated profile behind. */
+	temp_filename = (char *)malloc(strlen(filename) + sizeof(".tmp"));
+	if (temp_filename == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return 0;
+	}
+	strcpy(temp_filename, filename);
+	strcat(temp_filename, ".tmp");
+
+	file = fopen(temp_filename, "w");
+	if (file == NULL)
+	{
+		if (error != NULL)
+			*error = errno;
+		goto finish;
+	}
+
+	fprintf(file, "%s\n", IMX_DMA_BUFFER_POOL_PROFILE_HEADER);
+
+	pthread_mutex_lock(&(imx_pool_allocator->mutex));
+	for (size_class = imx_pool_allocator->size_classes; size_class != NULL; size_class = size_class->next)
+	{
+		if (size_class->peak_num_in_use > 0)
+			fprintf(file, "%zu %zu %zu\n", size_class->size, size_class->alignment, size_class->peak_num_in_use);
+	}
+	pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+	if (ferror(file))
+	{
+		if (error != NULL)
+			*error = EIO;
+		fclose(file);
+		unlink(temp_filename);
+		goto finish;
+	}
+
+	if ((fclose(file) != 0) || (rename(temp_filename, filename) != 0))
+	{
+		if (error != NULL)
+			*error = errno;
+		unlink(temp_filename);
+		goto finish;
+	}
+
+	retval = 1;
+
+finish:
+	free(temp_filename);
+	return retval;
+}
+
+
+int imx_dma_buffer_pool_allocator_preallocate_from_profile(ImxDmaBufferAllocator *allocator, char const *filename, unsigned int num_threads, int *error)
+{
+	int retval = 0;
+	FILE *file;
+	char header[64];
+	size_t size, alignment, peak_num_in_use;
+	size_t i, num_spawned_threads = 0;
+	size_t max_num_jobs;
+	pthread_t *threads = NULL;
+	ImxDmaBufferPoolSizeClass *size_class;
+	ImxDmaBufferPoolPreallocation preallocation;
+	ImxDmaBufferPoolAllocator *imx_pool_allocator = (ImxDmaBufferPoolAllocator *)allocator;
+
+	assert(imx_pool_allocator != NULL);
+	assert(filename != NULL);
+
+	memset(&preallocation, 0, sizeof(preallocation));
+	preallocation.imx_pool_allocator = imx_pool_allocator;
+
+	file = fopen(filename, "r");
+	if (file == NULL)
+	{
+		if (error != NULL)
+			*error = errno;
+		return 0;
+	}
+
+	if ((fgets(header, sizeof(header), file) == NULL) || (strcmp(header, IMX_DMA_BUFFER_POOL_PROFILE_HEADER "\n") != 0))
+	{
+		if (error != NULL)
+			*error = EINVAL;
+		goto finish;
+	}
+
+	/* The pool never holds more than max_num_idle_buffers idle buffers,
+	 * so there is no point in preallocating more than that. */
+	max_num_jobs = imx_pool_allocator->max_num_idle_buffers;
+	preallocation.jobs = (ImxDmaBufferPoolSizeClass **)malloc(sizeof(ImxDmaBufferPoolSizeClass *) * max_num_jobs);
+	if (preallocation.jobs == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		goto finish;
+	}
+
+	pthread_mutex_lock(&(imx_pool_allocator->mutex));
+
+	while (fscanf(file, "%zu %zu %zu", &size, &alignment, &peak_num_in_use) == 3)
+	{
+		size_t num_available;
+
+		if (size == 0)
+			continue;
+
+		size_class = imx_dma_buffer_pool_allocator_get_size_class(imx_pool_allocator, size, alignment);
+		if (size_class == NULL)
+			continue;
+
+		/* Keep the loaded peak. Otherwise, saving the profile after a run
+		 * that did not reach the usual demand would shrink the profile. */
+		if (peak_num_in_use > size_class->peak_num_in_use)
+			size_class->peak_num_in_use = peak_num_in_use;
+
+		num_available = size_class->num_in_use
+		              + imx_dma_buffer_pool_allocator_count_idle_buffers(imx_pool_allocator->clean_buffers, size_class)
+		              + imx_dma_buffer_pool_allocator_count_idle_buffers(imx_pool_allocator->dirty_buffers, size_class);
+
+		for (; (num_available < peak_num_in_use) && (preallocation.num_jobs < max_num_jobs) && ((imx_pool_allocator->num_idle_buffers + preallocation.num_jobs) < imx_pool_allocator->max_num_idle_buffers); ++num_available)
+			preallocation.jobs[preallocation.num_jobs++] = size_class;
+	}
+
+	/* Reserve the idle buffer slots for the buffers that are about to
+	 * be allocated, so concurrent deallocations cannot take them. */
+	imx_pool_allocator->num_idle_buffers += preallocation.num_jobs;
+
+	pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+	if (!feof(file))
+	{
+		if (error != NULL)
+			*error = EINVAL;
+		preallocation.error = EINVAL;
+	}
+	else if (preallocation.num_jobs > 0)
+	{
+		if (num_threads == 0)
+		{
+			long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			num_threads = (num_cpus > 0) ? (unsigned int)num_cpus : 1;
+		}
+		if (num_threads > preallocation.num_jobs)
+			num_threads = preallocation.num_jobs;
+
+		/* The calling thread is one of the workers. If creating a thread
+		 * fails, the remaining threads just have more work to do. */
+		if (num_threads > 1)
+		{
+			threads = (pthread_t *)malloc(sizeof(pthread_t) * (num_threads - 1));
+			if (threads != NULL)
+			{
+				for (i = 0; i < (num_threads - 1); ++i)
+				{
+					if (pthread_create(&(threads[num_spawned_threads]), NULL, imx_dma_buffer_pool_allocator_preallocation_thread, &preallocation) == 0)
+						num_spawned_threads++;
+				}
+			}
+		}
+
+		imx_dma_buffer_pool_allocator_preallocation_thread(&preallocation);
+
+		for (i = 0; i < num_spawned_threads; ++i)
+			pthread_join(threads[i], NULL);
+		free(threads);
+
+		if ((preallocation.error != 0) && (error != NULL))
+			*error = preallocation.error;
+	}
+
+	/* Release the reserved slots of buffers that were not allocated. */
+	pthread_mutex_lock(&(imx_pool_allocator->mutex));
+	imx_pool_allocator->num_idle_buffers -= (preallocation.num_jobs - preallocation.num_created_buffers);
+	pthread_mutex_unlock(&(imx_pool_allocator->mutex));
+
+	retval = (preallocation.error == 0);
+
+finish:
+	free(preallocation.jobs);
+	fclose(file);
+	return retval;
+}
@@ -0,0 +1,143 @@
+#ifndef IMXDMABUFFER_POOL_ALLOCATOR_H
+#define IMXDMABUFFER_POOL_ALLOCATOR_H
+
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ImxDmaBufferPoolAllocatorFlags: Flags for imx_dma_buffer_pool_allocator_new().
+ * These flags can be bitwise-OR combined. */
+typedef enum
+{
+	/* Buffers handed out by the pool are filled with zeros. Released buffers
+	 * are zeroed by a low priority background thread, so allocations normally
+	 * do not have to zero anything. If this flag is not set, the pool just
+	 * recycles buffers, and their contents are undefined after allocation. */
+	IMX_DMA_BUFFER_POOL_ALLOCATOR_FLAG_ZERO_FILL = (1UL << 0)
+}
+ImxDmaBufferPoolAllocatorFlags;
+
+
+/* Creates a new DMA buffer allocator that recycles buffers of another allocator.
+ *
+ * Deallocating a buffer that was allocated by a pool allocator does not free
+ * the underlying DMA memory. Instead, the buffer is kept as an idle buffer.
+ * Subsequent allocations with the same size and alignment reuse idle buffers
+ * before allocating new ones from the underlying allocator. This is intended
+ * for use cases like video playback, where the same frame sizes are allocated
+ * and deallocated over and over.
+ *
+ * If IMX_DMA_BUFFER_POOL_ALLOCATOR_FLAG_ZERO_FILL is set, then all buffers
+ * returned by imx_dma_buffer_allocate() contain only zeros. Idle buffers are
+ * zeroed by a background thread that runs with the lowest scheduling priority.
+ * The memory is written through a regular mapping of the underlying buffer,
+ * inside a sync session, so this also works with allocators that allocate
+ * cached memory. If an allocation cannot be served by an already zeroed idle
+ * buffer, the new buffer is zeroed in the imx_dma_buffer_allocate() call.
+ *
+ * The pool allocator does not take ownership of the underlying allocator. All
+ * buffers allocated by the pool must be deallocated before the pool allocator
+ * is destroyed. Destroying the pool allocator deallocates all idle buffers.
+ * The underlying allocator must be destroyed after the pool allocator.
+ *
+ * The pool allocator is thread safe if the underlying allocator is.
+ *
+ * @param underlying_allocator Allocator to allocate the actual DMA buffers with.
+ *        Must not be NULL.
+ * @param max_num_idle_buffers Maximum number of idle buffers the pool keeps. If
+ *        this many buffers are already idle, deallocated buffers are passed
+ *        on to the underlying allocator instead. Must be at least 1.
+ * @param flags Bitwise OR combination of ImxDmaBufferPoolAllocatorFlags.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If creating the allocator succeeds, the integer is not modified.
+ * @return Pointer to the newly created pool allocator, or NULL in case of an error.
+ */
+ImxDmaBufferAllocator* imx_dma_buffer_pool_allocator_new(
+	ImxDmaBufferAllocator *underlying_allocator,
+	size_t max_num_idle_buffers,
+	unsigned int flags,
+	int *error
+);
+
+/* Deallocates all idle buffers of the pool allocator.
+ *
+ * Buffers that are in use, and the buffer that is currently being zeroed
+ * by the background thread (if any), are not affected.
+ */
+void imx_dma_buffer_pool_allocator_trim(ImxDmaBufferAllocator *allocator);
+
+/* Returns the number of idle buffers the pool currently holds. */
+size_t imx_dma_buffer_pool_allocator_get_num_idle_buffers(ImxDmaBufferAllocator *allocator);
+
+
+/* Allocation profiles:
+ *
+ * The pool allocator records the demand for each combination of size and
+ * alignment that is allocated from it: the peak number of buffers of that
+ * combination that were in use at the same time. This demand can be saved
+ * as an allocation profile, typically at the end of a run or periodically.
+ * At the next start, the profile is used for allocating these buffers in
+ * advance, before the pipeline asks for them. Since pipelines usually
+ * allocate the same sizes and counts on every start, this takes the
+ * allocation work out of the time to the first frame, without having to
+ * configure the sizes manually.
+ *
+ * Profiles are small text files. The first line identifies the format,
+ * and each following line contains the size, alignment, and peak count
+ * of one combination, separated by spaces.
+ */
+
+/* Saves the allocation profile of the pool to a file.
+ *
+ * The file is written to a temporary file next to it first, which is then
+ * renamed, so an interrupted save does not leave a truncated profile behind.
+ * Peaks loaded by imx_dma_buffer_pool_allocator_preallocate_from_profile()
+ * are included, so a run with lower demand does not shrink the profile.
+ *
+ * @param allocator Pool allocator whose profile shall be saved.
+ * @param filename Name of the profile file.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ * @return Nonzero if the profile was saved, 0 in case of an error.
+ */
+int imx_dma_buffer_pool_allocator_save_profile(ImxDmaBufferAllocator *allocator, char const *filename, int *error);
+
+/* Loads an allocation profile, and preallocates the buffers it lists.
+ *
+ * For each size and alignment in the profile, as many buffers are allocated
+ * as needed to reach the peak count, counting buffers of the pool that are
+ * already in use or idle. They are allocated by several threads in parallel,
+ * and added to the pool as idle buffers. If the pool zero fills buffers,
+ * the background thread zeroes them. No more than max_num_idle_buffers
+ * buffers are preallocated.
+ *
+ * The underlying allocator must be thread safe if num_threads is not 1.
+ * This function blocks until all buffers are allocated. To keep it from
+ * delaying other startup work, it can be called in a separate thread.
+ *
+ * @param allocator Pool allocator to preallocate buffers for.
+ * @param filename Name of the profile file.
+ * @param num_threads Number of threads to allocate with, including the
+ *        calling thread. 0 uses one thread per online CPU.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If the profile file does not exist (for example, at the very first
+ *        start), the error code is ENOENT. If the file is not a valid profile,
+ *        the error code is EINVAL.
+ * @return Nonzero if all buffers were preallocated, 0 in case of an error.
+ *         Buffers that were preallocated before an error stay in the pool.
+ */
+int imx_dma_buffer_pool_allocator_preallocate_from_profile(ImxDmaBufferAllocator *allocator, char const *filename, unsigned int num_threads, int *error);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_POOL_ALLOCATOR_H */
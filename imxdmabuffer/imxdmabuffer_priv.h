@@ -1,8 +1,10 @@
 #ifndef IMXDMABUFFER_PRIV_H
 #define IMXDMABUFFER_PRIV_H
 
+#include <errno.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/mman.h>
 
 #include "imxdmabuffer.h"
 
@@ -16,6 +18,48 @@ extern "C" {
 #define IMX_DMA_BUFFER_ALIGN_VAL_TO(LENGTH, ALIGN_SIZE)  ( ((uintptr_t)(((uint8_t*)(LENGTH)) + (ALIGN_SIZE) - 1) / (ALIGN_SIZE)) * (ALIGN_SIZE) )
 
 
+/* Allocator flag for internal use. imx_dma_buffer_allocate() does not
+ * register the buffers of allocators that have this flag set, so they do
+ * not show up in the list of live buffers and in the address indexes. This
+ * is for allocators that reclaim all of their buffers at once, like the arena
+ * allocator, since unregistering each buffer would defeat the purpose. */
+#define IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNTRACKED_BUFFERS (1UL << 31)
+
+/* Mapping flag for internal use. It tells the allocator that the CPU also
+ * writes to the buffer through other mappings of its FD, like the double
+ * mapping of a ring. Writes through those mappings are not visible in the
+ * soft-dirty bits of the buffer's own mapping, so the allocator must not use
+ * dirty page tracking for the buffer, and always syncs all of it instead.
+ * Once passed to a map call, this stays in effect until the buffer is fully
+ * unmapped. Allocators that do not use dirty page tracking ignore it. */
+#define IMX_DMA_BUFFER_MAPPING_FLAG_NO_DIRTY_TRACKING (1UL << 31)
+
+/* Allocates a buffer that is only used internally by another allocator, like
+ * the buffers the pool allocator reuses. This initializes the fields that
+ * imx_dma_buffer_allocate() initializes, but the buffer is not registered,
+ * so it does not show up in leak reports and address lookups. Deallocate it
+ * by calling the allocator's deallocate vfunc directly. */
+ImxDmaBuffer* imx_dma_buffer_allocate_untracked(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error);
+
+/* Updates the virtual address index after the buffer's mapped virtual
+ * address changed. This is internal; imx_dma_buffer_map() and
+ * imx_dma_buffer_unmap() call it. */
+void imx_dma_buffer_update_virtual_address_index(ImxDmaBuffer *buffer);
+
+
+/* Linkage of the per-buffer vfuncs of the built-in allocators (map, unmap,
+ * and the sync session vfuncs). In static dispatch builds, these functions
+ * are exported, so imxdmabuffer_static_dispatch.h can call them directly
+ * instead of going through the vtable. Otherwise, they are static like all
+ * the other vfuncs. Note that imxdmabuffer_config.h must be included before
+ * this header. */
+#ifdef IMXDMABUFFER_STATIC_DISPATCH_ENABLED
+#define IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE
+#else
+#define IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE static
+#endif
+
+
 /* These two functions exist since most allocators do not allocate
  * cached DMA memory and thus do not need any syncing. */
 
@@ -33,6 +77,30 @@ static inline void imx_dma_buffer_noop_stop_sync_session_func(ImxDmaBufferAlloca
 
 
 
+/* Changes the protection of an existing mapping to match the given
+ * ImxDmaBufferMappingFlags. This is used by allocators that map buffers
+ * with mmap() for upgrading a mapping in place when a redundant map call
+ * requests read/write access that the mapping does not have yet.
+ * Returns nonzero on success. */
+static inline int imx_dma_buffer_protect_mapping(uint8_t *virtual_address, size_t size, unsigned int flags, int *error)
+{
+	int prot = 0;
+
+	prot |= (flags & IMX_DMA_BUFFER_MAPPING_FLAG_READ) ? PROT_READ : 0;
+	prot |= (flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE) ? PROT_WRITE : 0;
+
+	if (mprotect(virtual_address, size, prot) < 0)
+	{
+		if (error != NULL)
+			*error = errno;
+		return 0;
+	}
+
+	return 1;
+}
+
+
+
 #ifdef __cplusplus
 }
 #endif
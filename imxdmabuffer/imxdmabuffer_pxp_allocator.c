@@ -11,24 +11,31 @@
 #include <imxdmabuffer_config.h>
 #include "imxdmabuffer.h"
 #include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_slab_priv.h"
+#include "imxdmabuffer_window_priv.h"
 #include "imxdmabuffer_pxp_allocator.h"
+#include "imxdmabuffer_device_cache_priv.h"
 
 
 typedef struct
 {
+	/* The aligned physical address, size, and mapped virtual
+	 * address are stored in the common buffer header. */
 	ImxDmaBuffer parent;
 
+	/* The physical address as returned by the allocator,
+	 * prior to aligning it. */
 	imx_physical_address_t physical_address;
 
 	size_t actual_size;
-	size_t size;
-	uint8_t* mapped_virtual_address;
-	imx_physical_address_t aligned_physical_address;
 	unsigned int map_flags;
 
 	int mapping_refcount;
 
 	struct pxp_mem_desc mem_desc;
+
+	/* Windows mapped with imx_dma_buffer_map_range(). */
+	ImxDmaBufferWindow *windows;
 }
 ImxDmaBufferPxpBuffer;
 
@@ -38,6 +45,9 @@ typedef struct
 	ImxDmaBufferAllocator parent;
 	int pxp_fd;
 	int pxp_fd_is_internal;
+
+	/* The ImxDmaBufferPxpBuffer structures are allocated from this slab. */
+	ImxDmaBufferSlab buffer_slab;
 }
 ImxDmaBufferPxpAllocator;
 
@@ -45,8 +55,10 @@ ImxDmaBufferPxpAllocator;
 static void imx_dma_buffer_pxp_allocator_destroy(ImxDmaBufferAllocator *allocator);
 static ImxDmaBuffer* imx_dma_buffer_pxp_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error);
 static void imx_dma_buffer_pxp_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
-static uint8_t* imx_dma_buffer_pxp_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
-static void imx_dma_buffer_pxp_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_pxp_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_pxp_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+static uint8_t* imx_dma_buffer_pxp_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error);
+static void imx_dma_buffer_pxp_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address);
 static imx_physical_address_t imx_dma_buffer_pxp_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static int imx_dma_buffer_pxp_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
 static size_t imx_dma_buffer_pxp_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
@@ -60,10 +72,11 @@ static void imx_dma_buffer_pxp_allocator_destroy(ImxDmaBufferAllocator *allocato
 
 	if ((imx_pxp_allocator->pxp_fd >= 0) && imx_pxp_allocator->pxp_fd_is_internal)
 	{
-		close(imx_pxp_allocator->pxp_fd);
+		imx_dma_buffer_device_cache_release_fd(imx_pxp_allocator->pxp_fd);
 		imx_pxp_allocator->pxp_fd = -1;
 	}
 
+	imx_dma_buffer_slab_cleanup(&(imx_pxp_allocator->buffer_slab));
 	free(imx_pxp_allocator);
 }
 
@@ -75,12 +88,15 @@ static ImxDmaBuffer* imx_dma_buffer_pxp_allocator_allocate(ImxDmaBufferAllocator
 	ImxDmaBufferPxpAllocator *imx_pxp_allocator = (ImxDmaBufferPxpAllocator *)allocator;
 
 	assert(imx_pxp_allocator != NULL);
-	assert(imx_pxp_allocator->pxp_fd >= 0);
+
+	/* The internal PxP FD is acquired on first use. */
+	if (imx_pxp_allocator->pxp_fd_is_internal && (imx_dma_buffer_device_cache_get_fd(&(imx_pxp_allocator->pxp_fd), "/dev/pxp_device", O_RDWR, error) < 0))
+		return NULL;
 
 	/* The PXP allocator does not have a parameter for alignment, so we resort to a trick.
 	 * We allocate some extra bytes. Then, once allocated, we take the returned physical
 	 * address, and add an offset to it to make sure the address is aligned as requested.
-	 * This modified physical address is stored in aligned_physical_address . The maximum
+	 * This modified physical address is stored in the common buffer header. The maximum
 	 * offset equals the alignment size, which is why we increase the allocation size by
 	 * the alignment amount. Alignment of 0 or 1 however means "no alignment", so we don't
 	 * actually do this trick in that case. */
@@ -90,13 +106,21 @@ static ImxDmaBuffer* imx_dma_buffer_pxp_allocator_allocate(ImxDmaBufferAllocator
 	if (alignment > 1)
 		actual_size += alignment;
 
-	/* Allocate system memory for the DMA buffer structure, and initialize its fields. */
-	imx_pxp_buffer = (ImxDmaBufferPxpBuffer *)malloc(sizeof(ImxDmaBufferPxpBuffer));
+	/* Get the DMA buffer structure from the slab, and initialize its fields. */
+	imx_pxp_buffer = (ImxDmaBufferPxpBuffer *)imx_dma_buffer_slab_alloc(&(imx_pxp_allocator->buffer_slab));
+	if (imx_pxp_buffer == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
 	imx_pxp_buffer->parent.allocator = allocator;
 	imx_pxp_buffer->actual_size = actual_size;
-	imx_pxp_buffer->size = size;
-	imx_pxp_buffer->mapped_virtual_address = NULL;
+	imx_pxp_buffer->parent.size = size;
+	imx_pxp_buffer->parent.mapped_virtual_address = NULL;
+	imx_pxp_buffer->parent.fd = -1;
 	imx_pxp_buffer->mapping_refcount = 0;
+	imx_pxp_buffer->windows = NULL;
 
 	/* Perform the actual allocation. */
 	imx_pxp_buffer->mem_desc.size = size;
@@ -110,13 +134,13 @@ static ImxDmaBuffer* imx_dma_buffer_pxp_allocator_allocate(ImxDmaBufferAllocator
 	imx_pxp_buffer->physical_address = (imx_physical_address_t)((imx_pxp_buffer->mem_desc.phys_addr));
 
 	/* Align the physical address. */
-	imx_pxp_buffer->aligned_physical_address = (imx_physical_address_t)IMX_DMA_BUFFER_ALIGN_VAL_TO(imx_pxp_buffer->physical_address, alignment);
+	imx_pxp_buffer->parent.physical_address = (imx_physical_address_t)IMX_DMA_BUFFER_ALIGN_VAL_TO(imx_pxp_buffer->physical_address, alignment);
 
 finish:
 	return (ImxDmaBuffer *)imx_pxp_buffer;
 
 cleanup:
-	free(imx_pxp_buffer);
+	imx_dma_buffer_slab_free(&(imx_pxp_allocator->buffer_slab), imx_pxp_buffer);
 	imx_pxp_buffer = NULL;
 	goto finish;
 }
@@ -132,7 +156,7 @@ static void imx_dma_buffer_pxp_allocator_deallocate(ImxDmaBufferAllocator *alloc
 	assert(imx_pxp_buffer != NULL);
 	assert(imx_pxp_buffer->physical_address != 0);
 
-	if (imx_pxp_buffer->mapped_virtual_address != NULL)
+	if (imx_pxp_buffer->parent.mapped_virtual_address != NULL)
 	{
 		/* Set mapping_refcount to 1 to force an
 		* imx_dma_buffer_pxp_allocator_unmap() to actually unmap the buffer. */
@@ -140,13 +164,15 @@ static void imx_dma_buffer_pxp_allocator_deallocate(ImxDmaBufferAllocator *alloc
 		imx_dma_buffer_pxp_allocator_unmap(allocator, buffer);
 	}
 
+	imx_dma_buffer_window_unmap_all(&(imx_pxp_buffer->windows));
+
 	ioctl(imx_pxp_allocator->pxp_fd, PXP_IOC_PUT_PHYMEM, &(imx_pxp_buffer->mem_desc));
 
-	free(imx_pxp_buffer);
+	imx_dma_buffer_slab_free(&(imx_pxp_allocator->buffer_slab), imx_pxp_buffer);
 }
 
 
-static uint8_t* imx_dma_buffer_pxp_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE uint8_t* imx_dma_buffer_pxp_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
 {
 	ImxDmaBufferPxpBuffer *imx_pxp_buffer = (ImxDmaBufferPxpBuffer *)buffer;
 	ImxDmaBufferPxpAllocator *imx_pxp_allocator = (ImxDmaBufferPxpAllocator *)allocator;
@@ -156,9 +182,24 @@ static uint8_t* imx_dma_buffer_pxp_allocator_map(ImxDmaBufferAllocator *allocato
 	assert(imx_pxp_buffer != NULL);
 	assert(imx_pxp_buffer->physical_address != 0);
 
-	if (imx_pxp_buffer->mapped_virtual_address != NULL)
+	if (flags == 0)
+		flags = IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE;
+
+	if (imx_pxp_buffer->parent.mapped_virtual_address != NULL)
 	{
-		assert((imx_pxp_buffer->map_flags & flags & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK) == (flags & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK));
+		unsigned int missing_flags = flags & ~(imx_pxp_buffer->map_flags) & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK;
+
+		if (missing_flags != 0)
+		{
+			/* Buffer is already mapped, but without some of the requested
+			 * access flags. Upgrade the mapping in place instead of
+			 * remapping, so the virtual address stays the same and the
+			 * already populated pages do not have to be faulted in again. */
+			if (!imx_dma_buffer_protect_mapping(imx_pxp_buffer->parent.mapped_virtual_address, imx_pxp_buffer->parent.size, imx_pxp_buffer->map_flags | missing_flags, error))
+				return NULL;
+
+			imx_pxp_buffer->map_flags |= missing_flags;
+		}
 
 		/* Buffer is already mapped. Just increment the
 		 * refcount and otherwise do nothing. */
@@ -178,7 +219,7 @@ static uint8_t* imx_dma_buffer_pxp_allocator_map(ImxDmaBufferAllocator *allocato
 
 		imx_pxp_buffer->map_flags = flags;
 
-		virtual_address = mmap(0, imx_pxp_buffer->size, mmap_prot, mmap_flags, imx_pxp_allocator->pxp_fd, imx_pxp_buffer->physical_address);
+		virtual_address = mmap(0, imx_pxp_buffer->parent.size, mmap_prot, mmap_flags, imx_pxp_allocator->pxp_fd, imx_pxp_buffer->physical_address);
 		if (virtual_address == MAP_FAILED)
 		{
 			if (error != NULL)
@@ -187,15 +228,15 @@ static uint8_t* imx_dma_buffer_pxp_allocator_map(ImxDmaBufferAllocator *allocato
 		else
 		{
 			imx_pxp_buffer->mapping_refcount = 1;
-			imx_pxp_buffer->mapped_virtual_address = virtual_address;
+			imx_pxp_buffer->parent.mapped_virtual_address = virtual_address;
 		}
 	}
 
-	return imx_pxp_buffer->mapped_virtual_address;
+	return imx_pxp_buffer->parent.mapped_virtual_address;
 }
 
 
-static void imx_dma_buffer_pxp_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+IMX_DMA_BUFFER_STATIC_DISPATCH_LINKAGE void imx_dma_buffer_pxp_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
 {
 	ImxDmaBufferPxpBuffer *imx_pxp_buffer = (ImxDmaBufferPxpBuffer *)buffer;
 
@@ -204,15 +245,50 @@ static void imx_dma_buffer_pxp_allocator_unmap(ImxDmaBufferAllocator *allocator,
 	assert(imx_pxp_buffer != NULL);
 	assert(imx_pxp_buffer->physical_address != 0);
 
-	if (imx_pxp_buffer->mapped_virtual_address == NULL)
+	if (imx_pxp_buffer->parent.mapped_virtual_address == NULL)
 		return;
 
 	imx_pxp_buffer->mapping_refcount--;
 	if (imx_pxp_buffer->mapping_refcount != 0)
 		return;
 
-	munmap((void *)(imx_pxp_buffer->mapped_virtual_address), imx_pxp_buffer->size);
-	imx_pxp_buffer->mapped_virtual_address = NULL;
+	munmap((void *)(imx_pxp_buffer->parent.mapped_virtual_address), imx_pxp_buffer->parent.size);
+	imx_pxp_buffer->parent.mapped_virtual_address = NULL;
+}
+
+
+static uint8_t* imx_dma_buffer_pxp_allocator_map_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, size_t offset, size_t length, unsigned int flags, int *error)
+{
+	int needs_sync_start;
+	ImxDmaBufferWindow *window;
+	ImxDmaBufferPxpBuffer *imx_pxp_buffer = (ImxDmaBufferPxpBuffer *)buffer;
+	ImxDmaBufferPxpAllocator *imx_pxp_allocator = (ImxDmaBufferPxpAllocator *)allocator;
+
+	assert(imx_pxp_buffer != NULL);
+	assert(imx_pxp_buffer->physical_address != 0);
+
+	/* Sync sessions are no-ops with this allocator, so needs_sync_start is ignored. */
+	window = imx_dma_buffer_window_map(&(imx_pxp_buffer->windows), imx_pxp_allocator->pxp_fd, imx_pxp_buffer->physical_address, imx_pxp_buffer->parent.size, offset, length, flags, &needs_sync_start, error);
+	if (window == NULL)
+		return NULL;
+
+	return window->virtual_address + (offset - window->offset);
+}
+
+
+static void imx_dma_buffer_pxp_allocator_unmap_range(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, uint8_t *virtual_address)
+{
+	ImxDmaBufferWindow *window;
+	ImxDmaBufferPxpBuffer *imx_pxp_buffer = (ImxDmaBufferPxpBuffer *)buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	assert(imx_pxp_buffer != NULL);
+
+	window = imx_dma_buffer_window_find_by_address(imx_pxp_buffer->windows, virtual_address);
+	assert(window != NULL);
+
+	imx_dma_buffer_window_unmap(&(imx_pxp_buffer->windows), window);
 }
 
 
@@ -221,7 +297,7 @@ static imx_physical_address_t imx_dma_buffer_pxp_allocator_get_physical_address(
 	ImxDmaBufferPxpBuffer *imx_pxp_buffer = (ImxDmaBufferPxpBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_pxp_buffer != NULL);
-	return imx_pxp_buffer->aligned_physical_address;
+	return imx_pxp_buffer->parent.physical_address;
 }
 
 
@@ -238,13 +314,14 @@ static size_t imx_dma_buffer_pxp_allocator_get_size(ImxDmaBufferAllocator *alloc
 	ImxDmaBufferPxpBuffer *imx_pxp_buffer = (ImxDmaBufferPxpBuffer *)buffer;
 	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
 	assert(imx_pxp_buffer != NULL);
-	return imx_pxp_buffer->size;
+	return imx_pxp_buffer->parent.size;
 }
 
 
 ImxDmaBufferAllocator* imx_dma_buffer_pxp_allocator_new(int pxp_fd, int *error)
 {
 	ImxDmaBufferPxpAllocator *imx_pxp_allocator = (ImxDmaBufferPxpAllocator *)malloc(sizeof(ImxDmaBufferPxpAllocator));
+	imx_dma_buffer_allocator_init(&(imx_pxp_allocator->parent));
 	imx_pxp_allocator->parent.destroy = imx_dma_buffer_pxp_allocator_destroy;
 	imx_pxp_allocator->parent.allocate = imx_dma_buffer_pxp_allocator_allocate;
 	imx_pxp_allocator->parent.deallocate = imx_dma_buffer_pxp_allocator_deallocate;
@@ -255,20 +332,18 @@ ImxDmaBufferAllocator* imx_dma_buffer_pxp_allocator_new(int pxp_fd, int *error)
 	imx_pxp_allocator->parent.get_physical_address = imx_dma_buffer_pxp_allocator_get_physical_address;
 	imx_pxp_allocator->parent.get_fd = imx_dma_buffer_pxp_allocator_get_fd;
 	imx_pxp_allocator->parent.get_size = imx_dma_buffer_pxp_allocator_get_size;
+	imx_pxp_allocator->parent.flags = IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER | IMX_DMA_BUFFER_ALLOCATOR_FLAG_UNCACHED_MEMORY;
+	imx_dma_buffer_slab_init(&(imx_pxp_allocator->buffer_slab), sizeof(ImxDmaBufferPxpBuffer));
+	imx_pxp_allocator->parent.map_range = imx_dma_buffer_pxp_allocator_map_range;
+	imx_pxp_allocator->parent.unmap_range = imx_dma_buffer_pxp_allocator_unmap_range;
+	imx_pxp_allocator->parent.sync_range = NULL;
 	imx_pxp_allocator->pxp_fd = pxp_fd;
 	imx_pxp_allocator->pxp_fd_is_internal = (pxp_fd < 0);
 
+	/* The internal PxP FD is acquired on first use. */
+	IMX_DMA_BUFFER_UNUSED_PARAM(error);
 	if (pxp_fd < 0)
-	{
-		imx_pxp_allocator->pxp_fd = open("/dev/pxp_device", O_RDWR, 0);
-		if (imx_pxp_allocator->pxp_fd < 0)
-		{
-			if (error != NULL)
-				*error = errno;
-			free(imx_pxp_allocator);
-			return NULL;
-		}
-	}
+		imx_pxp_allocator->pxp_fd = -1;
 
 	return (ImxDmaBufferAllocator*)imx_pxp_allocator;
 }
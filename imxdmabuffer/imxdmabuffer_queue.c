@@ -0,0 +1,365 @@
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_queue.h"
+
+
+/* Producer and consumer fields are placed in separate cache lines,
+ * so that producers and consumers do not invalidate each other's
+ * cache lines all the time (false sharing). */
+#define QUEUE_CACHE_LINE_SIZE 64
+
+
+typedef struct
+{
+	/* Only used by MPMC queues. This tells whether the cell
+	 * is ready for being written or read (see below). */
+	size_t sequence;
+	ImxDmaBuffer *buffer;
+	unsigned int sync_direction;
+}
+ImxDmaBufferQueueCell;
+
+
+struct _ImxDmaBufferQueue
+{
+	ImxDmaBufferQueueType type;
+	size_t capacity;
+	size_t mask;
+	ImxDmaBufferQueueCell *cells;
+	int event_fd;
+
+	/* Written by producers. cached_head is a copy of head that the SPSC
+	 * producer keeps to avoid reading the consumer's cache line. */
+	size_t tail __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));
+	size_t cached_head;
+
+	/* Written by consumers. cached_tail is the SPSC consumer's counterpart. */
+	size_t head __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));
+	size_t cached_tail;
+
+	/* Set by consumers that found the queue empty. */
+	int consumer_waiting __attribute__((aligned(QUEUE_CACHE_LINE_SIZE)));
+};
+
+
+static int imx_dma_buffer_queue_try_push(ImxDmaBufferQueue *queue, ImxDmaBuffer *buffer, unsigned int sync_direction);
+static int imx_dma_buffer_queue_try_pop(ImxDmaBufferQueue *queue, ImxDmaBuffer **buffer, unsigned int *sync_direction);
+
+
+ImxDmaBufferQueue* imx_dma_buffer_queue_new(ImxDmaBufferQueueType type, size_t capacity, int *error)
+{
+	size_t i;
+	size_t rounded_capacity = 1;
+	ImxDmaBufferQueue *queue;
+
+	assert(capacity >= 1);
+
+	while (rounded_capacity < capacity)
+		rounded_capacity <<= 1;
+
+	if (posix_memalign((void **)&queue, QUEUE_CACHE_LINE_SIZE, sizeof(ImxDmaBufferQueue)) != 0)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	memset(queue, 0, sizeof(ImxDmaBufferQueue));
+	queue->type = type;
+	queue->capacity = rounded_capacity;
+	queue->mask = rounded_capacity - 1;
+
+	queue->cells = (ImxDmaBufferQueueCell *)malloc(sizeof(ImxDmaBufferQueueCell) * rounded_capacity);
+	if (queue->cells == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		free(queue);
+		return NULL;
+	}
+
+	for (i = 0; i < rounded_capacity; ++i)
+	{
+		queue->cells[i].sequence = i;
+		queue->cells[i].buffer = NULL;
+		queue->cells[i].sync_direction = IMX_DMA_BUFFER_QUEUE_SYNC_DIRECTION_NONE;
+	}
+
+	queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (queue->event_fd < 0)
+	{
+		if (error != NULL)
+			*error = errno;
+		free(queue->cells);
+		free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+
+void imx_dma_buffer_queue_free(ImxDmaBufferQueue *queue)
+{
+	assert(queue != NULL);
+
+	close(queue->event_fd);
+	free(queue->cells);
+	free(queue);
+}
+
+
+size_t imx_dma_buffer_queue_get_capacity(ImxDmaBufferQueue *queue)
+{
+	assert(queue != NULL);
+	return queue->capacity;
+}
+
+
+int imx_dma_buffer_queue_get_fd(ImxDmaBufferQueue *queue)
+{
+	assert(queue != NULL);
+	return queue->event_fd;
+}
+
+
+int imx_dma_buffer_queue_push(ImxDmaBufferQueue *queue, ImxDmaBuffer *buffer, unsigned int sync_direction)
+{
+	assert(queue != NULL);
+	assert(buffer != NULL);
+
+	if (!imx_dma_buffer_queue_try_push(queue, buffer, sync_direction))
+		return 0;
+
+	/* Pairs with the fence in imx_dma_buffer_queue_pop(). Either the consumer
+	 * sees the new buffer when it checks again after setting consumer_waiting,
+	 * or this sees consumer_waiting set and wakes up the consumer. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&(queue->consumer_waiting), __ATOMIC_RELAXED) && __atomic_exchange_n(&(queue->consumer_waiting), 0, __ATOMIC_ACQ_REL))
+	{
+		uint64_t one = 1;
+		/* This can only fail if the counter would overflow,
+		 * in which case the eventfd is readable anyway. */
+		ssize_t ret = write(queue->event_fd, &one, sizeof(one));
+		(void)ret;
+	}
+
+	return 1;
+}
+
+
+int imx_dma_buffer_queue_pop(ImxDmaBufferQueue *queue, ImxDmaBuffer **buffer, unsigned int *sync_direction)
+{
+	uint64_t counter;
+	ssize_t ret;
+
+	assert(queue != NULL);
+	assert(buffer != NULL);
+
+	if (imx_dma_buffer_queue_try_pop(queue, buffer, sync_direction))
+		return 1;
+
+	/* The queue is empty. Arm the wakeup, and clear wakeups that are left
+	 * over from earlier. Then check again, since a producer may have pushed
+	 * a buffer before it could see consumer_waiting set. */
+	__atomic_store_n(&(queue->consumer_waiting), 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	ret = read(queue->event_fd, &counter, sizeof(counter));
+	(void)ret;
+
+	return imx_dma_buffer_queue_try_pop(queue, buffer, sync_direction);
+}
+
+
+int imx_dma_buffer_queue_pop_wait(ImxDmaBufferQueue *queue, ImxDmaBuffer **buffer, unsigned int *sync_direction, int timeout_ms, int *error)
+{
+	struct timespec deadline;
+
+	assert(queue != NULL);
+	assert(buffer != NULL);
+
+	memset(&deadline, 0, sizeof(deadline));
+	if (timeout_ms > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	while (!imx_dma_buffer_queue_pop(queue, buffer, sync_direction))
+	{
+		struct pollfd pfd;
+		int remaining_ms = timeout_ms;
+		int ret;
+
+		/* Wakeups can be spurious, so the remaining
+		 * time has to be computed for each attempt. */
+		if (timeout_ms > 0)
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining_ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000L;
+			if (remaining_ms < 0)
+				remaining_ms = 0;
+		}
+
+		pfd.fd = queue->event_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		ret = poll(&pfd, 1, remaining_ms);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (error != NULL)
+				*error = errno;
+			return 0;
+		}
+
+		if (ret == 0)
+		{
+			/* Timeout expired. Make one last attempt, in case
+			 * a buffer was pushed right before it expired. */
+			if (imx_dma_buffer_queue_try_pop(queue, buffer, sync_direction))
+				return 1;
+			if (error != NULL)
+				*error = ETIMEDOUT;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+static int imx_dma_buffer_queue_try_push(ImxDmaBufferQueue *queue, ImxDmaBuffer *buffer, unsigned int sync_direction)
+{
+	ImxDmaBufferQueueCell *cell;
+
+	if (queue->type == IMX_DMA_BUFFER_QUEUE_TYPE_SPSC)
+	{
+		size_t tail = __atomic_load_n(&(queue->tail), __ATOMIC_RELAXED);
+
+		if ((tail - queue->cached_head) >= queue->capacity)
+		{
+			queue->cached_head = __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE);
+			if ((tail - queue->cached_head) >= queue->capacity)
+				return 0;
+		}
+
+		cell = &(queue->cells[tail & queue->mask]);
+		cell->buffer = buffer;
+		cell->sync_direction = sync_direction;
+
+		__atomic_store_n(&(queue->tail), tail + 1, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		/* Bounded MPMC queue as described by Dmitry Vyukov. Each cell has a
+		 * sequence number. A cell at position pos can be written once its
+		 * sequence number is pos, and read once it is pos + 1. After reading,
+		 * the sequence number is set to pos + capacity, which is the position
+		 * the cell has in the next round. Producers and consumers claim
+		 * positions with a CAS on tail and head respectively. */
+		size_t pos = __atomic_load_n(&(queue->tail), __ATOMIC_RELAXED);
+
+		while (1)
+		{
+			intptr_t diff;
+
+			cell = &(queue->cells[pos & queue->mask]);
+			diff = (intptr_t)__atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE) - (intptr_t)pos;
+
+			if (diff == 0)
+			{
+				if (__atomic_compare_exchange_n(&(queue->tail), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+					break;
+			}
+			else if (diff < 0)
+				return 0;
+			else
+				pos = __atomic_load_n(&(queue->tail), __ATOMIC_RELAXED);
+		}
+
+		cell->buffer = buffer;
+		cell->sync_direction = sync_direction;
+
+		__atomic_store_n(&(cell->sequence), pos + 1, __ATOMIC_RELEASE);
+	}
+
+	return 1;
+}
+
+
+static int imx_dma_buffer_queue_try_pop(ImxDmaBufferQueue *queue, ImxDmaBuffer **buffer, unsigned int *sync_direction)
+{
+	ImxDmaBufferQueueCell *cell;
+
+	if (queue->type == IMX_DMA_BUFFER_QUEUE_TYPE_SPSC)
+	{
+		size_t head = __atomic_load_n(&(queue->head), __ATOMIC_RELAXED);
+
+		if (head == queue->cached_tail)
+		{
+			queue->cached_tail = __atomic_load_n(&(queue->tail), __ATOMIC_ACQUIRE);
+			if (head == queue->cached_tail)
+				return 0;
+		}
+
+		cell = &(queue->cells[head & queue->mask]);
+		*buffer = cell->buffer;
+		if (sync_direction != NULL)
+			*sync_direction = cell->sync_direction;
+
+		__atomic_store_n(&(queue->head), head + 1, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		size_t pos = __atomic_load_n(&(queue->head), __ATOMIC_RELAXED);
+
+		while (1)
+		{
+			intptr_t diff;
+
+			cell = &(queue->cells[pos & queue->mask]);
+			diff = (intptr_t)__atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1);
+
+			if (diff == 0)
+			{
+				if (__atomic_compare_exchange_n(&(queue->head), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+					break;
+			}
+			else if (diff < 0)
+				return 0;
+			else
+				pos = __atomic_load_n(&(queue->head), __ATOMIC_RELAXED);
+		}
+
+		*buffer = cell->buffer;
+		if (sync_direction != NULL)
+			*sync_direction = cell->sync_direction;
+
+		__atomic_store_n(&(cell->sequence), pos + queue->capacity, __ATOMIC_RELEASE);
+	}
+
+	return 1;
+}
@@ -0,0 +1,127 @@
+#ifndef IMXDMABUFFER_QUEUE_H
+#define IMXDMABUFFER_QUEUE_H
+
+#include <stddef.h>
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ImxDmaBufferQueueType: Which threads may access a queue concurrently. */
+typedef enum
+{
+	/* Exactly one producer thread and one consumer thread. */
+	IMX_DMA_BUFFER_QUEUE_TYPE_SPSC,
+	/* Any number of producer and consumer threads. */
+	IMX_DMA_BUFFER_QUEUE_TYPE_MPMC
+}
+ImxDmaBufferQueueType;
+
+
+/* ImxDmaBufferQueueSyncDirection: Cache maintenance that is still pending
+ * for a queued buffer. This is passed along with the buffer so that the
+ * receiving stage knows what it has to do before accessing the buffer.
+ * These flags can be bitwise-OR combined. */
+typedef enum
+{
+	IMX_DMA_BUFFER_QUEUE_SYNC_DIRECTION_NONE = 0,
+	/* A device wrote to the buffer. Before the CPU reads the data, a sync
+	 * session must be started (for example by mapping the buffer for
+	 * reading), so that stale cache lines are invalidated. */
+	IMX_DMA_BUFFER_QUEUE_SYNC_DIRECTION_TO_CPU = (1UL << 0),
+	/* The CPU wrote to the buffer inside a manual sync session that has not
+	 * been stopped yet. Before a device reads the data, the sync session must
+	 * be stopped, so that the data is written back from the caches. */
+	IMX_DMA_BUFFER_QUEUE_SYNC_DIRECTION_TO_DEVICE = (1UL << 1)
+}
+ImxDmaBufferQueueSyncDirection;
+
+
+/* ImxDmaBufferQueue:
+ *
+ * Bounded lock-free queue for handing DMA buffers from one pipeline stage
+ * (thread) to another. Pushing and popping never block and never take locks.
+ *
+ * Each queue has an eventfd for waking up consumers. It becomes readable once
+ * a buffer was pushed after a consumer found the queue empty. This allows for
+ * waiting in poll() / epoll_wait(), together with other file descriptors.
+ * The typical consumer loop pops buffers until the queue is empty, and then
+ * waits until the eventfd is readable. Reading the eventfd is not necessary;
+ * the queue does that. Producers only write to the eventfd if a consumer
+ * found the queue empty, so while the consumer keeps up, no system calls are
+ * made. Wakeups can be spurious, so popping after a wakeup may find the
+ * queue empty.
+ *
+ * Queues do not take ownership of the buffers. Buffers that are still in
+ * the queue when it is freed are not deallocated.
+ */
+typedef struct _ImxDmaBufferQueue ImxDmaBufferQueue;
+
+
+/* Creates a new queue.
+ *
+ * @param type Queue type. SPSC queues are faster than MPMC ones, but must
+ *        only be used by one producer and one consumer thread.
+ * @param capacity Maximum number of buffers in the queue. This is rounded up
+ *        to the next power of two. Must be at least 1.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If creating the queue succeeds, the integer is not modified.
+ * @return Pointer to the newly created queue, or NULL in case of an error.
+ */
+ImxDmaBufferQueue* imx_dma_buffer_queue_new(ImxDmaBufferQueueType type, size_t capacity, int *error);
+
+/* Frees a queue. No thread may access the queue anymore at this point. */
+void imx_dma_buffer_queue_free(ImxDmaBufferQueue *queue);
+
+/* Returns the capacity of the queue (after rounding up). */
+size_t imx_dma_buffer_queue_get_capacity(ImxDmaBufferQueue *queue);
+
+/* Returns the queue's eventfd, for use with poll(), select(), and epoll.
+ * The file descriptor is owned by the queue, and must not be closed or read. */
+int imx_dma_buffer_queue_get_fd(ImxDmaBufferQueue *queue);
+
+/* Pushes a buffer into the queue.
+ *
+ * @param queue Queue to push the buffer into.
+ * @param buffer Buffer to push. Must not be NULL.
+ * @param sync_direction Bitwise OR combination of ImxDmaBufferQueueSyncDirection
+ *        flags describing pending cache maintenance for the buffer.
+ * @return Nonzero if the buffer was pushed, 0 if the queue is full.
+ */
+int imx_dma_buffer_queue_push(ImxDmaBufferQueue *queue, ImxDmaBuffer *buffer, unsigned int sync_direction);
+
+/* Pops a buffer from the queue.
+ *
+ * If the queue is empty, this arms the wakeup, that is, the eventfd becomes
+ * readable once the next buffer is pushed.
+ *
+ * @param queue Queue to pop the buffer from.
+ * @param buffer Pointer to a buffer pointer that is set to the popped buffer.
+ *        Must not be NULL.
+ * @param sync_direction If non-NULL, the sync direction flags that were
+ *        passed to imx_dma_buffer_queue_push() are written here.
+ * @return Nonzero if a buffer was popped, 0 if the queue is empty.
+ */
+int imx_dma_buffer_queue_pop(ImxDmaBufferQueue *queue, ImxDmaBuffer **buffer, unsigned int *sync_direction);
+
+/* Pops a buffer from the queue, and waits until one is pushed if it is empty.
+ *
+ * @param timeout_ms Maximum time to wait, in milliseconds. -1 waits indefinitely.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If the timeout expires, the integer is set to ETIMEDOUT.
+ * @return Nonzero if a buffer was popped, 0 if the timeout expired or an error occurred.
+ */
+int imx_dma_buffer_queue_pop_wait(ImxDmaBufferQueue *queue, ImxDmaBuffer **buffer, unsigned int *sync_direction, int timeout_ms, int *error);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_QUEUE_H */
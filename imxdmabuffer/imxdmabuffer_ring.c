@@ -0,0 +1,245 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_ring.h"
+
+
+struct _ImxDmaBufferRing
+{
+	ImxDmaBuffer *buffer;
+	size_t size;
+	uint8_t *virtual_address;
+	int buffer_mapped;
+
+	/* Written by the producer and consumer threads respectively. They are
+	 * accessed with atomics, and placed in separate cache lines. They are
+	 * 64 bit wide even on 32-bit platforms, so they never wrap around. */
+	uint64_t producer_index __attribute__((aligned(64)));
+	uint64_t consumer_index __attribute__((aligned(64)));
+};
+
+
+ImxDmaBufferRing* imx_dma_buffer_ring_new(ImxDmaBuffer *buffer, int *error)
+{
+	ImxDmaBufferRing *ring;
+	size_t size;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	int fd;
+	int i;
+	void *reserved_region;
+
+	assert(buffer != NULL);
+
+	size = imx_dma_buffer_get_size(buffer);
+	fd = imx_dma_buffer_get_fd(buffer);
+
+	if (fd < 0)
+	{
+		if (error != NULL)
+			*error = ENOTSUP;
+		return NULL;
+	}
+
+	if ((size == 0) || ((size % page_size) != 0))
+	{
+		if (error != NULL)
+			*error = EINVAL;
+		return NULL;
+	}
+
+	if (posix_memalign((void **)&ring, 64, sizeof(ImxDmaBufferRing)) != 0)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	memset(ring, 0, sizeof(ImxDmaBufferRing));
+	ring->buffer = buffer;
+	ring->size = size;
+
+	/* This mapping is not used for accessing the data. It is there
+	 * so that the buffer's sync sessions can be used for the ring. Since
+	 * the data is written through the ring's own mappings, dirty page
+	 * tracking of the buffer's mapping would miss these writes. */
+	if (imx_dma_buffer_map(buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE | IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC | IMX_DMA_BUFFER_MAPPING_FLAG_NO_DIRTY_TRACKING, error) == NULL)
+		goto error;
+	ring->buffer_mapped = 1;
+
+	/* Reserve virtual address space for both mappings first, so that no
+	 * other mapping can end up between them. MAP_FIXED then replaces the
+	 * reserved pages with the buffer mappings. */
+	reserved_region = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (reserved_region == MAP_FAILED)
+	{
+		if (error != NULL)
+			*error = errno;
+		goto error;
+	}
+	ring->virtual_address = (uint8_t *)reserved_region;
+
+	for (i = 0; i < 2; ++i)
+	{
+		void *mapping = mmap(ring->virtual_address + i * size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+		if (mapping == MAP_FAILED)
+		{
+			if (error != NULL)
+				*error = errno;
+			goto error;
+		}
+	}
+
+	return ring;
+
+error:
+	imx_dma_buffer_ring_free(ring);
+	return NULL;
+}
+
+
+void imx_dma_buffer_ring_free(ImxDmaBufferRing *ring)
+{
+	assert(ring != NULL);
+
+	/* This also removes the remaining reserved pages if creating
+	 * one of the two mappings failed. */
+	if (ring->virtual_address != NULL)
+		munmap(ring->virtual_address, ring->size * 2);
+
+	if (ring->buffer_mapped)
+		imx_dma_buffer_unmap(ring->buffer);
+
+	free(ring);
+}
+
+
+ImxDmaBuffer* imx_dma_buffer_ring_get_buffer(ImxDmaBufferRing *ring)
+{
+	assert(ring != NULL);
+	return ring->buffer;
+}
+
+
+size_t imx_dma_buffer_ring_get_size(ImxDmaBufferRing *ring)
+{
+	assert(ring != NULL);
+	return ring->size;
+}
+
+
+uint8_t* imx_dma_buffer_ring_get_virtual_address(ImxDmaBufferRing *ring)
+{
+	assert(ring != NULL);
+	return ring->virtual_address;
+}
+
+
+uint64_t imx_dma_buffer_ring_get_producer_index(ImxDmaBufferRing *ring)
+{
+	assert(ring != NULL);
+	return __atomic_load_n(&(ring->producer_index), __ATOMIC_ACQUIRE);
+}
+
+
+uint64_t imx_dma_buffer_ring_get_consumer_index(ImxDmaBufferRing *ring)
+{
+	assert(ring != NULL);
+	return __atomic_load_n(&(ring->consumer_index), __ATOMIC_ACQUIRE);
+}
+
+
+size_t imx_dma_buffer_ring_get_fill_level(ImxDmaBufferRing *ring)
+{
+	assert(ring != NULL);
+	return (size_t)(imx_dma_buffer_ring_get_producer_index(ring) - imx_dma_buffer_ring_get_consumer_index(ring));
+}
+
+
+uint8_t* imx_dma_buffer_ring_get_write_pointer(ImxDmaBufferRing *ring, size_t *available_space)
+{
+	uint64_t producer_index;
+
+	assert(ring != NULL);
+
+	producer_index = __atomic_load_n(&(ring->producer_index), __ATOMIC_RELAXED);
+	if (available_space != NULL)
+		*available_space = ring->size - (size_t)(producer_index - __atomic_load_n(&(ring->consumer_index), __ATOMIC_ACQUIRE));
+
+	return ring->virtual_address + (size_t)(producer_index % ring->size);
+}
+
+
+void imx_dma_buffer_ring_produce(ImxDmaBufferRing *ring, size_t length)
+{
+	uint64_t producer_index;
+
+	assert(ring != NULL);
+
+	producer_index = __atomic_load_n(&(ring->producer_index), __ATOMIC_RELAXED);
+	assert((producer_index + length - __atomic_load_n(&(ring->consumer_index), __ATOMIC_ACQUIRE)) <= ring->size);
+
+	__atomic_store_n(&(ring->producer_index), producer_index + length, __ATOMIC_RELEASE);
+}
+
+
+uint8_t* imx_dma_buffer_ring_get_read_pointer(ImxDmaBufferRing *ring, size_t *available_data)
+{
+	uint64_t consumer_index;
+
+	assert(ring != NULL);
+
+	consumer_index = __atomic_load_n(&(ring->consumer_index), __ATOMIC_RELAXED);
+	if (available_data != NULL)
+		*available_data = (size_t)(__atomic_load_n(&(ring->producer_index), __ATOMIC_ACQUIRE) - consumer_index);
+
+	return ring->virtual_address + (size_t)(consumer_index % ring->size);
+}
+
+
+void imx_dma_buffer_ring_consume(ImxDmaBufferRing *ring, size_t length)
+{
+	uint64_t consumer_index;
+
+	assert(ring != NULL);
+
+	consumer_index = __atomic_load_n(&(ring->consumer_index), __ATOMIC_RELAXED);
+	assert(length <= (__atomic_load_n(&(ring->producer_index), __ATOMIC_ACQUIRE) - consumer_index));
+
+	__atomic_store_n(&(ring->consumer_index), consumer_index + length, __ATOMIC_RELEASE);
+}
+
+
+unsigned int imx_dma_buffer_ring_get_physical_ranges(ImxDmaBufferRing *ring, uint64_t index, size_t length, ImxDmaBufferRingPhysicalRange ranges[2])
+{
+	imx_physical_address_t physical_address;
+	size_t offset;
+
+	assert(ring != NULL);
+	assert(length <= ring->size);
+	assert(ranges != NULL);
+
+	if (length == 0)
+		return 0;
+
+	physical_address = imx_dma_buffer_get_physical_address(ring->buffer);
+	offset = (size_t)(index % ring->size);
+
+	ranges[0].physical_address = physical_address + offset;
+	if ((offset + length) <= ring->size)
+	{
+		ranges[0].length = length;
+		return 1;
+	}
+
+	ranges[0].length = ring->size - offset;
+	ranges[1].physical_address = physical_address;
+	ranges[1].length = length - ranges[0].length;
+	return 2;
+}
@@ -0,0 +1,135 @@
+#ifndef IMXDMABUFFER_RING_H
+#define IMXDMABUFFER_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ImxDmaBufferRing:
+ *
+ * Circular buffer in DMA memory whose wrapping ranges are contiguous for the
+ * CPU. The DMA buffer is mapped twice, back to back, into one reserved region
+ * of virtual address space. Writing past the end of the first mapping thus
+ * writes to the beginning of the buffer, and a packet that wraps around the
+ * end of the ring can be read and written with one memcpy(), without being
+ * split or copied into a linear scratch buffer.
+ *
+ * This requires a buffer that can be mapped through its file descriptor, like
+ * the DMA-BUF FDs of the dma-heap and ION allocators. The buffer size must be
+ * a multiple of the page size.
+ *
+ * The ring has a producer index and a consumer index. These are 64-bit byte
+ * counters that only ever grow; the position in the buffer is the index
+ * modulo the ring size. The amount of data in the ring is the producer index
+ * minus the consumer index. One producer thread and one consumer thread may
+ * access the ring concurrently. Devices cannot use the virtual mapping, so ranges are
+ * also available as pairs of physical address and length. A range that wraps
+ * around consists of two such pairs.
+ *
+ * The ring keeps the buffer mapped with IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC
+ * while it exists. The CPU caches are shared by both mappings of the ring and
+ * by the buffer's own mapping, so imx_dma_buffer_start_sync_session() and
+ * imx_dma_buffer_stop_sync_session() on the ring's buffer are used for
+ * synchronizing CPU and device access. These always sync the whole buffer,
+ * even if dirty page tracking is enabled for the buffer's allocator (see
+ * imx_dma_buffer_dma_heap_allocator_enable_dirty_page_tracking()), since the
+ * writes through the ring's mappings are not visible to that tracking.
+ */
+typedef struct _ImxDmaBufferRing ImxDmaBufferRing;
+
+/* Physical address range, for passing ring ranges to devices. */
+typedef struct
+{
+	imx_physical_address_t physical_address;
+	size_t length;
+}
+ImxDmaBufferRingPhysicalRange;
+
+
+/* Creates a new ring on top of the given DMA buffer.
+ *
+ * The ring does not take ownership of the buffer. The buffer must not be
+ * deallocated before the ring is freed.
+ *
+ * @param buffer DMA buffer to use for the ring. It must have a file descriptor
+ *        that can be mapped, and its size must be a multiple of the page size.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If the buffer has no file descriptor, the error code is ENOTSUP.
+ *        If creating the ring succeeds, the integer is not modified.
+ * @return Pointer to the newly created ring, or NULL in case of an error.
+ */
+ImxDmaBufferRing* imx_dma_buffer_ring_new(ImxDmaBuffer *buffer, int *error);
+
+/* Frees a ring, and unmaps the buffer. */
+void imx_dma_buffer_ring_free(ImxDmaBufferRing *ring);
+
+/* Returns the buffer the ring was created with. */
+ImxDmaBuffer* imx_dma_buffer_ring_get_buffer(ImxDmaBufferRing *ring);
+
+/* Returns the size of the ring, in bytes. This is the size of the buffer. */
+size_t imx_dma_buffer_ring_get_size(ImxDmaBufferRing *ring);
+
+/* Returns the start of the double mapping. It is twice the ring size long. */
+uint8_t* imx_dma_buffer_ring_get_virtual_address(ImxDmaBufferRing *ring);
+
+/* Returns the producer index, that is, the total number of bytes written so far. */
+uint64_t imx_dma_buffer_ring_get_producer_index(ImxDmaBufferRing *ring);
+
+/* Returns the consumer index, that is, the total number of bytes consumed so far. */
+uint64_t imx_dma_buffer_ring_get_consumer_index(ImxDmaBufferRing *ring);
+
+/* Returns the number of bytes that were produced, but not consumed yet. */
+size_t imx_dma_buffer_ring_get_fill_level(ImxDmaBufferRing *ring);
+
+/* Returns a pointer to where the producer writes next.
+ *
+ * @param ring Ring to write to.
+ * @param available_space If non-NULL, the number of bytes that can be written
+ *        is written here. All of them are contiguous starting at the pointer.
+ * @return Pointer to the position of the producer index.
+ */
+uint8_t* imx_dma_buffer_ring_get_write_pointer(ImxDmaBufferRing *ring, size_t *available_space);
+
+/* Advances the producer index, making written data available to the consumer.
+ * length must not exceed the available space. */
+void imx_dma_buffer_ring_produce(ImxDmaBufferRing *ring, size_t length);
+
+/* Returns a pointer to where the consumer reads next.
+ *
+ * @param ring Ring to read from.
+ * @param available_data If non-NULL, the number of bytes that can be read is
+ *        written here. All of them are contiguous starting at the pointer.
+ * @return Pointer to the position of the consumer index.
+ */
+uint8_t* imx_dma_buffer_ring_get_read_pointer(ImxDmaBufferRing *ring, size_t *available_data);
+
+/* Advances the consumer index, making space available to the producer again.
+ * length must not exceed the fill level. */
+void imx_dma_buffer_ring_consume(ImxDmaBufferRing *ring, size_t length);
+
+/* Gets the physical address ranges of a part of the ring, for device access.
+ *
+ * @param ring Ring to get physical address ranges of.
+ * @param index Producer or consumer style index of the first byte. Only
+ *        index modulo the ring size is relevant.
+ * @param length Length of the part, in bytes. Must not exceed the ring size.
+ * @param ranges Array that is filled with the ranges.
+ * @return Number of ranges: 1, or 2 if the part wraps around the end of the
+ *         buffer. If length is 0, 0 is returned.
+ */
+unsigned int imx_dma_buffer_ring_get_physical_ranges(ImxDmaBufferRing *ring, uint64_t index, size_t length, ImxDmaBufferRingPhysicalRange ranges[2]);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_RING_H */
@@ -0,0 +1,441 @@
+/* Needed for recvmmsg(). */
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_rtp_ingest.h"
+
+
+/* Size of the fixed part of the RTP header. */
+#define RTP_HEADER_SIZE 12
+
+
+typedef struct
+{
+	uint8_t *payload;
+	size_t length;
+	uint32_t timestamp;
+	uint16_t sequence_number;
+	int marker;
+}
+ImxDmaBufferRtpPacket;
+
+
+typedef enum
+{
+	PACKET_ADDED,
+	PACKET_COMPLETED_FRAME,
+	PACKET_BELONGS_TO_NEXT_FRAME
+}
+PacketResult;
+
+
+struct _ImxDmaBufferRtpIngest
+{
+	int socket_fd;
+	ImxDmaBufferAllocator *allocator;
+	size_t frame_buffer_size;
+	/* Space for the part of a packet that follows the fixed RTP header. */
+	size_t slot_size;
+	unsigned int batch_size;
+
+	/* recvmmsg() arguments. Each message has two iovecs: one for
+	 * the fixed RTP header, and one for the rest of the packet. */
+	struct mmsghdr *messages;
+	struct iovec *iovecs;
+	uint8_t *headers;
+
+	/* Slots for receiving packets if the frame buffer is almost full,
+	 * and for reordering packets that arrived out of order. */
+	uint8_t *scratch;
+
+	ImxDmaBufferRtpPacket *packets;
+	unsigned int *order;
+
+	/* Packets that were received as part of a batch, but belong to the
+	 * next frame. Their payloads are copied into carry_data. */
+	uint8_t *carry_data;
+	ImxDmaBufferRtpPacket *carried_packets;
+	unsigned int num_carried_packets;
+	unsigned int carry_read_index;
+
+	/* Frame that is currently being assembled. */
+	ImxDmaBuffer *frame_buffer;
+	uint8_t *frame_virtual_address;
+	size_t frame_size;
+	uint32_t frame_timestamp;
+	int frame_has_timestamp;
+	unsigned int frame_flags;
+
+	uint16_t expected_sequence_number;
+	int has_expected_sequence_number;
+};
+
+
+static PacketResult imx_dma_buffer_rtp_ingest_add_packet(ImxDmaBufferRtpIngest *ingest, ImxDmaBufferRtpPacket const *packet);
+static int imx_dma_buffer_rtp_ingest_receive_batch(ImxDmaBufferRtpIngest *ingest, int *error);
+static void imx_dma_buffer_rtp_ingest_carry_packets(ImxDmaBufferRtpIngest *ingest, unsigned int first_order_index, unsigned int num_packets);
+
+
+ImxDmaBufferRtpIngest* imx_dma_buffer_rtp_ingest_new(int socket_fd, ImxDmaBufferAllocator *allocator, size_t frame_buffer_size, size_t max_packet_size, unsigned int batch_size, int *error)
+{
+	ImxDmaBufferRtpIngest *ingest;
+
+	assert(socket_fd >= 0);
+	assert(allocator != NULL);
+	assert(max_packet_size > RTP_HEADER_SIZE);
+	assert(batch_size >= 1);
+
+	ingest = (ImxDmaBufferRtpIngest *)malloc(sizeof(ImxDmaBufferRtpIngest));
+	if (ingest == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	memset(ingest, 0, sizeof(ImxDmaBufferRtpIngest));
+
+	ingest->socket_fd = socket_fd;
+	ingest->allocator = allocator;
+	ingest->frame_buffer_size = frame_buffer_size;
+	ingest->slot_size = max_packet_size - RTP_HEADER_SIZE;
+	ingest->batch_size = batch_size;
+
+	ingest->messages = (struct mmsghdr *)malloc(sizeof(struct mmsghdr) * batch_size);
+	ingest->iovecs = (struct iovec *)malloc(sizeof(struct iovec) * 2 * batch_size);
+	ingest->headers = (uint8_t *)malloc(RTP_HEADER_SIZE * batch_size);
+	ingest->scratch = (uint8_t *)malloc(ingest->slot_size * batch_size);
+	ingest->packets = (ImxDmaBufferRtpPacket *)malloc(sizeof(ImxDmaBufferRtpPacket) * batch_size);
+	ingest->order = (unsigned int *)malloc(sizeof(unsigned int) * batch_size);
+	ingest->carry_data = (uint8_t *)malloc(ingest->slot_size * batch_size);
+	ingest->carried_packets = (ImxDmaBufferRtpPacket *)malloc(sizeof(ImxDmaBufferRtpPacket) * batch_size);
+
+	if ((ingest->messages == NULL) || (ingest->iovecs == NULL) || (ingest->headers == NULL)
+	 || (ingest->scratch == NULL) || (ingest->packets == NULL) || (ingest->order == NULL)
+	 || (ingest->carry_data == NULL) || (ingest->carried_packets == NULL))
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		imx_dma_buffer_rtp_ingest_free(ingest);
+		return NULL;
+	}
+
+	return ingest;
+}
+
+
+void imx_dma_buffer_rtp_ingest_free(ImxDmaBufferRtpIngest *ingest)
+{
+	assert(ingest != NULL);
+
+	if (ingest->frame_buffer != NULL)
+	{
+		imx_dma_buffer_unmap(ingest->frame_buffer);
+		imx_dma_buffer_deallocate(ingest->frame_buffer);
+	}
+
+	free(ingest->messages);
+	free(ingest->iovecs);
+	free(ingest->headers);
+	free(ingest->scratch);
+	free(ingest->packets);
+	free(ingest->order);
+	free(ingest->carry_data);
+	free(ingest->carried_packets);
+	free(ingest);
+}
+
+
+ImxDmaBuffer* imx_dma_buffer_rtp_ingest_receive_frame(ImxDmaBufferRtpIngest *ingest, size_t *frame_size, uint32_t *rtp_timestamp, unsigned int *frame_flags, int *error)
+{
+	ImxDmaBuffer *frame_buffer;
+	int frame_complete = 0;
+
+	assert(ingest != NULL);
+	assert(frame_size != NULL);
+
+	if (ingest->frame_buffer == NULL)
+	{
+		ingest->frame_buffer = imx_dma_buffer_allocate(ingest->allocator, ingest->frame_buffer_size, 1, error);
+		if (ingest->frame_buffer == NULL)
+			return NULL;
+
+		/* Reading is necessary as well, since payloads are moved in place. */
+		ingest->frame_virtual_address = imx_dma_buffer_map(ingest->frame_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, error);
+		if (ingest->frame_virtual_address == NULL)
+		{
+			imx_dma_buffer_deallocate(ingest->frame_buffer);
+			ingest->frame_buffer = NULL;
+			return NULL;
+		}
+
+		ingest->frame_size = 0;
+		ingest->frame_has_timestamp = 0;
+		ingest->frame_flags = 0;
+	}
+
+	/* First place packets that were received together with the previous frame. */
+	while (!frame_complete && (ingest->carry_read_index < ingest->num_carried_packets))
+	{
+		switch (imx_dma_buffer_rtp_ingest_add_packet(ingest, &(ingest->carried_packets[ingest->carry_read_index])))
+		{
+			case PACKET_ADDED:
+				ingest->carry_read_index++;
+				break;
+			case PACKET_COMPLETED_FRAME:
+				ingest->carry_read_index++;
+				frame_complete = 1;
+				break;
+			case PACKET_BELONGS_TO_NEXT_FRAME:
+				frame_complete = 1;
+				break;
+		}
+	}
+
+	while (!frame_complete)
+	{
+		frame_complete = imx_dma_buffer_rtp_ingest_receive_batch(ingest, error);
+		if (frame_complete < 0)
+			return NULL;
+	}
+
+	frame_buffer = ingest->frame_buffer;
+	imx_dma_buffer_unmap(frame_buffer);
+	ingest->frame_buffer = NULL;
+
+	*frame_size = ingest->frame_size;
+	if (rtp_timestamp != NULL)
+		*rtp_timestamp = ingest->frame_timestamp;
+	if (frame_flags != NULL)
+		*frame_flags = ingest->frame_flags;
+
+	return frame_buffer;
+}
+
+
+static PacketResult imx_dma_buffer_rtp_ingest_add_packet(ImxDmaBufferRtpIngest *ingest, ImxDmaBufferRtpPacket const *packet)
+{
+	int16_t sequence_delta = 0;
+
+	if (ingest->has_expected_sequence_number)
+	{
+		sequence_delta = (int16_t)(packet->sequence_number - ingest->expected_sequence_number);
+
+		/* Packets that arrive after their successors were placed
+		 * already, and duplicates, cannot be used anymore. */
+		if (sequence_delta < 0)
+			return PACKET_ADDED;
+	}
+
+	if (ingest->frame_has_timestamp && (packet->timestamp != ingest->frame_timestamp))
+	{
+		/* The marker packet of this frame was lost. */
+		ingest->frame_flags |= IMX_DMA_BUFFER_RTP_INGEST_FRAME_FLAG_DISCONTINUITY;
+		return PACKET_BELONGS_TO_NEXT_FRAME;
+	}
+
+	if (sequence_delta > 0)
+		ingest->frame_flags |= IMX_DMA_BUFFER_RTP_INGEST_FRAME_FLAG_DISCONTINUITY;
+
+	ingest->expected_sequence_number = packet->sequence_number + 1;
+	ingest->has_expected_sequence_number = 1;
+	ingest->frame_timestamp = packet->timestamp;
+	ingest->frame_has_timestamp = 1;
+
+	if ((ingest->frame_size + packet->length) <= ingest->frame_buffer_size)
+	{
+		uint8_t *dest = ingest->frame_virtual_address + ingest->frame_size;
+		/* With in-place reception, the payload is at or after its final
+		 * position, and only needs to be moved if there were gaps. */
+		if (packet->payload != dest)
+			memmove(dest, packet->payload, packet->length);
+		ingest->frame_size += packet->length;
+	}
+	else
+		ingest->frame_flags |= IMX_DMA_BUFFER_RTP_INGEST_FRAME_FLAG_TRUNCATED;
+
+	return packet->marker ? PACKET_COMPLETED_FRAME : PACKET_ADDED;
+}
+
+
+/* Returns 1 if the frame was completed, 0 if not, and -1 in case of an error. */
+static int imx_dma_buffer_rtp_ingest_receive_batch(ImxDmaBufferRtpIngest *ingest, int *error)
+{
+	unsigned int i, num_messages, num_packets;
+	int ret;
+	int in_place;
+	int in_order = 1;
+	uint8_t *slots;
+
+	/* Receive into the frame buffer, right after the data assembled so far,
+	 * if all slots fit. Otherwise, receive into scratch slots; their payloads
+	 * are then copied into the frame buffer as far as there is space. */
+	num_messages = (ingest->frame_buffer_size - ingest->frame_size) / ingest->slot_size;
+	if (num_messages > ingest->batch_size)
+		num_messages = ingest->batch_size;
+	in_place = (num_messages > 0);
+	if (in_place)
+		slots = ingest->frame_virtual_address + ingest->frame_size;
+	else
+	{
+		num_messages = ingest->batch_size;
+		slots = ingest->scratch;
+	}
+
+	memset(ingest->messages, 0, sizeof(struct mmsghdr) * num_messages);
+	for (i = 0; i < num_messages; ++i)
+	{
+		struct iovec *iovecs = &(ingest->iovecs[i * 2]);
+
+		iovecs[0].iov_base = ingest->headers + i * RTP_HEADER_SIZE;
+		iovecs[0].iov_len = RTP_HEADER_SIZE;
+		iovecs[1].iov_base = slots + i * ingest->slot_size;
+		iovecs[1].iov_len = ingest->slot_size;
+
+		ingest->messages[i].msg_hdr.msg_iov = iovecs;
+		ingest->messages[i].msg_hdr.msg_iovlen = 2;
+	}
+
+	/* Block until at least one packet arrived, then take
+	 * whatever else is already queued, without blocking. */
+	do
+	{
+		ret = recvmmsg(ingest->socket_fd, ingest->messages, num_messages, MSG_WAITFORONE, NULL);
+	}
+	while ((ret < 0) && (errno == EINTR));
+
+	if (ret < 0)
+	{
+		if (error != NULL)
+			*error = errno;
+		return -1;
+	}
+
+	/* Parse the headers, and find out where the payloads are. */
+	num_packets = 0;
+	for (i = 0; i < (unsigned int)ret; ++i)
+	{
+		uint8_t const *header = ingest->headers + i * RTP_HEADER_SIZE;
+		uint8_t *slot = slots + i * ingest->slot_size;
+		size_t length = ingest->messages[i].msg_len;
+		size_t header_extra_size;
+		size_t padding_size = 0;
+		ImxDmaBufferRtpPacket *packet = &(ingest->packets[num_packets]);
+
+		if (ingest->messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+		{
+			ingest->frame_flags |= IMX_DMA_BUFFER_RTP_INGEST_FRAME_FLAG_TRUNCATED;
+			continue;
+		}
+
+		/* Only RTP version 2 exists. Anything else is not RTP. */
+		if ((length < RTP_HEADER_SIZE) || ((header[0] >> 6) != 2))
+			continue;
+		length -= RTP_HEADER_SIZE;
+
+		/* The CSRC list and the header extension were received into the
+		 * slot, in front of the payload. */
+		header_extra_size = (header[0] & 0x0F) * 4;
+		if (header[0] & 0x10)
+		{
+			if (length < (header_extra_size + 4))
+				continue;
+			header_extra_size += 4 + ((((size_t)(slot[header_extra_size + 2])) << 8) | slot[header_extra_size + 3]) * 4;
+		}
+		if (length < header_extra_size)
+			continue;
+		length -= header_extra_size;
+
+		/* The last byte of the padding contains the padding size. */
+		if ((header[0] & 0x20) && (length > 0))
+		{
+			padding_size = slot[header_extra_size + length - 1];
+			if (padding_size > length)
+				continue;
+		}
+		length -= padding_size;
+
+		packet->payload = slot + header_extra_size;
+		packet->length = length;
+		packet->marker = (header[1] & 0x80) != 0;
+		packet->sequence_number = (((uint16_t)(header[2])) << 8) | header[3];
+		packet->timestamp = (((uint32_t)(header[4])) << 24) | (((uint32_t)(header[5])) << 16) | (((uint32_t)(header[6])) << 8) | header[7];
+
+		/* Insertion sort by sequence number. Batches are small, and
+		 * usually already sorted, in which case this is O(n). */
+		{
+			unsigned int j = num_packets;
+			while ((j > 0) && (((int16_t)(packet->sequence_number - ingest->packets[ingest->order[j - 1]].sequence_number)) < 0))
+			{
+				ingest->order[j] = ingest->order[j - 1];
+				j--;
+				in_order = 0;
+			}
+			ingest->order[j] = num_packets;
+		}
+
+		num_packets++;
+	}
+
+	/* Moving payloads together in place only works if they are placed in
+	 * the order they were received in. Otherwise, a payload might overwrite
+	 * one that was not placed yet. Move the payloads out of the way first. */
+	if (in_place && !in_order)
+	{
+		for (i = 0; i < num_packets; ++i)
+		{
+			uint8_t *copy = ingest->scratch + i * ingest->slot_size;
+			memcpy(copy, ingest->packets[i].payload, ingest->packets[i].length);
+			ingest->packets[i].payload = copy;
+		}
+	}
+
+	for (i = 0; i < num_packets; ++i)
+	{
+		switch (imx_dma_buffer_rtp_ingest_add_packet(ingest, &(ingest->packets[ingest->order[i]])))
+		{
+			case PACKET_ADDED:
+				break;
+			case PACKET_COMPLETED_FRAME:
+				imx_dma_buffer_rtp_ingest_carry_packets(ingest, i + 1, num_packets - (i + 1));
+				return 1;
+			case PACKET_BELONGS_TO_NEXT_FRAME:
+				imx_dma_buffer_rtp_ingest_carry_packets(ingest, i, num_packets - i);
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+static void imx_dma_buffer_rtp_ingest_carry_packets(ImxDmaBufferRtpIngest *ingest, unsigned int first_order_index, unsigned int num_packets)
+{
+	unsigned int i;
+	uint8_t *dest = ingest->carry_data;
+
+	/* Batches are only received once all carried packets were placed. */
+	assert(ingest->carry_read_index == ingest->num_carried_packets);
+
+	for (i = 0; i < num_packets; ++i)
+	{
+		ImxDmaBufferRtpPacket *packet = &(ingest->carried_packets[i]);
+
+		*packet = ingest->packets[ingest->order[first_order_index + i]];
+		memcpy(dest, packet->payload, packet->length);
+		packet->payload = dest;
+		dest += packet->length;
+	}
+
+	ingest->num_carried_packets = num_packets;
+	ingest->carry_read_index = 0;
+}
@@ -0,0 +1,111 @@
+#ifndef IMXDMABUFFER_RTP_INGEST_H
+#define IMXDMABUFFER_RTP_INGEST_H
+
+#include <stdint.h>
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ImxDmaBufferRtpIngestFrameFlags: Flags describing a received frame.
+ * These flags can be bitwise-OR combined. */
+typedef enum
+{
+	/* Packets of this frame (or of the end of the previous frame) were lost,
+	 * or arrived too late to be placed. The frame is incomplete. */
+	IMX_DMA_BUFFER_RTP_INGEST_FRAME_FLAG_DISCONTINUITY = (1UL << 0),
+	/* The frame did not fit into the frame buffer, or a packet was larger
+	 * than max_packet_size. Data is missing at the end of the frame. */
+	IMX_DMA_BUFFER_RTP_INGEST_FRAME_FLAG_TRUNCATED = (1UL << 1)
+}
+ImxDmaBufferRtpIngestFrameFlags;
+
+
+/* ImxDmaBufferRtpIngest:
+ *
+ * Receives RTP packets from a UDP socket and assembles their payloads
+ * into DMA buffers, one buffer per frame.
+ *
+ * Packets are received in batches with recvmmsg(). The RTP header of each
+ * packet goes into a small header array, and the rest of the packet is
+ * received straight into the frame's DMA buffer, right after the data
+ * assembled so far. Afterwards, the payloads are moved together in place
+ * to remove the space left by CSRC lists, header extensions, padding, and
+ * short packets. The payload data is therefore not copied from heap memory
+ * into the DMA buffer at all; the only copies are small in-place moves.
+ * Packets that arrive out of order within a batch are put in sequence order
+ * (this requires copying the batch once), packets that arrive in a later
+ * batch than their successors are dropped.
+ *
+ * A frame ends with the packet that has the RTP marker bit set. If the
+ * marker packet is lost, the frame ends when a packet with a different RTP
+ * timestamp arrives. Packets that belong to the next frame are kept and
+ * placed in the next frame's buffer.
+ *
+ * The payloads are concatenated as they are. Payload formats that need
+ * depacketization (like fragmented H.264 NAL units) must be handled by the
+ * user, or by the sender choosing a format that does not need it.
+ *
+ * Ingest objects are not thread safe.
+ */
+typedef struct _ImxDmaBufferRtpIngest ImxDmaBufferRtpIngest;
+
+
+/* Creates a new RTP ingest object.
+ *
+ * @param socket_fd UDP socket to receive RTP packets from. The ingest object
+ *        does not take ownership of the socket. If the socket is non-blocking
+ *        or has a receive timeout, imx_dma_buffer_rtp_ingest_receive_frame()
+ *        may return without a frame (see its documentation).
+ * @param allocator Allocator to allocate the frame buffers with. Using a pool
+ *        allocator avoids allocating new DMA memory for every frame. The
+ *        ingest object does not take ownership of the allocator.
+ * @param frame_buffer_size Size of the frame buffers, in bytes.
+ * @param max_packet_size Maximum size of a packet, including the RTP header,
+ *        in bytes. Larger packets are truncated. Must be larger than 12.
+ * @param batch_size Maximum number of packets to receive with one recvmmsg()
+ *        call. Must be at least 1.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If creating the ingest object succeeds, the integer is not modified.
+ * @return Pointer to the newly created ingest object, or NULL in case of an error.
+ */
+ImxDmaBufferRtpIngest* imx_dma_buffer_rtp_ingest_new(int socket_fd, ImxDmaBufferAllocator *allocator, size_t frame_buffer_size, size_t max_packet_size, unsigned int batch_size, int *error);
+
+/* Frees an RTP ingest object. A frame that is still being assembled is discarded. */
+void imx_dma_buffer_rtp_ingest_free(ImxDmaBufferRtpIngest *ingest);
+
+/* Receives packets until a frame is complete, and returns the frame's buffer.
+ *
+ * The buffer is unmapped before it is returned, so the automatic sync session
+ * has already made the data visible to devices. The caller takes ownership of
+ * the buffer, and must deallocate it with imx_dma_buffer_deallocate().
+ *
+ * If receiving fails, NULL is returned, and the frame that is being assembled
+ * is kept. Calling this function again continues assembling it. This way,
+ * non-blocking sockets and receive timeouts can be used; then, EAGAIN is
+ * reported if no complete frame is available.
+ *
+ * @param ingest Ingest object to receive the frame with.
+ * @param frame_size Pointer to an integer that is set to the size of the frame
+ *        data, in bytes. Must not be NULL.
+ * @param rtp_timestamp If non-NULL, the RTP timestamp of the frame is written here.
+ * @param frame_flags If non-NULL, a bitwise OR combination of
+ *        ImxDmaBufferRtpIngestFrameFlags is written here.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If receiving succeeds, the integer is not modified.
+ * @return DMA buffer containing the frame, or NULL in case of an error.
+ */
+ImxDmaBuffer* imx_dma_buffer_rtp_ingest_receive_frame(ImxDmaBufferRtpIngest *ingest, size_t *frame_size, uint32_t *rtp_timestamp, unsigned int *frame_flags, int *error);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_RTP_INGEST_H */
@@ -0,0 +1,184 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "imxdmabuffer_slab_priv.h"
+
+
+#define IMX_DMA_BUFFER_SLAB_CACHE_LINE_SIZE 64
+
+#define SLAB_HEAD_INDEX(HEAD) ((uint32_t)((HEAD) & 0xFFFFFFFFu))
+#define SLAB_HEAD_TAG(HEAD) ((uint32_t)((HEAD) >> 32))
+#define SLAB_MAKE_HEAD(TAG, INDEX) ((((uint64_t)(TAG)) << 32) | ((uint64_t)(INDEX)))
+
+
+/* Each slot contains the object, followed by padding, with the object's
+ * index (plus 1) in the last 4 bytes of the slot. That way, freeing an
+ * object does not have to search the chunks. While an object is in the
+ * free list, its first 4 bytes contain the index (plus 1) of the next
+ * free object, or 0 if it is the last one. */
+
+
+static uint8_t* imx_dma_buffer_slab_get_slot(ImxDmaBufferSlab *slab, uint32_t index)
+{
+	/* The chunk table and chunk pointers are published before any index
+	 * that refers to them is pushed to the free list, so they are valid here. */
+	uint8_t **chunks = __atomic_load_n(&(slab->chunks), __ATOMIC_ACQUIRE);
+	return chunks[index / IMX_DMA_BUFFER_SLAB_OBJECTS_PER_CHUNK] + (index % IMX_DMA_BUFFER_SLAB_OBJECTS_PER_CHUNK) * slab->slot_size;
+}
+
+
+static uint32_t* imx_dma_buffer_slab_get_index_trailer(ImxDmaBufferSlab *slab, uint8_t *slot)
+{
+	return (uint32_t *)(slot + slab->slot_size - sizeof(uint32_t));
+}
+
+
+/* Pushes a chain of objects to the free list. The chain's objects except for
+ * the last one must already be linked with each other. */
+static void imx_dma_buffer_slab_push(ImxDmaBufferSlab *slab, uint8_t *last_slot, uint32_t first_index_plus_1)
+{
+	uint64_t old_head, new_head;
+
+	old_head = __atomic_load_n(&(slab->free_list_head), __ATOMIC_RELAXED);
+	do
+	{
+		__atomic_store_n((uint32_t *)last_slot, SLAB_HEAD_INDEX(old_head), __ATOMIC_RELAXED);
+		new_head = SLAB_MAKE_HEAD(SLAB_HEAD_TAG(old_head) + 1, first_index_plus_1);
+	}
+	while (!__atomic_compare_exchange_n(&(slab->free_list_head), &old_head, new_head, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+static void* imx_dma_buffer_slab_pop(ImxDmaBufferSlab *slab)
+{
+	uint64_t old_head, new_head;
+	uint8_t *slot;
+
+	old_head = __atomic_load_n(&(slab->free_list_head), __ATOMIC_ACQUIRE);
+	do
+	{
+		if (SLAB_HEAD_INDEX(old_head) == 0)
+			return NULL;
+
+		/* Another thread may pop this object and write to it before our
+		 * CAS below. The value read here is then stale, but the tag makes
+		 * the CAS fail in that case, and chunks are never freed while the
+		 * slab is in use, so the read itself is always safe. */
+		slot = imx_dma_buffer_slab_get_slot(slab, SLAB_HEAD_INDEX(old_head) - 1);
+		new_head = SLAB_MAKE_HEAD(SLAB_HEAD_TAG(old_head) + 1, __atomic_load_n((uint32_t *)slot, __ATOMIC_RELAXED));
+	}
+	while (!__atomic_compare_exchange_n(&(slab->free_list_head), &old_head, new_head, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+	return slot;
+}
+
+
+void imx_dma_buffer_slab_init(ImxDmaBufferSlab *slab, size_t object_size)
+{
+	assert(slab != NULL);
+	assert(object_size > 0);
+
+	memset(slab, 0, sizeof(ImxDmaBufferSlab));
+	slab->slot_size = (object_size + sizeof(uint32_t) + IMX_DMA_BUFFER_SLAB_CACHE_LINE_SIZE - 1) & ~((size_t)(IMX_DMA_BUFFER_SLAB_CACHE_LINE_SIZE - 1));
+	pthread_mutex_init(&(slab->grow_mutex), NULL);
+}
+
+
+void imx_dma_buffer_slab_cleanup(ImxDmaBufferSlab *slab)
+{
+	unsigned int i;
+
+	assert(slab != NULL);
+
+	for (i = 0; i < slab->num_chunks; ++i)
+		free(slab->chunks[i]);
+	free(slab->chunks);
+
+	slab->chunks = NULL;
+	slab->num_chunks = 0;
+	slab->free_list_head = 0;
+
+	pthread_mutex_destroy(&(slab->grow_mutex));
+}
+
+
+void* imx_dma_buffer_slab_alloc(ImxDmaBufferSlab *slab)
+{
+	void *object;
+	void *chunk_memory;
+	uint8_t *chunk;
+	uint32_t first_index;
+	unsigned int i;
+
+	assert(slab != NULL);
+
+	object = imx_dma_buffer_slab_pop(slab);
+	if (object != NULL)
+		return object;
+
+	pthread_mutex_lock(&(slab->grow_mutex));
+
+	/* Another thread may have added a chunk while we waited for the mutex. */
+	object = imx_dma_buffer_slab_pop(slab);
+	if (object != NULL)
+		goto finish;
+
+	if (slab->num_chunks >= IMX_DMA_BUFFER_SLAB_MAX_NUM_CHUNKS)
+		goto finish;
+
+	if (slab->chunks == NULL)
+	{
+		uint8_t **chunks = calloc(IMX_DMA_BUFFER_SLAB_MAX_NUM_CHUNKS, sizeof(uint8_t *));
+		if (chunks == NULL)
+			goto finish;
+		__atomic_store_n(&(slab->chunks), chunks, __ATOMIC_RELEASE);
+	}
+
+	if (posix_memalign(&chunk_memory, IMX_DMA_BUFFER_SLAB_CACHE_LINE_SIZE, slab->slot_size * IMX_DMA_BUFFER_SLAB_OBJECTS_PER_CHUNK) != 0)
+		goto finish;
+	chunk = (uint8_t *)chunk_memory;
+
+	first_index = slab->num_chunks * IMX_DMA_BUFFER_SLAB_OBJECTS_PER_CHUNK;
+
+	/* Write the index trailers, and chain objects 1..N-1 together.
+	 * Object 0 is handed out directly. */
+	for (i = 0; i < IMX_DMA_BUFFER_SLAB_OBJECTS_PER_CHUNK; ++i)
+	{
+		uint8_t *slot = chunk + i * slab->slot_size;
+		*imx_dma_buffer_slab_get_index_trailer(slab, slot) = first_index + i + 1;
+		if ((i > 0) && (i < (IMX_DMA_BUFFER_SLAB_OBJECTS_PER_CHUNK - 1)))
+			*((uint32_t *)slot) = first_index + i + 2;
+	}
+
+	/* Publish the chunk before its objects become reachable
+	 * through the free list. The push below has release
+	 * semantics, so other threads see this store first. */
+	__atomic_store_n(&(slab->chunks[slab->num_chunks]), chunk, __ATOMIC_RELAXED);
+	slab->num_chunks++;
+
+	imx_dma_buffer_slab_push(
+		slab,
+		chunk + (IMX_DMA_BUFFER_SLAB_OBJECTS_PER_CHUNK - 1) * slab->slot_size,
+		first_index + 2
+	);
+
+	object = chunk;
+
+finish:
+	pthread_mutex_unlock(&(slab->grow_mutex));
+	return object;
+}
+
+
+void imx_dma_buffer_slab_free(ImxDmaBufferSlab *slab, void *object)
+{
+	uint8_t *slot = (uint8_t *)object;
+
+	assert(slab != NULL);
+
+	if (object == NULL)
+		return;
+
+	imx_dma_buffer_slab_push(slab, slot, *imx_dma_buffer_slab_get_index_trailer(slab, slot));
+}
@@ -0,0 +1,71 @@
+#ifndef IMXDMABUFFER_SLAB_PRIV_H
+#define IMXDMABUFFER_SLAB_PRIV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Slab for the buffer structures of the built-in allocators.
+ *
+ * Each allocator embeds one slab, and allocates its ImxDmaBuffer structures
+ * (which all start with the common header) from it instead of with malloc().
+ * The slab gets memory from the system in chunks of a fixed number of
+ * objects. Objects are never returned to the system individually; all chunks
+ * are freed at once by imx_dma_buffer_slab_cleanup(). Each object starts at
+ * a cache line boundary, so the hot fields of the common buffer header
+ * (allocator, mapped virtual address, physical address, size, FD) always
+ * share the first cache line of the object.
+ *
+ * Free objects are kept in a lock-free list. Allocating and freeing thus only
+ * take a lock when a new chunk has to be added. The list head combines the
+ * index of the first free object with a tag that is incremented with each
+ * change to prevent ABA problems, so this requires 64-bit atomic operations.
+ */
+typedef struct
+{
+	/* Size of each object slot, a multiple of the cache line size. */
+	size_t slot_size;
+	/* Upper 32 bits: ABA tag. Lower 32 bits: index of the first
+	 * free object plus 1. 0 in the lower bits means "list is empty". */
+	uint64_t free_list_head;
+	/* Protects adding chunks. */
+	pthread_mutex_t grow_mutex;
+	/* Table of chunks. Allocated when the first chunk is added. */
+	uint8_t **chunks;
+	unsigned int num_chunks;
+}
+ImxDmaBufferSlab;
+
+
+#define IMX_DMA_BUFFER_SLAB_OBJECTS_PER_CHUNK 64
+#define IMX_DMA_BUFFER_SLAB_MAX_NUM_CHUNKS 4096
+
+
+/* Initializes a slab for objects of object_size bytes. This does not allocate anything. */
+void imx_dma_buffer_slab_init(ImxDmaBufferSlab *slab, size_t object_size);
+
+/* Frees all chunks of the slab. All objects must have been freed at this point. */
+void imx_dma_buffer_slab_cleanup(ImxDmaBufferSlab *slab);
+
+/* Allocates an object from the slab. The object's contents are undefined.
+ * Returns NULL if no memory could be allocated for a new chunk.
+ * This function is thread safe. */
+void* imx_dma_buffer_slab_alloc(ImxDmaBufferSlab *slab);
+
+/* Returns an object to the slab. object must have been allocated from
+ * this slab. This function is thread safe. */
+void imx_dma_buffer_slab_free(ImxDmaBufferSlab *slab, void *object);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_SLAB_PRIV_H */
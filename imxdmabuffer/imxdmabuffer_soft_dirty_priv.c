@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "imxdmabuffer_soft_dirty_priv.h"
+
+
+static pthread_once_t soft_dirty_init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t soft_dirty_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int pagemap_fd = -1;
+static int clear_refs_fd = -1;
+static int soft_dirty_available = 0;
+static int num_active_sessions = 0;
+
+
+static int clear_soft_dirty_bits(void)
+{
+	return write(clear_refs_fd, "4", 1) == 1;
+}
+
+
+/* Checks that clearing the soft-dirty bits clears the bit of the given
+ * page, and that writing to the page afterwards sets it again. The page
+ * must be mapped for reading and writing. Its first byte is modified. */
+static int check_page(uint8_t *page)
+{
+	uint64_t entry;
+	int ok;
+
+	/* Make sure the page is present, so the check covers the case that
+	 * matters: a page that was already written to before the session. */
+	page[0] = 1;
+	ok = clear_soft_dirty_bits()
+	  && imx_dma_buffer_soft_dirty_read_pagemap(page, 1, &entry)
+	  && !(entry & IMX_DMA_BUFFER_PAGEMAP_SOFT_DIRTY_BIT);
+	page[0] = 2;
+	ok = ok
+	  && imx_dma_buffer_soft_dirty_read_pagemap(page, 1, &entry)
+	  && (entry & IMX_DMA_BUFFER_PAGEMAP_SOFT_DIRTY_BIT);
+
+	return ok;
+}
+
+
+static void soft_dirty_init(void)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint8_t *test_page;
+
+	pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+	if ((pagemap_fd < 0) || (clear_refs_fd < 0))
+		goto error;
+
+	/* Kernels without CONFIG_MEM_SOFT_DIRTY accept the clear request, but
+	 * never set any soft-dirty bits. Using such a kernel would cause flushes
+	 * to be skipped even though the CPU wrote data. To rule that out, check
+	 * that a write to a test page really sets its soft-dirty bit. */
+
+	test_page = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (test_page == MAP_FAILED)
+		goto error;
+
+	soft_dirty_available = check_page(test_page);
+
+	munmap(test_page, page_size);
+
+	if (soft_dirty_available)
+		return;
+
+error:
+	if (pagemap_fd >= 0)
+	{
+		close(pagemap_fd);
+		pagemap_fd = -1;
+	}
+	if (clear_refs_fd >= 0)
+	{
+		close(clear_refs_fd);
+		clear_refs_fd = -1;
+	}
+}
+
+
+int imx_dma_buffer_soft_dirty_is_available(void)
+{
+	pthread_once(&soft_dirty_init_once, soft_dirty_init);
+	return soft_dirty_available;
+}
+
+
+int imx_dma_buffer_soft_dirty_check_mapping(uint8_t *page)
+{
+	int ret = 0;
+
+	if (!imx_dma_buffer_soft_dirty_is_available())
+		return 0;
+
+	pthread_mutex_lock(&soft_dirty_mutex);
+
+	/* Clearing would make running sessions lose their dirty bits. */
+	if (num_active_sessions == 0)
+		ret = check_page(page);
+
+	pthread_mutex_unlock(&soft_dirty_mutex);
+
+	return ret;
+}
+
+
+int imx_dma_buffer_soft_dirty_begin_session(void)
+{
+	int ret = 1;
+
+	if (!imx_dma_buffer_soft_dirty_is_available())
+		return 0;
+
+	pthread_mutex_lock(&soft_dirty_mutex);
+
+	/* Only clear if no other session is running. See the
+	 * explanation in imxdmabuffer_soft_dirty_priv.h. */
+	if (num_active_sessions == 0)
+		ret = clear_soft_dirty_bits();
+	if (ret)
+		num_active_sessions++;
+
+	pthread_mutex_unlock(&soft_dirty_mutex);
+
+	return ret;
+}
+
+
+void imx_dma_buffer_soft_dirty_end_session(void)
+{
+	pthread_mutex_lock(&soft_dirty_mutex);
+	if (num_active_sessions > 0)
+		num_active_sessions--;
+	pthread_mutex_unlock(&soft_dirty_mutex);
+}
+
+
+int imx_dma_buffer_soft_dirty_read_pagemap(void const *address, size_t num_pages, uint64_t *entries)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	off_t offset = (off_t)((uintptr_t)address / page_size) * sizeof(uint64_t);
+	size_t num_bytes = num_pages * sizeof(uint64_t);
+	uint8_t *dest = (uint8_t *)entries;
+
+	while (num_bytes > 0)
+	{
+		ssize_t num_read = pread(pagemap_fd, dest, num_bytes, offset);
+		if (num_read < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		if (num_read == 0)
+			return 0;
+
+		dest += num_read;
+		offset += num_read;
+		num_bytes -= num_read;
+	}
+
+	return 1;
+}
@@ -0,0 +1,62 @@
+#ifndef IMXDMABUFFER_SOFT_DIRTY_PRIV_H
+#define IMXDMABUFFER_SOFT_DIRTY_PRIV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Soft-dirty page tracking.
+ *
+ * The kernel keeps a "soft-dirty" bit for each page, which can be read through
+ * /proc/self/pagemap. Writing "4" to /proc/self/clear_refs clears the bits of
+ * all pages in the process. The next write to a page sets its bit again. This
+ * is used for finding out which pages of a mapped buffer the CPU wrote to.
+ *
+ * Since clearing is process-wide, it must not happen while another tracking
+ * session is running, otherwise that session would lose its dirty bits.
+ * Sessions that begin while others are running therefore reuse the previous
+ * clear. This can only cause false positives (pages that were written before
+ * the session began are reported as dirty), never false negatives.
+ */
+
+
+/* Bit 55 of a pagemap entry is the soft-dirty bit. */
+#define IMX_DMA_BUFFER_PAGEMAP_SOFT_DIRTY_BIT (UINT64_C(1) << 55)
+
+
+/* Returns nonzero if soft-dirty tracking works on this system. The first call
+ * checks this by actually clearing and setting a test page's soft-dirty bit.
+ * That test page is anonymous memory, so this says nothing about mappings of
+ * device memory; use imx_dma_buffer_soft_dirty_check_mapping() for those. */
+int imx_dma_buffer_soft_dirty_is_available(void);
+
+/* Returns nonzero if soft-dirty tracking works for the mapping that contains
+ * the given page. The kernel skips some kinds of mappings (for example those
+ * with VM_PFNMAP set) when clearing the bits, and writes to them never set the
+ * bits. The page must be mapped for reading and writing, and its first byte is
+ * overwritten. Since this clears the bits, it returns 0 while a session runs. */
+int imx_dma_buffer_soft_dirty_check_mapping(uint8_t *page);
+
+/* Begins a tracking session. Returns nonzero on success, 0 if the soft-dirty
+ * bits could not be cleared (the caller must then assume all pages are dirty). */
+int imx_dma_buffer_soft_dirty_begin_session(void);
+
+/* Ends a tracking session that was begun successfully. */
+void imx_dma_buffer_soft_dirty_end_session(void);
+
+/* Reads the pagemap entries of num_pages pages starting at the page aligned
+ * address into the entries array. Returns nonzero on success. */
+int imx_dma_buffer_soft_dirty_read_pagemap(void const *address, size_t num_pages, uint64_t *entries);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_SOFT_DIRTY_PRIV_H */
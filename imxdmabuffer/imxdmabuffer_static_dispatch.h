@@ -0,0 +1,188 @@
+#ifndef IMXDMABUFFER_STATIC_DISPATCH_H
+#define IMXDMABUFFER_STATIC_DISPATCH_H
+
+#include <assert.h>
+#include "imxdmabuffer_config.h"
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Direct-call variants of the hot imx_dma_buffer_* functions.
+ *
+ * The regular imx_dma_buffer_* functions always call the allocator vfuncs
+ * through the ImxDmaBufferAllocator vtable. If libimxdmabuffer was configured
+ * with --enable-static-dispatch, then exactly one allocator is built in, and
+ * the functions below can call that allocator's vfuncs directly. This allows
+ * the compiler to inline the call into the caller (for example when linking
+ * statically with LTO enabled). Buffers that were not allocated by the built-in
+ * allocator (custom allocators, wrapped DMA buffers) are still handled through
+ * the vtable, so these functions can be used with any ImxDmaBuffer.
+ *
+ * If static dispatch is not enabled, these functions just call their regular
+ * counterparts. That way, code can use them unconditionally.
+ *
+ * See the regular counterparts in imxdmabuffer.h for the documentation about
+ * what these functions do.
+ */
+
+
+#ifdef IMXDMABUFFER_STATIC_DISPATCH_ENABLED
+
+#if defined(IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED)
+#define IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(NAME) imx_dma_buffer_dma_heap_allocator_ ## NAME
+#define IMX_DMA_BUFFER_STATIC_DISPATCH_HAS_SYNC_FUNCS
+#elif defined(IMXDMABUFFER_ION_ALLOCATOR_ENABLED)
+#define IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(NAME) imx_dma_buffer_ion_allocator_ ## NAME
+#elif defined(IMXDMABUFFER_DWL_ALLOCATOR_ENABLED)
+#define IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(NAME) imx_dma_buffer_dwl_allocator_ ## NAME
+#elif defined(IMXDMABUFFER_IPU_ALLOCATOR_ENABLED)
+#define IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(NAME) imx_dma_buffer_ipu_allocator_ ## NAME
+#elif defined(IMXDMABUFFER_G2D_ALLOCATOR_ENABLED)
+#define IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(NAME) imx_dma_buffer_g2d_allocator_ ## NAME
+#elif defined(IMXDMABUFFER_PXP_ALLOCATOR_ENABLED)
+#define IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(NAME) imx_dma_buffer_pxp_allocator_ ## NAME
+#else
+#error Static dispatch is enabled, but no allocator is enabled
+#endif
+
+
+/* The vfuncs of the built-in allocator. These are not meant to be called
+ * directly; use the imx_dma_buffer_direct_* functions below instead. */
+
+uint8_t* IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(map)(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error);
+void IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(unmap)(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+#ifdef IMX_DMA_BUFFER_STATIC_DISPATCH_HAS_SYNC_FUNCS
+void IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(start_sync_session)(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+void IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(stop_sync_session)(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer);
+#endif
+
+
+/* The built-in allocator is recognized by its map vfunc. All instances
+ * of the built-in allocator use the same one. */
+#define IMX_DMA_BUFFER_IS_FROM_BUILTIN_ALLOCATOR(BUFFER) ((BUFFER)->allocator->map == IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(map))
+
+
+/* Mapping and unmapping may have to update the virtual address index (see
+ * imx_dma_buffer_lookup_by_virtual_address()). That is only done by the
+ * regular imx_dma_buffer_map() and imx_dma_buffer_unmap() functions, so the
+ * vfuncs are only called directly if the index is certainly not affected.
+ * The built-in allocators fill the common buffer header, so this can be
+ * checked here. Updating the index takes a process-wide lock, which costs
+ * far more than the indirect call that static dispatch avoids. */
+
+static inline uint8_t* imx_dma_buffer_direct_map(ImxDmaBuffer *buffer, unsigned int flags, int *error)
+{
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+	/* Only the first map call changes the mapped virtual address,
+	 * and only buffers with address lookup enabled are indexed. */
+	if (IMX_DMA_BUFFER_IS_FROM_BUILTIN_ALLOCATOR(buffer) && (!(buffer->address_indexed) || (buffer->mapped_virtual_address != NULL)))
+		return IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(map)(buffer->allocator, buffer, flags, error);
+	else
+		return imx_dma_buffer_map(buffer, flags, error);
+}
+
+static inline void imx_dma_buffer_direct_unmap(ImxDmaBuffer *buffer)
+{
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+	/* Buffers that are not in the index (for example buffers of allocators
+	 * without address lookup enabled) are not affected by the last unmap
+	 * call either. */
+	if (IMX_DMA_BUFFER_IS_FROM_BUILTIN_ALLOCATOR(buffer) && (buffer->indexed_virtual_address == NULL))
+		IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(unmap)(buffer->allocator, buffer);
+	else
+		imx_dma_buffer_unmap(buffer);
+}
+
+static inline void imx_dma_buffer_direct_start_sync_session(ImxDmaBuffer *buffer)
+{
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+#ifdef IMX_DMA_BUFFER_STATIC_DISPATCH_HAS_SYNC_FUNCS
+	/* Not checking with IMX_DMA_BUFFER_IS_FROM_BUILTIN_ALLOCATOR() here,
+	 * since the built-in allocator may use no-op sync vfuncs if it
+	 * allocates uncached memory. */
+	if (buffer->allocator->start_sync_session == IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(start_sync_session))
+		IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(start_sync_session)(buffer->allocator, buffer);
+	else
+		imx_dma_buffer_start_sync_session(buffer);
+#else
+	/* The built-in allocator does not sync anything. */
+	if (!IMX_DMA_BUFFER_IS_FROM_BUILTIN_ALLOCATOR(buffer))
+		imx_dma_buffer_start_sync_session(buffer);
+#endif
+}
+
+static inline void imx_dma_buffer_direct_stop_sync_session(ImxDmaBuffer *buffer)
+{
+	assert(buffer != NULL);
+	assert(buffer->allocator != NULL);
+#ifdef IMX_DMA_BUFFER_STATIC_DISPATCH_HAS_SYNC_FUNCS
+	if (buffer->allocator->stop_sync_session == IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(stop_sync_session))
+		IMX_DMA_BUFFER_STATIC_DISPATCH_FUNC(stop_sync_session)(buffer->allocator, buffer);
+	else
+		imx_dma_buffer_stop_sync_session(buffer);
+#else
+	if (!IMX_DMA_BUFFER_IS_FROM_BUILTIN_ALLOCATOR(buffer))
+		imx_dma_buffer_stop_sync_session(buffer);
+#endif
+}
+
+
+#else /* IMXDMABUFFER_STATIC_DISPATCH_ENABLED */
+
+
+static inline uint8_t* imx_dma_buffer_direct_map(ImxDmaBuffer *buffer, unsigned int flags, int *error)
+{
+	return imx_dma_buffer_map(buffer, flags, error);
+}
+
+static inline void imx_dma_buffer_direct_unmap(ImxDmaBuffer *buffer)
+{
+	imx_dma_buffer_unmap(buffer);
+}
+
+static inline void imx_dma_buffer_direct_start_sync_session(ImxDmaBuffer *buffer)
+{
+	imx_dma_buffer_start_sync_session(buffer);
+}
+
+static inline void imx_dma_buffer_direct_stop_sync_session(ImxDmaBuffer *buffer)
+{
+	imx_dma_buffer_stop_sync_session(buffer);
+}
+
+
+#endif /* IMXDMABUFFER_STATIC_DISPATCH_ENABLED */
+
+
+/* The getters do not need static dispatch, since the built-in allocators fill
+ * the common buffer header, so the regular getters already are inline loads. */
+
+static inline imx_physical_address_t imx_dma_buffer_direct_get_physical_address(ImxDmaBuffer *buffer)
+{
+	return imx_dma_buffer_get_physical_address(buffer);
+}
+
+static inline int imx_dma_buffer_direct_get_fd(ImxDmaBuffer *buffer)
+{
+	return imx_dma_buffer_get_fd(buffer);
+}
+
+static inline size_t imx_dma_buffer_direct_get_size(ImxDmaBuffer *buffer)
+{
+	return imx_dma_buffer_get_size(buffer);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_STATIC_DISPATCH_H */
@@ -0,0 +1,145 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_window_priv.h"
+
+
+ImxDmaBufferWindow* imx_dma_buffer_window_map(ImxDmaBufferWindow **windows, int fd, off_t fd_offset, size_t buffer_size, size_t offset, size_t length, unsigned int flags, int *needs_sync_start, int *error)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t window_offset, window_length;
+	int mmap_prot = 0;
+	void *virtual_address;
+	ImxDmaBufferWindow *window;
+
+	assert(windows != NULL);
+	assert(length > 0);
+	assert((offset + length) <= buffer_size);
+
+	if ((flags & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK) == 0)
+		flags |= IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE;
+
+	/* Extend the window to page boundaries, but not past the end of the buffer. */
+	window_offset = (offset / page_size) * page_size;
+	window_length = IMX_DMA_BUFFER_ALIGN_VAL_TO(offset + length, page_size) - window_offset;
+	if ((window_offset + window_length) > buffer_size)
+		window_length = buffer_size - window_offset;
+
+	*needs_sync_start = 0;
+
+	for (window = *windows; window != NULL; window = window->next)
+	{
+		unsigned int missing_flags;
+
+		if ((window->offset != window_offset) || (window->length != window_length))
+			continue;
+
+		missing_flags = flags & ~(window->map_flags) & IMX_DMA_BUFFER_MAPPING_READWRITE_FLAG_MASK;
+		if (missing_flags != 0)
+		{
+			if (!imx_dma_buffer_protect_mapping(window->virtual_address, window->length, window->map_flags | missing_flags, error))
+				return NULL;
+			window->map_flags |= missing_flags;
+			*needs_sync_start = 1;
+		}
+
+		window->refcount++;
+		return window;
+	}
+
+	mmap_prot |= (flags & IMX_DMA_BUFFER_MAPPING_FLAG_READ) ? PROT_READ : 0;
+	mmap_prot |= (flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE) ? PROT_WRITE : 0;
+
+	virtual_address = mmap(0, window_length, mmap_prot, MAP_SHARED, fd, fd_offset + (off_t)window_offset);
+	if (virtual_address == MAP_FAILED)
+	{
+		if (error != NULL)
+			*error = errno;
+		return NULL;
+	}
+
+	window = (ImxDmaBufferWindow *)malloc(sizeof(ImxDmaBufferWindow));
+	if (window == NULL)
+	{
+		munmap(virtual_address, window_length);
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	window->virtual_address = virtual_address;
+	window->offset = window_offset;
+	window->length = window_length;
+	window->map_flags = flags;
+	window->refcount = 1;
+	window->next = *windows;
+	*windows = window;
+
+	*needs_sync_start = 1;
+
+	return window;
+}
+
+
+void imx_dma_buffer_window_unmap(ImxDmaBufferWindow **windows, ImxDmaBufferWindow *window)
+{
+	ImxDmaBufferWindow **link;
+
+	assert(window->refcount > 0);
+
+	window->refcount--;
+	if (window->refcount != 0)
+		return;
+
+	for (link = windows; (*link) != window; link = &((*link)->next))
+		assert((*link) != NULL);
+	*link = window->next;
+
+	munmap(window->virtual_address, window->length);
+	free(window);
+}
+
+
+void imx_dma_buffer_window_unmap_all(ImxDmaBufferWindow **windows)
+{
+	while ((*windows) != NULL)
+	{
+		ImxDmaBufferWindow *window = *windows;
+		*windows = window->next;
+		munmap(window->virtual_address, window->length);
+		free(window);
+	}
+}
+
+
+ImxDmaBufferWindow* imx_dma_buffer_window_find_by_address(ImxDmaBufferWindow *windows, uint8_t const *virtual_address)
+{
+	ImxDmaBufferWindow *window;
+
+	for (window = windows; window != NULL; window = window->next)
+	{
+		if ((virtual_address >= window->virtual_address) && (virtual_address < (window->virtual_address + window->length)))
+			return window;
+	}
+
+	return NULL;
+}
+
+
+ImxDmaBufferWindow* imx_dma_buffer_window_find_by_range(ImxDmaBufferWindow *windows, size_t offset, size_t length)
+{
+	ImxDmaBufferWindow *window;
+
+	for (window = windows; window != NULL; window = window->next)
+	{
+		if ((offset >= window->offset) && ((offset + length) <= (window->offset + window->length)))
+			return window;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,70 @@
+#ifndef IMXDMABUFFER_WINDOW_PRIV_H
+#define IMXDMABUFFER_WINDOW_PRIV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Mapped windows, used by the allocators that map buffers with mmap()
+ * for implementing the map_range and unmap_range vfuncs.
+ *
+ * A window is a page aligned part of a buffer that is mapped on its own.
+ * Each window has its own mapping reference count. Mapping the same page
+ * aligned part again reuses the existing window. Windows of a buffer are
+ * kept in a singly linked list; buffers typically have very few of them.
+ */
+
+
+typedef struct _ImxDmaBufferWindow ImxDmaBufferWindow;
+
+struct _ImxDmaBufferWindow
+{
+	ImxDmaBufferWindow *next;
+
+	/* Start of the mapping. This is page aligned. */
+	uint8_t *virtual_address;
+	/* Page aligned offset and length of the window in the buffer. */
+	size_t offset;
+	size_t length;
+
+	unsigned int map_flags;
+	int refcount;
+};
+
+
+/* Maps the window that covers the given part of the buffer, or increments
+ * the refcount of an already existing window that covers the same pages.
+ * If the existing window lacks some of the requested read/write flags, its
+ * mapping is upgraded. *needs_sync_start is set to nonzero if the window is
+ * new or was upgraded, meaning that an automatic sync session must be
+ * (re)started. fd_offset is the mmap() offset of the beginning of the buffer.
+ * Returns the window, or NULL in case of an error. */
+ImxDmaBufferWindow* imx_dma_buffer_window_map(ImxDmaBufferWindow **windows, int fd, off_t fd_offset, size_t buffer_size, size_t offset, size_t length, unsigned int flags, int *needs_sync_start, int *error);
+
+/* Decrements the window's refcount. If it reaches zero, the window is
+ * unmapped, removed from the list, and freed. */
+void imx_dma_buffer_window_unmap(ImxDmaBufferWindow **windows, ImxDmaBufferWindow *window);
+
+/* Unmaps and frees all windows regardless of their refcounts. */
+void imx_dma_buffer_window_unmap_all(ImxDmaBufferWindow **windows);
+
+/* Returns the window whose mapping contains the given virtual address,
+ * or NULL if there is none. */
+ImxDmaBufferWindow* imx_dma_buffer_window_find_by_address(ImxDmaBufferWindow *windows, uint8_t const *virtual_address);
+
+/* Returns a window that covers the given part of the buffer, or NULL if there is none. */
+ImxDmaBufferWindow* imx_dma_buffer_window_find_by_range(ImxDmaBufferWindow *windows, size_t offset, size_t length);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_WINDOW_PRIV_H */
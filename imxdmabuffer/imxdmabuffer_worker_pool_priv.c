@@ -0,0 +1,206 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "imxdmabuffer_worker_pool_priv.h"
+
+
+/* Frames are split into a few bands only, so more threads do not help. */
+#define IMX_DMA_BUFFER_WORKER_POOL_MAX_NUM_THREADS 8
+
+
+typedef struct _ImxDmaBufferWorkerPoolJob ImxDmaBufferWorkerPoolJob;
+
+/* One submission. Jobs live on the stack of the submitting thread. */
+struct _ImxDmaBufferWorkerPoolJob
+{
+	/* Next job in the queue of jobs that still have unclaimed tasks. */
+	ImxDmaBufferWorkerPoolJob *next;
+
+	ImxDmaBufferWorkerPoolTaskFunc task_func;
+	uint8_t *tasks;
+	size_t task_size;
+	unsigned int num_tasks;
+
+	unsigned int num_claimed_tasks;
+	unsigned int num_finished_tasks;
+};
+
+
+static pthread_once_t worker_pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t worker_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signaled when jobs are added to the queue. */
+static pthread_cond_t worker_pool_job_cond = PTHREAD_COND_INITIALIZER;
+/* Signaled when a job leaves the queue, and when the last task of a job is finished. */
+static pthread_cond_t worker_pool_done_cond = PTHREAD_COND_INITIALIZER;
+static ImxDmaBufferWorkerPoolJob *worker_pool_queue_head = NULL;
+static ImxDmaBufferWorkerPoolJob *worker_pool_queue_tail = NULL;
+/* Number of running worker threads, excluding submitting threads. */
+static unsigned int worker_pool_num_workers = 0;
+static unsigned int worker_pool_num_threads = 1;
+
+
+/* Claims the next task of the job at the head of the queue. Removes the job
+ * from the queue if this was its last task. Must be called with the mutex
+ * locked, and the queue must not be empty. */
+static void* imx_dma_buffer_worker_pool_claim_task(ImxDmaBufferWorkerPoolJob *job)
+{
+	void *task;
+
+	assert(job == worker_pool_queue_head);
+	assert(job->num_claimed_tasks < job->num_tasks);
+
+	task = job->tasks + job->task_size * job->num_claimed_tasks;
+	job->num_claimed_tasks++;
+
+	if (job->num_claimed_tasks == job->num_tasks)
+	{
+		worker_pool_queue_head = job->next;
+		if (worker_pool_queue_head == NULL)
+			worker_pool_queue_tail = NULL;
+		job->next = NULL;
+
+		/* Let submitters whose jobs are now at the head of the queue help. */
+		pthread_cond_broadcast(&worker_pool_done_cond);
+	}
+
+	return task;
+}
+
+
+/* Must be called with the mutex locked. */
+static void imx_dma_buffer_worker_pool_finish_task(ImxDmaBufferWorkerPoolJob *job)
+{
+	job->num_finished_tasks++;
+	if (job->num_finished_tasks == job->num_tasks)
+		pthread_cond_broadcast(&worker_pool_done_cond);
+}
+
+
+static void* imx_dma_buffer_worker_pool_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&worker_pool_mutex);
+
+	while (1)
+	{
+		ImxDmaBufferWorkerPoolJob *job;
+		void *task;
+
+		while (worker_pool_queue_head == NULL)
+			pthread_cond_wait(&worker_pool_job_cond, &worker_pool_mutex);
+
+		job = worker_pool_queue_head;
+		task = imx_dma_buffer_worker_pool_claim_task(job);
+
+		pthread_mutex_unlock(&worker_pool_mutex);
+		job->task_func(task);
+		pthread_mutex_lock(&worker_pool_mutex);
+
+		imx_dma_buffer_worker_pool_finish_task(job);
+	}
+
+	return NULL;
+}
+
+
+static void imx_dma_buffer_worker_pool_start(void)
+{
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int num_threads = (num_cpus > 0) ? (unsigned int)num_cpus : 1;
+	unsigned int i;
+	pthread_attr_t attr;
+
+	if (num_threads > IMX_DMA_BUFFER_WORKER_POOL_MAX_NUM_THREADS)
+		num_threads = IMX_DMA_BUFFER_WORKER_POOL_MAX_NUM_THREADS;
+
+	/* The workers are never joined, since they run until the process exits. */
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	/* The submitting thread is one of the threads. */
+	for (i = 1; i < num_threads; ++i)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, imx_dma_buffer_worker_pool_thread, NULL) != 0)
+			break;
+	}
+
+	pthread_attr_destroy(&attr);
+
+	worker_pool_num_workers = i - 1;
+	worker_pool_num_threads = i;
+}
+
+
+unsigned int imx_dma_buffer_worker_pool_get_num_threads(void)
+{
+	pthread_once(&worker_pool_once, imx_dma_buffer_worker_pool_start);
+	return worker_pool_num_threads;
+}
+
+
+void imx_dma_buffer_worker_pool_run(ImxDmaBufferWorkerPoolTaskFunc task_func, void *tasks, size_t task_size, unsigned int num_tasks)
+{
+	ImxDmaBufferWorkerPoolJob job;
+	unsigned int i;
+
+	assert(task_func != NULL);
+	assert((tasks != NULL) || (num_tasks == 0));
+
+	pthread_once(&worker_pool_once, imx_dma_buffer_worker_pool_start);
+
+	if ((num_tasks <= 1) || (worker_pool_num_workers == 0))
+	{
+		for (i = 0; i < num_tasks; ++i)
+			task_func(((uint8_t *)tasks) + task_size * i);
+		return;
+	}
+
+	job.next = NULL;
+	job.task_func = task_func;
+	job.tasks = (uint8_t *)tasks;
+	job.task_size = task_size;
+	job.num_tasks = num_tasks;
+	job.num_claimed_tasks = 0;
+	job.num_finished_tasks = 0;
+
+	pthread_mutex_lock(&worker_pool_mutex);
+
+	if (worker_pool_queue_tail != NULL)
+		worker_pool_queue_tail->next = &job;
+	else
+		worker_pool_queue_head = &job;
+	worker_pool_queue_tail = &job;
+	pthread_cond_broadcast(&worker_pool_job_cond);
+
+	/* Help with the tasks of this job. Once they are all claimed, wait
+	 * for the ones that are still being processed by the workers. */
+	while (job.num_claimed_tasks < job.num_tasks)
+	{
+		void *task;
+
+		/* Tasks of jobs submitted earlier are claimed first, so
+		 * this job may not be at the head of the queue yet. */
+		if (worker_pool_queue_head != &job)
+		{
+			pthread_cond_wait(&worker_pool_done_cond, &worker_pool_mutex);
+			continue;
+		}
+
+		task = imx_dma_buffer_worker_pool_claim_task(&job);
+
+		pthread_mutex_unlock(&worker_pool_mutex);
+		task_func(task);
+		pthread_mutex_lock(&worker_pool_mutex);
+
+		imx_dma_buffer_worker_pool_finish_task(&job);
+	}
+
+	while (job.num_finished_tasks < job.num_tasks)
+		pthread_cond_wait(&worker_pool_done_cond, &worker_pool_mutex);
+
+	pthread_mutex_unlock(&worker_pool_mutex);
+}
@@ -0,0 +1,48 @@
+#ifndef IMXDMABUFFER_WORKER_POOL_PRIV_H
+#define IMXDMABUFFER_WORKER_POOL_PRIV_H
+
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Process-wide pool of worker threads, used for splitting CPU work on
+ * frames (like detiling and 2D blits) into bands that are processed in
+ * parallel.
+ *
+ * The threads are started the first time work is submitted, and keep
+ * running until the process exits. Work is submitted as an array of
+ * tasks. The submitting thread processes tasks as well, and waits until
+ * all tasks of its submission are finished. Several threads can submit
+ * work at the same time; the workers then process the tasks of all
+ * submissions in the order the submissions were made.
+ *
+ * All of these functions are thread safe.
+ */
+
+
+typedef void (*ImxDmaBufferWorkerPoolTaskFunc)(void *task);
+
+
+/* Returns the number of threads that process tasks, including the
+ * thread that submits them. This is the number of online CPU cores,
+ * limited to a small maximum. It is at least 1. */
+unsigned int imx_dma_buffer_worker_pool_get_num_threads(void);
+
+/* Calls task_func for each of the num_tasks tasks in the tasks array, and
+ * returns once all calls have finished. Each task is task_size bytes big.
+ * The calls are distributed over the worker threads and the calling thread.
+ * If the worker threads could not be started, all calls are made by the
+ * calling thread. */
+void imx_dma_buffer_worker_pool_run(ImxDmaBufferWorkerPoolTaskFunc task_func, void *tasks, size_t task_size, unsigned int num_tasks);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_WORKER_POOL_PRIV_H */
@@ -0,0 +1,417 @@
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <linux/errqueue.h>
+
+#include <imxdmabuffer_config.h>
+#include "imxdmabuffer.h"
+#include "imxdmabuffer_priv.h"
+#include "imxdmabuffer_zerocopy_sender.h"
+
+
+/* These were introduced in Linux 4.14. Define them here in case
+ * the userspace headers of the toolchain are older. */
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+
+/* Maximum number of allocators whose mappings a sender remembers as
+ * not pinnable. See imx_dma_buffer_zerocopy_sender_send(). */
+#define IMX_DMA_BUFFER_ZEROCOPY_SENDER_MAX_UNPINNABLE_ALLOCATORS 4
+
+
+typedef struct _ImxDmaBufferZeroCopySend ImxDmaBufferZeroCopySend;
+
+struct _ImxDmaBufferZeroCopySend
+{
+	ImxDmaBufferZeroCopySend *next;
+
+	ImxDmaBuffer *buffer;
+	ImxDmaBufferZeroCopyReleaseFunc release_func;
+	void *user_data;
+
+	/* A send may consist of several send() calls (for example if a stream
+	 * socket accepts only parts of the data at a time). The kernel assigns
+	 * consecutive IDs to them. The send is released once notifications
+	 * for all of these IDs arrived. */
+	uint32_t first_id;
+	uint32_t num_ids;
+	uint32_t num_completed_ids;
+};
+
+
+struct _ImxDmaBufferZeroCopySender
+{
+	int socket_fd;
+	int is_stream_socket;
+	int zerocopy_enabled;
+
+	/* ID the kernel assigns to the next successful zerocopy send() call. */
+	uint32_t next_id;
+
+	/* Pending sends, oldest first. */
+	ImxDmaBufferZeroCopySend *first_pending_send;
+	ImxDmaBufferZeroCopySend *last_pending_send;
+	int num_pending_sends;
+
+	/* Allocators whose mappings the kernel could not pin. Buffers
+	 * of these allocators are always sent with regular copies. */
+	ImxDmaBufferAllocator *unpinnable_allocators[IMX_DMA_BUFFER_ZEROCOPY_SENDER_MAX_UNPINNABLE_ALLOCATORS];
+	int num_unpinnable_allocators;
+};
+
+
+static void imx_dma_buffer_zerocopy_sender_complete_ids(ImxDmaBufferZeroCopySender *sender, uint32_t first_id, uint32_t last_id);
+static void imx_dma_buffer_zerocopy_sender_release(ImxDmaBufferZeroCopySend *send);
+
+
+ImxDmaBufferZeroCopySender* imx_dma_buffer_zerocopy_sender_new(int socket_fd, int *error)
+{
+	int one = 1;
+	int socket_type;
+	socklen_t socket_type_length = sizeof(socket_type);
+	ImxDmaBufferZeroCopySender *sender;
+
+	assert(socket_fd >= 0);
+
+	if (getsockopt(socket_fd, SOL_SOCKET, SO_TYPE, &socket_type, &socket_type_length) != 0)
+	{
+		if (error != NULL)
+			*error = errno;
+		return NULL;
+	}
+
+	sender = (ImxDmaBufferZeroCopySender *)malloc(sizeof(ImxDmaBufferZeroCopySender));
+	if (sender == NULL)
+	{
+		if (error != NULL)
+			*error = ENOMEM;
+		return NULL;
+	}
+
+	memset(sender, 0, sizeof(ImxDmaBufferZeroCopySender));
+	sender->socket_fd = socket_fd;
+	sender->is_stream_socket = (socket_type == SOCK_STREAM);
+
+	/* Older kernels and some socket types do not support SO_ZEROCOPY.
+	 * Sends are then done with regular copies. */
+	sender->zerocopy_enabled = (setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0);
+
+	return sender;
+}
+
+
+void imx_dma_buffer_zerocopy_sender_free(ImxDmaBufferZeroCopySender *sender)
+{
+	assert(sender != NULL);
+
+	if (imx_dma_buffer_zerocopy_sender_wait(sender, -1, NULL) != 0)
+	{
+		/* Notifications can no longer be read (for example because the
+		 * socket was closed, in which case the kernel also released the
+		 * data). Release the remaining sends anyway. */
+		while (sender->first_pending_send != NULL)
+		{
+			ImxDmaBufferZeroCopySend *send = sender->first_pending_send;
+			sender->first_pending_send = send->next;
+			imx_dma_buffer_zerocopy_sender_release(send);
+		}
+	}
+
+	free(sender);
+}
+
+
+int imx_dma_buffer_zerocopy_sender_is_zerocopy_enabled(ImxDmaBufferZeroCopySender *sender)
+{
+	assert(sender != NULL);
+	return sender->zerocopy_enabled;
+}
+
+
+ssize_t imx_dma_buffer_zerocopy_sender_send(ImxDmaBufferZeroCopySender *sender, ImxDmaBuffer *buffer, size_t offset, size_t length, int flags, ImxDmaBufferZeroCopyReleaseFunc release_func, void *user_data, int *error)
+{
+	uint8_t *virtual_address;
+	size_t num_sent_bytes = 0;
+	uint32_t first_id;
+	int use_zerocopy;
+	int i;
+	ImxDmaBufferZeroCopySend *pending_send = NULL;
+
+	assert(sender != NULL);
+	assert(buffer != NULL);
+	assert(length > 0);
+	assert((offset + length) <= imx_dma_buffer_get_size(buffer));
+
+	first_id = sender->next_id;
+
+	/* Release what the kernel is already done with first. This
+	 * also keeps the error queue from growing indefinitely. */
+	if (sender->zerocopy_enabled && (imx_dma_buffer_zerocopy_sender_process_completions(sender, error) < 0))
+		return -1;
+
+	/* The mapping is kept until the send is released. */
+	virtual_address = imx_dma_buffer_map(buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ, error);
+	if (virtual_address == NULL)
+		return -1;
+
+	/* The record of the pending send is allocated before sending, since
+	 * the send could not be tracked once the kernel pinned the pages.
+	 * If that is not possible, send a copy of the data instead. */
+	use_zerocopy = sender->zerocopy_enabled;
+	for (i = 0; use_zerocopy && (i < sender->num_unpinnable_allocators); ++i)
+	{
+		if (sender->unpinnable_allocators[i] == buffer->allocator)
+			use_zerocopy = 0;
+	}
+	if (use_zerocopy)
+	{
+		pending_send = (ImxDmaBufferZeroCopySend *)malloc(sizeof(ImxDmaBufferZeroCopySend));
+		use_zerocopy = (pending_send != NULL);
+	}
+
+	while (num_sent_bytes < length)
+	{
+		ssize_t ret;
+
+		if (use_zerocopy)
+		{
+			ret = send(sender->socket_fd, virtual_address + offset + num_sent_bytes, length - num_sent_bytes, flags | MSG_ZEROCOPY);
+			if (ret >= 0)
+			{
+				sender->next_id++;
+			}
+			else if (errno == ENOBUFS)
+			{
+				/* The kernel could not account for the pinned pages
+				 * (optmem_max was reached). Copy this part instead. */
+				ret = send(sender->socket_fd, virtual_address + offset + num_sent_bytes, length - num_sent_bytes, flags);
+			}
+			else if (errno == EFAULT)
+			{
+				/* The kernel could not pin the pages, since the mapping
+				 * is not backed by regular pages (for example the
+				 * remap_pfn_range() mappings of the IPU and PxP
+				 * allocators). Copy the rest of the data instead, and
+				 * do the same for later sends of this allocator's
+				 * buffers, since all of its mappings are of the same
+				 * kind. If the address is really invalid, the copying
+				 * send fails with EFAULT as well. */
+				use_zerocopy = 0;
+				if (sender->num_unpinnable_allocators < IMX_DMA_BUFFER_ZEROCOPY_SENDER_MAX_UNPINNABLE_ALLOCATORS)
+					sender->unpinnable_allocators[sender->num_unpinnable_allocators++] = buffer->allocator;
+				ret = send(sender->socket_fd, virtual_address + offset + num_sent_bytes, length - num_sent_bytes, flags);
+			}
+		}
+		else
+			ret = send(sender->socket_fd, virtual_address + offset + num_sent_bytes, length - num_sent_bytes, flags);
+
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			/* If some data was sent already, report that instead of the error. */
+			if ((num_sent_bytes == 0) && (error != NULL))
+				*error = errno;
+			break;
+		}
+
+		num_sent_bytes += ret;
+
+		if (!(sender->is_stream_socket))
+			break;
+	}
+
+	if (sender->next_id != first_id)
+	{
+		pending_send->next = NULL;
+		pending_send->buffer = buffer;
+		pending_send->release_func = release_func;
+		pending_send->user_data = user_data;
+		pending_send->first_id = first_id;
+		pending_send->num_ids = sender->next_id - first_id;
+		pending_send->num_completed_ids = 0;
+
+		if (sender->last_pending_send != NULL)
+			sender->last_pending_send->next = pending_send;
+		else
+			sender->first_pending_send = pending_send;
+		sender->last_pending_send = pending_send;
+		sender->num_pending_sends++;
+	}
+	else
+	{
+		/* Nothing was sent with MSG_ZEROCOPY, so the kernel already
+		 * copied the data, or nothing was sent at all. */
+		free(pending_send);
+		imx_dma_buffer_unmap(buffer);
+		if ((num_sent_bytes > 0) && (release_func != NULL))
+			release_func(buffer, user_data);
+	}
+
+	return (num_sent_bytes > 0) ? (ssize_t)num_sent_bytes : -1;
+}
+
+
+int imx_dma_buffer_zerocopy_sender_process_completions(ImxDmaBufferZeroCopySender *sender, int *error)
+{
+	assert(sender != NULL);
+
+	while (sender->num_pending_sends > 0)
+	{
+		/* Enough space for one IP_RECVERR / IPV6_RECVERR message. */
+		union
+		{
+			struct cmsghdr align;
+			uint8_t data[CMSG_SPACE(sizeof(struct sock_extended_err) + 64)];
+		}
+		control;
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control.data;
+		msg.msg_controllen = sizeof(control.data);
+
+		/* Reading from the error queue never blocks. */
+		if (recvmsg(sender->socket_fd, &msg, MSG_ERRQUEUE) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			if (error != NULL)
+				*error = errno;
+			return -1;
+		}
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			struct sock_extended_err serr;
+
+			if (cmsg->cmsg_len < CMSG_LEN(sizeof(serr)))
+				continue;
+
+			memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+			if ((serr.ee_errno != 0) || (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+				continue;
+
+			/* ee_info and ee_data contain the first and last ID of a range of
+			 * completed send() calls. The kernel merges consecutive ranges. */
+			imx_dma_buffer_zerocopy_sender_complete_ids(sender, serr.ee_info, serr.ee_data);
+		}
+	}
+
+	return sender->num_pending_sends;
+}
+
+
+int imx_dma_buffer_zerocopy_sender_wait(ImxDmaBufferZeroCopySender *sender, int timeout_ms, int *error)
+{
+	int num_pending_sends;
+
+	assert(sender != NULL);
+
+	while ((num_pending_sends = imx_dma_buffer_zerocopy_sender_process_completions(sender, error)) > 0)
+	{
+		struct pollfd pfd;
+		int ret;
+
+		/* POLLERR is reported when the error queue is not empty. */
+		pfd.fd = sender->socket_fd;
+		pfd.events = 0;
+		pfd.revents = 0;
+
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (error != NULL)
+				*error = errno;
+			return -1;
+		}
+
+		if (ret == 0)
+			break;
+
+		if (pfd.revents & POLLNVAL)
+		{
+			if (error != NULL)
+				*error = EBADF;
+			return -1;
+		}
+	}
+
+	return num_pending_sends;
+}
+
+
+static void imx_dma_buffer_zerocopy_sender_complete_ids(ImxDmaBufferZeroCopySender *sender, uint32_t first_id, uint32_t last_id)
+{
+	ImxDmaBufferZeroCopySend **link = &(sender->first_pending_send);
+	ImxDmaBufferZeroCopySend *previous_send = NULL;
+
+	/* Pending sends are ordered by their IDs. IDs wrap around at 2^32,
+	 * so they are compared by looking at the sign of their difference. */
+	while ((*link) != NULL)
+	{
+		ImxDmaBufferZeroCopySend *send = *link;
+		uint32_t last_send_id = send->first_id + send->num_ids - 1;
+		uint32_t overlap_start, overlap_end;
+
+		/* Range lies completely before this send, and therefore
+		 * also before all the sends that come after this one. */
+		if (((int32_t)(last_id - send->first_id)) < 0)
+			break;
+
+		/* Range lies completely after this send. */
+		if (((int32_t)(first_id - last_send_id)) > 0)
+		{
+			previous_send = send;
+			link = &(send->next);
+			continue;
+		}
+
+		overlap_start = (((int32_t)(first_id - send->first_id)) > 0) ? first_id : send->first_id;
+		overlap_end = (((int32_t)(last_id - last_send_id)) < 0) ? last_id : last_send_id;
+		send->num_completed_ids += overlap_end - overlap_start + 1;
+
+		if (send->num_completed_ids < send->num_ids)
+		{
+			previous_send = send;
+			link = &(send->next);
+			continue;
+		}
+
+		*link = send->next;
+		if (sender->last_pending_send == send)
+			sender->last_pending_send = previous_send;
+		sender->num_pending_sends--;
+
+		imx_dma_buffer_zerocopy_sender_release(send);
+	}
+}
+
+
+static void imx_dma_buffer_zerocopy_sender_release(ImxDmaBufferZeroCopySend *send)
+{
+	imx_dma_buffer_unmap(send->buffer);
+	if (send->release_func != NULL)
+		send->release_func(send->buffer, send->user_data);
+	free(send);
+}
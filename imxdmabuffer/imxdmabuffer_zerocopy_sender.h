@@ -0,0 +1,113 @@
+#ifndef IMXDMABUFFER_ZEROCOPY_SENDER_H
+#define IMXDMABUFFER_ZEROCOPY_SENDER_H
+
+#include <sys/types.h>
+#include "imxdmabuffer.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ImxDmaBufferZeroCopySender:
+ *
+ * Sends data from DMA buffers over a socket with MSG_ZEROCOPY. Instead of
+ * copying the data into socket buffers, the kernel then transmits it straight
+ * from the DMA buffer's pages. This means that the data must stay unmodified
+ * until the kernel is done with it. The kernel reports that through
+ * notifications in the socket's error queue. The sender reads these
+ * notifications, and until the notification for a send arrives, it keeps
+ * the buffer mapped and calls the send's release function afterwards.
+ * Users must neither modify nor deallocate the buffer before that.
+ *
+ * If the kernel could not avoid the copy (this is always the case with
+ * loopback connections), the notification still arrives, and the send is
+ * released the same way. If the socket does not support MSG_ZEROCOPY at all,
+ * or if the kernel cannot pin the pages of the buffer's mapping (like the
+ * remap_pfn_range() mappings of the IPU and PxP allocators), the data is
+ * copied by the send call, and the send is released right away. In the
+ * latter case, the sender also copies the data of later sends from buffers
+ * of the same allocator right away.
+ *
+ * The sender must be the only user of MSG_ZEROCOPY on its socket, since the
+ * kernel numbers all zerocopy send calls on a socket consecutively. Senders
+ * are not thread safe.
+ */
+typedef struct _ImxDmaBufferZeroCopySender ImxDmaBufferZeroCopySender;
+
+/* Function that is called once the kernel no longer accesses the data of
+ * a send. buffer is the buffer that was passed to the send function. */
+typedef void (*ImxDmaBufferZeroCopyReleaseFunc)(ImxDmaBuffer *buffer, void *user_data);
+
+
+/* Creates a new zerocopy sender for the given socket.
+ *
+ * This enables the SO_ZEROCOPY socket option. The sender does not take
+ * ownership of the socket; it must be closed after the sender was freed.
+ *
+ * @param socket_fd TCP or UDP socket to send data over.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If creating the sender succeeds, the integer is not modified.
+ * @return Pointer to the newly created sender, or NULL in case of an error.
+ */
+ImxDmaBufferZeroCopySender* imx_dma_buffer_zerocopy_sender_new(int socket_fd, int *error);
+
+/* Frees a zerocopy sender.
+ *
+ * If sends are still pending, this first waits until the kernel released
+ * them, and calls their release functions.
+ */
+void imx_dma_buffer_zerocopy_sender_free(ImxDmaBufferZeroCopySender *sender);
+
+/* Returns nonzero if the socket supports MSG_ZEROCOPY. If not, the send
+ * function falls back to regular, copying sends. */
+int imx_dma_buffer_zerocopy_sender_is_zerocopy_enabled(ImxDmaBufferZeroCopySender *sender);
+
+/* Sends a part of a DMA buffer.
+ *
+ * The buffer is mapped for reading until the send is released. With stream
+ * sockets, this sends all of the data unless the socket is non-blocking, in
+ * which case less data may be sent. With datagram sockets, the data is sent
+ * as one datagram.
+ *
+ * This also processes completion notifications that have arrived so far,
+ * so release functions of earlier sends may be called from here.
+ *
+ * @param sender Sender to use.
+ * @param buffer DMA buffer containing the data to send.
+ * @param offset Offset of the data in the buffer, in bytes.
+ * @param length Length of the data, in bytes. Must be at least 1.
+ * @param flags Additional flags for send(), like MSG_MORE.
+ * @param release_func Function to call once the kernel no longer accesses the
+ *        data. If nothing was sent, it is not called. Can be NULL.
+ * @param user_data Pointer that is passed to release_func.
+ * @param error If this pointer is non-NULL, and if an error occurs, then the
+ *        integer the pointer refers to is set to an error code from errno.h.
+ *        If sending succeeds, the integer is not modified.
+ * @return Number of bytes sent, or -1 in case of an error.
+ */
+ssize_t imx_dma_buffer_zerocopy_sender_send(ImxDmaBufferZeroCopySender *sender, ImxDmaBuffer *buffer, size_t offset, size_t length, int flags, ImxDmaBufferZeroCopyReleaseFunc release_func, void *user_data, int *error);
+
+/* Reads all completion notifications from the socket's error queue without
+ * blocking, and releases the sends they refer to.
+ *
+ * @return Number of sends that are still pending, or -1 in case of an error.
+ */
+int imx_dma_buffer_zerocopy_sender_process_completions(ImxDmaBufferZeroCopySender *sender, int *error);
+
+/* Waits until all pending sends are released, or until the timeout expires.
+ *
+ * @param timeout_ms Timeout in milliseconds. -1 waits indefinitely.
+ * @return Number of sends that are still pending, or -1 in case of an error.
+ */
+int imx_dma_buffer_zerocopy_sender_wait(ImxDmaBufferZeroCopySender *sender, int timeout_ms, int *error);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* IMXDMABUFFER_ZEROCOPY_SENDER_H */
@@ -0,0 +1,539 @@
+/* Needed for memfd_create(). */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "imxdmabuffer_config.h"
+#include "imxdmabuffer/imxdmabuffer.h"
+#include "imxdmabuffer/imxdmabuffer_priv.h"
+#include "imxdmabuffer/imxdmabuffer_pool_allocator.h"
+
+#ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
+#include "imxdmabuffer/imxdmabuffer_dma_heap_allocator.h"
+#endif
+
+#ifdef IMXDMABUFFER_ION_ALLOCATOR_ENABLED
+#include "imxdmabuffer/imxdmabuffer_ion_allocator.h"
+#endif
+
+#ifdef IMXDMABUFFER_DWL_ALLOCATOR_ENABLED
+#include "imxdmabuffer/imxdmabuffer_dwl_allocator.h"
+#endif
+
+#ifdef IMXDMABUFFER_IPU_ALLOCATOR_ENABLED
+#include "imxdmabuffer/imxdmabuffer_ipu_allocator.h"
+#endif
+
+#ifdef IMXDMABUFFER_G2D_ALLOCATOR_ENABLED
+#include "imxdmabuffer/imxdmabuffer_g2d_allocator.h"
+#endif
+
+#ifdef IMXDMABUFFER_PXP_ALLOCATOR_ENABLED
+#include "imxdmabuffer/imxdmabuffer_pxp_allocator.h"
+#endif
+
+
+/* Concurrency benchmark.
+ *
+ * Runs N threads that share one allocator. Each thread repeatedly allocates
+ * a buffer, maps it, writes to it inside a sync session, unmaps it, and
+ * deallocates it. This is done for thread counts from 1 to the number of
+ * online CPU cores (or the number specified with -t). For each thread count,
+ * the aggregate cycles per second, the latency distribution of one cycle,
+ * and the average time each thread spent off-CPU are reported.
+ *
+ * The off-CPU time is the wall clock time minus the thread's CPU time. Since
+ * the benchmark threads never sleep on purpose, this is the time they were
+ * blocked, mostly on contended locks (in userspace and in the kernel drivers),
+ * plus time during which they were preempted if there are more runnable
+ * threads than cores.
+ *
+ * The "memfd" allocator is a stand-in that does not need any i.MX hardware.
+ * It allocates memfd backed memory and fakes physical addresses. This makes
+ * it possible to measure the overhead of libimxdmabuffer itself and of the
+ * layers on top of it (like the pool allocator) on any Linux machine.
+ */
+
+
+
+
+/* memfd stand-in allocator */
+
+typedef struct
+{
+	ImxDmaBuffer parent;
+	int mapping_refcount;
+}
+MemfdDmaBuffer;
+
+
+static imx_physical_address_t memfd_next_physical_address = 0x10000000;
+
+
+static void memfd_allocator_destroy(ImxDmaBufferAllocator *allocator)
+{
+	free(allocator);
+}
+
+
+static ImxDmaBuffer* memfd_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error)
+{
+	int fd;
+	MemfdDmaBuffer *memfd_buffer;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(alignment);
+
+	fd = memfd_create("imxdmabuffer-bench", MFD_CLOEXEC);
+	if (fd < 0)
+		goto error;
+
+	if (ftruncate(fd, size) < 0)
+	{
+		close(fd);
+		goto error;
+	}
+
+	memfd_buffer = (MemfdDmaBuffer *)malloc(sizeof(MemfdDmaBuffer));
+	memfd_buffer->parent.allocator = allocator;
+	memfd_buffer->parent.mapped_virtual_address = NULL;
+	/* Fake page aligned physical addresses that never overlap. */
+	memfd_buffer->parent.physical_address = __atomic_fetch_add(&memfd_next_physical_address, IMX_DMA_BUFFER_ALIGN_VAL_TO(size, page_size), __ATOMIC_RELAXED);
+	memfd_buffer->parent.size = size;
+	memfd_buffer->parent.fd = fd;
+	memfd_buffer->mapping_refcount = 0;
+
+	return (ImxDmaBuffer *)memfd_buffer;
+
+error:
+	if (error != NULL)
+		*error = errno;
+	return NULL;
+}
+
+
+static void memfd_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	if (buffer->mapped_virtual_address != NULL)
+		munmap(buffer->mapped_virtual_address, buffer->size);
+	close(buffer->fd);
+	free(buffer);
+}
+
+
+static uint8_t* memfd_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
+{
+	int prot = 0;
+	void *virtual_address;
+	MemfdDmaBuffer *memfd_buffer = (MemfdDmaBuffer *)buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	if (memfd_buffer->mapping_refcount > 0)
+	{
+		memfd_buffer->mapping_refcount++;
+		return buffer->mapped_virtual_address;
+	}
+
+	prot |= (flags & IMX_DMA_BUFFER_MAPPING_FLAG_READ) ? PROT_READ : 0;
+	prot |= (flags & IMX_DMA_BUFFER_MAPPING_FLAG_WRITE) ? PROT_WRITE : 0;
+
+	virtual_address = mmap(0, buffer->size, prot, MAP_SHARED, buffer->fd, 0);
+	if (virtual_address == MAP_FAILED)
+	{
+		if (error != NULL)
+			*error = errno;
+		return NULL;
+	}
+
+	buffer->mapped_virtual_address = virtual_address;
+	memfd_buffer->mapping_refcount = 1;
+
+	return buffer->mapped_virtual_address;
+}
+
+
+static void memfd_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	MemfdDmaBuffer *memfd_buffer = (MemfdDmaBuffer *)buffer;
+
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+
+	if (memfd_buffer->mapping_refcount == 0)
+		return;
+
+	memfd_buffer->mapping_refcount--;
+	if (memfd_buffer->mapping_refcount == 0)
+	{
+		munmap(buffer->mapped_virtual_address, buffer->size);
+		buffer->mapped_virtual_address = NULL;
+	}
+}
+
+
+static imx_physical_address_t memfd_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return buffer->physical_address;
+}
+
+
+static int memfd_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return buffer->fd;
+}
+
+
+static size_t memfd_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return buffer->size;
+}
+
+
+static ImxDmaBufferAllocator* memfd_allocator_new(void)
+{
+	ImxDmaBufferAllocator *allocator = (ImxDmaBufferAllocator *)malloc(sizeof(ImxDmaBufferAllocator));
+	imx_dma_buffer_allocator_init(allocator);
+	allocator->destroy = memfd_allocator_destroy;
+	allocator->allocate = memfd_allocator_allocate;
+	allocator->deallocate = memfd_allocator_deallocate;
+	allocator->map = memfd_allocator_map;
+	allocator->unmap = memfd_allocator_unmap;
+	allocator->start_sync_session = imx_dma_buffer_noop_start_sync_session_func;
+	allocator->stop_sync_session = imx_dma_buffer_noop_stop_sync_session_func;
+	allocator->get_physical_address = memfd_allocator_get_physical_address;
+	allocator->get_fd = memfd_allocator_get_fd;
+	allocator->get_size = memfd_allocator_get_size;
+	allocator->flags = IMX_DMA_BUFFER_ALLOCATOR_FLAG_COMMON_BUFFER_HEADER;
+	return allocator;
+}
+
+
+
+
+/* Benchmark */
+
+typedef struct
+{
+	ImxDmaBufferAllocator *allocator;
+	size_t buffer_size;
+	size_t num_cycles;
+	pthread_barrier_t *start_barrier;
+
+	uint64_t *latencies;
+	size_t num_completed_cycles;
+	uint64_t wall_time;
+	uint64_t cpu_time;
+	int error;
+}
+BenchThread;
+
+
+static uint64_t get_time(clockid_t clock_id)
+{
+	struct timespec ts;
+	clock_gettime(clock_id, &ts);
+	return ((uint64_t)(ts.tv_sec)) * 1000000000ull + ts.tv_nsec;
+}
+
+
+static int compare_latencies(void const *first, void const *second)
+{
+	uint64_t a = *((uint64_t const *)first);
+	uint64_t b = *((uint64_t const *)second);
+	return (a > b) - (a < b);
+}
+
+
+static void* bench_thread_func(void *arg)
+{
+	size_t i;
+	uint64_t wall_start, cpu_start;
+	BenchThread *bench_thread = (BenchThread *)arg;
+
+	pthread_barrier_wait(bench_thread->start_barrier);
+
+	wall_start = get_time(CLOCK_MONOTONIC);
+	cpu_start = get_time(CLOCK_THREAD_CPUTIME_ID);
+
+	for (i = 0; i < bench_thread->num_cycles; ++i)
+	{
+		uint8_t *virtual_address;
+		ImxDmaBuffer *buffer;
+		uint64_t cycle_start = get_time(CLOCK_MONOTONIC);
+
+		buffer = imx_dma_buffer_allocate(bench_thread->allocator, bench_thread->buffer_size, 1, &(bench_thread->error));
+		if (buffer == NULL)
+			break;
+
+		virtual_address = imx_dma_buffer_map(buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE | IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC, &(bench_thread->error));
+		if (virtual_address == NULL)
+		{
+			imx_dma_buffer_deallocate(buffer);
+			break;
+		}
+
+		/* Write like a producer of video frames would. */
+		imx_dma_buffer_start_sync_session(buffer);
+		memset(virtual_address, (int)(i & 0xFF), bench_thread->buffer_size);
+		imx_dma_buffer_stop_sync_session(buffer);
+
+		imx_dma_buffer_unmap(buffer);
+		imx_dma_buffer_deallocate(buffer);
+
+		bench_thread->latencies[i] = get_time(CLOCK_MONOTONIC) - cycle_start;
+	}
+
+	bench_thread->num_completed_cycles = i;
+	bench_thread->cpu_time = get_time(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+	bench_thread->wall_time = get_time(CLOCK_MONOTONIC) - wall_start;
+
+	return NULL;
+}
+
+
+static int run_bench(ImxDmaBufferAllocator *allocator, size_t num_threads, size_t buffer_size, size_t num_cycles)
+{
+	size_t i, total_num_cycles = 0;
+	uint64_t wall_start, wall_time, offcpu_time = 0;
+	uint64_t *all_latencies;
+	pthread_t *threads;
+	BenchThread *bench_threads;
+	pthread_barrier_t start_barrier;
+	int retval = 1;
+
+	threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+	bench_threads = (BenchThread *)malloc(sizeof(BenchThread) * num_threads);
+	all_latencies = (uint64_t *)malloc(sizeof(uint64_t) * num_threads * num_cycles);
+
+	/* The extra participant is this thread; it starts
+	 * the wall clock once all threads are ready. */
+	pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+
+	for (i = 0; i < num_threads; ++i)
+	{
+		BenchThread *bench_thread = &(bench_threads[i]);
+		memset(bench_thread, 0, sizeof(BenchThread));
+		bench_thread->allocator = allocator;
+		bench_thread->buffer_size = buffer_size;
+		bench_thread->num_cycles = num_cycles;
+		bench_thread->start_barrier = &start_barrier;
+		bench_thread->latencies = all_latencies + i * num_cycles;
+		pthread_create(&(threads[i]), NULL, bench_thread_func, bench_thread);
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	wall_start = get_time(CLOCK_MONOTONIC);
+
+	for (i = 0; i < num_threads; ++i)
+		pthread_join(threads[i], NULL);
+
+	wall_time = get_time(CLOCK_MONOTONIC) - wall_start;
+
+	/* Compact the latencies of all threads into one array. */
+	for (i = 0; i < num_threads; ++i)
+	{
+		BenchThread *bench_thread = &(bench_threads[i]);
+
+		if (bench_thread->num_completed_cycles != num_cycles)
+		{
+			fprintf(stderr, "Thread %zu failed after %zu cycles: %s (%d)\n", i, bench_thread->num_completed_cycles, strerror(bench_thread->error), bench_thread->error);
+			retval = 0;
+		}
+
+		memmove(all_latencies + total_num_cycles, bench_thread->latencies, sizeof(uint64_t) * bench_thread->num_completed_cycles);
+		total_num_cycles += bench_thread->num_completed_cycles;
+
+		if (bench_thread->wall_time > bench_thread->cpu_time)
+			offcpu_time += bench_thread->wall_time - bench_thread->cpu_time;
+	}
+
+	if (total_num_cycles > 0)
+	{
+		qsort(all_latencies, total_num_cycles, sizeof(uint64_t), compare_latencies);
+
+		printf(
+			"%7zu  %12.0f  %9.1f  %9.1f  %9.1f  %9.1f  %12.1f\n",
+			num_threads,
+			(double)total_num_cycles * 1e9 / (double)wall_time,
+			all_latencies[total_num_cycles * 50 / 100] / 1e3,
+			all_latencies[total_num_cycles * 99 / 100] / 1e3,
+			all_latencies[total_num_cycles * 999 / 1000] / 1e3,
+			all_latencies[total_num_cycles - 1] / 1e3,
+			(double)offcpu_time / num_threads / 1e3
+		);
+	}
+
+	pthread_barrier_destroy(&start_barrier);
+	free(all_latencies);
+	free(bench_threads);
+	free(threads);
+
+	return retval;
+}
+
+
+static ImxDmaBufferAllocator* create_allocator(char const *name, int *error)
+{
+	if (strcmp(name, "memfd") == 0)
+		return memfd_allocator_new();
+	if (strcmp(name, "default") == 0)
+		return imx_dma_buffer_allocator_new(error);
+#ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
+	if (strcmp(name, "dma-heap") == 0)
+		return imx_dma_buffer_dma_heap_allocator_new(-1, IMX_DMA_BUFFER_DMA_HEAP_ALLOCATOR_DEFAULT_HEAP_FLAGS, IMX_DMA_BUFFER_DMA_HEAP_ALLOCATOR_DEFAULT_FD_FLAGS, error);
+#endif
+#ifdef IMXDMABUFFER_ION_ALLOCATOR_ENABLED
+	if (strcmp(name, "ion") == 0)
+		return imx_dma_buffer_ion_allocator_new(-1, IMX_DMA_BUFFER_ION_ALLOCATOR_DEFAULT_HEAP_ID_MASK, IMX_DMA_BUFFER_ION_ALLOCATOR_DEFAULT_HEAP_FLAGS, error);
+#endif
+#ifdef IMXDMABUFFER_DWL_ALLOCATOR_ENABLED
+	if (strcmp(name, "dwl") == 0)
+		return imx_dma_buffer_dwl_allocator_new(error);
+#endif
+#ifdef IMXDMABUFFER_IPU_ALLOCATOR_ENABLED
+	if (strcmp(name, "ipu") == 0)
+		return imx_dma_buffer_ipu_allocator_new(-1, error);
+#endif
+#ifdef IMXDMABUFFER_G2D_ALLOCATOR_ENABLED
+	if (strcmp(name, "g2d") == 0)
+		return imx_dma_buffer_g2d_allocator_new();
+#endif
+#ifdef IMXDMABUFFER_PXP_ALLOCATOR_ENABLED
+	if (strcmp(name, "pxp") == 0)
+		return imx_dma_buffer_pxp_allocator_new(-1, error);
+#endif
+
+	if (error != NULL)
+		*error = ENOENT;
+	return NULL;
+}
+
+
+static void print_usage(char const *program_name)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS]\n"
+		"\n"
+		"  -a NAME   allocator to use; one of: memfd default"
+#ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
+		" dma-heap"
+#endif
+#ifdef IMXDMABUFFER_ION_ALLOCATOR_ENABLED
+		" ion"
+#endif
+#ifdef IMXDMABUFFER_DWL_ALLOCATOR_ENABLED
+		" dwl"
+#endif
+#ifdef IMXDMABUFFER_IPU_ALLOCATOR_ENABLED
+		" ipu"
+#endif
+#ifdef IMXDMABUFFER_G2D_ALLOCATOR_ENABLED
+		" g2d"
+#endif
+#ifdef IMXDMABUFFER_PXP_ALLOCATOR_ENABLED
+		" pxp"
+#endif
+		" (default: memfd)\n"
+		"  -p        put a pool allocator on top of the allocator\n"
+		"  -z        put a zero filling pool allocator on top of the allocator\n"
+		"  -s SIZE   buffer size in bytes (default: 1382400, one 720p NV12 frame)\n"
+		"  -n COUNT  number of cycles per thread (default: 1000)\n"
+		"  -t COUNT  maximum number of threads (default: number of online CPU cores)\n",
+		program_name
+	);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int opt, err;
+	char const *allocator_name = "memfd";
+	unsigned int pool_flags = 0;
+	int use_pool = 0;
+	size_t buffer_size = 1280 * 720 * 3 / 2;
+	size_t num_cycles = 1000;
+	long max_num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long num_threads;
+	ImxDmaBufferAllocator *allocator, *pool_allocator = NULL;
+	int retval = 0;
+
+	while ((opt = getopt(argc, argv, "a:pzs:n:t:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a': allocator_name = optarg; break;
+			case 'p': use_pool = 1; break;
+			case 'z': use_pool = 1; pool_flags |= IMX_DMA_BUFFER_POOL_ALLOCATOR_FLAG_ZERO_FILL; break;
+			case 's': buffer_size = strtoul(optarg, NULL, 0); break;
+			case 'n': num_cycles = strtoul(optarg, NULL, 0); break;
+			case 't': max_num_threads = strtol(optarg, NULL, 0); break;
+			default:
+				print_usage(argv[0]);
+				return (opt == 'h') ? 0 : -1;
+		}
+	}
+
+	if ((buffer_size == 0) || (num_cycles == 0) || (max_num_threads < 1))
+	{
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	allocator = create_allocator(allocator_name, &err);
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create %s allocator: %s (%d)\n", allocator_name, strerror(err), err);
+		return -1;
+	}
+
+	if (use_pool)
+	{
+		/* Keep enough idle buffers around for all threads. */
+		pool_allocator = imx_dma_buffer_pool_allocator_new(allocator, max_num_threads, pool_flags, &err);
+		if (pool_allocator == NULL)
+		{
+			fprintf(stderr, "Could not create pool allocator: %s (%d)\n", strerror(err), err);
+			imx_dma_buffer_allocator_destroy(allocator);
+			return -1;
+		}
+	}
+
+	printf("allocator: %s%s  buffer size: %zu  cycles per thread: %zu\n", allocator_name, use_pool ? ((pool_flags & IMX_DMA_BUFFER_POOL_ALLOCATOR_FLAG_ZERO_FILL) ? " (zero filling pool)" : " (pool)") : "", buffer_size, num_cycles);
+	printf("%7s  %12s  %9s  %9s  %9s  %9s  %12s\n", "threads", "cycles/sec", "p50 (us)", "p99 (us)", "p99.9 (us)", "max (us)", "off-CPU (us)");
+
+	/* Double the thread count each time, and always end with the maximum. */
+	for (num_threads = 1; ; num_threads *= 2)
+	{
+		if (num_threads > max_num_threads)
+			num_threads = max_num_threads;
+
+		if (!run_bench((pool_allocator != NULL) ? pool_allocator : allocator, num_threads, buffer_size, num_cycles))
+		{
+			retval = -1;
+			break;
+		}
+
+		if (num_threads == max_num_threads)
+			break;
+	}
+
+	if (pool_allocator != NULL)
+		imx_dma_buffer_allocator_destroy(pool_allocator);
+	imx_dma_buffer_allocator_destroy(allocator);
+
+	return retval;
+}
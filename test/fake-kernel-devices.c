@@ -0,0 +1,672 @@
+/* Needed for RTLD_NEXT and memfd_create(). */
+#define _GNU_SOURCE
+/* open() and mmap() are defined below under their own names. With 64-bit
+ * file offsets on 32-bit platforms, the headers would rename them. */
+#undef _FILE_OFFSET_BITS
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "imxdmabuffer_config.h"
+
+#ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#endif
+
+#ifdef IMXDMABUFFER_ION_ALLOCATOR_ENABLED
+#include <linux/dma-buf.h>
+#include <linux/ion.h>
+#include <linux/version.h>
+#endif
+
+#ifdef IMXDMABUFFER_IPU_ALLOCATOR_ENABLED
+#include <linux/fb.h>
+/* See imxdmabuffer_ipu_priv.c for why this is necessary. */
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+#include <linux/ipu.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#ifdef IMXDMABUFFER_PXP_ALLOCATOR_ENABLED
+#include <linux/pxp_device.h>
+#endif
+
+
+/* Fake i.MX kernel devices.
+ *
+ * This is an LD_PRELOAD library that emulates the device nodes which the
+ * dma-heap, ION, IPU, and PxP allocators talk to. It makes it possible to
+ * run and profile these allocators on machines without i.MX hardware:
+ *
+ *   LD_PRELOAD=build/libfake-kernel-devices.so build/test-alloc
+ *
+ * open() on one of the device nodes returns a memfd that stands in for the
+ * device. ioctl() calls on it are emulated:
+ *
+ *   dma-heap: DMA_HEAP_IOCTL_ALLOC
+ *   ION:      ION_IOC_ALLOC, ION_IOC_HEAP_QUERY (the kernel >= 4.14 API only)
+ *   IPU:      IPU_ALLOC, IPU_FREE
+ *   PxP:      PXP_IOC_GET_PHYMEM, PXP_IOC_PUT_PHYMEM
+ *
+ * The memory of each buffer is a memfd, and gets a fake physical address.
+ * With dma-heap and ION, that memfd is the DMA-BUF FD of the buffer, so
+ * DMA_BUF_IOCTL_PHYS and DMA_BUF_IOCTL_SYNC are emulated on it, and mmap()
+ * works as usual. With IPU and PxP, mmap() on the device FD with a physical
+ * address as offset is redirected to the memfd of that buffer.
+ *
+ * The following environment variables control the behavior:
+ *
+ *   IMXDMABUFFER_FAKE_ALLOC_LATENCY_US: Time in microseconds that each
+ *     allocation takes, to model the cost of the kernel allocator.
+ *   IMXDMABUFFER_FAKE_SYNC_LATENCY_US: Time in microseconds that each
+ *     DMA_BUF_IOCTL_SYNC call takes, to model cache maintenance.
+ *   IMXDMABUFFER_FAKE_FAIL_EVERY_NTH_ALLOC: If set to N > 0, every Nth
+ *     allocation fails with ENOMEM, to exercise error paths.
+ *
+ * This is only meant for testing and benchmarking, and is not installed.
+ */
+
+
+typedef enum
+{
+	FAKE_DEVICE_TYPE_NONE,
+	FAKE_DEVICE_TYPE_DMA_HEAP,
+	FAKE_DEVICE_TYPE_ION,
+	FAKE_DEVICE_TYPE_IPU,
+	FAKE_DEVICE_TYPE_PXP
+}
+FakeDeviceType;
+
+
+typedef struct _FakeDevice FakeDevice;
+
+struct _FakeDevice
+{
+	FakeDevice *next;
+	int fd;
+	FakeDeviceType type;
+};
+
+
+typedef struct _FakeBuffer FakeBuffer;
+
+struct _FakeBuffer
+{
+	FakeBuffer *next;
+	/* With dma-heap and ION, this is also the DMA-BUF FD. */
+	int memfd;
+	unsigned long physical_address;
+	size_t size;
+	/* Nonzero if the caller owns memfd (it is a DMA-BUF FD), and the
+	 * buffer is freed when the caller closes it. Otherwise, the buffer
+	 * is freed with the device's free ioctl. */
+	int memfd_is_dmabuf;
+};
+
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int (*real_open)(char const *pathname, int flags, ...);
+static int (*real_close)(int fd);
+static int (*real_ioctl)(int fd, unsigned long request, ...);
+static void* (*real_mmap)(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+static void* (*real_mmap64)(void *addr, size_t length, int prot, int flags, int fd, off64_t offset);
+
+static unsigned long alloc_latency_us = 0;
+static unsigned long sync_latency_us = 0;
+static unsigned long fail_every_nth_alloc = 0;
+static unsigned long num_allocs = 0;
+
+static FakeDevice *devices = NULL;
+static FakeBuffer *buffers = NULL;
+
+/* Physical addresses are handed out linearly, and never reused. They
+ * stay below 4 GB, since some of the APIs use 32-bit addresses. */
+static unsigned long next_physical_address = 0x10000000;
+#define FAKE_PHYSICAL_ADDRESS_LIMIT 0xF0000000UL
+
+
+static void init(void)
+{
+	char const *value;
+
+	/* Going through a void pointer, since ISO C does not
+	 * allow for casting object pointers to function pointers. */
+	*(void **)(&real_open) = dlsym(RTLD_NEXT, "open");
+	*(void **)(&real_close) = dlsym(RTLD_NEXT, "close");
+	*(void **)(&real_ioctl) = dlsym(RTLD_NEXT, "ioctl");
+	*(void **)(&real_mmap) = dlsym(RTLD_NEXT, "mmap");
+	*(void **)(&real_mmap64) = dlsym(RTLD_NEXT, "mmap64");
+
+	if ((value = getenv("IMXDMABUFFER_FAKE_ALLOC_LATENCY_US")) != NULL)
+		alloc_latency_us = strtoul(value, NULL, 10);
+	if ((value = getenv("IMXDMABUFFER_FAKE_SYNC_LATENCY_US")) != NULL)
+		sync_latency_us = strtoul(value, NULL, 10);
+	if ((value = getenv("IMXDMABUFFER_FAKE_FAIL_EVERY_NTH_ALLOC")) != NULL)
+		fail_every_nth_alloc = strtoul(value, NULL, 10);
+}
+
+
+static void sleep_us(unsigned long us)
+{
+	struct timespec duration;
+
+	if (us == 0)
+		return;
+
+	duration.tv_sec = us / 1000000;
+	duration.tv_nsec = (long)(us % 1000000) * 1000;
+	while ((nanosleep(&duration, &duration) < 0) && (errno == EINTR));
+}
+
+
+static FakeDeviceType get_device_type_from_path(char const *pathname)
+{
+	if (pathname == NULL)
+		return FAKE_DEVICE_TYPE_NONE;
+
+#ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
+	if (strcmp(pathname, IMXDMABUFFER_DMA_HEAP_DEVICE_NODE_PATH) == 0)
+		return FAKE_DEVICE_TYPE_DMA_HEAP;
+#endif
+#ifdef IMXDMABUFFER_ION_ALLOCATOR_ENABLED
+	if (strcmp(pathname, "/dev/ion") == 0)
+		return FAKE_DEVICE_TYPE_ION;
+#endif
+#ifdef IMXDMABUFFER_IPU_ALLOCATOR_ENABLED
+	if (strcmp(pathname, "/dev/mxc_ipu") == 0)
+		return FAKE_DEVICE_TYPE_IPU;
+#endif
+#ifdef IMXDMABUFFER_PXP_ALLOCATOR_ENABLED
+	if (strcmp(pathname, "/dev/pxp_device") == 0)
+		return FAKE_DEVICE_TYPE_PXP;
+#endif
+
+	return FAKE_DEVICE_TYPE_NONE;
+}
+
+
+/* The functions below must be called with the mutex locked. */
+
+static FakeDeviceType get_device_type_from_fd(int fd)
+{
+	FakeDevice *device;
+
+	for (device = devices; device != NULL; device = device->next)
+	{
+		if (device->fd == fd)
+			return device->type;
+	}
+
+	return FAKE_DEVICE_TYPE_NONE;
+}
+
+
+static FakeBuffer* find_buffer_by_memfd(int memfd)
+{
+	FakeBuffer *buffer;
+
+	for (buffer = buffers; buffer != NULL; buffer = buffer->next)
+	{
+		if (buffer->memfd_is_dmabuf && (buffer->memfd == memfd))
+			return buffer;
+	}
+
+	return NULL;
+}
+
+
+static FakeBuffer* find_buffer_by_physical_address(unsigned long physical_address)
+{
+	FakeBuffer *buffer;
+
+	for (buffer = buffers; buffer != NULL; buffer = buffer->next)
+	{
+		if ((physical_address >= buffer->physical_address) && (physical_address < (buffer->physical_address + buffer->size)))
+			return buffer;
+	}
+
+	return NULL;
+}
+
+
+static FakeBuffer* allocate_buffer(size_t size, int memfd_is_dmabuf, int cloexec)
+{
+	FakeBuffer *buffer;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t aligned_size = (size + page_size - 1) / page_size * page_size;
+
+	if ((fail_every_nth_alloc > 0) && (((++num_allocs) % fail_every_nth_alloc) == 0))
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if ((size == 0) || ((FAKE_PHYSICAL_ADDRESS_LIMIT - next_physical_address) < aligned_size))
+	{
+		errno = (size == 0) ? EINVAL : ENOMEM;
+		return NULL;
+	}
+
+	buffer = (FakeBuffer *)malloc(sizeof(FakeBuffer));
+	if (buffer == NULL)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	buffer->memfd = memfd_create("imxdmabuffer-fake-buffer", cloexec ? MFD_CLOEXEC : 0);
+	if (buffer->memfd < 0)
+	{
+		free(buffer);
+		return NULL;
+	}
+
+	if (ftruncate(buffer->memfd, aligned_size) < 0)
+	{
+		int ftruncate_errno = errno;
+		real_close(buffer->memfd);
+		free(buffer);
+		errno = ftruncate_errno;
+		return NULL;
+	}
+
+	buffer->physical_address = next_physical_address;
+	buffer->size = aligned_size;
+	buffer->memfd_is_dmabuf = memfd_is_dmabuf;
+	buffer->next = buffers;
+	buffers = buffer;
+
+	/* Leave a gap, so that overruns do not end up in the next buffer. */
+	next_physical_address += aligned_size + page_size;
+
+	return buffer;
+}
+
+
+static void free_buffer(FakeBuffer *buffer, int close_memfd)
+{
+	FakeBuffer **link;
+
+	for (link = &buffers; (*link) != NULL; link = &((*link)->next))
+	{
+		if ((*link) == buffer)
+		{
+			*link = buffer->next;
+			break;
+		}
+	}
+
+	if (close_memfd)
+		real_close(buffer->memfd);
+	free(buffer);
+}
+
+
+static int device_ioctl(FakeDeviceType type, unsigned long request, void *arg)
+{
+	FakeBuffer *buffer;
+
+	switch (type)
+	{
+#ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
+		case FAKE_DEVICE_TYPE_DMA_HEAP:
+			if (request == DMA_HEAP_IOCTL_ALLOC)
+			{
+				struct dma_heap_allocation_data *data = (struct dma_heap_allocation_data *)arg;
+				buffer = allocate_buffer(data->len, 1, (data->fd_flags & O_CLOEXEC) != 0);
+				if (buffer == NULL)
+					return -1;
+				data->fd = buffer->memfd;
+				return 0;
+			}
+			break;
+#endif
+
+#ifdef IMXDMABUFFER_ION_ALLOCATOR_ENABLED
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+		case FAKE_DEVICE_TYPE_ION:
+			if (request == ION_IOC_ALLOC)
+			{
+				struct ion_allocation_data *data = (struct ion_allocation_data *)arg;
+				buffer = allocate_buffer(data->len, 1, 1);
+				if (buffer == NULL)
+					return -1;
+				data->fd = buffer->memfd;
+				return 0;
+			}
+			else if (request == ION_IOC_HEAP_QUERY)
+			{
+				/* There is one heap, and it is of the type that
+				 * the ION allocator looks for. */
+				struct ion_heap_query *query = (struct ion_heap_query *)arg;
+				if ((query->heaps != 0) && (query->cnt >= 1))
+				{
+					struct ion_heap_data *heap_data = (struct ion_heap_data *)((unsigned long)(query->heaps));
+					memset(heap_data, 0, sizeof(struct ion_heap_data));
+					strcpy(heap_data->name, "fake_dma");
+					heap_data->type = ION_HEAP_TYPE_DMA;
+					heap_data->heap_id = 0;
+				}
+				query->cnt = 1;
+				return 0;
+			}
+			break;
+#endif
+#endif
+
+#ifdef IMXDMABUFFER_IPU_ALLOCATOR_ENABLED
+		case FAKE_DEVICE_TYPE_IPU:
+			if (request == IPU_ALLOC)
+			{
+				/* The size is passed in, and the physical address is passed out. */
+				dma_addr_t *m = (dma_addr_t *)arg;
+				buffer = allocate_buffer((size_t)(*m), 0, 1);
+				if (buffer == NULL)
+					return -1;
+				*m = (dma_addr_t)(buffer->physical_address);
+				return 0;
+			}
+			else if (request == IPU_FREE)
+			{
+				buffer = find_buffer_by_physical_address((unsigned long)(*((dma_addr_t *)arg)));
+				if (buffer == NULL)
+				{
+					errno = EINVAL;
+					return -1;
+				}
+				free_buffer(buffer, 1);
+				return 0;
+			}
+			break;
+#endif
+
+#ifdef IMXDMABUFFER_PXP_ALLOCATOR_ENABLED
+		case FAKE_DEVICE_TYPE_PXP:
+			if (request == PXP_IOC_GET_PHYMEM)
+			{
+				struct pxp_mem_desc *mem_desc = (struct pxp_mem_desc *)arg;
+				buffer = allocate_buffer(mem_desc->size, 0, 1);
+				if (buffer == NULL)
+					return -1;
+				mem_desc->phys_addr = buffer->physical_address;
+				return 0;
+			}
+			else if (request == PXP_IOC_PUT_PHYMEM)
+			{
+				struct pxp_mem_desc *mem_desc = (struct pxp_mem_desc *)arg;
+				buffer = find_buffer_by_physical_address(mem_desc->phys_addr);
+				if (buffer == NULL)
+				{
+					errno = EINVAL;
+					return -1;
+				}
+				free_buffer(buffer, 1);
+				return 0;
+			}
+			break;
+#endif
+
+		default:
+			break;
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+
+static int open_device(FakeDeviceType type, int flags)
+{
+	int fd;
+	FakeDevice *device;
+
+	device = (FakeDevice *)malloc(sizeof(FakeDevice));
+	if (device == NULL)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+
+	fd = memfd_create("imxdmabuffer-fake-device", (flags & O_CLOEXEC) ? MFD_CLOEXEC : 0);
+	if (fd < 0)
+	{
+		free(device);
+		return -1;
+	}
+
+	pthread_mutex_lock(&mutex);
+	device->fd = fd;
+	device->type = type;
+	device->next = devices;
+	devices = device;
+	pthread_mutex_unlock(&mutex);
+
+	return fd;
+}
+
+
+static void* mmap_device(int fd, void *addr, size_t length, int prot, int flags, unsigned long offset, int *handled)
+{
+	void *mapping;
+	FakeBuffer *buffer;
+	FakeDeviceType type;
+
+	pthread_once(&init_once, init);
+
+	pthread_mutex_lock(&mutex);
+
+	type = get_device_type_from_fd(fd);
+	*handled = ((type == FAKE_DEVICE_TYPE_IPU) || (type == FAKE_DEVICE_TYPE_PXP));
+	if (!(*handled))
+	{
+		pthread_mutex_unlock(&mutex);
+		return MAP_FAILED;
+	}
+
+	/* The offset is a physical address. Map the
+	 * corresponding part of the buffer's memfd. */
+	buffer = find_buffer_by_physical_address(offset);
+	if ((buffer == NULL) || ((offset + length) > (buffer->physical_address + buffer->size)))
+	{
+		pthread_mutex_unlock(&mutex);
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	mapping = real_mmap(addr, length, prot, flags, buffer->memfd, (off_t)(offset - buffer->physical_address));
+
+	pthread_mutex_unlock(&mutex);
+
+	return mapping;
+}
+
+
+
+
+/* Interposed libc functions */
+
+
+static int open_impl(char const *pathname, int flags, mode_t mode)
+{
+	FakeDeviceType type;
+
+	pthread_once(&init_once, init);
+
+	type = get_device_type_from_path(pathname);
+	if (type != FAKE_DEVICE_TYPE_NONE)
+		return open_device(type, flags);
+
+	return real_open(pathname, flags, mode);
+}
+
+
+int open(char const *pathname, int flags, ...)
+{
+	mode_t mode = 0;
+
+	if ((flags & O_CREAT) || ((flags & O_TMPFILE) == O_TMPFILE))
+	{
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+
+	return open_impl(pathname, flags, mode);
+}
+
+
+int open64(char const *pathname, int flags, ...)
+{
+	mode_t mode = 0;
+
+	if ((flags & O_CREAT) || ((flags & O_TMPFILE) == O_TMPFILE))
+	{
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+
+	return open_impl(pathname, flags | O_LARGEFILE, mode);
+}
+
+
+int close(int fd)
+{
+	FakeDevice **device_link;
+	FakeBuffer *buffer;
+
+	pthread_once(&init_once, init);
+
+	pthread_mutex_lock(&mutex);
+
+	for (device_link = &devices; (*device_link) != NULL; device_link = &((*device_link)->next))
+	{
+		FakeDevice *device = *device_link;
+		if (device->fd == fd)
+		{
+			*device_link = device->next;
+			free(device);
+			break;
+		}
+	}
+
+	/* Closing the DMA-BUF FD frees the buffer. The FD itself is
+	 * closed below, and existing mappings stay valid, just like
+	 * with real DMA-BUF FDs. */
+	buffer = find_buffer_by_memfd(fd);
+	if (buffer != NULL)
+		free_buffer(buffer, 0);
+
+	pthread_mutex_unlock(&mutex);
+
+	return real_close(fd);
+}
+
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	int ret;
+	void *arg;
+	va_list args;
+	FakeDeviceType type;
+
+	va_start(args, request);
+	arg = va_arg(args, void *);
+	va_end(args);
+
+	pthread_once(&init_once, init);
+
+	pthread_mutex_lock(&mutex);
+
+	type = get_device_type_from_fd(fd);
+	if (type != FAKE_DEVICE_TYPE_NONE)
+	{
+		int is_alloc = 0;
+
+#ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
+		is_alloc = is_alloc || (request == DMA_HEAP_IOCTL_ALLOC);
+#endif
+#ifdef IMXDMABUFFER_ION_ALLOCATOR_ENABLED
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+		is_alloc = is_alloc || (request == ION_IOC_ALLOC);
+#endif
+#endif
+#ifdef IMXDMABUFFER_IPU_ALLOCATOR_ENABLED
+		is_alloc = is_alloc || (request == IPU_ALLOC);
+#endif
+#ifdef IMXDMABUFFER_PXP_ALLOCATOR_ENABLED
+		is_alloc = is_alloc || (request == PXP_IOC_GET_PHYMEM);
+#endif
+
+		ret = device_ioctl(type, request, arg);
+		pthread_mutex_unlock(&mutex);
+
+		/* Sleep without holding the lock, so the latency of
+		 * concurrent allocations overlaps like in the kernel. */
+		if (is_alloc)
+			sleep_us(alloc_latency_us);
+
+		return ret;
+	}
+
+#if defined(IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED) || defined(IMXDMABUFFER_ION_ALLOCATOR_ENABLED)
+	{
+		FakeBuffer *buffer = find_buffer_by_memfd(fd);
+		if (buffer != NULL)
+		{
+			if (request == DMA_BUF_IOCTL_PHYS)
+			{
+				((struct dma_buf_phys *)arg)->phys = buffer->physical_address;
+				pthread_mutex_unlock(&mutex);
+				return 0;
+			}
+			else if (request == DMA_BUF_IOCTL_SYNC)
+			{
+				pthread_mutex_unlock(&mutex);
+				sleep_us(sync_latency_us);
+				return 0;
+			}
+		}
+	}
+#endif
+
+	pthread_mutex_unlock(&mutex);
+
+	return real_ioctl(fd, request, arg);
+}
+
+
+void* mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	int handled;
+	void *mapping = mmap_device(fd, addr, length, prot, flags, (unsigned long)offset, &handled);
+	return handled ? mapping : real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+
+void* mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset)
+{
+	int handled;
+	void *mapping = mmap_device(fd, addr, length, prot, flags, (unsigned long)offset, &handled);
+	return handled ? mapping : real_mmap64(addr, length, prot, flags, fd, offset);
+}
@@ -1,9 +1,27 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 
 #include "imxdmabuffer_config.h"
 #include "imxdmabuffer/imxdmabuffer.h"
 #include "imxdmabuffer/imxdmabuffer_priv.h"
+#include "imxdmabuffer/imxdmabuffer_static_dispatch.h"
+#include "imxdmabuffer/imxdmabuffer_pool_allocator.h"
+#include "imxdmabuffer/imxdmabuffer_file_loader.h"
+#include "imxdmabuffer/imxdmabuffer_zerocopy_sender.h"
+#include "imxdmabuffer/imxdmabuffer_rtp_ingest.h"
+#include "imxdmabuffer/imxdmabuffer_queue.h"
+#include "imxdmabuffer/imxdmabuffer_ring.h"
+#include "imxdmabuffer/imxdmabuffer_arena_allocator.h"
+#include "imxdmabuffer/imxdmabuffer_detile.h"
+#include "imxdmabuffer/imxdmabuffer_blit.h"
+#include "imxdmabuffer/imxdmabuffer_copy_queue.h"
 
 #ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
 #include "imxdmabuffer/imxdmabuffer_dma_heap_allocator.h"
@@ -30,83 +48,2354 @@
 #endif
 
 
+static ImxDmaBufferAttachmentKey test_attachment_key = -1;
+static int num_destroyed_test_attachments = 0;
+
+static void destroy_test_attachment(ImxDmaBuffer *buffer, void *attachment)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(buffer);
+	IMX_DMA_BUFFER_UNUSED_PARAM(attachment);
+	num_destroyed_test_attachments++;
+}
+
+
 int check_allocation(ImxDmaBufferAllocator *allocator, char const *name)
 {
-	static size_t const expected_buffer_size = 4096;
-	static size_t const expected_alignment = 16;
-	size_t actual_buffer_size;
+	static int test_attachment = 0;
+	static size_t const expected_buffer_size = 4096;
+	static size_t const expected_alignment = 16;
+	size_t actual_buffer_size;
+	int retval = 0;
+	int err;
+	void *mapped_virtual_address = NULL;
+	void *second_mapped_virtual_address = NULL;
+	imx_physical_address_t physical_address;
+	ImxDmaBuffer *dma_buffer = NULL;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create %s allocator\n", name);
+		goto finish;
+	}
+
+	dma_buffer = imx_dma_buffer_allocate(allocator, expected_buffer_size, expected_alignment, &err);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer with %s allocator: %s (%d)\n", name, strerror(err), err);
+		goto finish;
+	}
+
+	actual_buffer_size = imx_dma_buffer_get_size(dma_buffer);
+	if (actual_buffer_size != expected_buffer_size)
+	{
+		fprintf(stderr, "DMA buffer allocated with %s allocator has incorrect size: expected %zu got %zu\n", name, expected_buffer_size, actual_buffer_size);
+		goto finish;
+	}
+
+	mapped_virtual_address = imx_dma_buffer_map(dma_buffer, 0, &err);
+	if (mapped_virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map DMA buffer allocated with %s allocator: %s (%d)\n", name, strerror(err), err);
+		goto finish;
+	}
+
+	second_mapped_virtual_address = imx_dma_buffer_map(dma_buffer, 0, &err);
+	if (second_mapped_virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map DMA buffer allocated with %s allocator: %s (%d)\n", name, strerror(err), err);
+		goto finish;
+	}
+
+	if (mapped_virtual_address != second_mapped_virtual_address)
+	{
+		fprintf(stderr, "Redundant mapping attempts must always return the same virtual pointer as the previous mapping\n");
+		goto finish;
+	}
+
+	physical_address = imx_dma_buffer_get_physical_address(dma_buffer);
+	if (physical_address == 0)
+	{
+		fprintf(stderr, "Could not get physical address for DMA buffer allocated %s allocator\n", name);
+		goto finish;
+	}
+	if ((physical_address & (expected_alignment - 1)) != 0)
+	{
+		fprintf(stderr, "Physical address %" IMX_PHYSICAL_ADDRESS_FORMAT " for DMA buffer allocated %s allocator is not aligned to %zu-byte boundaries\n", physical_address, name, expected_alignment);
+		goto finish;
+	}
+
+	if ((imx_dma_buffer_direct_get_physical_address(dma_buffer) != physical_address)
+	 || (imx_dma_buffer_direct_get_size(dma_buffer) != actual_buffer_size)
+	 || (imx_dma_buffer_direct_get_fd(dma_buffer) != imx_dma_buffer_get_fd(dma_buffer)))
+	{
+		fprintf(stderr, "Direct-call getters return different values than the regular getters for DMA buffer allocated %s allocator\n", name);
+		goto finish;
+	}
+
+	{
+		uint8_t *range_virtual_address;
+
+		((uint8_t *)mapped_virtual_address)[expected_buffer_size - 100] = 0x5A;
+		range_virtual_address = imx_dma_buffer_map_range(dma_buffer, expected_buffer_size - 100, 16, 0, &err);
+		if (range_virtual_address == NULL)
+		{
+			fprintf(stderr, "Could not map range of DMA buffer allocated with %s allocator: %s (%d)\n", name, strerror(err), err);
+			goto finish;
+		}
+
+		if (range_virtual_address[0] != 0x5A)
+		{
+			fprintf(stderr, "Mapped range of DMA buffer allocated with %s allocator does not show the buffer contents\n", name);
+			imx_dma_buffer_unmap_range(dma_buffer, range_virtual_address);
+			goto finish;
+		}
+
+		imx_dma_buffer_unmap_range(dma_buffer, range_virtual_address);
+	}
+
+	if ((imx_dma_buffer_get_attachment(dma_buffer, test_attachment_key) != NULL)
+	 || !imx_dma_buffer_set_attachment(dma_buffer, test_attachment_key, &test_attachment)
+	 || (imx_dma_buffer_get_attachment(dma_buffer, test_attachment_key) != &test_attachment))
+	{
+		fprintf(stderr, "Attachments do not work with DMA buffer allocated %s allocator\n", name);
+		goto finish;
+	}
+
+	fprintf(stderr, "%s allocator works correctly\n", name);
+	retval = 1;
+
+finish:
+	if (second_mapped_virtual_address != NULL)
+		imx_dma_buffer_unmap(dma_buffer);
+	if (mapped_virtual_address != NULL)
+		imx_dma_buffer_unmap(dma_buffer);
+	if (dma_buffer != NULL)
+	{
+		int num_destroyed_before = num_destroyed_test_attachments;
+		int had_attachment = (imx_dma_buffer_get_attachment(dma_buffer, test_attachment_key) != NULL);
+
+		imx_dma_buffer_deallocate(dma_buffer);
+
+		if (had_attachment && (num_destroyed_test_attachments != (num_destroyed_before + 1)))
+		{
+			fprintf(stderr, "Attachment of DMA buffer allocated %s allocator was not destroyed\n", name);
+			retval = 0;
+		}
+	}
+	if (allocator != NULL)
+		imx_dma_buffer_allocator_destroy(allocator);
+
+	return retval;
+}
+
+
+int check_pool_allocation(ImxDmaBufferAllocator *underlying_allocator)
+{
+	static size_t const buffer_size = 4096;
+	size_t i;
+	int retval = 0;
+	int err;
+	uint8_t *mapped_virtual_address;
+	ImxDmaBufferAllocator *allocator = NULL;
+	ImxDmaBuffer *dma_buffer = NULL;
+
+	if (underlying_allocator == NULL)
+	{
+		fprintf(stderr, "Could not create underlying allocator for pool allocator\n");
+		goto finish;
+	}
+
+	allocator = imx_dma_buffer_pool_allocator_new(underlying_allocator, 4, IMX_DMA_BUFFER_POOL_ALLOCATOR_FLAG_ZERO_FILL, &err);
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create pool allocator: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	/* Fill a buffer with nonzero bytes and return it to the pool.
+	 * The next allocation must reuse it, and it must be zeroed. */
+
+	dma_buffer = imx_dma_buffer_allocate(allocator, buffer_size, 1, &err);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer with pool allocator: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	mapped_virtual_address = imx_dma_buffer_map(dma_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, &err);
+	if (mapped_virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map DMA buffer allocated with pool allocator: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	memset(mapped_virtual_address, 0xAB, buffer_size);
+	imx_dma_buffer_unmap(dma_buffer);
+
+	imx_dma_buffer_deallocate(dma_buffer);
+
+	dma_buffer = imx_dma_buffer_allocate(allocator, buffer_size, 1, &err);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer with pool allocator: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	mapped_virtual_address = imx_dma_buffer_map(dma_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+	if (mapped_virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map DMA buffer allocated with pool allocator: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	for (i = 0; i < buffer_size; ++i)
+	{
+		if (mapped_virtual_address[i] != 0)
+			break;
+	}
+	imx_dma_buffer_unmap(dma_buffer);
+
+	if (i != buffer_size)
+	{
+		fprintf(stderr, "Recycled DMA buffer allocated with pool allocator was not zeroed (nonzero byte at offset %zu)\n", i);
+		goto finish;
+	}
+
+	fprintf(stderr, "pool allocator works correctly\n");
+	retval = 1;
+
+finish:
+	if (dma_buffer != NULL)
+		imx_dma_buffer_deallocate(dma_buffer);
+	if (allocator != NULL)
+		imx_dma_buffer_allocator_destroy(allocator);
+	if (underlying_allocator != NULL)
+		imx_dma_buffer_allocator_destroy(underlying_allocator);
+
+	return retval;
+}
+
+
+int check_file_loading(ImxDmaBufferAllocator *allocator)
+{
+	static size_t const file_size = 3 * 4096 + 123;
+	static size_t const chunk_size = 4096;
+	char filename[] = "/tmp/test-alloc-XXXXXX";
+	int fd = -1;
+	size_t i, num_loaded_bytes = 0;
+	ssize_t num_read_bytes;
+	int retval = 0;
+	int err;
+	int ret;
+	uint8_t file_data[3 * 4096 + 123];
+	uint8_t *mapped_virtual_address;
+	ImxDmaBuffer *dma_buffer = NULL;
+	ImxDmaBuffer *chunk;
+	size_t chunk_length;
+	ImxDmaBufferFileLoader *loader = NULL;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for file loading\n");
+		goto finish;
+	}
+
+	for (i = 0; i < file_size; ++i)
+		file_data[i] = (uint8_t)(i * 7);
+
+	fd = mkstemp(filename);
+	if ((fd < 0) || (write(fd, file_data, file_size) != (ssize_t)file_size))
+	{
+		fprintf(stderr, "Could not create test file for file loading\n");
+		goto finish;
+	}
+
+	/* Read a part of the file that ends before the end of the buffer. */
+
+	dma_buffer = imx_dma_buffer_allocate(allocator, file_size, 1, &err);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer for file loading: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	num_read_bytes = imx_dma_buffer_read_file(dma_buffer, filename, 4096, &err);
+	if (num_read_bytes != (ssize_t)(file_size - 4096))
+	{
+		fprintf(stderr, "Reading file into DMA buffer failed: got %zd bytes, expected %zu\n", num_read_bytes, file_size - 4096);
+		goto finish;
+	}
+
+	mapped_virtual_address = imx_dma_buffer_map(dma_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+	if (mapped_virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map DMA buffer for file loading: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	ret = memcmp(mapped_virtual_address, file_data + 4096, file_size - 4096);
+	imx_dma_buffer_unmap(dma_buffer);
+
+	if (ret != 0)
+	{
+		fprintf(stderr, "DMA buffer does not contain the file data\n");
+		goto finish;
+	}
+
+	/* Stream the whole file in chunks. */
+
+	loader = imx_dma_buffer_file_loader_new(allocator, filename, chunk_size, &err);
+	if (loader == NULL)
+	{
+		fprintf(stderr, "Could not create file loader: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	while ((ret = imx_dma_buffer_file_loader_next_chunk(loader, &chunk, &chunk_length, &err)) > 0)
+	{
+		if ((num_loaded_bytes + chunk_length) > file_size)
+			break;
+
+		mapped_virtual_address = imx_dma_buffer_map(chunk, IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+		if (mapped_virtual_address == NULL)
+		{
+			fprintf(stderr, "Could not map chunk buffer: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+		ret = memcmp(mapped_virtual_address, file_data + num_loaded_bytes, chunk_length);
+		imx_dma_buffer_unmap(chunk);
+
+		if (ret != 0)
+		{
+			fprintf(stderr, "Chunk at offset %zu does not contain the file data\n", num_loaded_bytes);
+			goto finish;
+		}
+
+		num_loaded_bytes += chunk_length;
+	}
+
+	if ((ret != 0) || (num_loaded_bytes != file_size))
+	{
+		fprintf(stderr, "Streaming file into DMA buffers failed: got %zu bytes, expected %zu\n", num_loaded_bytes, file_size);
+		goto finish;
+	}
+
+	fprintf(stderr, "file loading works correctly\n");
+	retval = 1;
+
+finish:
+	if (loader != NULL)
+		imx_dma_buffer_file_loader_free(loader);
+	if (dma_buffer != NULL)
+		imx_dma_buffer_deallocate(dma_buffer);
+	if (fd >= 0)
+	{
+		close(fd);
+		unlink(filename);
+	}
+	if (allocator != NULL)
+		imx_dma_buffer_allocator_destroy(allocator);
+
+	return retval;
+}
+
+
+static void count_zerocopy_release(ImxDmaBuffer *buffer, void *user_data)
+{
+	(void)buffer;
+	(*((int *)user_data))++;
+}
+
+
+int check_zerocopy_sending(ImxDmaBufferAllocator *allocator)
+{
+	static size_t const buffer_size = 65536;
+	static size_t const send_offset = 1000;
+	static size_t const send_length = 60000;
+	size_t i, num_received_bytes = 0;
+	int retval = 0;
+	int err;
+	int listen_fd = -1, send_fd = -1, receive_fd = -1;
+	int num_released_sends = 0;
+	struct sockaddr_in address;
+	socklen_t address_length = sizeof(address);
+	uint8_t *mapped_virtual_address;
+	static uint8_t received_data[65536];
+	ImxDmaBuffer *dma_buffer = NULL;
+	ImxDmaBufferZeroCopySender *sender = NULL;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for zerocopy sending\n");
+		goto finish;
+	}
+
+	/* Set up a TCP connection over loopback. */
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	send_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if ((listen_fd < 0) || (send_fd < 0)
+	 || (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+	 || (listen(listen_fd, 1) != 0)
+	 || (getsockname(listen_fd, (struct sockaddr *)&address, &address_length) != 0)
+	 || (connect(send_fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+	 || ((receive_fd = accept(listen_fd, NULL, NULL)) < 0))
+	{
+		fprintf(stderr, "Could not set up loopback connection for zerocopy sending\n");
+		goto finish;
+	}
+
+	dma_buffer = imx_dma_buffer_allocate(allocator, buffer_size, 1, &err);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer for zerocopy sending: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	mapped_virtual_address = imx_dma_buffer_map(dma_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, &err);
+	if (mapped_virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map DMA buffer for zerocopy sending: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	for (i = 0; i < buffer_size; ++i)
+		mapped_virtual_address[i] = (uint8_t)(i * 3);
+	imx_dma_buffer_unmap(dma_buffer);
+
+	sender = imx_dma_buffer_zerocopy_sender_new(send_fd, &err);
+	if (sender == NULL)
+	{
+		fprintf(stderr, "Could not create zerocopy sender: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	if (imx_dma_buffer_zerocopy_sender_send(sender, dma_buffer, send_offset, send_length, 0, count_zerocopy_release, &num_released_sends, &err) != (ssize_t)send_length)
+	{
+		fprintf(stderr, "Could not send DMA buffer data: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	while (num_received_bytes < send_length)
+	{
+		ssize_t ret = recv(receive_fd, received_data + num_received_bytes, send_length - num_received_bytes, 0);
+		if (ret <= 0)
+			break;
+		num_received_bytes += ret;
+	}
+
+	if (num_received_bytes != send_length)
+	{
+		fprintf(stderr, "Received %zu bytes instead of %zu\n", num_received_bytes, send_length);
+		goto finish;
+	}
+	for (i = 0; i < send_length; ++i)
+	{
+		if (received_data[i] != (uint8_t)((i + send_offset) * 3))
+		{
+			fprintf(stderr, "Received data does not match the sent DMA buffer data at offset %zu\n", i);
+			goto finish;
+		}
+	}
+
+	if ((imx_dma_buffer_zerocopy_sender_wait(sender, 5000, &err) != 0) || (num_released_sends != 1))
+	{
+		fprintf(stderr, "Zerocopy send was not released\n");
+		goto finish;
+	}
+
+	fprintf(stderr, "zerocopy sending works correctly (MSG_ZEROCOPY %s)\n", imx_dma_buffer_zerocopy_sender_is_zerocopy_enabled(sender) ? "enabled" : "not supported");
+	retval = 1;
+
+finish:
+	if (sender != NULL)
+		imx_dma_buffer_zerocopy_sender_free(sender);
+	if (dma_buffer != NULL)
+		imx_dma_buffer_deallocate(dma_buffer);
+	if (receive_fd >= 0)
+		close(receive_fd);
+	if (send_fd >= 0)
+		close(send_fd);
+	if (listen_fd >= 0)
+		close(listen_fd);
+	if (allocator != NULL)
+		imx_dma_buffer_allocator_destroy(allocator);
+
+	return retval;
+}
+
+static void send_rtp_packet(int fd, uint16_t sequence_number, uint32_t timestamp, int marker, int num_csrcs, int padding_size, uint8_t const *payload, size_t payload_length)
+{
+	uint8_t packet[256];
+	size_t length = 0;
+	int i;
+
+	packet[length++] = 0x80 | (padding_size ? 0x20 : 0x00) | num_csrcs;
+	packet[length++] = (marker ? 0x80 : 0x00) | 96;
+	packet[length++] = sequence_number >> 8;
+	packet[length++] = sequence_number & 0xFF;
+	for (i = 24; i >= 0; i -= 8)
+		packet[length++] = (timestamp >> i) & 0xFF;
+	memset(packet + length, 0x11, 4 + num_csrcs * 4);
+	length += 4 + num_csrcs * 4;
+	memcpy(packet + length, payload, payload_length);
+	length += payload_length;
+	for (i = 0; i < padding_size; ++i)
+		packet[length++] = padding_size;
+
+	send(fd, packet, length, 0);
+}
+
+
+int check_rtp_ingest(ImxDmaBufferAllocator *allocator)
+{
+	int retval = 0;
+	int err;
+	int i, frame_index;
+	int send_fd = -1, receive_fd = -1;
+	struct sockaddr_in address;
+	socklen_t address_length = sizeof(address);
+	uint8_t payload[300];
+	ImxDmaBufferRtpIngest *ingest = NULL;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for RTP ingest\n");
+		goto finish;
+	}
+
+	for (i = 0; i < (int)sizeof(payload); ++i)
+		payload[i] = (uint8_t)(i * 7);
+
+	/* Set up a UDP socket pair over loopback. */
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = 0;
+
+	receive_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if ((receive_fd < 0) || (send_fd < 0)
+	 || (bind(receive_fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+	 || (getsockname(receive_fd, (struct sockaddr *)&address, &address_length) != 0)
+	 || (connect(send_fd, (struct sockaddr *)&address, sizeof(address)) != 0))
+	{
+		fprintf(stderr, "Could not set up loopback sockets for RTP ingest\n");
+		goto finish;
+	}
+
+	ingest = imx_dma_buffer_rtp_ingest_new(receive_fd, allocator, 4096, 256, 8, &err);
+	if (ingest == NULL)
+	{
+		fprintf(stderr, "Could not create RTP ingest: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	/* Frame 1 consists of three packets, with a CSRC list and padding.
+	 * Frame 2 consists of two packets that arrive out of order. All
+	 * packets are sent before receiving, so they arrive in one batch. */
+	send_rtp_packet(send_fd, 65534, 1000, 0, 0, 0, payload, 100);
+	send_rtp_packet(send_fd, 65535, 1000, 0, 2, 3, payload + 100, 100);
+	send_rtp_packet(send_fd, 0, 1000, 1, 0, 0, payload + 200, 50);
+	send_rtp_packet(send_fd, 2, 2000, 1, 0, 0, payload + 120, 80);
+	send_rtp_packet(send_fd, 1, 2000, 0, 1, 0, payload, 120);
+
+	for (frame_index = 0; frame_index < 2; ++frame_index)
+	{
+		size_t expected_frame_size = (frame_index == 0) ? 250 : 200;
+		uint32_t expected_timestamp = (frame_index == 0) ? 1000 : 2000;
+		size_t frame_size;
+		uint32_t timestamp;
+		unsigned int frame_flags;
+		uint8_t *mapped_virtual_address;
+		ImxDmaBuffer *frame = imx_dma_buffer_rtp_ingest_receive_frame(ingest, &frame_size, &timestamp, &frame_flags, &err);
+		int frame_ok;
+
+		if (frame == NULL)
+		{
+			fprintf(stderr, "Could not receive RTP frame: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+
+		mapped_virtual_address = imx_dma_buffer_map(frame, IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+		frame_ok = (mapped_virtual_address != NULL) && (frame_size == expected_frame_size) && (timestamp == expected_timestamp)
+		        && (frame_flags == 0) && (memcmp(mapped_virtual_address, payload, frame_size) == 0);
+		if (mapped_virtual_address != NULL)
+			imx_dma_buffer_unmap(frame);
+		imx_dma_buffer_deallocate(frame);
+
+		if (!frame_ok)
+		{
+			fprintf(stderr, "RTP frame %d was not reassembled correctly (size %zu timestamp %u flags %u)\n", frame_index, frame_size, (unsigned int)timestamp, frame_flags);
+			goto finish;
+		}
+	}
+
+	fprintf(stderr, "RTP ingest works correctly\n");
+	retval = 1;
+
+finish:
+	if (ingest != NULL)
+		imx_dma_buffer_rtp_ingest_free(ingest);
+	if (receive_fd >= 0)
+		close(receive_fd);
+	if (send_fd >= 0)
+		close(send_fd);
+	if (allocator != NULL)
+		imx_dma_buffer_allocator_destroy(allocator);
+
+	return retval;
+}
+
+int check_buffer_queue(ImxDmaBufferQueueType type, char const *name)
+{
+	ImxDmaBuffer dummy_buffers[4];
+	ImxDmaBuffer *buffer;
+	unsigned int sync_direction;
+	struct pollfd pfd;
+	int i, err;
+	int retval = 0;
+	ImxDmaBufferQueue *queue;
+
+	queue = imx_dma_buffer_queue_new(type, 3, &err);
+	if (queue == NULL)
+	{
+		fprintf(stderr, "Could not create %s queue: %s (%d)\n", name, strerror(err), err);
+		return 0;
+	}
+
+	if (imx_dma_buffer_queue_get_capacity(queue) != 4)
+	{
+		fprintf(stderr, "%s queue capacity was not rounded up to a power of two\n", name);
+		goto finish;
+	}
+
+	pfd.fd = imx_dma_buffer_queue_get_fd(queue);
+	pfd.events = POLLIN;
+
+	/* Popping from the empty queue arms the wakeup. */
+	if (imx_dma_buffer_queue_pop(queue, &buffer, NULL) || (poll(&pfd, 1, 0) != 0))
+	{
+		fprintf(stderr, "Empty %s queue returned a buffer or signaled a wakeup\n", name);
+		goto finish;
+	}
+
+	for (i = 0; i < 4; ++i)
+	{
+		if (!imx_dma_buffer_queue_push(queue, &(dummy_buffers[i]), (i & 1) ? IMX_DMA_BUFFER_QUEUE_SYNC_DIRECTION_TO_CPU : IMX_DMA_BUFFER_QUEUE_SYNC_DIRECTION_TO_DEVICE))
+		{
+			fprintf(stderr, "Could not push buffer #%d into %s queue\n", i, name);
+			goto finish;
+		}
+	}
+
+	if (imx_dma_buffer_queue_push(queue, &(dummy_buffers[0]), 0))
+	{
+		fprintf(stderr, "Could push buffer into full %s queue\n", name);
+		goto finish;
+	}
+
+	if (poll(&pfd, 1, 0) != 1)
+	{
+		fprintf(stderr, "%s queue did not signal a wakeup after pushing\n", name);
+		goto finish;
+	}
+
+	for (i = 0; i < 4; ++i)
+	{
+		if (!imx_dma_buffer_queue_pop(queue, &buffer, &sync_direction) || (buffer != &(dummy_buffers[i]))
+		 || (sync_direction != ((i & 1) ? IMX_DMA_BUFFER_QUEUE_SYNC_DIRECTION_TO_CPU : IMX_DMA_BUFFER_QUEUE_SYNC_DIRECTION_TO_DEVICE)))
+		{
+			fprintf(stderr, "Popped wrong buffer #%d from %s queue\n", i, name);
+			goto finish;
+		}
+	}
+
+	err = 0;
+	if (imx_dma_buffer_queue_pop_wait(queue, &buffer, NULL, 10, &err) || (err != ETIMEDOUT) || (poll(&pfd, 1, 0) != 0))
+	{
+		fprintf(stderr, "Waiting for a buffer from the empty %s queue did not time out\n", name);
+		goto finish;
+	}
+
+	fprintf(stderr, "%s queue works correctly\n", name);
+	retval = 1;
+
+finish:
+	imx_dma_buffer_queue_free(queue);
+	return retval;
+}
+
+static uint8_t* map_file_backed_wrapped_buffer(ImxWrappedDmaBuffer *wrapped_dma_buffer, unsigned int flags, int *error)
+{
+	void *virtual_address;
+
+	(void)flags;
+
+	virtual_address = mmap(NULL, wrapped_dma_buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED, wrapped_dma_buffer->fd, 0);
+	if (virtual_address == MAP_FAILED)
+	{
+		if (error != NULL)
+			*error = errno;
+		return NULL;
+	}
+
+	wrapped_dma_buffer->parent.mapped_virtual_address = virtual_address;
+	return virtual_address;
+}
+
+
+static void unmap_file_backed_wrapped_buffer(ImxWrappedDmaBuffer *wrapped_dma_buffer)
+{
+	munmap(wrapped_dma_buffer->parent.mapped_virtual_address, wrapped_dma_buffer->size);
+	wrapped_dma_buffer->parent.mapped_virtual_address = NULL;
+}
+
+
+int check_ring_buffer(void)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t i, available;
+	uint8_t *pointer;
+	char filename[] = "/tmp/test-alloc-XXXXXX";
+	int err;
+	int retval = 0;
+	ImxWrappedDmaBuffer wrapped_dma_buffer;
+	ImxDmaBufferRing *ring = NULL;
+	ImxDmaBufferRingPhysicalRange ranges[2];
+
+	/* The ring needs a buffer that can be mapped through its FD. Not all
+	 * allocators provide one, so use a wrapped buffer backed by a file. */
+	imx_dma_buffer_init_wrapped_buffer(&wrapped_dma_buffer);
+	wrapped_dma_buffer.map = map_file_backed_wrapped_buffer;
+	wrapped_dma_buffer.unmap = unmap_file_backed_wrapped_buffer;
+	wrapped_dma_buffer.physical_address = 0x10000000;
+	wrapped_dma_buffer.size = page_size * 2;
+	wrapped_dma_buffer.fd = mkstemp(filename);
+	if (wrapped_dma_buffer.fd < 0)
+	{
+		fprintf(stderr, "Could not create file for ring buffer\n");
+		return 0;
+	}
+	unlink(filename);
+
+	if (ftruncate(wrapped_dma_buffer.fd, wrapped_dma_buffer.size) != 0)
+	{
+		fprintf(stderr, "Could not resize file for ring buffer\n");
+		goto finish;
+	}
+
+	ring = imx_dma_buffer_ring_new((ImxDmaBuffer *)&wrapped_dma_buffer, &err);
+	if (ring == NULL)
+	{
+		fprintf(stderr, "Could not create ring buffer: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	/* Move the indices close to the end of the ring, then
+	 * write and read a block that wraps around the end. */
+	imx_dma_buffer_ring_produce(ring, page_size + page_size / 2);
+	imx_dma_buffer_ring_consume(ring, page_size + page_size / 2);
+
+	pointer = imx_dma_buffer_ring_get_write_pointer(ring, &available);
+	if (available != (page_size * 2))
+	{
+		fprintf(stderr, "Empty ring buffer reports %zu bytes of space instead of %zu\n", available, page_size * 2);
+		goto finish;
+	}
+	for (i = 0; i < page_size; ++i)
+		pointer[i] = (uint8_t)(i * 5);
+	imx_dma_buffer_ring_produce(ring, page_size);
+
+	if (imx_dma_buffer_ring_get_virtual_address(ring)[0] != (uint8_t)((page_size / 2) * 5))
+	{
+		fprintf(stderr, "Data written past the end of the ring buffer did not wrap around\n");
+		goto finish;
+	}
+
+	pointer = imx_dma_buffer_ring_get_read_pointer(ring, &available);
+	if (available != page_size)
+	{
+		fprintf(stderr, "Ring buffer reports %zu bytes of data instead of %zu\n", available, page_size);
+		goto finish;
+	}
+	for (i = 0; i < page_size; ++i)
+	{
+		if (pointer[i] != (uint8_t)(i * 5))
+		{
+			fprintf(stderr, "Ring buffer data mismatch at offset %zu\n", i);
+			goto finish;
+		}
+	}
+
+	if ((imx_dma_buffer_ring_get_physical_ranges(ring, imx_dma_buffer_ring_get_consumer_index(ring), page_size, ranges) != 2)
+	 || (ranges[0].physical_address != (0x10000000 + page_size + page_size / 2)) || (ranges[0].length != (page_size / 2))
+	 || (ranges[1].physical_address != 0x10000000) || (ranges[1].length != (page_size / 2)))
+	{
+		fprintf(stderr, "Ring buffer physical ranges are incorrect\n");
+		goto finish;
+	}
+
+	imx_dma_buffer_ring_consume(ring, page_size);
+
+	fprintf(stderr, "ring buffer works correctly\n");
+	retval = 1;
+
+finish:
+	if (ring != NULL)
+		imx_dma_buffer_ring_free(ring);
+	close(wrapped_dma_buffer.fd);
+
+	return retval;
+}
+
+#ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
+int check_ring_buffer_dirty_tracking(ImxDmaBufferAllocator *allocator)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t i;
+	uint8_t *pointer, *mapped_virtual_address = NULL;
+	int err;
+	int retval = 0;
+	ImxDmaBuffer *dma_buffer = NULL;
+	ImxDmaBufferRing *ring = NULL;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for ring buffer dirty tracking test\n");
+		return 0;
+	}
+
+	/* Writes through the ring's mappings are not visible to dirty page
+	 * tracking, so stopping the sync session must sync the whole buffer. */
+	if (!imx_dma_buffer_dma_heap_allocator_enable_dirty_page_tracking(allocator, &err))
+	{
+		if ((err != ENOTSUP) && (err != EINVAL))
+		{
+			fprintf(stderr, "Could not enable dirty page tracking: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+		fprintf(stderr, "dirty page tracking is not supported here; testing the ring without it\n");
+	}
+
+	dma_buffer = imx_dma_buffer_allocate(allocator, page_size * 2, 1, &err);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer for ring buffer: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	/* Map the buffer and start a session before the ring is created, so
+	 * the ring is set up while a tracked session may already be running. */
+	mapped_virtual_address = imx_dma_buffer_map(dma_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE | IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC, &err);
+	if (mapped_virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map DMA buffer for ring buffer: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	imx_dma_buffer_start_sync_session(dma_buffer);
+
+	ring = imx_dma_buffer_ring_new(dma_buffer, &err);
+	if (ring == NULL)
+	{
+		fprintf(stderr, "Could not create ring buffer: %s (%d)\n", strerror(err), err);
+		imx_dma_buffer_stop_sync_session(dma_buffer);
+		goto finish;
+	}
+
+	imx_dma_buffer_ring_produce(ring, page_size + page_size / 2);
+	imx_dma_buffer_ring_consume(ring, page_size + page_size / 2);
+
+	pointer = imx_dma_buffer_ring_get_write_pointer(ring, NULL);
+	for (i = 0; i < page_size; ++i)
+		pointer[i] = (uint8_t)(i * 3);
+	imx_dma_buffer_ring_produce(ring, page_size);
+
+	imx_dma_buffer_stop_sync_session(dma_buffer);
+
+	imx_dma_buffer_start_sync_session(dma_buffer);
+	for (i = 0; i < page_size; ++i)
+	{
+		if (mapped_virtual_address[(page_size + page_size / 2 + i) % (page_size * 2)] != (uint8_t)(i * 3))
+		{
+			fprintf(stderr, "Data written through the ring buffer mismatches at offset %zu\n", i);
+			imx_dma_buffer_stop_sync_session(dma_buffer);
+			goto finish;
+		}
+	}
+	imx_dma_buffer_stop_sync_session(dma_buffer);
+
+	fprintf(stderr, "ring buffer with dirty page tracking works correctly\n");
+	retval = 1;
+
+finish:
+	if (ring != NULL)
+		imx_dma_buffer_ring_free(ring);
+	if (mapped_virtual_address != NULL)
+		imx_dma_buffer_unmap(dma_buffer);
+	if (dma_buffer != NULL)
+		imx_dma_buffer_deallocate(dma_buffer);
+	imx_dma_buffer_allocator_destroy(allocator);
+
+	return retval;
+}
+#endif
+
+int check_arena_allocation(ImxDmaBufferAllocator *underlying_allocator)
+{
+	int retval = 0;
+	int i, err;
+	uint8_t *mapped_virtual_address;
+	imx_physical_address_t first_physical_address;
+	ImxDmaBufferAllocator *arena_allocator = NULL;
+	ImxDmaBuffer *buffers[4];
+
+	if (underlying_allocator == NULL)
+	{
+		fprintf(stderr, "Could not create underlying allocator for arena allocator\n");
+		return 0;
+	}
+
+	arena_allocator = imx_dma_buffer_arena_allocator_new(underlying_allocator, 65536, 3, &err);
+	if (arena_allocator == NULL)
+	{
+		fprintf(stderr, "Could not create arena allocator: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	buffers[0] = imx_dma_buffer_allocate(arena_allocator, 100, 1, &err);
+	buffers[1] = imx_dma_buffer_allocate(arena_allocator, 1000, 256, &err);
+	if ((buffers[0] == NULL) || (buffers[1] == NULL))
+	{
+		fprintf(stderr, "Could not allocate buffers from arena: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	/* Arena buffers are not registered, so that resetting takes constant time. */
+	if ((imx_dma_buffer_allocator_get_num_live_buffers(arena_allocator) != 0)
+	 || (imx_dma_buffer_lookup_by_physical_address(imx_dma_buffer_get_physical_address(buffers[0]), NULL) != NULL))
+	{
+		fprintf(stderr, "Arena buffers were registered\n");
+		goto finish;
+	}
+
+	first_physical_address = imx_dma_buffer_get_physical_address(buffers[0]);
+	if (((imx_dma_buffer_get_physical_address(buffers[1]) % 256) != 0)
+	 || (imx_dma_buffer_get_physical_address(buffers[1]) < (first_physical_address + 100))
+	 || (imx_dma_buffer_arena_allocator_get_used_size(arena_allocator) != (imx_dma_buffer_get_physical_address(buffers[1]) + 1000 - first_physical_address)))
+	{
+		fprintf(stderr, "Arena buffers are not placed correctly\n");
+		goto finish;
+	}
+
+	mapped_virtual_address = imx_dma_buffer_map(buffers[1], IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, &err);
+	if (mapped_virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map arena buffer: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	memset(mapped_virtual_address, 0x55, 1000);
+	imx_dma_buffer_unmap(buffers[1]);
+
+	/* Exceed the maximum number of buffers, then the arena size. */
+	buffers[2] = imx_dma_buffer_allocate(arena_allocator, 100, 1, &err);
+	buffers[3] = imx_dma_buffer_allocate(arena_allocator, 100, 1, &err);
+	if ((buffers[2] == NULL) || (buffers[3] != NULL))
+	{
+		fprintf(stderr, "Arena allocator does not respect the maximum number of buffers\n");
+		goto finish;
+	}
+
+	for (i = 0; i < 3; ++i)
+		imx_dma_buffer_deallocate(buffers[i]);
+	imx_dma_buffer_arena_allocator_reset(arena_allocator);
+
+	if (imx_dma_buffer_allocate(arena_allocator, 65537, 1, &err) != NULL)
+	{
+		fprintf(stderr, "Arena allocator does not respect the arena size\n");
+		goto finish;
+	}
+
+	buffers[0] = imx_dma_buffer_allocate(arena_allocator, 65536, 1, &err);
+	if ((buffers[0] == NULL) || (imx_dma_buffer_get_physical_address(buffers[0]) != first_physical_address))
+	{
+		fprintf(stderr, "Arena allocator did not reclaim space on reset\n");
+		goto finish;
+	}
+
+	fprintf(stderr, "arena allocator works correctly\n");
+	retval = 1;
+
+finish:
+	if (arena_allocator != NULL)
+		imx_dma_buffer_allocator_destroy(arena_allocator);
+	imx_dma_buffer_allocator_destroy(underlying_allocator);
+
+	return retval;
+}
+
+static void count_buffer_release(ImxDmaBuffer *buffer, void *user_data)
+{
+	(void)buffer;
+	(*((int *)user_data))++;
+}
+
+
+int check_reference_counting(ImxDmaBufferAllocator *allocator)
+{
+	int retval = 0;
+	int err;
+	int num_releases = 0;
+	ImxDmaBuffer *dma_buffer;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for reference counting\n");
+		return 0;
+	}
+
+	dma_buffer = imx_dma_buffer_allocate(allocator, 4096, 1, &err);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer for reference counting: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	if (!imx_dma_buffer_ref(dma_buffer) || !imx_dma_buffer_set_release_func(dma_buffer, count_buffer_release, &num_releases))
+	{
+		fprintf(stderr, "Buffer does not support reference counting\n");
+		imx_dma_buffer_deallocate(dma_buffer);
+		goto finish;
+	}
+
+	/* Two references exist now, so only the second unref releases the buffer. */
+	imx_dma_buffer_unref(dma_buffer);
+	if (num_releases != 0)
+	{
+		fprintf(stderr, "Buffer was released while a reference was still held\n");
+		imx_dma_buffer_deallocate(dma_buffer);
+		goto finish;
+	}
+	imx_dma_buffer_unref(dma_buffer);
+	if (num_releases != 1)
+	{
+		fprintf(stderr, "Buffer was not released after dropping the last reference\n");
+		imx_dma_buffer_deallocate(dma_buffer);
+		goto finish;
+	}
+
+	/* The release function kept the buffer. Reuse it, and let
+	 * the last unref deallocate it this time. */
+	imx_dma_buffer_ref(dma_buffer);
+	imx_dma_buffer_set_release_func(dma_buffer, NULL, NULL);
+	imx_dma_buffer_unref(dma_buffer);
+
+	fprintf(stderr, "reference counting works correctly\n");
+	retval = 1;
+
+finish:
+	imx_dma_buffer_allocator_destroy(allocator);
+	return retval;
+}
+
+
+int check_buffer_registry(ImxDmaBufferAllocator *allocator)
+{
+	int retval = 0;
+	int err;
+	int i;
+	int num_destroyed_before;
+	size_t num_freed;
+	unsigned int const groups[4] = { 1, 1, 2, IMX_DMA_BUFFER_NO_GROUP };
+	ImxDmaBuffer *dma_buffers[4];
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for buffer registry\n");
+		return 0;
+	}
+
+	for (i = 0; i < 4; ++i)
+	{
+		dma_buffers[i] = imx_dma_buffer_allocate(allocator, 4096, 1, &err);
+		if (dma_buffers[i] == NULL)
+		{
+			fprintf(stderr, "Could not allocate DMA buffer for buffer registry: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+
+		if (!imx_dma_buffer_set_group(dma_buffers[i], groups[i]))
+		{
+			fprintf(stderr, "Buffer does not support groups\n");
+			goto finish;
+		}
+	}
+
+	if (imx_dma_buffer_allocator_get_num_live_buffers(allocator) != 4)
+	{
+		fprintf(stderr, "Expected 4 live buffers, got %zu\n", imx_dma_buffer_allocator_get_num_live_buffers(allocator));
+		goto finish;
+	}
+
+	/* Deallocating a buffer individually must unregister it. */
+	imx_dma_buffer_deallocate(dma_buffers[2]);
+	if (imx_dma_buffer_allocator_get_num_live_buffers(allocator) != 3)
+	{
+		fprintf(stderr, "Deallocated buffer is still registered\n");
+		goto finish;
+	}
+
+	num_freed = imx_dma_buffer_allocator_free_group(allocator, 1);
+	if ((num_freed != 2) || (imx_dma_buffer_allocator_get_num_live_buffers(allocator) != 1))
+	{
+		fprintf(stderr, "Freeing group 1 freed %zu buffers instead of 2\n", num_freed);
+		goto finish;
+	}
+
+	if (imx_dma_buffer_allocator_report_leaks(allocator, STDERR_FILENO) != 1)
+	{
+		fprintf(stderr, "Leak report does not list the remaining buffer\n");
+		goto finish;
+	}
+
+	/* Destroying the allocator must deallocate the remaining buffer,
+	 * which is observable through its attachment being destroyed. */
+	imx_dma_buffer_set_attachment(dma_buffers[3], test_attachment_key, &err);
+	num_destroyed_before = num_destroyed_test_attachments;
+	imx_dma_buffer_allocator_destroy(allocator);
+	allocator = NULL;
+	if (num_destroyed_test_attachments != (num_destroyed_before + 1))
+	{
+		fprintf(stderr, "Destroying the allocator did not deallocate the remaining buffer\n");
+		goto finish;
+	}
+
+	fprintf(stderr, "buffer registry works correctly\n");
+	retval = 1;
+
+finish:
+	/* Buffers that are still allocated at this point
+	 * are deallocated together with the allocator. */
+	if (allocator != NULL)
+		imx_dma_buffer_allocator_destroy(allocator);
+	return retval;
+}
+
+
+int check_address_lookup(ImxDmaBufferAllocator *allocator)
+{
+	int retval = 0;
+	int err;
+	int i;
+	size_t offset;
+	uint8_t *virtual_address;
+	ImxDmaBuffer *dma_buffers[3] = { NULL, NULL, NULL };
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for address lookup\n");
+		return 0;
+	}
+
+	/* Address lookup is opt-in, so buffers allocated before
+	 * enabling it must not be found. */
+	dma_buffers[0] = imx_dma_buffer_allocate(allocator, 256, 1, &err);
+	if (dma_buffers[0] == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer for address lookup: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	if (imx_dma_buffer_lookup_by_physical_address(imx_dma_buffer_get_physical_address(dma_buffers[0]), NULL) != NULL)
+	{
+		fprintf(stderr, "Buffer was indexed without address lookup being enabled\n");
+		goto finish;
+	}
+	imx_dma_buffer_deallocate(dma_buffers[0]);
+	dma_buffers[0] = NULL;
+
+	if (!imx_dma_buffer_allocator_enable_address_lookup(allocator, &err))
+	{
+		fprintf(stderr, "Could not enable address lookup: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	for (i = 0; i < 3; ++i)
+	{
+		dma_buffers[i] = imx_dma_buffer_allocate(allocator, 256, 1, &err);
+		if (dma_buffers[i] == NULL)
+		{
+			fprintf(stderr, "Could not allocate DMA buffer for address lookup: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+	}
+
+	for (i = 0; i < 3; ++i)
+	{
+		imx_physical_address_t physical_address = imx_dma_buffer_get_physical_address(dma_buffers[i]);
+		if ((imx_dma_buffer_lookup_by_physical_address(physical_address + 100, &offset) != dma_buffers[i]) || (offset != 100))
+		{
+			fprintf(stderr, "Looking up buffer #%d by physical address failed\n", i);
+			goto finish;
+		}
+	}
+
+	virtual_address = imx_dma_buffer_map(dma_buffers[1], IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+	if (virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map DMA buffer for address lookup: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	if ((imx_dma_buffer_lookup_by_virtual_address(virtual_address + 255, &offset) != dma_buffers[1]) || (offset != 255))
+	{
+		fprintf(stderr, "Looking up mapped buffer by virtual address failed\n");
+		imx_dma_buffer_unmap(dma_buffers[1]);
+		goto finish;
+	}
+
+	imx_dma_buffer_unmap(dma_buffers[1]);
+	if (imx_dma_buffer_lookup_by_virtual_address(virtual_address, NULL) != NULL)
+	{
+		fprintf(stderr, "Unmapped buffer can still be looked up by virtual address\n");
+		goto finish;
+	}
+
+	/* The direct variants must keep the index up to date as well, also when mapping redundantly. */
+	virtual_address = imx_dma_buffer_direct_map(dma_buffers[0], IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+	if ((virtual_address == NULL) || (imx_dma_buffer_direct_map(dma_buffers[0], IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err) != virtual_address))
+	{
+		fprintf(stderr, "Could not directly map DMA buffer for address lookup: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	imx_dma_buffer_direct_unmap(dma_buffers[0]);
+	if (imx_dma_buffer_lookup_by_virtual_address(virtual_address + 10, NULL) != dma_buffers[0])
+	{
+		fprintf(stderr, "Looking up directly mapped buffer by virtual address failed\n");
+		imx_dma_buffer_direct_unmap(dma_buffers[0]);
+		goto finish;
+	}
+	imx_dma_buffer_direct_unmap(dma_buffers[0]);
+	if (imx_dma_buffer_lookup_by_virtual_address(virtual_address, NULL) != NULL)
+	{
+		fprintf(stderr, "Directly unmapped buffer can still be looked up by virtual address\n");
+		goto finish;
+	}
+
+	imx_dma_buffer_deallocate(dma_buffers[2]);
+	if (imx_dma_buffer_lookup_by_physical_address(imx_dma_buffer_get_physical_address(dma_buffers[0]), NULL) != dma_buffers[0])
+	{
+		fprintf(stderr, "Deallocating a buffer broke the physical address index\n");
+		dma_buffers[2] = NULL;
+		goto finish;
+	}
+	dma_buffers[2] = NULL;
+
+	fprintf(stderr, "address lookup works correctly\n");
+	retval = 1;
+
+finish:
+	for (i = 0; i < 3; ++i)
+	{
+		if (dma_buffers[i] != NULL)
+			imx_dma_buffer_deallocate(dma_buffers[i]);
+	}
+	imx_dma_buffer_allocator_destroy(allocator);
+	return retval;
+}
+
+
+int check_pool_profile(ImxDmaBufferAllocator *underlying_allocator)
+{
+	int retval = 0;
+	int err;
+	int i;
+	char filename[] = "/tmp/imxdmabuffer-pool-profile-XXXXXX";
+	int fd;
+	ImxDmaBufferAllocator *allocator = NULL;
+	ImxDmaBuffer *dma_buffers[3] = { NULL, NULL, NULL };
+
+	if (underlying_allocator == NULL)
+	{
+		fprintf(stderr, "Could not create underlying allocator for pool profile\n");
+		return 0;
+	}
+
+	fd = mkstemp(filename);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Could not create temporary file for pool profile: %s (%d)\n", strerror(errno), errno);
+		goto finish;
+	}
+	close(fd);
+
+	/* Record a demand of two 4096-byte and one 8192-byte buffers. */
+
+	allocator = imx_dma_buffer_pool_allocator_new(underlying_allocator, 8, 0, &err);
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create pool allocator: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	for (i = 0; i < 3; ++i)
+	{
+		dma_buffers[i] = imx_dma_buffer_allocate(allocator, (i < 2) ? 4096 : 8192, 1, &err);
+		if (dma_buffers[i] == NULL)
+		{
+			fprintf(stderr, "Could not allocate DMA buffer for pool profile: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+	}
+
+	for (i = 0; i < 3; ++i)
+	{
+		imx_dma_buffer_deallocate(dma_buffers[i]);
+		dma_buffers[i] = NULL;
+	}
+
+	if (!imx_dma_buffer_pool_allocator_save_profile(allocator, filename, &err))
+	{
+		fprintf(stderr, "Could not save pool profile: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	imx_dma_buffer_allocator_destroy(allocator);
+
+	/* A new pool must preallocate exactly these buffers from the profile. */
+
+	allocator = imx_dma_buffer_pool_allocator_new(underlying_allocator, 8, 0, &err);
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create pool allocator: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	if (!imx_dma_buffer_pool_allocator_preallocate_from_profile(allocator, filename, 2, &err))
+	{
+		fprintf(stderr, "Could not preallocate from pool profile: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	if (imx_dma_buffer_pool_allocator_get_num_idle_buffers(allocator) != 3)
+	{
+		fprintf(stderr, "Expected 3 preallocated buffers, got %zu\n", imx_dma_buffer_pool_allocator_get_num_idle_buffers(allocator));
+		goto finish;
+	}
+
+	for (i = 0; i < 3; ++i)
+	{
+		dma_buffers[i] = imx_dma_buffer_allocate(allocator, (i < 2) ? 4096 : 8192, 1, &err);
+		if (dma_buffers[i] == NULL)
+		{
+			fprintf(stderr, "Could not allocate DMA buffer for pool profile: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+	}
+
+	if (imx_dma_buffer_pool_allocator_get_num_idle_buffers(allocator) != 0)
+	{
+		fprintf(stderr, "Allocations did not use the preallocated buffers\n");
+		goto finish;
+	}
+
+	fprintf(stderr, "pool profile works correctly\n");
+	retval = 1;
+
+finish:
+	for (i = 0; i < 3; ++i)
+	{
+		if (dma_buffers[i] != NULL)
+			imx_dma_buffer_deallocate(dma_buffers[i]);
+	}
+	if (allocator != NULL)
+		imx_dma_buffer_allocator_destroy(allocator);
+	unlink(filename);
+	if (underlying_allocator != NULL)
+		imx_dma_buffer_allocator_destroy(underlying_allocator);
+	return retval;
+}
+
+
+int check_default_allocator(void)
+{
+	int err;
+	ImxDmaBuffer *dma_buffer;
+	ImxDmaBufferAllocator *allocator;
+
+	allocator = imx_dma_buffer_allocator_get_default(&err);
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not get default allocator: %s (%d)\n", strerror(err), err);
+		return 0;
+	}
+
+	if (imx_dma_buffer_allocator_get_default(&err) != allocator)
+	{
+		fprintf(stderr, "Getting the default allocator twice returned different allocators\n");
+		return 0;
+	}
+
+	dma_buffer = imx_dma_buffer_allocate(allocator, 4096, 1, &err);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer with default allocator: %s (%d)\n", strerror(err), err);
+		return 0;
+	}
+
+	imx_dma_buffer_deallocate(dma_buffer);
+
+	fprintf(stderr, "default allocator works correctly\n");
+	return 1;
+}
+
+
+int check_buffer_metadata_reuse(ImxDmaBufferAllocator *allocator)
+{
+	/* More than one slab chunk worth of buffers. */
+	enum { NUM_BUFFERS = 150 };
+
+	int retval = 0;
+	int err;
+	int i;
+	ImxDmaBuffer *dma_buffers[NUM_BUFFERS];
+	ImxDmaBuffer *freed_buffer;
+
+	memset(dma_buffers, 0, sizeof(dma_buffers));
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for buffer metadata reuse\n");
+		return 0;
+	}
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+	{
+		dma_buffers[i] = imx_dma_buffer_allocate(allocator, 256, 1, &err);
+		if (dma_buffers[i] == NULL)
+		{
+			fprintf(stderr, "Could not allocate DMA buffer #%d for buffer metadata reuse: %s (%d)\n", i, strerror(err), err);
+			goto finish;
+		}
+
+		/* The buffer structures of the built-in allocators start at
+		 * cache line boundaries, so the hot fields share one line. */
+		if ((((uintptr_t)(dma_buffers[i])) % 64) != 0)
+		{
+			fprintf(stderr, "DMA buffer structure #%d is not cache line aligned\n", i);
+			goto finish;
+		}
+	}
+
+	/* A deallocated buffer structure must be reused by the next allocation. */
+	freed_buffer = dma_buffers[100];
+	imx_dma_buffer_deallocate(dma_buffers[100]);
+	dma_buffers[100] = imx_dma_buffer_allocate(allocator, 512, 1, &err);
+	if (dma_buffers[100] == NULL)
+	{
+		fprintf(stderr, "Could not reallocate DMA buffer for buffer metadata reuse: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	if ((dma_buffers[100] != freed_buffer) || (imx_dma_buffer_get_size(dma_buffers[100]) != 512))
+	{
+		fprintf(stderr, "Deallocated DMA buffer structure was not reused\n");
+		goto finish;
+	}
+
+	fprintf(stderr, "buffer metadata reuse works correctly\n");
+	retval = 1;
+
+finish:
+	for (i = 0; i < NUM_BUFFERS; ++i)
+	{
+		if (dma_buffers[i] != NULL)
+			imx_dma_buffer_deallocate(dma_buffers[i]);
+	}
+	imx_dma_buffer_allocator_destroy(allocator);
+	return retval;
+}
+
+
+static uint8_t detiling_test_pattern(int plane_index, size_t x, size_t y)
+{
+	return (plane_index == 0) ? (uint8_t)(x * 7 + y * 13) : (uint8_t)(x * 5 + y * 11 + 100);
+}
+
+
+int check_detiling(ImxDmaBufferAllocator *allocator)
+{
+	/* The width is not a multiple of 16 and the height is not a multiple
+	 * of the tile height, so both the SIMD and the scalar code are used. */
+	enum { WIDTH = 40, HEIGHT = 22, STRIDE = 48 };
+
+	int retval = 0;
+	int err;
+	int layout_index, format_index, plane_index;
+	size_t x, y;
+	size_t luma_size = STRIDE * ((HEIGHT + 3) / 4) * 4;
+	size_t chroma_size = STRIDE * ((HEIGHT / 2 + 3) / 4) * 4;
+	ImxDmaBuffer *tiled_buffer = NULL;
+	ImxDmaBuffer *linear_buffer = NULL;
+	uint8_t *virtual_address;
+	ImxDmaBufferTiledFrame tiled_frame;
+	ImxDmaBufferLinearFrame linear_frame;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for detiling\n");
+		return 0;
+	}
+
+	tiled_buffer = imx_dma_buffer_allocate(allocator, luma_size + chroma_size, 1, &err);
+	linear_buffer = imx_dma_buffer_allocate(allocator, 2048, 1, &err);
+	if ((tiled_buffer == NULL) || (linear_buffer == NULL))
+	{
+		fprintf(stderr, "Could not allocate DMA buffers for detiling: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	for (layout_index = 0; layout_index < 2; ++layout_index)
+	{
+		unsigned int tile_width = (layout_index == 0) ? 4 : 8;
+
+		memset(&tiled_frame, 0, sizeof(tiled_frame));
+		tiled_frame.tile_layout = (layout_index == 0) ? IMX_DMA_BUFFER_TILE_LAYOUT_4X4 : IMX_DMA_BUFFER_TILE_LAYOUT_8X4;
+		tiled_frame.width = WIDTH;
+		tiled_frame.height = HEIGHT;
+		tiled_frame.stride = STRIDE;
+		tiled_frame.luma_offset = 0;
+		tiled_frame.chroma_offset = luma_size;
+
+		/* Synthesize the tiled frame, including the padding. */
+		virtual_address = imx_dma_buffer_map(tiled_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, &err);
+		if (virtual_address == NULL)
+		{
+			fprintf(stderr, "Could not map tiled DMA buffer: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+		for (plane_index = 0; plane_index < 2; ++plane_index)
+		{
+			size_t plane_size = (plane_index == 0) ? luma_size : chroma_size;
+			uint8_t *plane = virtual_address + ((plane_index == 0) ? 0 : luma_size);
+
+			for (y = 0; y < plane_size / STRIDE; ++y)
+			{
+				for (x = 0; x < STRIDE; ++x)
+					plane[(y / 4) * STRIDE * 4 + (x / tile_width) * tile_width * 4 + (y % 4) * tile_width + (x % tile_width)] = detiling_test_pattern(plane_index, x, y);
+			}
+		}
+		imx_dma_buffer_unmap(tiled_buffer);
+
+		for (format_index = 0; format_index < 2; ++format_index)
+		{
+			int is_i420 = (format_index == 1);
+
+			memset(&linear_frame, 0, sizeof(linear_frame));
+			linear_frame.format = is_i420 ? IMX_DMA_BUFFER_LINEAR_FORMAT_I420 : IMX_DMA_BUFFER_LINEAR_FORMAT_NV12;
+			linear_frame.strides[0] = WIDTH;
+			linear_frame.strides[1] = is_i420 ? (WIDTH / 2) : WIDTH;
+			linear_frame.strides[2] = WIDTH / 2;
+			linear_frame.offsets[0] = 0;
+			linear_frame.offsets[1] = WIDTH * HEIGHT;
+			linear_frame.offsets[2] = WIDTH * HEIGHT + (WIDTH / 2) * (HEIGHT / 2);
+
+			if (!imx_dma_buffer_detile(tiled_buffer, &tiled_frame, linear_buffer, &linear_frame, 3, &err))
+			{
+				fprintf(stderr, "Could not detile frame: %s (%d)\n", strerror(err), err);
+				goto finish;
+			}
+
+			virtual_address = imx_dma_buffer_map(linear_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+			if (virtual_address == NULL)
+			{
+				fprintf(stderr, "Could not map linear DMA buffer: %s (%d)\n", strerror(err), err);
+				goto finish;
+			}
+
+			for (y = 0; y < HEIGHT; ++y)
+			{
+				for (x = 0; x < WIDTH; ++x)
+				{
+					uint8_t expected_luma = detiling_test_pattern(0, x, y);
+					uint8_t expected_chroma = detiling_test_pattern(1, x, y / 2);
+					uint8_t actual_chroma;
+
+					if (virtual_address[y * WIDTH + x] != expected_luma)
+					{
+						fprintf(stderr, "Detiled luma of tile layout #%d mismatches at %zu,%zu\n", layout_index, x, y);
+						imx_dma_buffer_unmap(linear_buffer);
+						goto finish;
+					}
+
+					if ((y & 1) != 0)
+						continue;
+
+					if (is_i420)
+						actual_chroma = virtual_address[linear_frame.offsets[1 + (x & 1)] + (y / 2) * (WIDTH / 2) + x / 2];
+					else
+						actual_chroma = virtual_address[linear_frame.offsets[1] + (y / 2) * WIDTH + x];
+
+					if (actual_chroma != expected_chroma)
+					{
+						fprintf(stderr, "Detiled %s chroma of tile layout #%d mismatches at %zu,%zu\n", is_i420 ? "I420" : "NV12", layout_index, x, y / 2);
+						imx_dma_buffer_unmap(linear_buffer);
+						goto finish;
+					}
+				}
+			}
+
+			imx_dma_buffer_unmap(linear_buffer);
+		}
+	}
+
+	tiled_frame.stride = STRIDE + 2;
+	if (imx_dma_buffer_detile(tiled_buffer, &tiled_frame, linear_buffer, &linear_frame, 1, &err) || (err != EINVAL))
+	{
+		fprintf(stderr, "Detiling with a stride that is not a multiple of the tile width did not fail with EINVAL\n");
+		goto finish;
+	}
+
+	fprintf(stderr, "detiling works correctly\n");
+	retval = 1;
+
+finish:
+	if (tiled_buffer != NULL)
+		imx_dma_buffer_deallocate(tiled_buffer);
+	if (linear_buffer != NULL)
+		imx_dma_buffer_deallocate(linear_buffer);
+	imx_dma_buffer_allocator_destroy(allocator);
+	return retval;
+}
+
+
+int check_blit(ImxDmaBufferAllocator *allocator)
+{
+	/* Big enough to be split into several bands. */
+	enum { SOURCE_STRIDE = 2048, SOURCE_HEIGHT = 400, DEST_STRIDE = 1600, DEST_HEIGHT = 420, BPP = 2 };
+
+	int retval = 0;
+	int err;
+	size_t x, y;
+	ImxDmaBuffer *source_buffer = NULL;
+	ImxDmaBuffer *dest_buffer = NULL;
+	uint8_t *virtual_address;
+	ImxDmaBufferRect rect = { 10, 20, 700, 380 };
+	unsigned int dest_x = 50, dest_y = 30;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for blit\n");
+		return 0;
+	}
+
+	source_buffer = imx_dma_buffer_allocate(allocator, SOURCE_STRIDE * SOURCE_HEIGHT, 1, &err);
+	dest_buffer = imx_dma_buffer_allocate(allocator, DEST_STRIDE * DEST_HEIGHT, 1, &err);
+	if ((source_buffer == NULL) || (dest_buffer == NULL))
+	{
+		fprintf(stderr, "Could not allocate DMA buffers for blit: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	virtual_address = imx_dma_buffer_map(source_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, &err);
+	if (virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map source DMA buffer for blit: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	for (y = 0; y < SOURCE_HEIGHT; ++y)
+	{
+		for (x = 0; x < SOURCE_STRIDE; ++x)
+			virtual_address[y * SOURCE_STRIDE + x] = (uint8_t)(x * 3 + y * 7);
+	}
+	imx_dma_buffer_unmap(source_buffer);
+
+	virtual_address = imx_dma_buffer_map(dest_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, &err);
+	if (virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map destination DMA buffer for blit: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	memset(virtual_address, 0xEE, DEST_STRIDE * DEST_HEIGHT);
+	imx_dma_buffer_unmap(dest_buffer);
+
+	if (!imx_dma_buffer_blit_2d(source_buffer, 0, SOURCE_STRIDE, &rect, dest_buffer, 0, DEST_STRIDE, dest_x, dest_y, BPP, &err))
+	{
+		fprintf(stderr, "Could not blit: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	virtual_address = imx_dma_buffer_map(dest_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+	if (virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map destination DMA buffer for blit: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+	for (y = 0; y < DEST_HEIGHT; ++y)
+	{
+		for (x = 0; x < DEST_STRIDE; ++x)
+		{
+			uint8_t expected = 0xEE;
+			int inside = (y >= dest_y) && (y < (dest_y + rect.height)) && (x >= (dest_x * BPP)) && (x < ((dest_x + rect.width) * BPP));
+
+			if (inside)
+			{
+				size_t source_x = x - dest_x * BPP + rect.x * BPP;
+				size_t source_y = y - dest_y + rect.y;
+				expected = (uint8_t)(source_x * 3 + source_y * 7);
+			}
+
+			if (virtual_address[y * DEST_STRIDE + x] != expected)
+			{
+				fprintf(stderr, "Blitted data mismatches at byte %zu of row %zu\n", x, y);
+				imx_dma_buffer_unmap(dest_buffer);
+				goto finish;
+			}
+		}
+	}
+	imx_dma_buffer_unmap(dest_buffer);
+
+	/* Rectangles that do not fit, and overlapping copies within one buffer, must be rejected. */
+	rect.x = SOURCE_STRIDE / BPP - 100;
+	if (imx_dma_buffer_blit_2d(source_buffer, 0, SOURCE_STRIDE, &rect, dest_buffer, 0, DEST_STRIDE, 0, 0, BPP, &err) || (err != EINVAL))
+	{
+		fprintf(stderr, "Blitting a rectangle that exceeds the source plane did not fail with EINVAL\n");
+		goto finish;
+	}
+	/* Coordinates whose sums wrap around must not pass the bounds checks. */
+	rect.x = 0xFFFFFFF0u;
+	rect.width = 0x20;
+	err = 0;
+	if (imx_dma_buffer_blit_2d(source_buffer, 0, SOURCE_STRIDE, &rect, dest_buffer, 0, DEST_STRIDE, 0, 0, BPP, &err) || (err != EINVAL))
+	{
+		fprintf(stderr, "Blitting a rectangle with a wrapping X coordinate did not fail with EINVAL\n");
+		goto finish;
+	}
+	rect.x = 0;
+	err = 0;
+	if (imx_dma_buffer_blit_2d(source_buffer, 0, SOURCE_STRIDE, &rect, dest_buffer, 0, DEST_STRIDE, 0xFFFFFFF0u, 0xFFFFFFFFu, BPP, &err) || (err != EINVAL))
+	{
+		fprintf(stderr, "Blitting to a destination with wrapping coordinates did not fail with EINVAL\n");
+		goto finish;
+	}
+	rect.width = 700;
+	err = 0;
+	if (imx_dma_buffer_blit_2d(source_buffer, 0, SOURCE_STRIDE, &rect, source_buffer, 0, SOURCE_STRIDE, 100, 10, BPP, &err) || (err != EINVAL))
+	{
+		fprintf(stderr, "Blitting overlapping rectangles within one buffer did not fail with EINVAL\n");
+		goto finish;
+	}
+
+	fprintf(stderr, "blit works correctly\n");
+	retval = 1;
+
+finish:
+	if (source_buffer != NULL)
+		imx_dma_buffer_deallocate(source_buffer);
+	if (dest_buffer != NULL)
+		imx_dma_buffer_deallocate(dest_buffer);
+	imx_dma_buffer_allocator_destroy(allocator);
+	return retval;
+}
+
+
+static int copy_queue_engine_num_copies = 0;
+static int copy_queue_engine_destroyed = 0;
+
+static int copy_queue_counting_copy(void *engine_data, ImxDmaBufferCopyJob const *job, int *error)
+{
+	__atomic_add_fetch((int *)engine_data, 1, __ATOMIC_RELAXED);
+	return imx_dma_buffer_blit_2d(job->source_buffer, job->source_offset, job->source_stride, &(job->source_rect), job->dest_buffer, job->dest_offset, job->dest_stride, job->dest_x, job->dest_y, job->bytes_per_pixel, error);
+}
+
+static void copy_queue_counting_destroy(void *engine_data)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(engine_data);
+	copy_queue_engine_destroyed = 1;
+}
+
+int check_copy_queue(ImxDmaBufferAllocator *allocator)
+{
+	enum { STRIDE = 1024, HEIGHT = 64, NUM_JOBS = 4, ROWS_PER_JOB = HEIGHT / NUM_JOBS };
+
 	int retval = 0;
 	int err;
-	void *mapped_virtual_address = NULL;
-	void *second_mapped_virtual_address = NULL;
-	imx_physical_address_t physical_address;
-	ImxDmaBuffer *dma_buffer = NULL;
+	unsigned int i, engine_index;
+	size_t x;
+	ImxDmaBuffer *source_buffer = NULL;
+	ImxDmaBuffer *dest_buffer = NULL;
+	ImxDmaBufferCopyQueue *queue = NULL;
+	ImxDmaBufferCopyToken *tokens[NUM_JOBS] = { NULL };
+	ImxDmaBufferCopyToken *invalid_token = NULL;
+	ImxDmaBufferCopyEngine engine;
+	ImxDmaBufferCopyJob job;
+	uint8_t *virtual_address;
 
 	if (allocator == NULL)
 	{
-		fprintf(stderr, "Could not create %s allocator\n", name);
+		fprintf(stderr, "Could not create allocator for copy queue\n");
+		return 0;
+	}
+
+	source_buffer = imx_dma_buffer_allocate(allocator, STRIDE * HEIGHT, 1, &err);
+	dest_buffer = imx_dma_buffer_allocate(allocator, STRIDE * HEIGHT, 1, &err);
+	if ((source_buffer == NULL) || (dest_buffer == NULL))
+	{
+		fprintf(stderr, "Could not allocate DMA buffers for copy queue: %s (%d)\n", strerror(err), err);
 		goto finish;
 	}
 
-	dma_buffer = imx_dma_buffer_allocate(allocator, expected_buffer_size, expected_alignment, &err);
-	if (dma_buffer == NULL)
+	virtual_address = imx_dma_buffer_map(source_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, &err);
+	if (virtual_address == NULL)
 	{
-		fprintf(stderr, "Could not allocate DMA buffer with %s allocator: %s (%d)\n", name, strerror(err), err);
+		fprintf(stderr, "Could not map source DMA buffer for copy queue: %s (%d)\n", strerror(err), err);
 		goto finish;
 	}
+	for (x = 0; x < STRIDE * HEIGHT; ++x)
+		virtual_address[x] = (uint8_t)(x * 13 + x / STRIDE);
+	imx_dma_buffer_unmap(source_buffer);
 
-	actual_buffer_size = imx_dma_buffer_get_size(dma_buffer);
-	if (actual_buffer_size != expected_buffer_size)
+	engine.copy = copy_queue_counting_copy;
+	engine.destroy = copy_queue_counting_destroy;
+	engine.engine_data = &copy_queue_engine_num_copies;
+
+	/* Run the same jobs with the default CPU engine, then with a custom one. */
+	for (engine_index = 0; engine_index < 2; ++engine_index)
 	{
-		fprintf(stderr, "DMA buffer allocated with %s allocator has incorrect size: expected %zu got %zu\n", name, expected_buffer_size, actual_buffer_size);
+		virtual_address = imx_dma_buffer_map(dest_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, &err);
+		if (virtual_address == NULL)
+		{
+			fprintf(stderr, "Could not map destination DMA buffer for copy queue: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+		memset(virtual_address, 0, STRIDE * HEIGHT);
+		imx_dma_buffer_unmap(dest_buffer);
+
+		queue = imx_dma_buffer_copy_queue_new((engine_index == 0) ? NULL : &engine, 2, &err);
+		if (queue == NULL)
+		{
+			fprintf(stderr, "Could not create copy queue: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+
+		memset(&job, 0, sizeof(job));
+		job.source_buffer = source_buffer;
+		job.source_stride = STRIDE;
+		job.dest_buffer = dest_buffer;
+		job.dest_stride = STRIDE;
+		job.bytes_per_pixel = 1;
+		job.source_rect.width = STRIDE;
+		job.source_rect.height = ROWS_PER_JOB;
+
+		for (i = 0; i < NUM_JOBS; ++i)
+		{
+			job.source_rect.y = i * ROWS_PER_JOB;
+			job.dest_y = i * ROWS_PER_JOB;
+			tokens[i] = imx_dma_buffer_copy_queue_submit(queue, &job, &err);
+			if (tokens[i] == NULL)
+			{
+				fprintf(stderr, "Could not submit copy job: %s (%d)\n", strerror(err), err);
+				goto finish;
+			}
+		}
+
+		/* Wait for the first job with poll(), like an event loop would. */
+		{
+			struct pollfd pfd;
+			pfd.fd = imx_dma_buffer_copy_token_get_fd(tokens[0]);
+			pfd.events = POLLIN;
+			if ((poll(&pfd, 1, 5000) != 1) || !imx_dma_buffer_copy_token_is_complete(tokens[0]))
+			{
+				fprintf(stderr, "Copy token eventfd did not become readable\n");
+				goto finish;
+			}
+		}
+
+		for (i = 0; i < NUM_JOBS; ++i)
+		{
+			if (!imx_dma_buffer_copy_token_wait(tokens[i], 5000, &err))
+			{
+				fprintf(stderr, "Copy job %u failed: %s (%d)\n", i, strerror(err), err);
+				goto finish;
+			}
+		}
+
+		virtual_address = imx_dma_buffer_map(dest_buffer, IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+		if (virtual_address == NULL)
+		{
+			fprintf(stderr, "Could not map destination DMA buffer for copy queue: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+		for (x = 0; x < STRIDE * HEIGHT; ++x)
+		{
+			if (virtual_address[x] != (uint8_t)(x * 13 + x / STRIDE))
+			{
+				fprintf(stderr, "Copied data mismatches at byte %zu\n", x);
+				imx_dma_buffer_unmap(dest_buffer);
+				goto finish;
+			}
+		}
+		imx_dma_buffer_unmap(dest_buffer);
+
+		/* Errors of the copy itself must be reported by the token. */
+		job.source_rect.y = HEIGHT;
+		invalid_token = imx_dma_buffer_copy_queue_submit(queue, &job, &err);
+		if (invalid_token == NULL)
+		{
+			fprintf(stderr, "Could not submit copy job: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+		err = 0;
+		if (imx_dma_buffer_copy_token_wait(invalid_token, -1, &err) || (err != EINVAL))
+		{
+			fprintf(stderr, "Invalid copy job did not fail with EINVAL\n");
+			goto finish;
+		}
+		imx_dma_buffer_copy_token_free(invalid_token);
+		invalid_token = NULL;
+
+		/* Tokens may be freed before their job is done, and
+		 * freeing the queue executes jobs that are still pending. */
+		job.source_rect.y = 0;
+		job.dest_y = 0;
+		for (i = 0; i < NUM_JOBS; ++i)
+		{
+			imx_dma_buffer_copy_token_free(tokens[i]);
+			tokens[i] = imx_dma_buffer_copy_queue_submit(queue, &job, &err);
+			if (tokens[i] == NULL)
+			{
+				fprintf(stderr, "Could not submit copy job: %s (%d)\n", strerror(err), err);
+				goto finish;
+			}
+		}
+		imx_dma_buffer_copy_token_free(tokens[0]);
+		tokens[0] = NULL;
+		imx_dma_buffer_copy_queue_free(queue);
+		queue = NULL;
+
+		for (i = 1; i < NUM_JOBS; ++i)
+		{
+			if (!imx_dma_buffer_copy_token_is_complete(tokens[i]))
+			{
+				fprintf(stderr, "Pending copy job was not executed when freeing the queue\n");
+				goto finish;
+			}
+			imx_dma_buffer_copy_token_free(tokens[i]);
+			tokens[i] = NULL;
+		}
+	}
+
+	if ((copy_queue_engine_num_copies != (NUM_JOBS * 2 + 1)) || !copy_queue_engine_destroyed)
+	{
+		fprintf(stderr, "Custom copy engine was not used as expected\n");
 		goto finish;
 	}
 
-	mapped_virtual_address = imx_dma_buffer_map(dma_buffer, 0, &err);
-	if (mapped_virtual_address == NULL)
+	fprintf(stderr, "copy queue works correctly\n");
+	retval = 1;
+
+finish:
+	imx_dma_buffer_copy_queue_free(queue);
+	for (i = 0; i < NUM_JOBS; ++i)
+		imx_dma_buffer_copy_token_free(tokens[i]);
+	imx_dma_buffer_copy_token_free(invalid_token);
+	if (source_buffer != NULL)
+		imx_dma_buffer_deallocate(source_buffer);
+	if (dest_buffer != NULL)
+		imx_dma_buffer_deallocate(dest_buffer);
+	imx_dma_buffer_allocator_destroy(allocator);
+	return retval;
+}
+
+
+static int copy_queue_blocking_copy_released = 0;
+
+/* Blocks copies from the engine_data buffer until released. */
+static int copy_queue_blocking_copy(void *engine_data, ImxDmaBufferCopyJob const *job, int *error)
+{
+	if (job->source_buffer == (ImxDmaBuffer *)engine_data)
 	{
-		fprintf(stderr, "Could not map DMA buffer allocated with %s allocator: %s (%d)\n", name, strerror(err), err);
+		while (!__atomic_load_n(&copy_queue_blocking_copy_released, __ATOMIC_ACQUIRE))
+			usleep(1000);
+	}
+	return imx_dma_buffer_blit_2d(job->source_buffer, job->source_offset, job->source_stride, &(job->source_rect), job->dest_buffer, job->dest_offset, job->dest_stride, job->dest_x, job->dest_y, job->bytes_per_pixel, error);
+}
+
+int check_copy_queue_ordering(ImxDmaBufferAllocator *allocator)
+{
+	enum { STRIDE = 256, HEIGHT = 16, NUM_BUFFERS = 4, NUM_JOBS = NUM_BUFFERS - 1 };
+
+	int retval = 0;
+	int err;
+	unsigned int i;
+	size_t x;
+	ImxDmaBuffer *buffers[NUM_BUFFERS] = { NULL };
+	ImxDmaBufferCopyQueue *queue = NULL;
+	ImxDmaBufferCopyToken *tokens[NUM_JOBS] = { NULL };
+	ImxDmaBufferCopyEngine engine;
+	ImxDmaBufferCopyJob job;
+	uint8_t *virtual_address;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for copy queue ordering\n");
+		return 0;
+	}
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+	{
+		buffers[i] = imx_dma_buffer_allocate(allocator, STRIDE * HEIGHT, 1, &err);
+		if (buffers[i] == NULL)
+		{
+			fprintf(stderr, "Could not allocate DMA buffer for copy queue ordering: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+
+		virtual_address = imx_dma_buffer_map(buffers[i], IMX_DMA_BUFFER_MAPPING_FLAG_WRITE, &err);
+		if (virtual_address == NULL)
+		{
+			fprintf(stderr, "Could not map DMA buffer for copy queue ordering: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+		for (x = 0; x < STRIDE * HEIGHT; ++x)
+			virtual_address[x] = (i == 0) ? (uint8_t)(x * 7 + 1) : 0;
+		imx_dma_buffer_unmap(buffers[i]);
+	}
+
+	/* The copy out of the first buffer blocks until it is released. */
+	engine.copy = copy_queue_blocking_copy;
+	engine.destroy = NULL;
+	engine.engine_data = buffers[0];
+
+	queue = imx_dma_buffer_copy_queue_new(&engine, NUM_JOBS, &err);
+	if (queue == NULL)
+	{
+		fprintf(stderr, "Could not create copy queue: %s (%d)\n", strerror(err), err);
 		goto finish;
 	}
 
-	second_mapped_virtual_address = imx_dma_buffer_map(dma_buffer, 0, &err);
-	if (second_mapped_virtual_address == NULL)
+	/* Chain the copies 0 -> 1 -> 2 -> 3. The last job shares no buffer with
+	 * the first one, but it must still wait for the second one, which
+	 * writes to its source buffer. There are enough threads to run all
+	 * jobs at once, so only the ordering prevents that. */
+	memset(&job, 0, sizeof(job));
+	job.source_stride = STRIDE;
+	job.dest_stride = STRIDE;
+	job.bytes_per_pixel = 1;
+	job.source_rect.width = STRIDE;
+	job.source_rect.height = HEIGHT;
+
+	for (i = 0; i < NUM_JOBS; ++i)
 	{
-		fprintf(stderr, "Could not map DMA buffer allocated with %s allocator: %s (%d)\n", name, strerror(err), err);
+		job.source_buffer = buffers[i];
+		job.dest_buffer = buffers[i + 1];
+		tokens[i] = imx_dma_buffer_copy_queue_submit(queue, &job, &err);
+		if (tokens[i] == NULL)
+		{
+			fprintf(stderr, "Could not submit copy job: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+	}
+
+	usleep(100000);
+	for (i = 0; i < NUM_JOBS; ++i)
+	{
+		if (imx_dma_buffer_copy_token_is_complete(tokens[i]))
+		{
+			fprintf(stderr, "Copy job %u overtook an older job that uses the same buffer\n", i);
+			goto finish;
+		}
+	}
+
+	__atomic_store_n(&copy_queue_blocking_copy_released, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < NUM_JOBS; ++i)
+	{
+		if (!imx_dma_buffer_copy_token_wait(tokens[i], 5000, &err))
+		{
+			fprintf(stderr, "Copy job %u failed: %s (%d)\n", i, strerror(err), err);
+			goto finish;
+		}
+	}
+
+	virtual_address = imx_dma_buffer_map(buffers[NUM_BUFFERS - 1], IMX_DMA_BUFFER_MAPPING_FLAG_READ, &err);
+	if (virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map DMA buffer for copy queue ordering: %s (%d)\n", strerror(err), err);
 		goto finish;
 	}
+	for (x = 0; x < STRIDE * HEIGHT; ++x)
+	{
+		if (virtual_address[x] != (uint8_t)(x * 7 + 1))
+		{
+			fprintf(stderr, "Chained copy result mismatches at byte %zu\n", x);
+			imx_dma_buffer_unmap(buffers[NUM_BUFFERS - 1]);
+			goto finish;
+		}
+	}
+	imx_dma_buffer_unmap(buffers[NUM_BUFFERS - 1]);
 
-	if (mapped_virtual_address != second_mapped_virtual_address)
+	fprintf(stderr, "copy queue ordering works correctly\n");
+	retval = 1;
+
+finish:
+	/* Make sure that freeing the queue does not wait forever. */
+	__atomic_store_n(&copy_queue_blocking_copy_released, 1, __ATOMIC_RELEASE);
+	imx_dma_buffer_copy_queue_free(queue);
+	for (i = 0; i < NUM_JOBS; ++i)
+		imx_dma_buffer_copy_token_free(tokens[i]);
+	for (i = 0; i < NUM_BUFFERS; ++i)
 	{
-		fprintf(stderr, "Redundant mapping attempts must always return the same virtual pointer as the previous mapping\n");
+		if (buffers[i] != NULL)
+			imx_dma_buffer_deallocate(buffers[i]);
+	}
+	imx_dma_buffer_allocator_destroy(allocator);
+	return retval;
+}
+
+
+int check_sync_many(ImxDmaBufferAllocator *allocator)
+{
+	enum { NUM_BUFFERS = 4 };
+	static size_t const sizes[NUM_BUFFERS] = { 256, 4096, 256 * 1024, 4096 };
+
+	int retval = 0;
+	int err;
+	size_t i, j;
+	ImxDmaBufferAllocator *pool_allocator = NULL;
+	ImxDmaBuffer *buffers[NUM_BUFFERS] = { NULL };
+	ImxDmaBufferSyncDirection directions[NUM_BUFFERS];
+	uint8_t *virtual_addresses[NUM_BUFFERS] = { NULL };
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for batched sync\n");
+		return 0;
+	}
+
+	pool_allocator = imx_dma_buffer_pool_allocator_new(allocator, 2, 0, &err);
+	if (pool_allocator == NULL)
+	{
+		fprintf(stderr, "Could not create pool allocator for batched sync: %s (%d)\n", strerror(err), err);
 		goto finish;
 	}
 
-	physical_address = imx_dma_buffer_get_physical_address(dma_buffer);
-	if (physical_address == 0)
+	/* The last buffer comes from the pool, so that the
+	 * batch contains buffers of two different allocators. */
+	for (i = 0; i < NUM_BUFFERS; ++i)
 	{
-		fprintf(stderr, "Could not get physical address for DMA buffer allocated %s allocator\n", name);
+		buffers[i] = imx_dma_buffer_allocate((i == (NUM_BUFFERS - 1)) ? pool_allocator : allocator, sizes[i], 1, &err);
+		if (buffers[i] == NULL)
+		{
+			fprintf(stderr, "Could not allocate DMA buffer for batched sync: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+
+		virtual_addresses[i] = imx_dma_buffer_map(buffers[i], IMX_DMA_BUFFER_MAPPING_FLAG_READ | IMX_DMA_BUFFER_MAPPING_FLAG_WRITE | IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC, &err);
+		if (virtual_addresses[i] == NULL)
+		{
+			fprintf(stderr, "Could not map DMA buffer for batched sync: %s (%d)\n", strerror(err), err);
+			goto finish;
+		}
+	}
+
+	/* An empty batch must be accepted. */
+	imx_dma_buffer_sync_many(NULL, NULL, 0);
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+		directions[i] = IMX_DMA_BUFFER_SYNC_DIRECTION_START;
+	imx_dma_buffer_sync_many(buffers, directions, NUM_BUFFERS);
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+	{
+		for (j = 0; j < sizes[i]; ++j)
+			virtual_addresses[i][j] = (uint8_t)(i * 31 + j);
+	}
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+		directions[i] = IMX_DMA_BUFFER_SYNC_DIRECTION_STOP;
+	imx_dma_buffer_sync_many(buffers, directions, NUM_BUFFERS);
+
+	/* Mixed directions: restart the sessions of some buffers, and stop
+	 * the already stopped sessions of the others, which must do nothing. */
+	for (i = 0; i < NUM_BUFFERS; ++i)
+		directions[i] = (i & 1) ? IMX_DMA_BUFFER_SYNC_DIRECTION_STOP : IMX_DMA_BUFFER_SYNC_DIRECTION_START;
+	imx_dma_buffer_sync_many(buffers, directions, NUM_BUFFERS);
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+	{
+		for (j = 0; j < sizes[i]; ++j)
+		{
+			if (virtual_addresses[i][j] != (uint8_t)(i * 31 + j))
+			{
+				fprintf(stderr, "Data of buffer %zu mismatches at byte %zu after batched sync\n", i, j);
+				goto finish;
+			}
+		}
+	}
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+		directions[i] = IMX_DMA_BUFFER_SYNC_DIRECTION_STOP;
+	imx_dma_buffer_sync_many(buffers, directions, NUM_BUFFERS);
+
+	fprintf(stderr, "batched sync works correctly\n");
+	retval = 1;
+
+finish:
+	for (i = 0; i < NUM_BUFFERS; ++i)
+	{
+		if (virtual_addresses[i] != NULL)
+			imx_dma_buffer_unmap(buffers[i]);
+		if (buffers[i] != NULL)
+			imx_dma_buffer_deallocate(buffers[i]);
+	}
+	if (pool_allocator != NULL)
+		imx_dma_buffer_allocator_destroy(pool_allocator);
+	imx_dma_buffer_allocator_destroy(allocator);
+	return retval;
+}
+
+
+/* Custom allocator that does not call imx_dma_buffer_allocator_init(), like
+ * allocators written against older versions of libimxdmabuffer. Its buffers
+ * wrap buffers of an underlying allocator. */
+
+typedef struct
+{
+	ImxDmaBufferAllocator parent;
+	ImxDmaBufferAllocator *underlying_allocator;
+}
+LegacyAllocator;
+
+typedef struct
+{
+	ImxDmaBuffer parent;
+	ImxDmaBuffer *underlying_buffer;
+}
+LegacyBuffer;
+
+static ImxDmaBuffer* legacy_allocator_allocate(ImxDmaBufferAllocator *allocator, size_t size, size_t alignment, int *error)
+{
+	LegacyBuffer *legacy_buffer = (LegacyBuffer *)malloc(sizeof(LegacyBuffer));
+	/* Older allocators did not know about the common header, so make sure that
+	 * a garbage header is noticed if libimxdmabuffer uses it anyway. */
+	memset(legacy_buffer, 0xA5, sizeof(LegacyBuffer));
+	legacy_buffer->parent.allocator = allocator;
+	legacy_buffer->underlying_buffer = imx_dma_buffer_allocate(((LegacyAllocator *)allocator)->underlying_allocator, size, alignment, error);
+	if (legacy_buffer->underlying_buffer == NULL)
+	{
+		free(legacy_buffer);
+		return NULL;
+	}
+	return (ImxDmaBuffer *)legacy_buffer;
+}
+
+static void legacy_allocator_deallocate(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	imx_dma_buffer_deallocate(((LegacyBuffer *)buffer)->underlying_buffer);
+	free(buffer);
+}
+
+static uint8_t* legacy_allocator_map(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer, unsigned int flags, int *error)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return imx_dma_buffer_map(((LegacyBuffer *)buffer)->underlying_buffer, flags, error);
+}
+
+static void legacy_allocator_unmap(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	imx_dma_buffer_unmap(((LegacyBuffer *)buffer)->underlying_buffer);
+}
+
+static imx_physical_address_t legacy_allocator_get_physical_address(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return imx_dma_buffer_get_physical_address(((LegacyBuffer *)buffer)->underlying_buffer);
+}
+
+static int legacy_allocator_get_fd(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return imx_dma_buffer_get_fd(((LegacyBuffer *)buffer)->underlying_buffer);
+}
+
+static size_t legacy_allocator_get_size(ImxDmaBufferAllocator *allocator, ImxDmaBuffer *buffer)
+{
+	IMX_DMA_BUFFER_UNUSED_PARAM(allocator);
+	return imx_dma_buffer_get_size(((LegacyBuffer *)buffer)->underlying_buffer);
+}
+
+int check_uninitialized_allocator(ImxDmaBufferAllocator *allocator)
+{
+	int retval = 0;
+	int err;
+	LegacyAllocator legacy_allocator;
+	ImxDmaBuffer *dma_buffer = NULL;
+	uint8_t *virtual_address = NULL;
+
+	if (allocator == NULL)
+	{
+		fprintf(stderr, "Could not create allocator for uninitialized allocator\n");
+		return 0;
+	}
+
+	/* Older allocators did not zero the formerly reserved slots. Fill
+	 * them with garbage to make sure that they are not used. */
+	memset(&legacy_allocator, 0xA5, sizeof(legacy_allocator));
+	legacy_allocator.parent.destroy = NULL;
+	legacy_allocator.parent.allocate = legacy_allocator_allocate;
+	legacy_allocator.parent.deallocate = legacy_allocator_deallocate;
+	legacy_allocator.parent.map = legacy_allocator_map;
+	legacy_allocator.parent.unmap = legacy_allocator_unmap;
+	legacy_allocator.parent.start_sync_session = imx_dma_buffer_noop_start_sync_session_func;
+	legacy_allocator.parent.stop_sync_session = imx_dma_buffer_noop_stop_sync_session_func;
+	legacy_allocator.parent.get_physical_address = legacy_allocator_get_physical_address;
+	legacy_allocator.parent.get_fd = legacy_allocator_get_fd;
+	legacy_allocator.parent.get_size = legacy_allocator_get_size;
+	legacy_allocator.underlying_allocator = allocator;
+
+	dma_buffer = imx_dma_buffer_allocate(&(legacy_allocator.parent), 8192, 1, &err);
+	if (dma_buffer == NULL)
+	{
+		fprintf(stderr, "Could not allocate DMA buffer with uninitialized allocator: %s (%d)\n", strerror(err), err);
 		goto finish;
 	}
-	if ((physical_address & expected_alignment) != 0)
+
+	if (imx_dma_buffer_get_size(dma_buffer) != 8192)
 	{
-		fprintf(stderr, "Physical address %" IMX_PHYSICAL_ADDRESS_FORMAT " for DMA buffer allocated %s allocator is not aligned to %zu-byte boundaries\n", physical_address, name, expected_alignment);
+		fprintf(stderr, "Buffer of uninitialized allocator has size %zu instead of 8192\n", imx_dma_buffer_get_size(dma_buffer));
 		goto finish;
 	}
 
-	fprintf(stderr, "%s allocator works correctly\n", name);
+	if (imx_dma_buffer_get_attachment(dma_buffer, test_attachment_key) != NULL)
+	{
+		fprintf(stderr, "Buffer of uninitialized allocator has an attachment\n");
+		goto finish;
+	}
+
+	/* This must fall back to mapping the whole buffer
+	 * instead of calling the garbage map_range slot. */
+	virtual_address = imx_dma_buffer_map_range(dma_buffer, 4096, 4096, IMX_DMA_BUFFER_MAPPING_FLAG_WRITE | IMX_DMA_BUFFER_MAPPING_FLAG_MANUAL_SYNC, &err);
+	if (virtual_address == NULL)
+	{
+		fprintf(stderr, "Could not map window of buffer of uninitialized allocator: %s (%d)\n", strerror(err), err);
+		goto finish;
+	}
+
+	imx_dma_buffer_start_range_sync_session(dma_buffer, virtual_address);
+	memset(virtual_address, 0x11, 4096);
+	imx_dma_buffer_stop_range_sync_session(dma_buffer, virtual_address);
+	imx_dma_buffer_unmap_range(dma_buffer, virtual_address);
+
+	fprintf(stderr, "uninitialized allocator works correctly\n");
 	retval = 1;
 
 finish:
-	if (second_mapped_virtual_address != NULL)
-		imx_dma_buffer_unmap(dma_buffer);
-	if (mapped_virtual_address != NULL)
-		imx_dma_buffer_unmap(dma_buffer);
 	if (dma_buffer != NULL)
 		imx_dma_buffer_deallocate(dma_buffer);
-	if (allocator != NULL)
-		imx_dma_buffer_allocator_destroy(allocator);
-
+	imx_dma_buffer_allocator_destroy(allocator);
 	return retval;
 }
 
@@ -117,6 +2406,13 @@ int main()
 	ImxDmaBufferAllocator *allocator;
 	int retval = 0;
 
+	test_attachment_key = imx_dma_buffer_register_attachment_key("test", destroy_test_attachment, &err);
+	if (test_attachment_key < 0)
+	{
+		fprintf(stderr, "Could not register attachment key: %s (%d)\n", strerror(err), err);
+		return -1;
+	}
+
 #ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
 	allocator = imx_dma_buffer_dma_heap_allocator_new(-1, IMX_DMA_BUFFER_DMA_HEAP_ALLOCATOR_DEFAULT_HEAP_FLAGS, IMX_DMA_BUFFER_DMA_HEAP_ALLOCATOR_DEFAULT_FD_FLAGS, &err);
 	if (allocator == NULL)
@@ -177,6 +2473,71 @@ int main()
 	else if (check_allocation(allocator, "PxP") == 0)
 		retval = -1;
 #endif
+
+	if (check_pool_allocation(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_file_loading(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_zerocopy_sending(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_rtp_ingest(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_buffer_queue(IMX_DMA_BUFFER_QUEUE_TYPE_SPSC, "SPSC") == 0)
+		retval = -1;
+
+	if (check_buffer_queue(IMX_DMA_BUFFER_QUEUE_TYPE_MPMC, "MPMC") == 0)
+		retval = -1;
+
+	if (check_ring_buffer() == 0)
+		retval = -1;
+
+#ifdef IMXDMABUFFER_DMA_HEAP_ALLOCATOR_ENABLED
+	if (check_ring_buffer_dirty_tracking(imx_dma_buffer_dma_heap_allocator_new(-1, IMX_DMA_BUFFER_DMA_HEAP_ALLOCATOR_DEFAULT_HEAP_FLAGS, IMX_DMA_BUFFER_DMA_HEAP_ALLOCATOR_DEFAULT_FD_FLAGS, &err)) == 0)
+		retval = -1;
+#endif
+
+	if (check_arena_allocation(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_reference_counting(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_buffer_registry(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_address_lookup(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_default_allocator() == 0)
+		retval = -1;
+
+	if (check_pool_profile(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_buffer_metadata_reuse(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_detiling(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_blit(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_copy_queue(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_copy_queue_ordering(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_sync_many(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
+
+	if (check_uninitialized_allocator(imx_dma_buffer_allocator_new(&err)) == 0)
+		retval = -1;
 	
 	return retval;
 }